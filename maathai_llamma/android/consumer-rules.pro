@@ -0,0 +1,7 @@
+# Methods invoked from libmaathai_llamma.so via JNI must survive shrinking.
+-keepclasseswithmembernames class com.usemaathai.maathai_llamma.MaathaiLlammaPlugin {
+    native <methods>;
+}
+-keepclassmembers class com.usemaathai.maathai_llamma.MaathaiLlammaPlugin {
+    private void onNative*(...);
+}
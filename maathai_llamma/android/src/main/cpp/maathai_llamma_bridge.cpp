@@ -1,124 +1,481 @@
 #include <jni.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
-#include <thread>
 #include <vector>
-#include <queue>
-#include <condition_variable>
-#include <atomic>
-#include <algorithm>
-
-#include <android/log.h>
 
-#include "llama.h"
+#include "llama_engine.h"
+#include "memory_plan.h"
+#include "model_residency.h"
+#include "stream_frame.h"
+#include "utf8.h"
+#include "vector_index.h"
+#include "maathai_log.h"
 
 namespace {
 
-struct LlamaSession {
-    llama_model * model = nullptr;
-    llama_context * ctx = nullptr;
-    llama_sampler * sampler = nullptr;
+JavaVM * g_vm = nullptr;
+jobject g_plugin = nullptr;      // global ref to the MaathaiLlammaPlugin instance
+jmethodID g_on_prefill = nullptr; // MaathaiLlammaPlugin.onNativePrefillProgress(III)V
+jmethodID g_on_load = nullptr;    // MaathaiLlammaPlugin.onNativeLoadProgress(IJJ)V
+jmethodID g_on_threads = nullptr; // MaathaiLlammaPlugin.onNativeThreads(IIIIDD)V
+
+// Returns a JNIEnv for the calling thread, attaching native worker threads on
+// first use. Attached threads detach automatically when they exit.
+JNIEnv * current_env() {
+    if (g_vm == nullptr) {
+        return nullptr;
+    }
+    JNIEnv * env = nullptr;
+    if (g_vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6) == JNI_OK) {
+        return env;
+    }
+    struct ThreadAttachment {
+        JNIEnv * env = nullptr;
+        ~ThreadAttachment() {
+            if (env != nullptr) {
+                g_vm->DetachCurrentThread();
+            }
+        }
+    };
+    thread_local ThreadAttachment attachment;
+    if (g_vm->AttachCurrentThread(&attachment.env, nullptr) != JNI_OK) {
+        attachment.env = nullptr;
+    }
+    return attachment.env;
+}
+
+void post_prefill_progress(int session, int done, int total) {
+    if (g_plugin == nullptr || g_on_prefill == nullptr) {
+        return;
+    }
+    JNIEnv * env = current_env();
+    if (env == nullptr) {
+        return;
+    }
+    env->CallVoidMethod(g_plugin, g_on_prefill, (jint) session, (jint) done, (jint) total);
+    if (env->ExceptionCheck()) {
+        env->ExceptionClear();
+    }
+}
+
+void post_thread_change(const maathai::GovernorDecision & decision) {
+    if (g_plugin == nullptr || g_on_threads == nullptr) {
+        return;
+    }
+    JNIEnv * env = current_env();
+    if (env == nullptr) {
+        return;
+    }
+    env->CallVoidMethod(g_plugin, g_on_threads, (jint) decision.n_threads, (jint) decision.n_threads_batch,
+                        (jint) decision.from_threads, (jint) decision.reason, (jdouble) decision.tok_s,
+                        (jdouble) decision.temp_c);
+    if (env->ExceptionCheck()) {
+        env->ExceptionClear();
+    }
+}
+
+// Set by cancelLoad(); the load in flight sees it at its next progress report.
+std::atomic_bool g_cancel_load{false};
+std::atomic_bool g_loading{false};
+// One load at a time, in place or in the background.
+std::mutex g_load_mutex;
+
+bool post_load_progress(maathai::LoadStage stage, uint64_t done, uint64_t total) {
+    if (g_plugin != nullptr && g_on_load != nullptr) {
+        JNIEnv * env = current_env();
+        if (env != nullptr) {
+            env->CallVoidMethod(g_plugin, g_on_load, (jint) stage, (jlong) done, (jlong) total);
+            if (env->ExceptionCheck()) {
+                env->ExceptionClear();
+            }
+        }
+    }
+    return !g_cancel_load.load();
+}
+
+// The serving engine. Entry points work on a reference-counted copy, so a
+// background load can swap a new engine in while calls on the old one run to
+// completion; the old model is freed by whichever call lets go of it last.
+// Streams remember the engine they started on, so a stream that was running
+// during a swap is drained to the end from the old model.
+//
+// Intentionally leaked: JNI entry points may still run while the process
+// tears down static objects, and the OS reclaims everything anyway.
+struct EngineSlot {
     std::mutex mutex;
-    // sampler params
-    float temperature = 0.7f;
-    int top_k = 40;
-    float top_p = 0.95f;
-    // streaming / cancel
-    bool cancel = false;
-    std::thread worker;
-    bool small_model = false;
-    uint64_t model_params = 0;
-    int tuned_ctx = 0;
-    int tuned_threads = 0;
-    int tuned_threads_batch = 0;
-    int tuned_batch = 0;
+    std::shared_ptr<maathai::LlamaEngine> current;
+    std::shared_ptr<maathai::LlamaEngine> streams[maathai::LlamaEngine::kMaxSessions];
 };
 
-std::unique_ptr<LlamaSession> g_session;
+EngineSlot & engine_slot() {
+    static auto * slot = new EngineSlot();
+    return *slot;
+}
+
+std::shared_ptr<maathai::LlamaEngine> engine() {
+    EngineSlot & slot = engine_slot();
+    std::lock_guard<std::mutex> lock(slot.mutex);
+    if (slot.current == nullptr) {
+        slot.current = std::make_shared<maathai::LlamaEngine>();
+    }
+    return slot.current;
+}
+
+bool valid_session(jint session) {
+    return session >= 0 && session < maathai::LlamaEngine::kMaxSessions;
+}
+
+// The engine the session's stream runs on, falling back to the current one.
+std::shared_ptr<maathai::LlamaEngine> stream_engine(jint session) {
+    EngineSlot & slot = engine_slot();
+    {
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        if (valid_session(session) && slot.streams[session] != nullptr) {
+            return slot.streams[session];
+        }
+    }
+    return engine();
+}
+
+void set_stream_engine(jint session, std::shared_ptr<maathai::LlamaEngine> target) {
+    if (!valid_session(session)) {
+        return;
+    }
+    EngineSlot & slot = engine_slot();
+    std::lock_guard<std::mutex> lock(slot.mutex);
+    slot.streams[session] = std::move(target);
+}
+
+// Models kept loaded by handle once setResidencyBudget() sets a budget; the
+// current engine is one of them. Loading a model that is already resident,
+// or switchModel(), only swaps slot.current; making room frees the contexts
+// of idle models first and evicts whole models only when that is not
+// enough (see model_residency.h). Without a budget the pool stays empty and
+// loadModel() replaces the current model as before. Guarded by
+// g_load_mutex, like every other change to which engine serves.
+struct ResidentEngine {
+    std::shared_ptr<maathai::LlamaEngine> engine;
+    std::string path;
+};
+std::map<jint, ResidentEngine> g_resident;
+maathai::ModelResidency g_residency;
+jint g_current_model = -1;
+jint g_next_model = 1;
+
+// Everything that shapes the engine load() builds. The sampler is left out:
+// switching applies the new one to the resident engine.
+std::string residency_key(const maathai::EngineConfig & config) {
+    std::string key = config.model_path;
+    const long long values[] = {
+        config.n_ctx, config.n_threads, config.n_threads_batch, config.n_batch, config.n_ubatch,
+        config.n_gpu_layers, config.prefer_performance_cores ? 1 : 0, (long long) config.memory_budget_bytes,
+        (long long) config.type_k, (long long) config.type_v, (long long) config.flash_attn,
+        config.n_draft, (long long) config.tune, config.use_mmap ? 1 : 0, config.use_mlock ? 1 : 0,
+    };
+    for (const long long value : values) {
+        key += '|';
+        key += std::to_string(value);
+    }
+    key += '|';
+    key += config.draft_model_path;
+    return key;
+}
 
-// logging helpers
-#define LOG_TAG "MaathaiLL-NATIVE"
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO,  LOG_TAG, __VA_ARGS__)
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+// Handles the residency policy must leave alone besides the pinned ones:
+// the current model and any model a request or stream is still using.
+std::vector<int> residency_in_use() {
+    std::vector<std::shared_ptr<maathai::LlamaEngine>> streaming;
+    {
+        EngineSlot & slot = engine_slot();
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        for (const auto & stream : slot.streams) {
+            if (stream != nullptr) {
+                streaming.push_back(stream);
+            }
+        }
+    }
+    std::vector<int> in_use = {g_current_model};
+    for (const auto & entry : g_resident) {
+        const auto & resident = entry.second.engine;
+        if (!resident->idle() || std::find(streaming.begin(), streaming.end(), resident) != streaming.end()) {
+            in_use.push_back(entry.first);
+        }
+    }
+    return in_use;
+}
 
-constexpr int kUnboundedSafetyCap = 1024;
+// Frees what the policy names to fit `incoming` more bytes. Returns false
+// when pinned and busy models leave too little room; loads go ahead anyway,
+// the budget is a target, not a hard limit.
+bool make_resident_room(uint64_t incoming, std::vector<int> in_use) {
+    std::vector<maathai::ResidencyAction> actions;
+    const bool fits = g_residency.plan(incoming, in_use, actions);
+    for (const maathai::ResidencyAction & action : actions) {
+        const auto it = g_resident.find(action.handle);
+        if (it == g_resident.end()) {
+            continue;
+        }
+        if (action.kind == maathai::ResidencyActionKind::kFreeContext) {
+            it->second.engine->suspend();
+            g_residency.context_freed(action.handle);
+            LOGI("residency: freed the context of %s", it->second.path.c_str());
+        } else {
+            it->second.engine->release();
+            LOGI("residency: evicted %s", it->second.path.c_str());
+            g_resident.erase(it);
+            g_residency.evicted(action.handle);
+        }
+    }
+    if (!fits) {
+        LOGI("residency: %llu MiB over budget, the rest is pinned or busy",
+             (unsigned long long) ((g_residency.resident_bytes() + incoming - g_residency.budget()) >> 20));
+    }
+    return fits;
+}
 
-int resolve_target_tokens(int requested, int prompt_tokens) {
-    if (requested > 0) {
-        return requested;
+// Makes a resident model the current one, rebuilding its context first if
+// it was freed. Returns false when the context cannot be rebuilt.
+bool switch_resident(jint handle) {
+    const auto it = g_resident.find(handle);
+    const maathai::ResidentModel * model = g_residency.model(handle);
+    if (it == g_resident.end() || model == nullptr) {
+        return false;
+    }
+    const std::shared_ptr<maathai::LlamaEngine> target = it->second.engine;
+    if (!model->has_context) {
+        std::vector<int> in_use = residency_in_use();
+        in_use.push_back(handle);
+        make_resident_room(model->context_bytes, in_use);
+        if (!target->resume()) {
+            LOGE("residency: could not rebuild the context of %s", it->second.path.c_str());
+            return false;
+        }
+        g_residency.context_restored(handle);
+    }
+    const std::shared_ptr<maathai::LlamaEngine> previous = engine();
+    if (previous != target) {
+        target->set_conversation_mode(previous->conversation_mode());
+        target->set_adaptive_threads(previous->adaptive_threads());
+        EngineSlot & slot = engine_slot();
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        slot.current = target;
     }
-    if (!g_session || g_session->ctx == nullptr) {
-        return kUnboundedSafetyCap;
+    g_current_model = handle;
+    g_residency.touch(handle);
+    return true;
+}
+
+// Frees a resident model whose context could not be rebuilt, so the next
+// lookup of its key misses instead of finding it again.
+void evict_resident(jint handle) {
+    const auto it = g_resident.find(handle);
+    if (it != g_resident.end()) {
+        it->second.engine->release();
+        g_resident.erase(it);
     }
-    const int ctx_slots = llama_n_ctx(g_session->ctx);
-    int available = ctx_slots - prompt_tokens;
-    if (available <= 0) {
-        return 1;
+    g_residency.evicted(handle);
+    if (handle == g_current_model) {
+        g_current_model = -1;
     }
-    return std::min(kUnboundedSafetyCap, available);
 }
 
-inline void ensure_backend() {
-    static std::once_flag init_flag;
-    std::call_once(init_flag, []() {
-        llama_backend_init();
-    });
+// Open vector indexes by handle. Calls hold a shared_ptr, so closing an
+// index while a search runs on another thread is safe.
+std::mutex g_indexes_mutex;
+std::map<jint, std::shared_ptr<maathai::VectorIndex>> g_indexes;
+jint g_next_index = 1;
+
+std::shared_ptr<maathai::VectorIndex> vector_index(jint handle) {
+    std::lock_guard<std::mutex> lock(g_indexes_mutex);
+    auto it = g_indexes.find(handle);
+    return it != g_indexes.end() ? it->second : nullptr;
 }
 
-void free_session() {
-    if (!g_session) {
-        return;
+std::string to_std_string(JNIEnv * env, jstring value) {
+    if (value == nullptr) {
+        return std::string();
     }
-    {
-        std::lock_guard<std::mutex> lock(g_session->mutex);
-        if (g_session->worker.joinable()) {
-            g_session->cancel = true;
+    // GetStringUTFChars yields modified UTF-8 (surrogate pairs encoded
+    // separately), which the tokenizer would see as garbage for emoji.
+    const jsize len = env->GetStringLength(value);
+    const jchar * chars = env->GetStringChars(value, nullptr);
+    if (chars == nullptr) {
+        return std::string();
+    }
+    std::string out = maathai::utf16_to_utf8(reinterpret_cast<const char16_t *>(chars), (size_t) len);
+    env->ReleaseStringChars(value, chars);
+    return out;
+}
+
+jstring to_jstring(JNIEnv * env, const std::string & value) {
+    const std::u16string wide = maathai::utf8_to_utf16(value.data(), value.size());
+    return env->NewString(reinterpret_cast<const jchar *>(wide.data()), (jsize) wide.size());
+}
+
+// Builds the message list for a request. When the caller sends the whole
+// conversation (`roles`/`contents` non-null) it is used as-is; otherwise the
+// prompt becomes a single user turn.
+std::vector<maathai::ChatMessage> to_messages(
+    JNIEnv * env,
+    jstring prompt,
+    jobjectArray roles,
+    jobjectArray contents) {
+    std::vector<maathai::ChatMessage> messages;
+    if (roles != nullptr && contents != nullptr) {
+        const jsize n = std::min(env->GetArrayLength(roles), env->GetArrayLength(contents));
+        messages.reserve((size_t) n);
+        for (jsize i = 0; i < n; ++i) {
+            auto role = (jstring) env->GetObjectArrayElement(roles, i);
+            auto content = (jstring) env->GetObjectArrayElement(contents, i);
+            messages.push_back({to_std_string(env, role), to_std_string(env, content)});
+            env->DeleteLocalRef(role);
+            env->DeleteLocalRef(content);
         }
     }
-    if (g_session->worker.joinable()) {
-        LOGI("Joining background worker before freeing session");
-        g_session->worker.join();
+    if (messages.empty()) {
+        messages.push_back({"user", to_std_string(env, prompt)});
     }
+    return messages;
+}
 
-    std::lock_guard<std::mutex> lock(g_session->mutex);
-    if (g_session->sampler != nullptr) {
-        llama_sampler_free(g_session->sampler);
-        g_session->sampler = nullptr;
+std::vector<std::string> to_strings(JNIEnv * env, jobjectArray values) {
+    std::vector<std::string> out;
+    if (values == nullptr) {
+        return out;
     }
-    if (g_session->ctx != nullptr) {
-        llama_free(g_session->ctx);
-        g_session->ctx = nullptr;
+    const jsize n = env->GetArrayLength(values);
+    out.reserve((size_t) n);
+    for (jsize i = 0; i < n; ++i) {
+        auto value = (jstring) env->GetObjectArrayElement(values, i);
+        out.push_back(to_std_string(env, value));
+        env->DeleteLocalRef(value);
     }
-    if (g_session->model != nullptr) {
-        llama_model_free(g_session->model);
-        g_session->model = nullptr;
+    return out;
+}
+
+// 0 model default, 1 mean, 2 cls, 3 last
+maathai::EmbeddingPooling to_embedding_pooling(jint pooling) {
+    switch (pooling) {
+        case 1: return maathai::EmbeddingPooling::kMean;
+        case 2: return maathai::EmbeddingPooling::kCls;
+        case 3: return maathai::EmbeddingPooling::kLast;
+        default: return maathai::EmbeddingPooling::kModel;
     }
-    g_session.reset();
+}
+
+// -1 auto, 0 off, 1 on
+maathai::FlashAttention to_flash_attention(jint mode) {
+    return mode == 1 ? maathai::FlashAttention::kOn
+        : mode == 0 ? maathai::FlashAttention::kOff : maathai::FlashAttention::kAuto;
+}
+
+maathai::SamplerConfig make_sampler_config(
+    jfloat temperature,
+    jint top_k,
+    jfloat top_p,
+    jfloat min_p,
+    jfloat typical_p,
+    jfloat top_n_sigma,
+    jint mirostat_type,
+    jfloat mirostat_tau,
+    jfloat mirostat_eta,
+    jfloat repeat_penalty,
+    jfloat frequency_penalty,
+    jfloat presence_penalty,
+    jint repeat_last_n,
+    jint min_keep) {
+    maathai::SamplerConfig config;
+    config.temperature = temperature;
+    config.top_k = top_k;
+    config.top_p = top_p;
+    config.min_p = min_p;
+    config.typical_p = typical_p;
+    config.top_n_sigma = top_n_sigma;
+    config.mirostat_type = mirostat_type;
+    config.mirostat_tau = mirostat_tau;
+    config.mirostat_eta = mirostat_eta;
+    config.repeat_penalty = repeat_penalty;
+    config.frequency_penalty = frequency_penalty;
+    config.presence_penalty = presence_penalty;
+    config.repeat_last_n = repeat_last_n;
+    config.min_keep = min_keep;
+    return config;
 }
 
 }  // namespace
 
+extern "C" JNIEXPORT jint JNICALL
+JNI_OnLoad(JavaVM * vm, void * /* reserved */) {
+    g_vm = vm;
+    return JNI_VERSION_1_6;
+}
+
 extern "C" JNIEXPORT jboolean JNICALL
 Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_initBackend(
     JNIEnv * env,
-    jobject /* thiz */) {
-    (void) env;
-    ensure_backend();
+    jobject thiz) {
+    maathai::LlamaEngine::init_backend();
+    if (g_plugin != nullptr) {
+        env->DeleteGlobalRef(g_plugin);
+    }
+    g_plugin = env->NewGlobalRef(thiz);
+    jclass plugin_class = env->GetObjectClass(thiz);
+    g_on_prefill = env->GetMethodID(plugin_class, "onNativePrefillProgress", "(III)V");
+    if (g_on_prefill == nullptr) {
+        env->ExceptionClear();
+        LOGE("initBackend(): onNativePrefillProgress not found, progress events disabled");
+    }
+    g_on_load = env->GetMethodID(plugin_class, "onNativeLoadProgress", "(IJJ)V");
+    if (g_on_load == nullptr) {
+        env->ExceptionClear();
+        LOGE("initBackend(): onNativeLoadProgress not found, load progress events disabled");
+    }
+    g_on_threads = env->GetMethodID(plugin_class, "onNativeThreads", "(IIIIDD)V");
+    if (g_on_threads == nullptr) {
+        env->ExceptionClear();
+        LOGE("initBackend(): onNativeThreads not found, thread events disabled");
+    }
+    env->DeleteLocalRef(plugin_class);
+    engine()->set_prefill_progress_callback(post_prefill_progress);
+    engine()->set_governor_callback(post_thread_change);
     LOGI("initBackend() called");
     return JNI_TRUE;
 }
 
-extern "C" JNIEXPORT jboolean JNICALL
+// Loads in place, replacing the current model, or with `swap` into a second
+// engine while the current one keeps serving, switching over only once the
+// new model is ready. Sessions other than 0 do not carry over a swap.
+// With a residency budget every load is a swap that keeps the old model
+// resident, and loading a resident model with the same settings switches to
+// it instead of reading the file. Returns {ok, cancelled, file bytes, mmap,
+// mlock, weights ms, prefault ms, warmup ms, total ms, swapped, resident
+// handle or -1, cache hit}.
+extern "C" JNIEXPORT jdoubleArray JNICALL
 Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_loadModel(
     JNIEnv * env,
     jobject /* thiz */,
     jstring model_path,
     jint n_ctx,
     jint n_threads,
+    jint n_threads_batch,
+    jint n_batch,
+    jint n_ubatch,
     jint n_gpu_layers,
+    jboolean prefer_performance_cores,
+    jlong memory_budget_bytes,
+    jstring cache_type_k,
+    jstring cache_type_v,
+    jint flash_attn,
+    jstring draft_model_path,
+    jint n_draft,
+    jint tune_mode,
+    jstring tune_dir,
     jfloat temperature,
     jint top_k,
     jfloat top_p,
@@ -132,239 +489,290 @@ Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_loadModel(
     jfloat frequency_penalty,
     jfloat presence_penalty,
     jint repeat_last_n,
-    jint min_keep) {
-    ensure_backend();
-
-    const char * c_path = env->GetStringUTFChars(model_path, nullptr);
-    std::string path(c_path ? c_path : "");
-    env->ReleaseStringUTFChars(model_path, c_path);
-
-    if (path.empty()) {
-        LOGE("loadModel(): empty path");
-        return JNI_FALSE;
+    jint min_keep,
+    jboolean use_mmap,
+    jboolean use_mlock,
+    jboolean warmup,
+    jboolean swap) {
+    maathai::EngineConfig config;
+    config.model_path = to_std_string(env, model_path);
+    config.n_ctx = n_ctx;
+    config.n_threads = n_threads;
+    config.n_threads_batch = n_threads_batch;
+    config.n_batch = n_batch;
+    config.n_ubatch = n_ubatch;
+    config.n_gpu_layers = n_gpu_layers;
+    config.prefer_performance_cores = prefer_performance_cores == JNI_TRUE;
+    config.memory_budget_bytes = memory_budget_bytes > 0 ? (uint64_t) memory_budget_bytes : 0;
+    // unknown names keep f16
+    maathai::parse_kv_cache_type(to_std_string(env, cache_type_k), config.type_k);
+    maathai::parse_kv_cache_type(to_std_string(env, cache_type_v), config.type_v);
+    config.flash_attn = to_flash_attention(flash_attn);
+    config.draft_model_path = to_std_string(env, draft_model_path);
+    config.n_draft = n_draft;
+    // 0 off, 1 reuse the cached profile, 2 re-tune
+    config.tune = tune_mode == 2 ? maathai::TuneMode::kForce
+        : tune_mode == 1 ? maathai::TuneMode::kAuto : maathai::TuneMode::kOff;
+    config.tune_dir = to_std_string(env, tune_dir);
+    config.sampler = make_sampler_config(
+        temperature, top_k, top_p, min_p, typical_p, top_n_sigma,
+        mirostat_type, mirostat_tau, mirostat_eta,
+        repeat_penalty, frequency_penalty, presence_penalty, repeat_last_n, min_keep);
+    config.use_mmap = use_mmap == JNI_TRUE;
+    config.use_mlock = use_mlock == JNI_TRUE;
+    config.warmup = warmup == JNI_TRUE;
+    config.on_progress = post_load_progress;
+
+    std::lock_guard<std::mutex> load_lock(g_load_mutex);
+    const bool residency = g_residency.budget() > 0;
+    const std::string key = residency ? residency_key(config) : std::string();
+    if (residency) {
+        const jint hit = g_residency.find(key);
+        const auto t_switch = std::chrono::steady_clock::now();
+        if (hit >= 0 && !switch_resident(hit)) {
+            // loaded again below, under the same key
+            evict_resident(hit);
+        } else if (hit >= 0) {
+            const std::shared_ptr<maathai::LlamaEngine> current = engine();
+            current->update_sampler(config.sampler);
+            const double switch_ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - t_switch).count();
+            const maathai::LoadReport & report = current->load_report();
+            LOGI("loadModel(): %s already resident, switched in %.1f ms", config.model_path.c_str(), switch_ms);
+            const jdouble values[12] = {
+                1.0, 0.0, (jdouble) report.file_bytes, report.use_mmap ? 1.0 : 0.0, report.use_mlock ? 1.0 : 0.0,
+                0.0, 0.0, 0.0, switch_ms, 1.0, (jdouble) hit, 1.0,
+            };
+            jdoubleArray out = env->NewDoubleArray(12);
+            if (out != nullptr) {
+                env->SetDoubleArrayRegion(out, 0, 12, values);
+            }
+            return out;
+        }
+        make_resident_room(maathai::LlamaEngine::estimate_load(config).total(), residency_in_use());
     }
-
-    llama_model_params model_params = llama_model_default_params();
-    model_params.n_gpu_layers = n_gpu_layers;
-
-    free_session();
-
-    auto session = std::make_unique<LlamaSession>();
-    LOGI("loadModel(): loading %s", path.c_str());
-    session->model = llama_model_load_from_file(path.c_str(), model_params);
-    if (session->model == nullptr) {
-        LOGE("loadModel(): llama_model_load_from_file failed");
-        return JNI_FALSE;
+    g_cancel_load = false;
+    g_loading = true;
+    // Held to the end: after a swap the old model is freed here, on the
+    // loading thread, unless a stream or call still holds it.
+    const std::shared_ptr<maathai::LlamaEngine> current = engine();
+    std::shared_ptr<maathai::LlamaEngine> target = current;
+    // with a residency budget the current model stays loaded beside the new one
+    if ((swap == JNI_TRUE || residency) && current->is_loaded()) {
+        target = std::make_shared<maathai::LlamaEngine>();
+        target->set_prefill_progress_callback(post_prefill_progress);
+        target->set_governor_callback(post_thread_change);
+        target->set_conversation_mode(current->conversation_mode());
+        target->set_adaptive_threads(current->adaptive_threads());
     }
-
-    llama_context_params ctx_params = llama_context_default_params();
-
-    constexpr uint64_t kSmallModelParamLimit = 2000000000ULL; // 2B params
-    constexpr int kSmallModelCtxDefault = 1024;
-    constexpr int kSmallModelCtxCap = 2048;
-    constexpr int kSmallModelThreadCeil = 4;
-    constexpr int kSmallModelBatch = 32;
-    constexpr int kDefaultCtxFallback = 4096;
-    constexpr int kDefaultBatch = 64;
-
-    session->model_params = llama_model_n_params(session->model);
-    session->small_model = session->model_params > 0 && session->model_params <= kSmallModelParamLimit;
-
-    const unsigned hw_concurrency = std::max(1u, std::thread::hardware_concurrency());
-
-    int tuned_ctx = n_ctx;
-    if (tuned_ctx <= 0) {
-        tuned_ctx = session->small_model ? kSmallModelCtxDefault : kDefaultCtxFallback;
+    bool ok = target->load(config);
+    maathai::LoadReport report = target->load_report();
+    // a cancel that arrived after the last progress report still counts
+    if (ok && g_cancel_load.load()) {
+        target->release();
+        ok = false;
+        report.cancelled = true;
     }
-    if (session->small_model && tuned_ctx > kSmallModelCtxCap) {
-        LOGI("loadModel(): clamping context length to %d for small model", kSmallModelCtxCap);
-        tuned_ctx = kSmallModelCtxCap;
+    const bool swapped = ok && target != current;
+    if (swapped) {
+        EngineSlot & slot = engine_slot();
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        slot.current = target;
     }
-
-    int tuned_threads = n_threads > 0 ? n_threads : static_cast<int>(hw_concurrency);
-    if (session->small_model && n_threads <= 0) {
-        tuned_threads = static_cast<int>(std::min<unsigned>(hw_concurrency, kSmallModelThreadCeil));
-        if (hw_concurrency >= 2 && tuned_threads < 2) {
-            tuned_threads = 2;
-        }
-        if (tuned_threads <= 0) {
-            tuned_threads = 1;
+    jint handle = -1;
+    if (ok && residency) {
+        if (!swapped) {
+            // loaded in place over a model the pool did not know about
+            g_resident.erase(g_current_model);
+            g_residency.remove(g_current_model);
         }
+        handle = g_next_model++;
+        const maathai::MemoryEstimate estimate = target->resident_estimate();
+        g_resident[handle] = ResidentEngine{target, config.model_path};
+        g_residency.add(handle, key, estimate.weights + estimate.overhead, estimate.kv + estimate.compute);
+        g_current_model = handle;
+        make_resident_room(0, residency_in_use());
     }
-    if (tuned_threads <= 0) {
-        tuned_threads = 1;
+    g_loading = false;
+    LOGI("loadModel(): %s in %.0f ms%s", ok ? "loaded" : report.cancelled ? "cancelled" : "failed",
+         report.total_ms, swapped ? ", swapped in" : "");
+
+    const jdouble values[12] = {
+        ok ? 1.0 : 0.0,
+        report.cancelled ? 1.0 : 0.0,
+        (jdouble) report.file_bytes,
+        report.use_mmap ? 1.0 : 0.0,
+        report.use_mlock ? 1.0 : 0.0,
+        report.weights_ms,
+        report.prefault_ms,
+        report.warmup_ms,
+        report.total_ms,
+        swapped ? 1.0 : 0.0,
+        (jdouble) handle,
+        0.0,
+    };
+    jdoubleArray out = env->NewDoubleArray(12);
+    if (out != nullptr) {
+        env->SetDoubleArrayRegion(out, 0, 12, values);
     }
+    return out;
+}
 
-    int tuned_threads_batch = tuned_threads;
-    if (session->small_model) {
-        tuned_threads_batch = std::max(1, tuned_threads / 2);
-    }
-
-    const int tuned_batch = session->small_model ? kSmallModelBatch : kDefaultBatch;
-
-    ctx_params.n_ctx = tuned_ctx;
-    ctx_params.n_threads = tuned_threads;
-    ctx_params.n_threads_batch = tuned_threads_batch;
-    ctx_params.n_batch = tuned_batch;
-    ctx_params.no_perf = false;
-
-    session->tuned_ctx = tuned_ctx;
-    session->tuned_threads = tuned_threads;
-    session->tuned_threads_batch = tuned_threads_batch;
-    session->tuned_batch = tuned_batch;
-
-    session->ctx = llama_init_from_model(session->model, ctx_params);
-    if (session->ctx == nullptr) {
-        llama_model_free(session->model);
-        LOGE("loadModel(): llama_init_from_model failed");
+// Returns whether a load was in flight to cancel.
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_cancelLoad(
+    JNIEnv * /* env */,
+    jobject /* thiz */) {
+    if (!g_loading.load()) {
         return JNI_FALSE;
     }
-
-    // store sampler params
-    session->temperature = temperature;
-    session->top_k = top_k;
-    session->top_p = top_p;
-
-    auto sampler_params = llama_sampler_chain_default_params();
-    session->sampler = llama_sampler_chain_init(sampler_params);
-    // advanced samplers if provided (>0)
-    if (min_p > 0.0f)        llama_sampler_chain_add(session->sampler, llama_sampler_init_min_p(min_p, (size_t) (min_keep > 0 ? min_keep : 1)));
-    if (typical_p > 0.0f)    llama_sampler_chain_add(session->sampler, llama_sampler_init_typical(typical_p, (size_t) (min_keep > 0 ? min_keep : 1)));
-    if (top_n_sigma > 0.0f)  llama_sampler_chain_add(session->sampler, llama_sampler_init_top_n_sigma(top_n_sigma));
-    if (mirostat_type == 1)  llama_sampler_chain_add(session->sampler, llama_sampler_init_mirostat(llama_vocab_n_tokens(llama_model_get_vocab(session->model)), 0 /*seed*/, mirostat_tau > 0 ? mirostat_tau : 5.0f, mirostat_eta > 0 ? mirostat_eta : 0.1f, 100));
-    if (mirostat_type == 2)  llama_sampler_chain_add(session->sampler, llama_sampler_init_mirostat_v2(0 /*seed*/, mirostat_tau > 0 ? mirostat_tau : 5.0f, mirostat_eta > 0 ? mirostat_eta : 0.1f));
-    // core samplers
-    llama_sampler_chain_add(session->sampler, llama_sampler_init_temp(session->temperature));
-    llama_sampler_chain_add(session->sampler, llama_sampler_init_top_k(session->top_k));
-    llama_sampler_chain_add(session->sampler, llama_sampler_init_top_p(session->top_p, (size_t) (min_keep > 0 ? min_keep : 1)));
-    // RNG / distribution sampler is required for sampling
-    llama_sampler_chain_add(session->sampler, llama_sampler_init_dist(0));
-    if (repeat_penalty > 0.0f || frequency_penalty > 0.0f || presence_penalty > 0.0f) {
-        auto * penalties = llama_sampler_init_penalties(
-            (size_t) (repeat_last_n > 0 ? repeat_last_n : 64),
-            repeat_penalty > 0.0f ? repeat_penalty : 1.0f,
-            frequency_penalty > 0.0f ? frequency_penalty : 0.0f,
-            presence_penalty > 0.0f ? presence_penalty : 0.0f
-        );
-        llama_sampler_chain_add(session->sampler, penalties);
-    }
-
-    g_session = std::move(session);
-    LOGI("loadModel(): success (ctx=%u, threads=%d, threads_batch=%d, n_batch=%d, params=%llu, small=%d)",
-         llama_n_ctx(g_session->ctx),
-         g_session->tuned_threads,
-         g_session->tuned_threads_batch,
-         g_session->tuned_batch,
-         static_cast<unsigned long long>(g_session->model_params),
-         g_session->small_model ? 1 : 0);
+    g_cancel_load = true;
     return JNI_TRUE;
 }
 
-extern "C" JNIEXPORT jstring JNICALL
-Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_generate(
-    JNIEnv * env,
+// 0 turns residency off: models other than the current one are freed and
+// loadModel() replaces the current model again.
+extern "C" JNIEXPORT void JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_setResidencyBudget(
+    JNIEnv * /* env */,
     jobject /* thiz */,
-    jstring prompt,
-    jint n_predict) {
-    if (!g_session || g_session->ctx == nullptr) {
-        LOGE("generate(): session/context not ready");
-        return env->NewStringUTF("");
-    }
-
-    const char * c_prompt = env->GetStringUTFChars(prompt, nullptr);
-    std::string prompt_text(c_prompt ? c_prompt : "");
-    env->ReleaseStringUTFChars(prompt, c_prompt);
-
-    std::lock_guard<std::mutex> lock(g_session->mutex);
-
-    const llama_vocab * vocab = llama_model_get_vocab(g_session->model);
-
-    llama_set_n_threads(g_session->ctx, llama_n_threads(g_session->ctx), llama_n_threads_batch(g_session->ctx));
-    if (g_session->sampler == nullptr) {
-        auto sampler_params = llama_sampler_chain_default_params();
-        g_session->sampler = llama_sampler_chain_init(sampler_params);
-        llama_sampler_chain_add(g_session->sampler, llama_sampler_init_temp(g_session->temperature));
-        llama_sampler_chain_add(g_session->sampler, llama_sampler_init_top_k(g_session->top_k));
-        llama_sampler_chain_add(g_session->sampler, llama_sampler_init_top_p(g_session->top_p, 1));
-        llama_sampler_chain_add(g_session->sampler, llama_sampler_init_dist(0));
-    } else {
-        llama_sampler_reset(g_session->sampler);
+    jlong budget_bytes) {
+    std::lock_guard<std::mutex> load_lock(g_load_mutex);
+    g_residency.set_budget(budget_bytes > 0 ? (uint64_t) budget_bytes : 0);
+    if (budget_bytes > 0) {
+        make_resident_room(0, residency_in_use());
+        return;
     }
-
-    // Apply chat template if available
-    std::string final_prompt = prompt_text;
-    {
-        const char * tmpl = llama_model_chat_template(g_session->model, nullptr);
-        if (tmpl != nullptr && *tmpl != '\0') {
-            llama_chat_message msgs[1];
-            msgs[0].role = "user";
-            msgs[0].content = prompt_text.c_str();
-            std::vector<char> buf(prompt_text.size() * 4 + 256);
-            int32_t n = llama_chat_apply_template(tmpl, msgs, 1, true, buf.data(), (int32_t)buf.size());
-            if (n > 0) {
-                final_prompt.assign(buf.data(), (size_t)n);
-            }
+    for (auto & entry : g_resident) {
+        if (entry.first != g_current_model) {
+            entry.second.engine->release();
         }
+        g_residency.remove(entry.first);
     }
+    g_resident.clear();
+    g_current_model = -1;
+}
 
-    const int n_prompt = -llama_tokenize(
-        vocab,
-        final_prompt.c_str(),
-        final_prompt.size(),
-        nullptr,
-        0,
-        true,
-        true);
-
-    if (n_prompt <= 0) {
-        return env->NewStringUTF("");
+// Returns the milliseconds the switch took, or -1 when `handle` is not
+// resident or its context could not be rebuilt.
+extern "C" JNIEXPORT jdouble JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_switchModel(
+    JNIEnv * /* env */,
+    jobject /* thiz */,
+    jint handle) {
+    std::lock_guard<std::mutex> load_lock(g_load_mutex);
+    const auto t_switch = std::chrono::steady_clock::now();
+    if (!switch_resident(handle)) {
+        evict_resident(handle);
+        return -1.0;
     }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_switch).count();
+}
 
-    std::vector<llama_token> tokens(static_cast<size_t>(n_prompt));
-    if (llama_tokenize(
-        vocab,
-        final_prompt.c_str(),
-        final_prompt.size(),
-        tokens.data(),
-        tokens.size(),
-        true,
-        true) < 0) {
-        return env->NewStringUTF("");
-    }
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_pinModel(
+    JNIEnv * /* env */,
+    jobject /* thiz */,
+    jint handle,
+    jboolean pinned) {
+    std::lock_guard<std::mutex> load_lock(g_load_mutex);
+    return g_residency.set_pinned(handle, pinned == JNI_TRUE) ? JNI_TRUE : JNI_FALSE;
+}
 
-    llama_batch batch = llama_batch_get_one(tokens.data(), tokens.size());
-    if (llama_decode(g_session->ctx, batch) != 0) {
-        return env->NewStringUTF("");
+// Frees a resident model now, whether or not the budget needs the room.
+// Unloading the current model leaves nothing loaded until the next load.
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_unloadModel(
+    JNIEnv * /* env */,
+    jobject /* thiz */,
+    jint handle) {
+    std::lock_guard<std::mutex> load_lock(g_load_mutex);
+    const auto it = g_resident.find(handle);
+    if (it == g_resident.end()) {
+        return JNI_FALSE;
     }
+    it->second.engine->release();
+    g_resident.erase(it);
+    g_residency.remove(handle);
+    if (handle == g_current_model) {
+        g_current_model = -1;
+    }
+    return JNI_TRUE;
+}
 
-    std::string response;
-    llama_token new_token = 0;
-    int generated = 0;
-
-    const int target_tokens = resolve_target_tokens(n_predict, n_prompt);
-    while (generated < target_tokens) {
-        new_token = llama_sampler_sample(g_session->sampler, g_session->ctx, -1);
-        if (llama_vocab_is_eog(vocab, new_token)) {
-            break;
-        }
-
-        char piece[256];
-        int piece_len = llama_token_to_piece(vocab, new_token, piece, sizeof(piece), 0, true);
-        if (piece_len <= 0) {
-            break;
-        }
-        response.append(piece, piece_len);
-
-        batch = llama_batch_get_one(&new_token, 1);
-        if (llama_decode(g_session->ctx, batch) != 0) {
-            break;
+// Resident models, most recently used first: five longs per model, {handle,
+// weights bytes, context bytes, context live, pinned}, with their paths in
+// `paths`, which must hold as many entries as there are models (at most the
+// array's length are written).
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_residentModels(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jobjectArray paths) {
+    std::lock_guard<std::mutex> load_lock(g_load_mutex);
+    const std::vector<maathai::ResidentModel> models = g_residency.models();
+    std::vector<jlong> values;
+    values.reserve(models.size() * 5);
+    const jsize n_paths = paths != nullptr ? env->GetArrayLength(paths) : 0;
+    for (size_t i = 0; i < models.size(); ++i) {
+        const maathai::ResidentModel & model = models[i];
+        values.push_back(model.handle);
+        values.push_back((jlong) model.weights_bytes);
+        values.push_back((jlong) model.context_bytes);
+        values.push_back(model.has_context ? 1 : 0);
+        values.push_back(model.pinned ? 1 : 0);
+        if ((jsize) i < n_paths) {
+            const auto it = g_resident.find(model.handle);
+            jstring path = to_jstring(env, it != g_resident.end() ? it->second.path : std::string());
+            env->SetObjectArrayElement(paths, (jsize) i, path);
+            env->DeleteLocalRef(path);
         }
+    }
+    jlongArray out = env->NewLongArray((jsize) values.size());
+    if (out != nullptr) {
+        env->SetLongArrayRegion(out, 0, (jsize) values.size(), values.data());
+    }
+    return out;
+}
 
-        ++generated;
+// Returns {budget, resident bytes, models, live contexts, hits, misses,
+// context frees, context restores, evictions, current handle or -1}.
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_residencyStats(
+    JNIEnv * env,
+    jobject /* thiz */) {
+    std::lock_guard<std::mutex> load_lock(g_load_mutex);
+    const maathai::ResidencyStats stats = g_residency.stats();
+    const jlong values[10] = {
+        (jlong) stats.budget_bytes,
+        (jlong) stats.resident_bytes,
+        stats.models,
+        stats.contexts,
+        (jlong) stats.hits,
+        (jlong) stats.misses,
+        (jlong) stats.context_frees,
+        (jlong) stats.context_restores,
+        (jlong) stats.evictions,
+        g_current_model,
+    };
+    jlongArray out = env->NewLongArray(10);
+    if (out != nullptr) {
+        env->SetLongArrayRegion(out, 0, 10, values);
     }
+    return out;
+}
 
-    LOGI("generate(): done, tokens=%d", generated);
-    return env->NewStringUTF(response.c_str());
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_generate(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint session,
+    jstring prompt,
+    jint n_predict,
+    jobjectArray roles,
+    jobjectArray contents) {
+    const std::string response = engine()->generate(session, to_messages(env, prompt, roles, contents), n_predict);
+    return to_jstring(env, response);
 }
 
 extern "C" JNIEXPORT jboolean JNICALL
@@ -386,190 +794,661 @@ Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_updateSampler(
     jint repeat_last_n,
     jint min_keep) {
     (void) env;
-    if (!g_session) return JNI_FALSE;
-    std::lock_guard<std::mutex> lock(g_session->mutex);
-    if (g_session->sampler != nullptr) {
-        llama_sampler_free(g_session->sampler);
-        g_session->sampler = nullptr;
-    }
-    g_session->temperature = temperature;
-    g_session->top_k = top_k;
-    g_session->top_p = top_p;
-    auto sampler_params = llama_sampler_chain_default_params();
-    g_session->sampler = llama_sampler_chain_init(sampler_params);
-    if (min_p > 0.0f)        llama_sampler_chain_add(g_session->sampler, llama_sampler_init_min_p(min_p, (size_t) (min_keep > 0 ? min_keep : 1)));
-    if (typical_p > 0.0f)    llama_sampler_chain_add(g_session->sampler, llama_sampler_init_typical(typical_p, (size_t) (min_keep > 0 ? min_keep : 1)));
-    if (top_n_sigma > 0.0f)  llama_sampler_chain_add(g_session->sampler, llama_sampler_init_top_n_sigma(top_n_sigma));
-    if (mirostat_type == 1)  llama_sampler_chain_add(g_session->sampler, llama_sampler_init_mirostat(llama_vocab_n_tokens(llama_model_get_vocab(g_session->model)), 0, mirostat_tau > 0 ? mirostat_tau : 5.0f, mirostat_eta > 0 ? mirostat_eta : 0.1f, 100));
-    if (mirostat_type == 2)  llama_sampler_chain_add(g_session->sampler, llama_sampler_init_mirostat_v2(0, mirostat_tau > 0 ? mirostat_tau : 5.0f, mirostat_eta > 0 ? mirostat_eta : 0.1f));
-    llama_sampler_chain_add(g_session->sampler, llama_sampler_init_temp(g_session->temperature));
-    llama_sampler_chain_add(g_session->sampler, llama_sampler_init_top_k(g_session->top_k));
-    llama_sampler_chain_add(g_session->sampler, llama_sampler_init_top_p(g_session->top_p, (size_t) (min_keep > 0 ? min_keep : 1)));
-    llama_sampler_chain_add(g_session->sampler, llama_sampler_init_dist(0));
-    return JNI_TRUE;
+    const auto config = make_sampler_config(
+        temperature, top_k, top_p, min_p, typical_p, top_n_sigma,
+        mirostat_type, mirostat_tau, mirostat_eta,
+        repeat_penalty, frequency_penalty, presence_penalty, repeat_last_n, min_keep);
+    return engine()->update_sampler(config) ? JNI_TRUE : JNI_FALSE;
 }
 
-// Streaming state (producer-consumer queue)
-static std::queue<std::string> g_stream_queue;
-static std::mutex g_stream_mutex;
-static std::condition_variable g_stream_cv;
-static std::atomic_bool g_stream_active{false};
-
 extern "C" JNIEXPORT jboolean JNICALL
 Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_startGenerate(
     JNIEnv * env,
     jobject /* thiz */,
+    jint session,
     jstring prompt,
-    jint n_predict) {
-    if (!g_session || g_session->ctx == nullptr) {
-        LOGE("startGenerate(): session/context not ready");
+    jint n_predict,
+    jobjectArray roles,
+    jobjectArray contents,
+    jboolean logprobs) {
+    const std::shared_ptr<maathai::LlamaEngine> target = engine();
+    if (!target->start_stream(session, to_messages(env, prompt, roles, contents), n_predict, logprobs == JNI_TRUE)) {
         return JNI_FALSE;
     }
-    const char * c_prompt = env->GetStringUTFChars(prompt, nullptr);
-    std::string prompt_text(c_prompt ? c_prompt : "");
-    env->ReleaseStringUTFChars(prompt, c_prompt);
+    set_stream_engine(session, target);
+    return JNI_TRUE;
+}
 
-    {
-        std::lock_guard<std::mutex> lock(g_session->mutex);
-        if (g_session->worker.joinable()) {
-            LOGI("startGenerate(): joining previous worker");
-            g_session->cancel = true;
+// Blocks up to timeoutMs for the session's next piece, drains up to maxCount pieces
+// and writes them as one binary frame (see stream_frame.h) into the direct
+// ByteBuffer `frame`, which the caller reuses across calls. Returns the frame
+// length, 0 on timeout and -1 once the stream is over.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_waitForTokenFrame(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint session,
+    jobject frame,
+    jint timeout_ms,
+    jint max_count) {
+    auto * dst = static_cast<uint8_t *>(env->GetDirectBufferAddress(frame));
+    const jlong capacity = env->GetDirectBufferCapacity(frame);
+    const size_t max_pieces = std::min((size_t) std::max(1, (int) max_count),
+                                       maathai::stream_frame_max_pieces(capacity > 0 ? (size_t) capacity : 0));
+    if (dst == nullptr || max_pieces == 0) {
+        LOGE("waitForTokenFrame: frame buffer must be direct and hold at least one piece");
+        return -1;
+    }
+    thread_local maathai::StreamFrame drained;
+    const std::shared_ptr<maathai::LlamaEngine> source = stream_engine(session);
+    if (!source->wait_for_frame(session, drained, timeout_ms, max_pieces)) {
+        // done with the engine; after a swap this may free the old model
+        EngineSlot & slot = engine_slot();
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        if (valid_session(session) && slot.streams[session] == source) {
+            slot.streams[session].reset();
         }
+        return -1;
     }
-    if (g_session->worker.joinable()) {
-        g_session->worker.join();
+    if (drained.tokens.empty() && drained.text.empty()) {
+        return 0;
     }
+    return (jint) maathai::encode_stream_frame(drained, dst, (size_t) capacity);
+}
 
-    // clear any previous queue content
-    {
-        std::lock_guard<std::mutex> ql(g_stream_mutex);
-        while (!g_stream_queue.empty()) g_stream_queue.pop();
+extern "C" JNIEXPORT void JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_cancelGenerate(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint session) {
+    (void) env;
+    const auto source = stream_engine(session);
+    source->cancel(session);
+    const auto current = engine();
+    if (current != source) {
+        current->cancel(session);
     }
+}
 
+extern "C" JNIEXPORT void JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_cancelAllSessions(
+    JNIEnv * env,
+    jobject /* thiz */) {
+    (void) env;
+    EngineSlot & slot = engine_slot();
+    std::vector<std::shared_ptr<maathai::LlamaEngine>> engines;
     {
-        std::lock_guard<std::mutex> lock(g_session->mutex);
-        g_session->cancel = false;
-        g_stream_active.store(true);
-        // spawn producer
-        g_session->worker = std::thread([prompt_text, n_predict]() {
-            LOGI("[worker] start, promptLen=%zu, maxTokens=%d", prompt_text.size(), (int)n_predict);
-            std::unique_lock<std::mutex> slock(g_session->mutex);
-            const llama_vocab * vocab = llama_model_get_vocab(g_session->model);
-            llama_set_n_threads(g_session->ctx, llama_n_threads(g_session->ctx), llama_n_threads_batch(g_session->ctx));
-            llama_sampler_reset(g_session->sampler);
-
-            // apply chat template
-            std::string final_prompt = prompt_text;
-            {
-                const char * tmpl = llama_model_chat_template(g_session->model, nullptr);
-                if (tmpl != nullptr && *tmpl != '\0') {
-                    llama_chat_message msgs[1];
-                    msgs[0].role = "user";
-                    msgs[0].content = prompt_text.c_str();
-                    std::vector<char> buf(prompt_text.size() * 4 + 256);
-                    int32_t n = llama_chat_apply_template(tmpl, msgs, 1, true, buf.data(), (int32_t)buf.size());
-                    if (n > 0) {
-                        final_prompt.assign(buf.data(), (size_t)n);
-                    }
-                }
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        for (const auto & stream : slot.streams) {
+            if (stream != nullptr) {
+                engines.push_back(stream);
             }
+        }
+    }
+    for (const auto & target : engines) {
+        target->cancel_all();
+    }
+    engine()->cancel_all();
+}
 
-            // tokenize
-            int n_prompt = -llama_tokenize(vocab, final_prompt.c_str(), (int)final_prompt.size(), nullptr, 0, true, true);
-            if (n_prompt <= 0) {
-                LOGE("[worker] tokenize size failed: %d", n_prompt);
-                g_stream_active.store(false);
-                return;
-            }
-            std::vector<llama_token> tokens(static_cast<size_t>(n_prompt));
-            if (llama_tokenize(vocab, final_prompt.c_str(), (int)final_prompt.size(), tokens.data(), (int)tokens.size(), true, true) < 0) {
-                LOGE("[worker] tokenize failed");
-                g_stream_active.store(false);
-                return;
-            }
-            llama_batch batch = llama_batch_get_one(tokens.data(), (int)tokens.size());
-            if (llama_decode(g_session->ctx, batch) != 0) {
-                LOGE("[worker] decode prompt failed");
-                g_stream_active.store(false);
-                return;
-            }
+// Returns the new session id, or -1 when every KV sequence is in use.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_openSession(
+    JNIEnv * env,
+    jobject /* thiz */) {
+    (void) env;
+    return engine()->open_session();
+}
 
-            int generated = 0;
-            slock.unlock(); // allow nextTokenPiece to run while generating
-
-            const int target_tokens = resolve_target_tokens(n_predict, n_prompt);
-            while (generated < target_tokens) {
-                {
-                    std::lock_guard<std::mutex> lk(g_session->mutex);
-                    if (g_session->cancel) {
-                        LOGI("[worker] cancel requested");
-                        break;
-                    }
-                }
-                llama_token new_token = llama_sampler_sample(g_session->sampler, g_session->ctx, -1);
-                if (llama_vocab_is_eog(vocab, new_token)) {
-                    LOGI("[worker] EOG reached after %d tokens", generated);
-                    break;
-                }
-                char piece[256];
-                int piece_len = llama_token_to_piece(vocab, new_token, piece, sizeof(piece), 0, true);
-                if (piece_len <= 0) {
-                    LOGE("[worker] token_to_piece <= 0");
-                    break;
-                }
-                {
-                    std::lock_guard<std::mutex> ql(g_stream_mutex);
-                    g_stream_queue.emplace(std::string(piece, (size_t)piece_len));
-                }
-                g_stream_cv.notify_all();
-
-                llama_batch nb = llama_batch_get_one(&new_token, 1);
-                if (llama_decode(g_session->ctx, nb) != 0) {
-                    LOGE("[worker] decode next failed");
-                    break;
-                }
-                ++generated;
-            }
-            LOGI("[worker] done, generated=%d", generated);
-            g_stream_active.store(false);
-            g_stream_cv.notify_all();
-        });
+extern "C" JNIEXPORT void JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_closeSession(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint session) {
+    (void) env;
+    engine()->close_session(session);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_setConversationMode(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jboolean enabled) {
+    (void) env;
+    engine()->set_conversation_mode(enabled == JNI_TRUE);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_setAdaptiveThreads(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jboolean enabled) {
+    (void) env;
+    engine()->set_adaptive_threads(enabled == JNI_TRUE);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_resetConversation(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint session) {
+    (void) env;
+    engine()->reset_context(session);
+}
+
+// n_keep < 0 keeps the pinned prefix; n_discard <= 0 evicts half the context.
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_setContextShift(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint session,
+    jboolean enabled,
+    jint n_keep,
+    jint n_discard) {
+    (void) env;
+    maathai::ContextShift shift;
+    shift.enabled = enabled == JNI_TRUE;
+    shift.n_keep = n_keep;
+    shift.n_discard = n_discard;
+    return engine()->set_context_shift(session, shift) ? JNI_TRUE : JNI_FALSE;
+}
+
+// priority: 0 background, 1 normal, 2 interactive. Applies from the
+// session's next batch and to the requests it starts after this.
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_setSessionPriority(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint session,
+    jint priority) {
+    (void) env;
+    if (priority < 0 || priority >= maathai::kRequestPriorityCount) {
+        return JNI_FALSE;
     }
+    return engine()->set_session_priority(session, (maathai::RequestPriority) priority) ? JNI_TRUE : JNI_FALSE;
+}
 
-    return JNI_TRUE;
+// Adapters belong to the current model: a reload, in place or swapped in the
+// background, starts without any. Returns the adapter id or -1.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_loadLora(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jstring path) {
+    return engine()->load_lora(to_std_string(env, path));
 }
 
-extern "C" JNIEXPORT jstring JNICALL
-Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_nextTokenPiece(
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_unloadLora(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint id) {
+    (void) env;
+    return engine()->unload_lora(id) ? JNI_TRUE : JNI_FALSE;
+}
+
+// `ids` and `scales` run in parallel; empty arrays select the base model.
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_setSessionLoras(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint session,
+    jintArray ids,
+    jfloatArray scales) {
+    const jsize n = ids != nullptr ? env->GetArrayLength(ids) : 0;
+    if (scales == nullptr ? n != 0 : env->GetArrayLength(scales) != n) {
+        return JNI_FALSE;
+    }
+    std::vector<jint> id_values((size_t) n);
+    std::vector<jfloat> scale_values((size_t) n);
+    if (n > 0) {
+        env->GetIntArrayRegion(ids, 0, n, id_values.data());
+        env->GetFloatArrayRegion(scales, 0, n, scale_values.data());
+    }
+    maathai::LoraSet set((size_t) n);
+    for (jsize i = 0; i < n; ++i) {
+        set[(size_t) i].id = id_values[(size_t) i];
+        set[(size_t) i].scale = scale_values[(size_t) i];
+    }
+    return engine()->set_session_loras(session, set) ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_embeddingSize(
     JNIEnv * env,
     jobject /* thiz */) {
     (void) env;
-    if (!g_session) return nullptr;
-    std::lock_guard<std::mutex> ql(g_stream_mutex);
-    if (g_stream_queue.empty()) return nullptr;
-    std::string next = std::move(g_stream_queue.front());
-    g_stream_queue.pop();
-    return env->NewStringUTF(next.c_str());
+    return engine()->n_embd();
+}
+
+// Writes one float row per text, in native byte order, straight into the
+// direct ByteBuffer `out` (at least texts * embeddingSize() * 4 bytes).
+// Returns {texts, tokens, truncated, batches, elapsed ms, texts/s, resolved
+// pooling (1 mean, 2 cls, 3 last)}, or null on failure.
+extern "C" JNIEXPORT jdoubleArray JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_embed(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jobjectArray texts,
+    jint pooling,
+    jboolean normalize,
+    jint n_batch,
+    jint n_seq,
+    jobject out) {
+    auto * dst = static_cast<float *>(env->GetDirectBufferAddress(out));
+    const jlong capacity = env->GetDirectBufferCapacity(out);
+    if (dst == nullptr || capacity < 0) {
+        return nullptr;
+    }
+    maathai::EmbedOptions options;
+    options.pooling = to_embedding_pooling(pooling);
+    options.normalize = normalize == JNI_TRUE;
+    options.n_batch = n_batch;
+    options.n_seq = n_seq;
+    maathai::EmbedStats stats;
+    if (!engine()->embed(to_strings(env, texts), options, dst, (size_t) capacity / sizeof(float), &stats)) {
+        return nullptr;
+    }
+    const jdouble values[7] = {
+        (jdouble) stats.texts,
+        (jdouble) stats.tokens,
+        (jdouble) stats.truncated,
+        (jdouble) stats.batches,
+        stats.ms,
+        stats.texts_per_s,
+        (jdouble) stats.pooling,
+    };
+    jdoubleArray result = env->NewDoubleArray(7);
+    if (result != nullptr) {
+        env->SetDoubleArrayRegion(result, 0, 7, values);
+    }
+    return result;
+}
+
+namespace {
+
+// Per phase, in maathai::MetricPhase order: count, total, mean, p50, p95, max
+// (microseconds except count).
+constexpr int kPhaseFields = 6;
+constexpr int kStatsHeader = 21;
+constexpr int kStatsLength = kStatsHeader + (2 * maathai::kMetricPhaseCount + 1) * kPhaseFields;
+
+void put_stat(jdouble * row, const maathai::PhaseStat & stat) {
+    row[0] = (jdouble) stat.count;
+    row[1] = stat.total_us;
+    row[2] = stat.mean_us();
+    row[3] = stat.percentile_us(0.50);
+    row[4] = stat.percentile_us(0.95);
+    row[5] = stat.max_us;
+}
+
+void put_phases(jdouble * out, const maathai::PhaseMetrics & metrics) {
+    for (int phase = 0; phase < maathai::kMetricPhaseCount; ++phase) {
+        put_stat(out + phase * kPhaseFields, metrics[phase]);
+    }
+}
+
+}  // namespace
+
+// Returns {requests, threads, threads batch, n_batch, n_ubatch, kv used,
+// kv used by the session, kv size, active sessions, llama load ms, llama
+// prompt ms, llama eval ms, llama prompt tokens, llama eval tokens, last
+// request's prompt tokens, cached tokens, generated tokens, total ms,
+// cancelled (0/1) and cancel ms, aborted decodes}, then the last request's
+// phases, the phases of all requests and cancel-to-idle latency.
+extern "C" JNIEXPORT jdoubleArray JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_getStats(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint session) {
+    const maathai::EngineStats stats = engine()->get_stats(session);
+    jdouble values[kStatsLength];
+    const jdouble header[kStatsHeader] = {
+        (jdouble) stats.requests,
+        (jdouble) stats.n_threads,
+        (jdouble) stats.n_threads_batch,
+        (jdouble) stats.n_batch,
+        (jdouble) stats.n_ubatch,
+        (jdouble) stats.kv_used,
+        (jdouble) stats.kv_session,
+        (jdouble) stats.kv_size,
+        (jdouble) stats.active_sessions,
+        stats.llama_load_ms,
+        stats.llama_prompt_ms,
+        stats.llama_eval_ms,
+        (jdouble) stats.llama_prompt_tokens,
+        (jdouble) stats.llama_eval_tokens,
+        (jdouble) stats.last.prompt_tokens,
+        (jdouble) stats.last.cached_tokens,
+        (jdouble) stats.last.generated_tokens,
+        stats.last.total_ms,
+        stats.last.cancelled ? 1.0 : 0.0,
+        stats.last.cancel_ms,
+        (jdouble) stats.aborted_decodes,
+    };
+    std::copy(header, header + kStatsHeader, values);
+    put_phases(values + kStatsHeader, stats.last.phases);
+    put_phases(values + kStatsHeader + maathai::kMetricPhaseCount * kPhaseFields, stats.total);
+    put_stat(values + kStatsHeader + 2 * maathai::kMetricPhaseCount * kPhaseFields, stats.cancel);
+    jdoubleArray out = env->NewDoubleArray(kStatsLength);
+    if (out != nullptr) {
+        env->SetDoubleArrayRegion(out, 0, kStatsLength, values);
+    }
+    return out;
 }
 
 extern "C" JNIEXPORT void JNICALL
-Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_cancelGenerate(
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_startTrace(
+    JNIEnv * /* env */,
+    jobject /* thiz */,
+    jint max_events) {
+    engine()->start_trace(max_events > 0 ? (size_t) max_events : maathai::TraceRecorder::kDefaultCapacity);
+}
+
+// Stops recording and writes the Chrome trace JSON to `path` (nothing is
+// written for an empty path).
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_stopTrace(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jstring path) {
+    return engine()->stop_trace(to_std_string(env, path)) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Returns {samples, then microseconds per sampler stage in pipeline order},
+// accumulated since loadModel().
+extern "C" JNIEXPORT jdoubleArray JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_samplerTimings(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint session) {
+    const maathai::SamplerTimings timings = engine()->sampler_timings(session);
+    jdouble values[1 + maathai::kSamplerStageCount];
+    values[0] = (jdouble) timings.samples;
+    for (int stage = 0; stage < maathai::kSamplerStageCount; ++stage) {
+        values[1 + stage] = timings.us[stage];
+    }
+    jdoubleArray out = env->NewDoubleArray(1 + maathai::kSamplerStageCount);
+    if (out != nullptr) {
+        env->SetDoubleArrayRegion(out, 0, 1 + maathai::kSamplerStageCount, values);
+    }
+    return out;
+}
+
+// Returns {status (0 failed, 1 restored, 2 created), prefix tokens, elapsed ms}.
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_primePrefix(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint session,
+    jobjectArray roles,
+    jobjectArray contents,
+    jstring cache_dir) {
+    const auto result = engine()->prime_prefix(
+        to_messages(env, nullptr, roles, contents), to_std_string(env, cache_dir), session);
+    const jint values[3] = {
+        (jint) result.status,
+        (jint) result.n_tokens,
+        (jint) result.ms,
+    };
+    jintArray out = env->NewIntArray(3);
+    if (out != nullptr) {
+        env->SetIntArrayRegion(out, 0, 3, values);
+    }
+    return out;
+}
+
+// Estimates resident memory for the given settings from the GGUF header alone
+// and, with a budget, plans the largest context/batch that fits. Returns
+// {ok, weights, kv, compute, overhead, total, n_ctx_train,
+//  plan fits, plan n_ctx, plan n_batch, plan n_ubatch, plan total}, or null
+// when the file cannot be read as GGUF.
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_estimateMemory(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jstring model_path,
+    jint n_ctx,
+    jint n_batch,
+    jint n_ubatch,
+    jstring cache_type_k,
+    jstring cache_type_v,
+    jint flash_attn,
+    jlong budget_bytes) {
+    maathai::GgufModelInfo info;
+    if (!maathai::read_gguf_info(to_std_string(env, model_path), info)) {
+        return nullptr;
+    }
+    maathai::KvCacheType type_k = maathai::KvCacheType::kF16;
+    maathai::KvCacheType type_v = maathai::KvCacheType::kF16;
+    maathai::parse_kv_cache_type(to_std_string(env, cache_type_k), type_k);
+    maathai::parse_kv_cache_type(to_std_string(env, cache_type_v), type_v);
+    // mirrors load(): a quantized V cache runs with flash attention
+    const bool flash = to_flash_attention(flash_attn) == maathai::FlashAttention::kOn ||
+        (type_v != maathai::KvCacheType::kF16 && to_flash_attention(flash_attn) == maathai::FlashAttention::kAuto);
+    if (!flash) {
+        type_v = maathai::KvCacheType::kF16;
+    }
+    const int ctx = n_ctx > 0 ? n_ctx : info.n_ctx_train;
+    const int batch = n_batch > 0 ? n_batch : maathai::kPlanDefaultBatch;
+    const maathai::MemoryEstimate estimate = maathai::estimate_memory(info, ctx, batch, n_ubatch, type_k, type_v, flash);
+    maathai::MemoryPlan plan;
+    if (budget_bytes > 0) {
+        plan = maathai::plan_memory(info, (uint64_t) budget_bytes, n_ctx, n_batch, n_ubatch, type_k, type_v, flash);
+    }
+    const jlong values[12] = {
+        1,
+        (jlong) estimate.weights,
+        (jlong) estimate.kv,
+        (jlong) estimate.compute,
+        (jlong) estimate.overhead,
+        (jlong) estimate.total(),
+        (jlong) info.n_ctx_train,
+        plan.fits ? 1 : 0,
+        (jlong) plan.n_ctx,
+        (jlong) plan.n_batch,
+        (jlong) plan.n_ubatch,
+        (jlong) plan.estimate.total(),
+    };
+    jlongArray out = env->NewLongArray(12);
+    if (out != nullptr) {
+        env->SetLongArrayRegion(out, 0, 12, values);
+    }
+    return out;
+}
+
+// Settings the loaded model actually runs with:
+// {n_ctx, n_threads, n_threads_batch, n_batch, n_ubatch, type_k, type_v,
+//  flash_attn (-1 auto, 0 off, 1 on), speculative, n_draft}, types as
+// maathai::KvCacheType values. Null when nothing is loaded.
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_activeSettings(
     JNIEnv * env,
     jobject /* thiz */) {
+    const std::shared_ptr<maathai::LlamaEngine> e = engine();
+    if (!e->is_loaded()) {
+        return nullptr;
+    }
+    const jint flash = e->flash_attn() == maathai::FlashAttention::kOn ? 1
+        : e->flash_attn() == maathai::FlashAttention::kOff ? 0 : -1;
+    const jint values[10] = {
+        (jint) e->n_ctx(),
+        (jint) e->n_threads(),
+        (jint) e->n_threads_batch(),
+        (jint) e->n_batch(),
+        (jint) e->n_ubatch(),
+        (jint) e->type_k(),
+        (jint) e->type_v(),
+        flash,
+        e->speculative() ? 1 : 0,
+        (jint) e->n_draft(),
+    };
+    jintArray out = env->NewIntArray(10);
+    if (out != nullptr) {
+        env->SetIntArrayRegion(out, 0, 10, values);
+    }
+    return out;
+}
+
+// Opens (or creates) the index file; returns a handle or -1.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_vectorIndexOpen(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jstring path,
+    jint dim,
+    jboolean quantized) {
+    auto index = std::make_shared<maathai::VectorIndex>();
+    const std::string file = to_std_string(env, path);
+    if (dim <= 0 || !index->open(file, (uint32_t) dim,
+                                 quantized == JNI_TRUE ? maathai::VectorType::kI8 : maathai::VectorType::kF32)) {
+        LOGE("vectorIndexOpen(): cannot open %s for dim=%d", file.c_str(), dim);
+        return -1;
+    }
+    LOGI("vectorIndexOpen(): %s, %zu vectors, simd=%s", file.c_str(), index->size(), maathai::vector_simd_name());
+    std::lock_guard<std::mutex> lock(g_indexes_mutex);
+    const jint handle = g_next_index++;
+    g_indexes[handle] = std::move(index);
+    return handle;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_vectorIndexClose(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint handle) {
     (void) env;
-    if (!g_session) return;
-    std::lock_guard<std::mutex> lock(g_session->mutex);
-    g_session->cancel = true;
-    g_stream_active.store(false);
-    g_stream_cv.notify_all();
+    std::shared_ptr<maathai::VectorIndex> index;
+    {
+        std::lock_guard<std::mutex> lock(g_indexes_mutex);
+        auto it = g_indexes.find(handle);
+        if (it == g_indexes.end()) {
+            return;
+        }
+        index = std::move(it->second);
+        g_indexes.erase(it);
+    }
+    index->flush();
 }
 
+// `vectors` holds ids.length rows of the index's dimension.
 extern "C" JNIEXPORT jboolean JNICALL
-Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_isStreamActive(
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_vectorIndexAdd(
     JNIEnv * env,
-    jobject /* thiz */) {
+    jobject /* thiz */,
+    jint handle,
+    jlongArray ids,
+    jfloatArray vectors) {
+    const auto index = vector_index(handle);
+    if (index == nullptr || ids == nullptr || vectors == nullptr) {
+        return JNI_FALSE;
+    }
+    const jsize n = env->GetArrayLength(ids);
+    if ((size_t) env->GetArrayLength(vectors) != (size_t) n * index->dim()) {
+        return JNI_FALSE;
+    }
+    // add() takes the index's write lock and may grow the file, so copy out
+    // instead of pinning the Java arrays for that long
+    std::vector<int64_t> id_values((size_t) n);
+    std::vector<float> vector_values((size_t) n * index->dim());
+    env->GetLongArrayRegion(ids, 0, n, reinterpret_cast<jlong *>(id_values.data()));
+    env->GetFloatArrayRegion(vectors, 0, (jsize) vector_values.size(), vector_values.data());
+    return index->add(id_values.data(), vector_values.data(), (size_t) n) ? JNI_TRUE : JNI_FALSE;
+}
+
+// Returns how many of `ids` were present.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_vectorIndexRemove(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint handle,
+    jlongArray ids) {
+    const auto index = vector_index(handle);
+    if (index == nullptr || ids == nullptr) {
+        return 0;
+    }
+    const jsize n = env->GetArrayLength(ids);
+    std::vector<int64_t> id_values((size_t) n);
+    env->GetLongArrayRegion(ids, 0, n, reinterpret_cast<jlong *>(id_values.data()));
+    return (jint) index->remove(id_values.data(), (size_t) n);
+}
+
+// Writes up to k = outIds.length hits, best first, into the caller's
+// primitive arrays and returns how many; no Java object per hit. -1 for a
+// bad handle or query.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_vectorIndexSearch(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint handle,
+    jfloatArray query,
+    jint threads,
+    jlongArray out_ids,
+    jfloatArray out_scores) {
+    const auto index = vector_index(handle);
+    if (index == nullptr || query == nullptr || out_ids == nullptr || out_scores == nullptr ||
+        (uint32_t) env->GetArrayLength(query) != index->dim()) {
+        return -1;
+    }
+    const jsize k = std::min(env->GetArrayLength(out_ids), env->GetArrayLength(out_scores));
+    std::vector<float> q(index->dim());
+    env->GetFloatArrayRegion(query, 0, (jsize) q.size(), q.data());
+    thread_local std::vector<maathai::VectorHit> hits;
+    hits.resize((size_t) k);
+    const size_t found = index->search(q.data(), (size_t) k, hits.data(), threads);
+    thread_local std::vector<jlong> ids;
+    thread_local std::vector<jfloat> scores;
+    ids.resize(found);
+    scores.resize(found);
+    for (size_t i = 0; i < found; ++i) {
+        ids[i] = (jlong) hits[i].id;
+        scores[i] = hits[i].score;
+    }
+    env->SetLongArrayRegion(out_ids, 0, (jsize) found, ids.data());
+    env->SetFloatArrayRegion(out_scores, 0, (jsize) found, scores.data());
+    return (jint) found;
+}
+
+// Returns {live vectors, records including removed ones, dim, quantized}.
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_vectorIndexInfo(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint handle) {
+    const auto index = vector_index(handle);
+    if (index == nullptr) {
+        return nullptr;
+    }
+    const jlong values[4] = {
+        (jlong) index->size(),
+        (jlong) index->slots(),
+        (jlong) index->dim(),
+        index->type() == maathai::VectorType::kI8 ? 1 : 0,
+    };
+    jlongArray out = env->NewLongArray(4);
+    if (out != nullptr) {
+        env->SetLongArrayRegion(out, 0, 4, values);
+    }
+    return out;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_vectorIndexCompact(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jint handle) {
     (void) env;
-    return g_stream_active.load() ? JNI_TRUE : JNI_FALSE;
+    const auto index = vector_index(handle);
+    return index != nullptr && index->compact() && index->flush() ? JNI_TRUE : JNI_FALSE;
+}
+
+// Deletes the cached tuning profiles so the next tuned load calibrates again.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_invalidateTuning(
+    JNIEnv * env,
+    jobject /* thiz */,
+    jstring tune_dir) {
+    return (jint) maathai::LlamaEngine::invalidate_tune_profiles(to_std_string(env, tune_dir));
 }
 
 extern "C" JNIEXPORT void JNICALL
@@ -577,7 +1456,30 @@ Java_com_usemaathai_maathai_1llamma_MaathaiLlammaPlugin_release(
     JNIEnv * env,
     jobject /* thiz */) {
     (void) env;
-    free_session();
+    EngineSlot & slot = engine_slot();
+    std::shared_ptr<maathai::LlamaEngine> streams[maathai::LlamaEngine::kMaxSessions];
+    {
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        for (int i = 0; i < maathai::LlamaEngine::kMaxSessions; ++i) {
+            streams[i] = std::move(slot.streams[i]);
+        }
+    }
+    // engines left over from a swap go once their last stream lets go
+    for (const auto & stream : streams) {
+        if (stream != nullptr) {
+            stream->cancel_all();
+        }
+    }
+    engine()->release();
+    // a load in flight gives up at its next progress report
+    if (g_loading.load()) {
+        g_cancel_load = true;
+    }
+    std::lock_guard<std::mutex> load_lock(g_load_mutex);
+    for (auto & entry : g_resident) {
+        entry.second.engine->release();
+    }
+    g_resident.clear();
+    g_residency = maathai::ModelResidency(g_residency.budget());
+    g_current_model = -1;
 }
-
-
@@ -7,6 +7,11 @@ import io.flutter.plugin.common.MethodChannel.MethodCallHandler
 import io.flutter.plugin.common.MethodChannel.Result
 import io.flutter.plugin.common.EventChannel
 import java.io.File
+import java.nio.ByteBuffer
+import java.util.concurrent.ConcurrentHashMap
+import java.util.concurrent.Executors
+import android.app.ActivityManager
+import android.content.Context
 import android.os.Handler
 import android.os.Looper
 import android.util.Log
@@ -17,6 +22,30 @@ class MaathaiLlammaPlugin : FlutterPlugin, MethodCallHandler, EventChannel.Strea
         // Soft guard; tune per device class via Dart (defaults to 3.5 GB for 4-bit 7B models)
         private const val DEFAULT_MAX_MODEL_BYTES = 3_500L * 1024L * 1024L
         private const val TAG = "MaathaiLL"
+        private const val STREAM_WAIT_MS = 100
+        private const val STREAM_MAX_DRAIN = 64
+        // Holds STREAM_MAX_DRAIN pieces of up to 256 bytes plus per-token fields
+        private const val STREAM_FRAME_BYTES = 20 * 1024
+        // Indexed by maathai::KvCacheType
+        private val KV_CACHE_TYPES = listOf("f16", "q8_0", "q4_0")
+        // Indexed by the bridge's pooling code
+        private val EMBEDDING_POOLINGS = listOf("model", "mean", "cls", "last")
+        // Sampler stages in pipeline order, as reported by samplerTimings().
+        private val SAMPLER_STAGES = listOf("topK", "penalties", "filters", "temperature", "dist")
+        // Request phases in maathai::MetricPhase order, as reported by getStats().
+        private val METRIC_PHASES = listOf(
+            "queue", "template", "tokenize", "prefill", "decode", "sample", "detokenize", "handoff"
+        )
+        private const val STATS_HEADER = 21
+        private const val PHASE_FIELDS = 6
+        // residentModels() lists at most this many; a budget holds far fewer
+        private const val MAX_RESIDENT_MODELS = 32
+        // Indexed by maathai::LoadStage
+        private val LOAD_STAGES = listOf("weights", "prefault", "warmup")
+        // Indexed by maathai::GovernorReason
+        private val GOVERNOR_REASONS = listOf("probe", "revert", "thermal", "slowdown")
+        // Indexed by maathai::RequestPriority
+        private val PRIORITIES = listOf("background", "normal", "interactive")
 
         init {
             System.loadLibrary("maathai_llamma")
@@ -26,8 +55,18 @@ class MaathaiLlammaPlugin : FlutterPlugin, MethodCallHandler, EventChannel.Strea
     private lateinit var channel: MethodChannel
     private lateinit var eventChannel: EventChannel
     @Volatile private var eventSink: EventChannel.EventSink? = null
-    @Volatile private var streamingThread: Thread? = null
+    // One frame-pumping thread per session with a live stream
+    private val streamingThreads = ConcurrentHashMap<Int, Thread>()
     private var maxModelBytes: Long = DEFAULT_MAX_MODEL_BYTES
+    private var defaultSnapshotDir: File? = null
+    private var defaultTuneDir: File? = null
+    private var appContext: Context? = null
+    // Grown on demand and reused by every embed call, under embedLock.
+    private val embedLock = Any()
+    private var embedBuffer: ByteBuffer? = null
+    // Vector index calls run in order off the main thread; a search
+    // parallelizes natively.
+    private val vectorExecutor = Executors.newSingleThreadExecutor()
 
     override fun onAttachedToEngine(binding: FlutterPlugin.FlutterPluginBinding) {
         Log.i(TAG, "onAttachedToEngine")
@@ -35,6 +74,9 @@ class MaathaiLlammaPlugin : FlutterPlugin, MethodCallHandler, EventChannel.Strea
         channel.setMethodCallHandler(this)
         eventChannel = EventChannel(binding.binaryMessenger, "maathai_llamma/events")
         eventChannel.setStreamHandler(this)
+        defaultSnapshotDir = File(binding.applicationContext.cacheDir, "maathai_prefix")
+        defaultTuneDir = File(binding.applicationContext.cacheDir, "maathai_tune")
+        appContext = binding.applicationContext
         val ok = initBackend()
         Log.i(TAG, "initBackend result: $ok")
     }
@@ -42,6 +84,8 @@ class MaathaiLlammaPlugin : FlutterPlugin, MethodCallHandler, EventChannel.Strea
     override fun onDetachedFromEngine(binding: FlutterPlugin.FlutterPluginBinding) {
         Log.i(TAG, "onDetachedFromEngine: cancelling and releasing")
         cancelAll()
+        // the engine goes next, so every worker must be out of it first
+        streamingThreads.keys.toList().forEach { joinStreamingThread(it) }
         release()
         channel.setMethodCallHandler(null)
     }
@@ -53,6 +97,77 @@ class MaathaiLlammaPlugin : FlutterPlugin, MethodCallHandler, EventChannel.Strea
 
             "loadModel" -> handleLoadModel(call, result)
 
+            "cancelLoad" -> result.success(cancelLoad())
+
+            "setResidencyBudget" -> {
+                val budget = call.argument<Number>("budgetBytes")?.toLong() ?: 0L
+                onModelThread(result) { reply ->
+                    setResidencyBudget(budget)
+                    reply.success(null)
+                }
+            }
+
+            "switchModel" -> {
+                val handle = call.argument<Int>("handle") ?: -1
+                onModelThread(result) { reply ->
+                    val ms = switchModel(handle)
+                    if (ms < 0.0) {
+                        reply.error("not_resident", "Model $handle is not resident", null)
+                    } else {
+                        Log.i(TAG, "switchModel: $handle in $ms ms")
+                        reply.success(activeSettingsMap()?.plus("switchMs" to ms))
+                    }
+                }
+            }
+
+            "pinModel" -> {
+                val handle = call.argument<Int>("handle") ?: -1
+                val pinned = call.argument<Boolean>("pinned") ?: true
+                onModelThread(result) { reply -> reply.success(pinModel(handle, pinned)) }
+            }
+
+            "unloadModel" -> {
+                val handle = call.argument<Int>("handle") ?: -1
+                onModelThread(result) { reply -> reply.success(unloadModel(handle)) }
+            }
+
+            "residentModels" -> {
+                onModelThread(result) { reply ->
+                    val paths = arrayOfNulls<String>(MAX_RESIDENT_MODELS)
+                    val out = residentModels(paths) ?: LongArray(0)
+                    reply.success(List(minOf(out.size / 5, paths.size)) { i ->
+                        mapOf(
+                            "handle" to out[i * 5].toInt(),
+                            "path" to (paths[i] ?: ""),
+                            "weightsBytes" to out[i * 5 + 1],
+                            "contextBytes" to out[i * 5 + 2],
+                            "hasContext" to (out[i * 5 + 3] == 1L),
+                            "pinned" to (out[i * 5 + 4] == 1L)
+                        )
+                    })
+                }
+            }
+
+            "residencyStats" -> {
+                onModelThread(result) { reply ->
+                    val out = residencyStats()
+                    reply.success(out?.let {
+                        mapOf(
+                            "budgetBytes" to it[0],
+                            "residentBytes" to it[1],
+                            "models" to it[2].toInt(),
+                            "contexts" to it[3].toInt(),
+                            "hits" to it[4],
+                            "misses" to it[5],
+                            "contextFrees" to it[6],
+                            "contextRestores" to it[7],
+                            "evictions" to it[8],
+                            "currentHandle" to it[9].toInt().takeIf { handle -> handle >= 0 }
+                        )
+                    })
+                }
+            }
+
             "updateSampler" -> {
                 Log.d(TAG, "updateSampler called")
                 val temperature = (call.argument<Double>("temperature") ?: 0.7).toFloat()
@@ -78,20 +193,54 @@ class MaathaiLlammaPlugin : FlutterPlugin, MethodCallHandler, EventChannel.Strea
                 result.success(ok)
             }
 
+            "openSession" -> {
+                val session = openSession()
+                Log.i(TAG, "openSession: $session")
+                if (session < 0) {
+                    result.error("no_session", "All native sessions are in use", null)
+                } else {
+                    result.success(session)
+                }
+            }
+
+            "closeSession" -> {
+                val session = call.argument<Int>("session") ?: 0
+                Log.i(TAG, "closeSession: $session")
+                cancelSession(session)
+                Thread {
+                    joinStreamingThread(session)
+                    closeSession(session)
+                    Handler(Looper.getMainLooper()).post { result.success(null) }
+                }.start()
+            }
+
             "startGenerateStream" -> {
                 Log.i(TAG, "startGenerateStream called")
+                val session = call.argument<Int>("session") ?: 0
                 val prompt = call.argument<String>("prompt")
                 val maxTokens = call.argument<Int>("maxTokens") ?: 512
-                if (prompt.isNullOrEmpty()) {
+                val logprobs = call.argument<Boolean>("logprobs") ?: false
+                val (roles, contents) = messageArrays(call)
+                if (prompt.isNullOrEmpty() && roles == null) {
                     result.error("invalid_prompt", "prompt must not be empty", null)
                     return
                 }
 
-                // Ensure only one streaming thread
-                cancelAll()
+                if (!applyAdapters(call, session, result)) return
+                if (!applyPriority(call, session, result)) return
 
-                streamingThread = Thread {
-                    Log.i(TAG, "[stream] worker started, promptLen=${prompt.length}, maxTokens=$maxTokens")
+                // One streaming thread per session: the old one drains its
+                // cancelled stream and the new one waits for it, off the main
+                // thread, so a restart does not stall the UI.
+                cancelGenerate(session)
+                val previous = streamingThreads.remove(session)
+
+                streamingThreads[session] = Thread {
+                    try {
+                        previous?.join()
+                    } catch (_: InterruptedException) {
+                    }
+                    Log.i(TAG, "[stream] worker started, session=$session, promptLen=${prompt?.length ?: 0}, messages=${roles?.size ?: 0}, maxTokens=$maxTokens")
                     val sink = eventSink
                     if (sink == null) {
                         Log.e(TAG, "[stream] No event stream listener attached")
@@ -100,85 +249,415 @@ class MaathaiLlammaPlugin : FlutterPlugin, MethodCallHandler, EventChannel.Strea
                         }
                         return@Thread
                     }
-                    val ok = startGenerate(prompt, maxTokens)
+                    val ok = startGenerate(session, prompt ?: "", maxTokens, roles, contents, logprobs)
                     Log.i(TAG, "[stream] startGenerate returned: $ok")
                     if (!ok) {
                         Handler(Looper.getMainLooper()).post {
-                            sink.error("start_failed", "Failed to start generation", null)
+                            sink.error("start_failed", "Failed to start generation", mapOf("session" to session))
                             result.success(false)
                         }
                         return@Thread
                     }
                     Handler(Looper.getMainLooper()).post { result.success(true) }
-                    var tokenCount = 0
+                    var flushCount = 0
+                    // main-thread delay of each posted frame, read back on the main thread
+                    var flushDelayNs = 0L
+                    var flushMaxNs = 0L
                     val main = Handler(Looper.getMainLooper())
-                    val buffer = StringBuilder()
-                    var lastFlush = System.currentTimeMillis()
-                    val flush = {
-                        if (buffer.isNotEmpty()) {
-                            val text = buffer.toString()
-                            buffer.clear()
-                            main.post { sink.success(mapOf("type" to "token", "text" to text)) }
-                        }
-                    }
-                    val FLUSH_EVERY_TOKENS = 4
-                    val FLUSH_EVERY_MS = 30L
-                    while (isStreamActive() || true) {
-                        val piece = nextTokenPiece()
-                        if (piece != null) {
-                            tokenCount += 1
-                            buffer.append(piece)
-                            val now = System.currentTimeMillis()
-                            if (tokenCount % FLUSH_EVERY_TOKENS == 0 || now - lastFlush >= FLUSH_EVERY_MS) {
-                                if (tokenCount % (FLUSH_EVERY_TOKENS * 2) == 0) {
-                                    Log.d(TAG, "[stream] tokens emitted=$tokenCount")
-                                }
-                                flush()
-                                lastFlush = now
+                    // Native code blocks until the decoder produces pieces and writes
+                    // everything that piled up as one binary frame (token ids, timings,
+                    // UTF-8 text cut at a character boundary). Dart decodes the bytes.
+                    val frame = ByteBuffer.allocateDirect(STREAM_FRAME_BYTES)
+                    while (true) {
+                        val length = waitForTokenFrame(session, frame, STREAM_WAIT_MS, STREAM_MAX_DRAIN)
+                        if (length < 0) break
+                        if (length > 0) {
+                            val bytes = ByteArray(length)
+                            frame.position(0)
+                            frame.get(bytes, 0, length)
+                            flushCount += 1
+                            val postedNs = System.nanoTime()
+                            main.post {
+                                val delayNs = System.nanoTime() - postedNs
+                                flushDelayNs += delayNs
+                                flushMaxNs = maxOf(flushMaxNs, delayNs)
+                                sink.success(mapOf("type" to "frame", "session" to session, "data" to bytes))
                             }
-                        } else if (!isStreamActive()) {
-                            break
-                        } else {
-                            try { Thread.sleep(8) } catch (_: InterruptedException) {}
                         }
                     }
-                    // final flush
-                    if (buffer.isNotEmpty()) {
-                        val text = buffer.toString()
-                        buffer.clear()
-                        main.post { sink.success(mapOf("type" to "token", "text" to text)) }
+                    Log.i(TAG, "[stream] session $session done. events=$flushCount")
+                    val stats = statsMap(session)
+                    val frames = flushCount
+                    main.post {
+                        // runs after every frame post above
+                        if (stats != null) {
+                            val flush = mapOf(
+                                "frames" to frames,
+                                "meanUs" to if (frames > 0) flushDelayNs / 1000.0 / frames else 0.0,
+                                "maxUs" to flushMaxNs / 1000.0
+                            )
+                            sink.success(stats + mapOf("type" to "stats", "session" to session, "flush" to flush))
+                        }
+                        sink.success(mapOf("type" to "done", "session" to session))
                     }
-                    Log.i(TAG, "[stream] done. totalTokens=$tokenCount")
-                    Handler(Looper.getMainLooper()).post { sink.success(mapOf("type" to "done")) }
                 }.also { it.start() }
             }
 
             "cancelGenerate" -> {
-                Log.i(TAG, "cancelGenerate called")
-                cancelAll()
+                val session = call.argument<Int>("session")
+                Log.i(TAG, "cancelGenerate called, session=${session ?: "all"}")
+                if (session == null) cancelAll() else cancelSession(session)
                 result.success(null)
             }
 
             "generate" -> {
                 Log.i(TAG, "generate called")
+                val session = call.argument<Int>("session") ?: 0
                 val prompt = call.argument<String>("prompt")
                 val maxTokens = call.argument<Int>("maxTokens") ?: 512
+                val (roles, contents) = messageArrays(call)
 
-                if (prompt.isNullOrEmpty()) {
+                if (prompt.isNullOrEmpty() && roles == null) {
                     result.error("invalid_prompt", "prompt must not be empty", null)
                     return
                 }
+                if (!applyAdapters(call, session, result)) return
+                if (!applyPriority(call, session, result)) return
 
                 Thread {
-                    Log.i(TAG, "[generate] begin, promptLen=${prompt.length}, maxTokens=$maxTokens")
-                    val output = generate(prompt, maxTokens)
+                    Log.i(TAG, "[generate] begin, promptLen=${prompt?.length ?: 0}, messages=${roles?.size ?: 0}, maxTokens=$maxTokens")
+                    val output = generate(session, prompt ?: "", maxTokens, roles, contents)
                     Log.i(TAG, "[generate] finished, outLen=${output.length}")
+                    val stats = statsMap(session)
                     Handler(Looper.getMainLooper()).post {
                         result.success(output)
+                        if (stats != null) {
+                            eventSink?.success(stats + mapOf("type" to "stats", "session" to session))
+                        }
+                    }
+                }.start()
+            }
+
+            "setConversationMode" -> {
+                val enabled = call.argument<Boolean>("enabled") ?: false
+                Log.i(TAG, "setConversationMode: $enabled")
+                setConversationMode(enabled)
+                result.success(null)
+            }
+
+            "setAdaptiveThreads" -> {
+                val enabled = call.argument<Boolean>("enabled") ?: false
+                Log.i(TAG, "setAdaptiveThreads: $enabled")
+                setAdaptiveThreads(enabled)
+                result.success(null)
+            }
+
+            "resetConversation" -> {
+                resetConversation(call.argument<Int>("session") ?: 0)
+                result.success(null)
+            }
+
+            "setContextShift" -> {
+                val session = call.argument<Int>("session") ?: 0
+                val enabled = call.argument<Boolean>("enabled") ?: false
+                val keep = call.argument<Int>("keepTokens") ?: -1
+                val discard = call.argument<Int>("discardTokens") ?: 0
+                Log.i(TAG, "setContextShift: session=$session enabled=$enabled keep=$keep discard=$discard")
+                if (setContextShift(session, enabled, keep, discard)) {
+                    result.success(null)
+                } else {
+                    result.error("invalid_session", "No session $session", null)
+                }
+            }
+
+            "setPriority" -> {
+                val session = call.argument<Int>("session") ?: 0
+                Log.i(TAG, "setPriority: session=$session ${call.argument<String>("priority")}")
+                if (applyPriority(call, session, result)) {
+                    result.success(null)
+                }
+            }
+
+            "loadLora" -> {
+                val path = call.argument<String>("path")
+                if (path.isNullOrEmpty() || !File(path).isFile) {
+                    result.error("invalid_path", "LoRA adapter not found: $path", null)
+                    return
+                }
+                Thread {
+                    val id = loadLora(path)
+                    Log.i(TAG, "loadLora: $path -> $id")
+                    Handler(Looper.getMainLooper()).post {
+                        if (id < 0) {
+                            result.error("lora_failed", "$path is not a LoRA adapter for the loaded model", null)
+                        } else {
+                            result.success(id)
+                        }
+                    }
+                }.start()
+            }
+
+            "unloadLora" -> {
+                val id = call.argument<Int>("id") ?: -1
+                // waits for requests using the adapter to stop
+                Thread {
+                    val ok = unloadLora(id)
+                    Log.i(TAG, "unloadLora: $id -> $ok")
+                    Handler(Looper.getMainLooper()).post { result.success(ok) }
+                }.start()
+            }
+
+            "setLoras" -> {
+                val session = call.argument<Int>("session") ?: 0
+                if (applyAdapters(call, session, result)) result.success(null)
+            }
+
+            "embed" -> {
+                val texts = call.argument<List<String>>("texts") ?: emptyList()
+                val pooling = EMBEDDING_POOLINGS.indexOf(call.argument<String>("pooling") ?: "model")
+                if (pooling < 0) {
+                    result.error("invalid_argument", "pooling must be one of $EMBEDDING_POOLINGS", null)
+                    return
+                }
+                val normalize = call.argument<Boolean>("normalize") ?: true
+                val batchSize = call.argument<Int>("batchSize") ?: 0
+                val maxSequences = call.argument<Int>("maxSequences") ?: 0
+                Thread {
+                    val main = Handler(Looper.getMainLooper())
+                    val dim = embeddingSize()
+                    if (dim <= 0) {
+                        main.post { result.error("not_loaded", "No model loaded", null) }
+                        return@Thread
+                    }
+                    // Native code writes every vector into one direct buffer;
+                    // it crosses to Dart as a single byte array.
+                    val bytes = texts.size * dim * 4
+                    val data = ByteArray(bytes)
+                    val stats = synchronized(embedLock) {
+                        val buffer = embedBuffer?.takeIf { it.capacity() >= bytes }
+                            ?: ByteBuffer.allocateDirect(maxOf(bytes, 4)).also { embedBuffer = it }
+                        embed(texts.toTypedArray(), pooling, normalize, batchSize, maxSequences, buffer)?.also {
+                            buffer.position(0)
+                            buffer.get(data, 0, bytes)
+                        }
+                    }
+                    if (stats == null) {
+                        main.post { result.error("embed_failed", "Embedding failed", null) }
+                        return@Thread
+                    }
+                    Log.i(TAG, "[embed] ${texts.size} texts in ${stats[3].toInt()} batches, ${"%.1f".format(stats[5])} texts/s")
+                    main.post {
+                        result.success(mapOf(
+                            "dimension" to dim,
+                            "count" to texts.size,
+                            "data" to data,
+                            "pooling" to EMBEDDING_POOLINGS.getOrElse(stats[6].toInt()) { "mean" },
+                            "tokens" to stats[1].toInt(),
+                            "truncated" to stats[2].toInt(),
+                            "batches" to stats[3].toInt(),
+                            "elapsedMs" to stats[4],
+                            "textsPerSecond" to stats[5]
+                        ))
+                    }
+                }.start()
+            }
+
+            "samplerTimings" -> {
+                val out = samplerTimings(call.argument<Int>("session") ?: 0)
+                if (out == null) {
+                    result.error("sampler_timings_failed", "Could not read sampler timings", null)
+                    return
+                }
+                val stages = SAMPLER_STAGES.mapIndexed { i, name -> name to out[1 + i] }.toMap()
+                result.success(mapOf("samples" to out[0].toLong(), "stagesUs" to stages))
+            }
+
+            "getStats" -> {
+                val stats = statsMap(call.argument<Int>("session") ?: 0)
+                if (stats == null) {
+                    result.error("stats_failed", "Could not read engine stats", null)
+                    return
+                }
+                result.success(stats)
+            }
+
+            "startTrace" -> {
+                startTrace(call.argument<Int>("maxEvents") ?: 0)
+                result.success(null)
+            }
+
+            "stopTrace" -> {
+                val path = call.argument<String>("path") ?: ""
+                // serializing a full trace takes a while
+                Thread {
+                    val ok = stopTrace(path)
+                    Handler(Looper.getMainLooper()).post { result.success(ok) }
+                }.start()
+            }
+
+            "primePrefix" -> {
+                val (roles, contents) = messageArrays(call)
+                if (roles == null || contents == null) {
+                    result.error("invalid_prefix", "messages must not be empty", null)
+                    return
+                }
+                val session = call.argument<Int>("session") ?: 0
+                val dir = call.argument<String>("cacheDir")?.let { File(it) } ?: defaultSnapshotDir
+                Thread {
+                    val cacheDir = dir?.takeIf { it.isDirectory || it.mkdirs() }?.absolutePath ?: ""
+                    val out = primePrefix(session, roles, contents, cacheDir)
+                    val status = when (out[0]) {
+                        1 -> "restored"
+                        2 -> "created"
+                        else -> "failed"
+                    }
+                    Log.i(TAG, "[primePrefix] $status tokens=${out[1]} ms=${out[2]}")
+                    Handler(Looper.getMainLooper()).post {
+                        result.success(mapOf("status" to status, "tokens" to out[1], "elapsedMs" to out[2]))
+                    }
+                }.start()
+            }
+
+            "estimateMemory" -> {
+                val path = call.argument<String>("modelPath")
+                if (path.isNullOrBlank() || !File(path).exists()) {
+                    result.error("missing_file", "Model file not found at $path", null)
+                    return
+                }
+                val nCtx = call.argument<Int>("contextLength") ?: 0
+                val nBatch = call.argument<Int>("batchSize") ?: 0
+                val nUbatch = call.argument<Int>("ubatchSize") ?: 0
+                val cacheTypeK = call.argument<String>("cacheTypeK") ?: "f16"
+                val cacheTypeV = call.argument<String>("cacheTypeV") ?: "f16"
+                val flashAttn = flashAttentionMode(call.argument<Boolean>("flashAttention"))
+                val available = availableMemoryBytes()
+                val budget = call.argument<Number>("memoryBudgetBytes")?.toLong() ?: available
+                Thread {
+                    val out = estimateMemory(path, nCtx, nBatch, nUbatch, cacheTypeK, cacheTypeV, flashAttn, budget)
+                    Handler(Looper.getMainLooper()).post {
+                        if (out == null) {
+                            result.error("invalid_file", "Not a readable GGUF file: $path", null)
+                        } else {
+                            result.success(mapOf(
+                                "weightsBytes" to out[1],
+                                "kvBytes" to out[2],
+                                "computeBytes" to out[3],
+                                "overheadBytes" to out[4],
+                                "totalBytes" to out[5],
+                                "trainContextLength" to out[6],
+                                "availableBytes" to available,
+                                "budgetBytes" to budget,
+                                "fits" to (out[7] == 1L),
+                                "plannedContextLength" to out[8],
+                                "plannedBatchSize" to out[9],
+                                "plannedUbatchSize" to out[10],
+                                "plannedTotalBytes" to out[11]
+                            ))
+                        }
                     }
                 }.start()
             }
 
+            "invalidateTuning" -> {
+                val dir = call.argument<String>("tuneDir")?.let { File(it) } ?: defaultTuneDir
+                val removed = dir?.takeIf { it.isDirectory }?.let { invalidateTuning(it.absolutePath) } ?: 0
+                Log.i(TAG, "invalidateTuning: removed $removed profile(s)")
+                result.success(removed)
+            }
+
+            "vectorIndexOpen" -> {
+                val path = call.argument<String>("path")
+                val dimension = call.argument<Int>("dimension") ?: 0
+                val quantized = call.argument<Boolean>("quantized") ?: false
+                if (path.isNullOrEmpty() || dimension <= 0) {
+                    result.error("invalid_argument", "path and a positive dimension are required", null)
+                    return
+                }
+                onVectorThread(result) { reply ->
+                    val handle = vectorIndexOpen(path, dimension, quantized)
+                    if (handle < 0) {
+                        reply.error("vector_index_failed", "Cannot open $path with dimension $dimension", null)
+                    } else {
+                        reply.success(handle)
+                    }
+                }
+            }
+
+            "vectorIndexClose" -> {
+                val handle = call.argument<Int>("handle") ?: -1
+                onVectorThread(result) { reply -> vectorIndexClose(handle); reply.success(null) }
+            }
+
+            "vectorIndexAdd" -> {
+                val handle = call.argument<Int>("handle") ?: -1
+                val ids = call.argument<LongArray>("ids")
+                val vectors = call.argument<FloatArray>("vectors")
+                if (ids == null || vectors == null) {
+                    result.error("invalid_argument", "ids and vectors are required", null)
+                    return
+                }
+                onVectorThread(result) { reply ->
+                    if (vectorIndexAdd(handle, ids, vectors)) {
+                        reply.success(null)
+                    } else {
+                        reply.error("vector_index_failed", "Add failed (bad handle or vector size)", null)
+                    }
+                }
+            }
+
+            "vectorIndexRemove" -> {
+                val handle = call.argument<Int>("handle") ?: -1
+                val ids = call.argument<LongArray>("ids") ?: LongArray(0)
+                onVectorThread(result) { reply -> reply.success(vectorIndexRemove(handle, ids)) }
+            }
+
+            "vectorIndexSearch" -> {
+                val handle = call.argument<Int>("handle") ?: -1
+                val query = call.argument<FloatArray>("query")
+                val k = call.argument<Int>("k") ?: 10
+                val threads = call.argument<Int>("threads") ?: 0
+                if (query == null || k <= 0) {
+                    result.error("invalid_argument", "query and a positive k are required", null)
+                    return
+                }
+                onVectorThread(result) { reply ->
+                    // Hits land in two primitive arrays, not one object each
+                    val ids = LongArray(k)
+                    val scores = FloatArray(k)
+                    val found = vectorIndexSearch(handle, query, threads, ids, scores)
+                    if (found < 0) {
+                        reply.error("vector_index_failed", "Search failed (bad handle or query size)", null)
+                    } else {
+                        reply.success(mapOf(
+                            "ids" to if (found == k) ids else ids.copyOf(found),
+                            "scores" to if (found == k) scores else scores.copyOf(found)
+                        ))
+                    }
+                }
+            }
+
+            "vectorIndexInfo" -> {
+                val handle = call.argument<Int>("handle") ?: -1
+                onVectorThread(result) { reply ->
+                    val info = vectorIndexInfo(handle)
+                    if (info == null) {
+                        reply.error("vector_index_failed", "No vector index $handle", null)
+                    } else {
+                        reply.success(mapOf(
+                            "size" to info[0],
+                            "slots" to info[1],
+                            "dimension" to info[2].toInt(),
+                            "quantized" to (info[3] == 1L)
+                        ))
+                    }
+                }
+            }
+
+            "vectorIndexCompact" -> {
+                val handle = call.argument<Int>("handle") ?: -1
+                onVectorThread(result) { reply -> reply.success(vectorIndexCompact(handle)) }
+            }
+
             "release" -> {
                 release()
                 result.success(null)
@@ -197,15 +676,81 @@ class MaathaiLlammaPlugin : FlutterPlugin, MethodCallHandler, EventChannel.Strea
     override fun onCancel(arguments: Any?) {
         Log.i(TAG, "EventChannel onCancel")
         eventSink = null
-        cancelGenerate()
+        cancelAllSessions()
+    }
+
+    // Splits an optional `messages` list of {role, content} maps into the
+    // parallel arrays the native side expects.
+    private fun messageArrays(call: MethodCall): Pair<Array<String>?, Array<String>?> {
+        val messages = call.argument<List<Map<String, Any?>>>("messages")
+        if (messages.isNullOrEmpty()) {
+            return Pair(null, null)
+        }
+        val roles = Array(messages.size) { i -> messages[i]["role"] as? String ?: "user" }
+        val contents = Array(messages.size) { i -> messages[i]["content"] as? String ?: "" }
+        return Pair(roles, contents)
+    }
+
+    // Sets the session's LoRA adapters from an optional `adapters` map of
+    // id -> scale. Reports the error and returns false when they are rejected.
+    private fun applyAdapters(call: MethodCall, session: Int, result: Result): Boolean {
+        val adapters = call.argument<Map<Int, Double>>("adapters") ?: return true
+        val ids = adapters.keys.toIntArray()
+        val scales = FloatArray(ids.size) { i -> adapters.getValue(ids[i]).toFloat() }
+        if (!setSessionLoras(session, ids, scales)) {
+            result.error("invalid_adapter", "Unknown LoRA adapter or session in $adapters", null)
+            return false
+        }
+        return true
+    }
+
+    // Sets the session's priority from an optional `priority` name. Reports
+    // the error and returns false when it is rejected.
+    private fun applyPriority(call: MethodCall, session: Int, result: Result): Boolean {
+        val name = call.argument<String>("priority") ?: return true
+        val level = PRIORITIES.indexOf(name)
+        if (level < 0) {
+            result.error("invalid_priority", "Unknown priority $name, expected one of $PRIORITIES", null)
+            return false
+        }
+        if (!setSessionPriority(session, level)) {
+            result.error("invalid_session", "No session $session", null)
+            return false
+        }
+        return true
     }
 
     private fun handleLoadModel(call: MethodCall, result: Result) {
         val path = call.argument<String>("modelPath")
         val nCtx = call.argument<Int>("contextLength") ?: 4096
-        val nThreads = call.argument<Int>("threads") ?: Runtime.getRuntime().availableProcessors()
+        // 0 lets the native loader pick from the core topology and its size heuristics
+        val nThreads = call.argument<Int>("threads") ?: 0
+        val nThreadsBatch = call.argument<Int>("threadsBatch") ?: 0
+        val nBatch = call.argument<Int>("batchSize") ?: 0
+        val nUbatch = call.argument<Int>("ubatchSize") ?: 0
         val nGpuLayers = call.argument<Int>("gpuLayers") ?: 0
-        Log.i(TAG, "loadModel: path=$path ctx=$nCtx threads=$nThreads gpuLayers=$nGpuLayers")
+        val preferPerformanceCores = call.argument<Boolean>("preferPerformanceCores") ?: true
+        // 0 keeps the size heuristics; otherwise n_ctx/n_batch are planned to fit
+        val memoryBudget = call.argument<Number>("memoryBudgetBytes")?.toLong() ?: 0L
+        val cacheTypeK = call.argument<String>("cacheTypeK") ?: "f16"
+        val cacheTypeV = call.argument<String>("cacheTypeV") ?: "f16"
+        val flashAttn = flashAttentionMode(call.argument<Boolean>("flashAttention"))
+        val modelByteLimit = call.argument<Number>("maxModelBytes")?.toLong()?.takeIf { it > 0 } ?: maxModelBytes
+        val draftPath = call.argument<String>("draftModelPath")
+        val nDraft = call.argument<Int>("draftMax") ?: 0
+        // 0 off, 1 reuse the cached profile (calibrating on a miss), 2 re-tune
+        val tuneMode = when {
+            call.argument<Boolean>("retune") == true -> 2
+            call.argument<Boolean>("autoTune") == true -> 1
+            else -> 0
+        }
+        val tuneDir = call.argument<String>("tuneDir")?.let { File(it) } ?: defaultTuneDir
+        val useMmap = call.argument<Boolean>("useMmap") ?: true
+        val useMlock = call.argument<Boolean>("useMlock") ?: false
+        val warmup = call.argument<Boolean>("warmup") ?: false
+        // load next to the current model and switch when ready
+        val swap = call.argument<Boolean>("swap") ?: false
+        Log.i(TAG, "loadModel: path=$path ctx=$nCtx threads=$nThreads threadsBatch=$nThreadsBatch batch=$nBatch ubatch=$nUbatch gpuLayers=$nGpuLayers performanceCores=$preferPerformanceCores budget=$memoryBudget cache=$cacheTypeK/$cacheTypeV flashAttn=$flashAttn draft=${draftPath ?: "none"} tune=$tuneMode mmap=$useMmap mlock=$useMlock warmup=$warmup swap=$swap")
         val temperature = (call.argument<Double>("temperature") ?: 0.7).toFloat()
         val topK = call.argument<Int>("topK") ?: 40
         val topP = (call.argument<Double>("topP") ?: 0.95).toFloat()
@@ -226,24 +771,38 @@ class MaathaiLlammaPlugin : FlutterPlugin, MethodCallHandler, EventChannel.Strea
             return
         }
 
+        if (cacheTypeK !in KV_CACHE_TYPES || cacheTypeV !in KV_CACHE_TYPES) {
+            result.error(
+                "invalid_argument",
+                "KV cache types must be one of $KV_CACHE_TYPES (got $cacheTypeK/$cacheTypeV)",
+                null
+            )
+            return
+        }
+
         val modelFile = File(path)
         if (!modelFile.exists()) {
             result.error("missing_file", "Model file not found at $path", null)
             return
         }
 
+        if (!draftPath.isNullOrBlank() && !File(draftPath).exists()) {
+            result.error("missing_file", "Draft model file not found at $draftPath", null)
+            return
+        }
+
         val modelSize = runCatching { modelFile.length() }.getOrDefault(-1L)
         if (modelSize <= 0) {
             result.error("invalid_file", "Unable to determine model size", null)
             return
         }
 
-        if (modelSize > maxModelBytes) {
+        if (modelSize > modelByteLimit) {
             result.error(
                 "model_too_large",
-                "Model size ${(modelSize / (1024 * 1024)).toString()} MB exceeds ${maxModelBytes / (1024 * 1024)} MB guard",
+                "Model size ${(modelSize / (1024 * 1024)).toString()} MB exceeds ${modelByteLimit / (1024 * 1024)} MB guard",
                 mapOf(
-                    "maxBytes" to maxModelBytes,
+                    "maxBytes" to modelByteLimit,
                     "actualBytes" to modelSize
                 )
             )
@@ -252,19 +811,30 @@ class MaathaiLlammaPlugin : FlutterPlugin, MethodCallHandler, EventChannel.Strea
 
         Thread {
             Log.i(TAG, "loadModel: native call begin")
-            val ok = loadModel(
-                path, nCtx, nThreads, nGpuLayers,
+            val tunePath = if (tuneMode == 0) "" else
+                tuneDir?.takeIf { it.isDirectory || it.mkdirs() }?.absolutePath ?: ""
+            val report = loadModel(
+                path, nCtx, nThreads, nThreadsBatch, nBatch, nUbatch, nGpuLayers, preferPerformanceCores, memoryBudget,
+                cacheTypeK, cacheTypeV, flashAttn,
+                draftPath ?: "", nDraft, tuneMode, tunePath,
                 temperature, topK, topP,
                 minP, typicalP, topNSigma,
                 mirostatType, mirostatTau, mirostatEta,
                 repeatPenalty, frequencyPenalty, presencePenalty,
-                repeatLastN, minKeep
+                repeatLastN, minKeep,
+                useMmap, useMlock, warmup, swap
             )
-            Log.i(TAG, "loadModel: native returned $ok")
+            val ok = report != null && report[0] != 0.0
+            val cancelled = report != null && report[1] != 0.0
+            Log.i(TAG, "loadModel: native returned $ok${if (cancelled) " (cancelled)" else ""}")
+            val settings = if (ok) activeSettingsMap()?.plus("load" to loadReportMap(report!!)) else null
             Handler(Looper.getMainLooper()).post {
                 if (ok) {
-                    Log.i(TAG, "loadModel: success")
-                    result.success(true)
+                    Log.i(TAG, "loadModel: success $settings")
+                    result.success(settings ?: true)
+                } else if (cancelled) {
+                    Log.i(TAG, "loadModel: cancelled for $path")
+                    result.error("load_cancelled", "Loading $path was cancelled", null)
                 } else {
                     Log.e(TAG, "loadModel: failed for $path")
                     result.error("load_failed", "Failed to load model at $path", null)
@@ -279,7 +849,19 @@ class MaathaiLlammaPlugin : FlutterPlugin, MethodCallHandler, EventChannel.Strea
         modelPath: String,
         contextLength: Int,
         threads: Int,
+        threadsBatch: Int,
+        batchSize: Int,
+        ubatchSize: Int,
         gpuLayers: Int,
+        preferPerformanceCores: Boolean,
+        memoryBudgetBytes: Long,
+        cacheTypeK: String,
+        cacheTypeV: String,
+        flashAttention: Int,
+        draftModelPath: String,
+        draftMax: Int,
+        tuneMode: Int,
+        tuneDir: String,
         temperature: Float,
         topK: Int,
         topP: Float,
@@ -293,13 +875,148 @@ class MaathaiLlammaPlugin : FlutterPlugin, MethodCallHandler, EventChannel.Strea
         frequencyPenalty: Float,
         presencePenalty: Float,
         repeatLastN: Int,
-        minKeep: Int
-    ): Boolean
+        minKeep: Int,
+        useMmap: Boolean,
+        useMlock: Boolean,
+        warmup: Boolean,
+        swap: Boolean
+    ): DoubleArray?
+
+    private external fun cancelLoad(): Boolean
+
+    private external fun setResidencyBudget(budgetBytes: Long)
+
+    private external fun switchModel(handle: Int): Double
 
-    private external fun generate(prompt: String, maxTokens: Int): String
+    private external fun pinModel(handle: Int, pinned: Boolean): Boolean
+
+    private external fun unloadModel(handle: Int): Boolean
+
+    private external fun residentModels(paths: Array<String?>): LongArray?
+
+    private external fun residencyStats(): LongArray?
+
+    private external fun generate(
+        session: Int,
+        prompt: String,
+        maxTokens: Int,
+        roles: Array<String>?,
+        contents: Array<String>?
+    ): String
 
     private external fun release()
 
+    private external fun invalidateTuning(tuneDir: String): Int
+
+    private external fun estimateMemory(
+        modelPath: String,
+        contextLength: Int,
+        batchSize: Int,
+        ubatchSize: Int,
+        cacheTypeK: String,
+        cacheTypeV: String,
+        flashAttention: Int,
+        memoryBudgetBytes: Long
+    ): LongArray?
+
+    private external fun activeSettings(): IntArray?
+
+    // -1 lets the native side decide, which turns flash attention on when the
+    // V cache is quantized.
+    private fun flashAttentionMode(enabled: Boolean?): Int = when (enabled) {
+        null -> -1
+        true -> 1
+        false -> 0
+    }
+
+    // What the loaded model actually runs with, after the native side
+    // resolved its heuristics, the memory plan and the tuner.
+    private fun activeSettingsMap(): Map<String, Any?>? {
+        val out = activeSettings() ?: return null
+        return mapOf(
+            "contextLength" to out[0],
+            "threads" to out[1],
+            "threadsBatch" to out[2],
+            "batchSize" to out[3],
+            "ubatchSize" to out[4],
+            "cacheTypeK" to KV_CACHE_TYPES.getOrElse(out[5]) { "f16" },
+            "cacheTypeV" to KV_CACHE_TYPES.getOrElse(out[6]) { "f16" },
+            // null: left to llama.cpp, which enables it where the backend supports it
+            "flashAttention" to when (out[7]) { 1 -> true; 0 -> false; else -> null },
+            "speculative" to (out[8] == 1),
+            "draftMax" to out[9]
+        )
+    }
+
+    // Layout documented at the bridge's loadModel().
+    private fun loadReportMap(out: DoubleArray): Map<String, Any> = mapOf(
+        "fileBytes" to out[2].toLong(),
+        "useMmap" to (out[3] != 0.0),
+        "useMlock" to (out[4] != 0.0),
+        "weightsMs" to out[5],
+        "prefaultMs" to out[6],
+        "warmupMs" to out[7],
+        "totalMs" to out[8],
+        "swapped" to (out[9] != 0.0),
+        "residentHandle" to out[10].toInt().takeIf { it >= 0 },
+        "cacheHit" to (out[11] != 0.0)
+    )
+
+    private fun phaseMap(out: DoubleArray, at: Int): Map<String, Any> = mapOf(
+        "count" to out[at].toLong(),
+        "totalUs" to out[at + 1],
+        "meanUs" to out[at + 2],
+        "p50Us" to out[at + 3],
+        "p95Us" to out[at + 4],
+        "maxUs" to out[at + 5]
+    )
+
+    private fun phasesMap(out: DoubleArray, offset: Int): Map<String, Any> =
+        METRIC_PHASES.mapIndexed { i, name -> name to phaseMap(out, offset + i * PHASE_FIELDS) }.toMap()
+
+    // Layout documented at the bridge's getStats().
+    private fun statsMap(session: Int): Map<String, Any?>? {
+        val out = getStats(session) ?: return null
+        return mapOf(
+            "requests" to out[0].toLong(),
+            "threads" to out[1].toInt(),
+            "threadsBatch" to out[2].toInt(),
+            "batchSize" to out[3].toInt(),
+            "ubatchSize" to out[4].toInt(),
+            "kvUsed" to out[5].toInt(),
+            "kvSession" to out[6].toInt(),
+            "kvSize" to out[7].toInt(),
+            "activeSessions" to out[8].toInt(),
+            "llama" to mapOf(
+                "loadMs" to out[9],
+                "promptMs" to out[10],
+                "evalMs" to out[11],
+                "promptTokens" to out[12].toInt(),
+                "evalTokens" to out[13].toInt()
+            ),
+            "last" to mapOf(
+                "promptTokens" to out[14].toInt(),
+                "cachedTokens" to out[15].toInt(),
+                "generatedTokens" to out[16].toInt(),
+                "totalMs" to out[17],
+                "cancelled" to (out[18] != 0.0),
+                "cancelMs" to out[19],
+                "phases" to phasesMap(out, STATS_HEADER)
+            ),
+            "abortedDecodes" to out[20].toLong(),
+            "total" to phasesMap(out, STATS_HEADER + METRIC_PHASES.size * PHASE_FIELDS),
+            "cancel" to phaseMap(out, STATS_HEADER + 2 * METRIC_PHASES.size * PHASE_FIELDS)
+        )
+    }
+
+    // Memory the system could hand out before it starts killing processes.
+    private fun availableMemoryBytes(): Long {
+        val manager = appContext?.getSystemService(Context.ACTIVITY_SERVICE) as? ActivityManager ?: return 0L
+        val info = ActivityManager.MemoryInfo()
+        manager.getMemoryInfo(info)
+        return (info.availMem - info.threshold).coerceAtLeast(0L)
+    }
+
     private external fun updateSampler(
         temperature: Float,
         topK: Int,
@@ -317,31 +1034,172 @@ class MaathaiLlammaPlugin : FlutterPlugin, MethodCallHandler, EventChannel.Strea
         minKeep: Int
     ): Boolean
 
-    private external fun startGenerate(prompt: String, maxTokens: Int): Boolean
+    private external fun startGenerate(
+        session: Int,
+        prompt: String,
+        maxTokens: Int,
+        roles: Array<String>?,
+        contents: Array<String>?,
+        logprobs: Boolean
+    ): Boolean
+
+    private external fun waitForTokenFrame(session: Int, frame: ByteBuffer, timeoutMs: Int, maxCount: Int): Int
+
+    private external fun cancelGenerate(session: Int)
+
+    private external fun cancelAllSessions()
+
+    private external fun openSession(): Int
+
+    private external fun closeSession(session: Int)
+
+    private external fun setConversationMode(enabled: Boolean)
+
+    private external fun resetConversation(session: Int)
+
+    private external fun setAdaptiveThreads(enabled: Boolean)
+
+    private external fun setContextShift(session: Int, enabled: Boolean, keepTokens: Int, discardTokens: Int): Boolean
+
+    private external fun setSessionPriority(session: Int, priority: Int): Boolean
+
+    private external fun loadLora(path: String): Int
+
+    private external fun unloadLora(id: Int): Boolean
+
+    private external fun setSessionLoras(session: Int, ids: IntArray, scales: FloatArray): Boolean
+
+    private external fun samplerTimings(session: Int): DoubleArray?
+
+    private external fun getStats(session: Int): DoubleArray?
 
-    private external fun nextTokenPiece(): String?
+    private external fun startTrace(maxEvents: Int)
 
-    private external fun cancelGenerate()
+    private external fun stopTrace(path: String): Boolean
 
-    private external fun isStreamActive(): Boolean
+    private external fun embeddingSize(): Int
 
-    private fun cancelGenerateThreadIfAny() {
-        val t = streamingThread
+    // Wraps `result` so calls made on a worker thread are posted back to the
+    // main thread.
+    private fun posting(result: Result): Result {
+        val main = Handler(Looper.getMainLooper())
+        return object : Result {
+            override fun success(value: Any?) { main.post { result.success(value) } }
+            override fun error(code: String, message: String?, details: Any?) {
+                main.post { result.error(code, message, details) }
+            }
+            override fun notImplemented() { main.post { result.notImplemented() } }
+        }
+    }
+
+    // Runs `block` on the vector thread; `result` calls made inside it are
+    // posted back to the main thread.
+    private fun onVectorThread(result: Result, block: (Result) -> Unit) {
+        val reply = posting(result)
+        vectorExecutor.execute { block(reply) }
+    }
+
+    // Runs `block` on a new thread: residency calls wait for a load in
+    // flight, which can take seconds.
+    private fun onModelThread(result: Result, block: (Result) -> Unit) {
+        val reply = posting(result)
+        Thread { block(reply) }.start()
+    }
+
+    private external fun vectorIndexOpen(path: String, dimension: Int, quantized: Boolean): Int
+
+    private external fun vectorIndexClose(handle: Int)
+
+    private external fun vectorIndexAdd(handle: Int, ids: LongArray, vectors: FloatArray): Boolean
+
+    private external fun vectorIndexRemove(handle: Int, ids: LongArray): Int
+
+    private external fun vectorIndexSearch(
+        handle: Int,
+        query: FloatArray,
+        threads: Int,
+        outIds: LongArray,
+        outScores: FloatArray
+    ): Int
+
+    private external fun vectorIndexInfo(handle: Int): LongArray?
+
+    private external fun vectorIndexCompact(handle: Int): Boolean
+
+    private external fun embed(
+        texts: Array<String>,
+        pooling: Int,
+        normalize: Boolean,
+        batchSize: Int,
+        maxSequences: Int,
+        out: ByteBuffer
+    ): DoubleArray?
+
+    private external fun primePrefix(
+        session: Int,
+        roles: Array<String>,
+        contents: Array<String>,
+        cacheDir: String
+    ): IntArray
+
+    // Called from native after each prefill chunk, on the scheduler thread.
+    @Suppress("unused")
+    private fun onNativePrefillProgress(session: Int, done: Int, total: Int) {
+        val sink = eventSink ?: return
+        Handler(Looper.getMainLooper()).post {
+            sink.success(mapOf("type" to "prefill", "session" to session, "done" to done, "total" to total))
+        }
+    }
+
+    // Called from native on the scheduler thread whenever the thread governor
+    // changes the thread counts; tempC < 0 means no thermal reading.
+    @Suppress("unused")
+    private fun onNativeThreads(threads: Int, threadsBatch: Int, fromThreads: Int, reason: Int, tokS: Double, tempC: Double) {
+        val sink = eventSink ?: return
+        val event = mapOf(
+            "type" to "threads",
+            "threads" to threads,
+            "threadsBatch" to threadsBatch,
+            "fromThreads" to fromThreads,
+            "reason" to GOVERNOR_REASONS.getOrElse(reason) { "probe" },
+            "tokS" to tokS,
+            "tempC" to if (tempC < 0) null else tempC
+        )
+        Handler(Looper.getMainLooper()).post { sink.success(event) }
+    }
+
+    // Called from native on the loading thread, about once per percent of
+    // each stage (see LOAD_STAGES): bytes for weights and prefault, steps for warmup.
+    @Suppress("unused")
+    private fun onNativeLoadProgress(stage: Int, done: Long, total: Long) {
+        val sink = eventSink ?: return
+        val name = LOAD_STAGES.getOrElse(stage) { "weights" }
+        Handler(Looper.getMainLooper()).post {
+            sink.success(mapOf("type" to "load", "stage" to name, "done" to done, "total" to total))
+        }
+    }
+
+    // Waits for the session's worker to drain its stream. Blocks until it
+    // does, so never on the main thread while a stream may still run.
+    private fun joinStreamingThread(session: Int) {
+        val t = streamingThreads.remove(session)
         if (t != null && t.isAlive) {
             try {
-                Log.d(TAG, "Joining streaming thread")
-                t.join(250)
+                Log.d(TAG, "Joining streaming thread for session $session")
+                t.join()
             } catch (_: InterruptedException) {
             }
         }
-        streamingThread = null
+    }
+
+    // Native side only: the worker sees its stream end and exits on its own.
+    // It stays in streamingThreads, so the next stream on the session waits
+    // for it off the main thread and never shares the session's ring with it.
+    private fun cancelSession(session: Int) {
+        cancelGenerate(session)
     }
 
     private fun cancelAll() {
-        try {
-            cancelGenerate()
-        } finally {
-            cancelGenerateThreadIfAny()
-        }
+        cancelAllSessions()
     }
 }
@@ -99,9 +99,27 @@ class _ChatScreenState extends State<ChatScreen> {
       if (!controller.modelLoaded) {
         throw Exception('Model not loaded');
       }
+      // Send the whole transcript so native can reuse the cached prefix
+      final history = _messages
+          .where((m) => m.error == null)
+          .map((m) => {'role': m.role.toLowerCase(), 'content': m.content})
+          .toList();
       // Stream tokens
       String buffer = '';
-      await for (final chunk in controller.generateStream(message, maxTokens: 512)) {
+      final stream = controller.generateStream(
+        message,
+        maxTokens: 512,
+        history: history,
+        onPrefillProgress: (done, total) {
+          if (!mounted || total <= 0) return;
+          setState(() {
+            _status = done < total
+                ? 'Reading prompt… ${(done * 100 / total).round()}%'
+                : 'Generating response...';
+          });
+        },
+      );
+      await for (final chunk in stream) {
         String incoming = chunk;
         if (_captureThinking) {
           // capture <think> ... </think> and do not show in chat when enabled
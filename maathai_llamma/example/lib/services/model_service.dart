@@ -1,5 +1,6 @@
 import 'dart:io';
 import 'package:file_picker/file_picker.dart';
+import 'package:maathai_llamma/maathai_llamma.dart';
 import 'package:path/path.dart' as path;
 import 'package:path_provider/path_provider.dart';
 import '../utils/logger.dart';
@@ -33,7 +34,8 @@ class ModelInfo {
 }
 
 class ModelService {
-  static const int maxModelSizeBytes = 1024 * 1024 * 1024; // 1 GB limit
+  // Smallest context the app is still usable with.
+  static const int minContextLength = 512;
   
   Future<Directory> get _modelsDirectory async {
     final appDir = await getApplicationSupportDirectory();
@@ -101,10 +103,18 @@ class ModelService {
       }
 
       final fileSize = await sourceFile.length();
-      if (fileSize > maxModelSizeBytes) {
+      // Weights, KV cache and compute buffers against the memory available
+      // right now, read from the GGUF header before copying gigabytes.
+      final memory = await MaathaiLlamma().estimateMemory(
+        modelPath: sourcePath,
+        contextLength: minContextLength,
+      );
+      if (memory['fits'] == false) {
+        final needed = (memory['plannedTotalBytes'] as int? ?? 0) / (1024 * 1024);
+        final budget = (memory['budgetBytes'] as int? ?? 0) / (1024 * 1024);
         throw Exception(
-          'Model size (${(fileSize / (1024 * 1024)).toStringAsFixed(1)} MB) '
-          'exceeds maximum allowed size (${(maxModelSizeBytes / (1024 * 1024)).toStringAsFixed(1)} MB)',
+          'Model needs about ${needed.toStringAsFixed(0)} MB with a $minContextLength-token context, '
+          'but only ${budget.toStringAsFixed(0)} MB are available',
         );
       }
 
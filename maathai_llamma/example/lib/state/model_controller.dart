@@ -12,6 +12,11 @@ class ModelController extends ChangeNotifier {
   int _contextLength = 4096;
   int _threads = 0;
   int _gpuLayers = 0;
+  // Device memory the models may share, measured on the first load. Keeping
+  // it fixed keeps the load settings, and so the residency key, stable.
+  int? _memoryBudget;
+  // Resident handles by model path, for switching back without a reload.
+  final Map<String, int> _residentHandles = {};
   // UI / thinking settings
   bool _showThinkingIndicator = true;
   bool _captureThinking = true;
@@ -83,14 +88,36 @@ class ModelController extends ChangeNotifier {
       await initializeBackend();
       if (!_backendReady) return false;
     }
+    final sameSettings = (contextLength == null || contextLength == _contextLength) &&
+        (threads == null || threads == _threads) &&
+        (gpuLayers == null || gpuLayers == _gpuLayers);
     _contextLength = contextLength ?? _contextLength;
     _threads = threads ?? _threads;
     _gpuLayers = gpuLayers ?? _gpuLayers;
 
+    final handle = _residentHandles[model.path];
+    if (handle != null && sameSettings && await _switchTo(model, handle)) {
+      return true;
+    }
+
     try {
+      // Let the loader shrink the context to what this device can hold
+      // instead of being OOM-killed after a "successful" load, and keep the
+      // previous models resident alongside it within the same memory.
+      if (_memoryBudget == null) {
+        final memory = await _client.estimateMemory(modelPath: model.path, contextLength: _contextLength);
+        final budget = memory['budgetBytes'] as int?;
+        if (budget != null && budget > 0) {
+          _memoryBudget = budget;
+          await _client.setResidencyBudget(budget);
+        }
+      }
+      final budget = _memoryBudget;
       final ok = await _client.loadModel(
         modelPath: model.path,
         contextLength: _contextLength,
+        // half the budget each leaves room to switch between two models
+        memoryBudgetBytes: budget != null ? budget ~/ 2 : null,
         threads: _threads,
         gpuLayers: _gpuLayers,
         temperature: temperature,
@@ -110,6 +137,13 @@ class ModelController extends ChangeNotifier {
       );
       _modelLoaded = ok;
       _activeModel = ok ? model : null;
+      if (ok) {
+        // chat re-sends the transcript each turn; let native reuse the KV cache
+        await _client.setConversationMode(true);
+        final load = (await _client.activeSettings())['load'];
+        final resident = load is Map ? load['residentHandle'] as int? : null;
+        if (resident != null) _residentHandles[model.path] = resident;
+      }
       Logger.info('Model load result', data: {
         'ok': ok,
         'path': model.path,
@@ -128,6 +162,39 @@ class ModelController extends ChangeNotifier {
     }
   }
 
+  // Switches to a model that is still resident. False when it was evicted
+  // meanwhile; the caller then loads it again.
+  Future<bool> _switchTo(ModelInfo model, int handle) async {
+    try {
+      final settings = await _client.switchModel(handle);
+      await _client.updateSampler(
+        temperature: temperature,
+        topK: topK,
+        topP: topP,
+        minP: minP,
+        typicalP: typicalP,
+        topNSigma: topNSigma,
+        mirostatType: mirostatType,
+        mirostatTau: mirostatTau,
+        mirostatEta: mirostatEta,
+        repeatPenalty: repeatPenalty,
+        frequencyPenalty: frequencyPenalty,
+        presencePenalty: presencePenalty,
+        repeatLastN: repeatLastN,
+        minKeep: minKeep,
+      );
+      _modelLoaded = true;
+      _activeModel = model;
+      Logger.info('Switched to resident model', data: {'path': model.path, 'ms': settings['switchMs']});
+      notifyListeners();
+      return true;
+    } catch (e) {
+      _residentHandles.remove(model.path);
+      Logger.info('Model no longer resident, reloading', data: {'path': model.path});
+      return false;
+    }
+  }
+
   Future<String> generate(String prompt, {int maxTokens = 512}) async {
     try {
       Logger.info('Generate request', data: {
@@ -144,14 +211,27 @@ class ModelController extends ChangeNotifier {
     }
   }
 
-  Stream<String> generateStream(String prompt, {int maxTokens = 512}) {
+  Stream<String> generateStream(
+    String prompt, {
+    int maxTokens = 512,
+    List<Map<String, String>>? history,
+    void Function(int done, int total)? onPrefillProgress,
+  }) {
     Logger.info('GenerateStream request', data: {
       'prompt': prompt,
       'maxTokens': maxTokens,
+      'historyMessages': history?.length ?? 0,
       'model': _activeModel?.name,
     });
     int emitted = 0;
-    return _client.generateStream(prompt: prompt, maxTokens: maxTokens).map((chunk) {
+    return _client
+        .generateStream(
+          prompt: prompt,
+          maxTokens: maxTokens,
+          messages: history,
+          onPrefillProgress: onPrefillProgress,
+        )
+        .map((chunk) {
       emitted += 1;
       if (emitted % 8 == 0) {
         Logger.info('GenerateStream progress', data: {'tokens': emitted});
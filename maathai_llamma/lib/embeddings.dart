@@ -0,0 +1,88 @@
+import 'dart:typed_data';
+
+/// Vectors produced by one `embed` call, one row per input text.
+///
+/// All rows live in a single [Float32List] of `count * dimension` floats, as
+/// the native side wrote them; [operator []] returns views, not copies.
+class Embeddings {
+  Embeddings({
+    required this.dimension,
+    required this.vectors,
+    required this.pooling,
+    this.tokens = 0,
+    this.truncated = 0,
+    this.batches = 0,
+    this.elapsedMs = 0,
+    this.textsPerSecond = 0,
+  });
+
+  /// Width of each vector.
+  final int dimension;
+
+  /// Row-major, `length * dimension` floats.
+  final Float32List vectors;
+
+  /// Pooling actually used (`mean`, `cls` or `last`).
+  final String pooling;
+
+  /// Tokens decoded over all texts.
+  final int tokens;
+
+  /// Texts cut to the batch size before embedding.
+  final int truncated;
+
+  /// Native decode calls the texts were packed into.
+  final int batches;
+
+  final double elapsedMs;
+  final double textsPerSecond;
+
+  int get length => dimension == 0 ? 0 : vectors.length ~/ dimension;
+
+  Float32List operator [](int index) {
+    RangeError.checkValidIndex(index, this, 'index', length);
+    return Float32List.sublistView(vectors, index * dimension, (index + 1) * dimension);
+  }
+
+  /// Dot product of two rows; the cosine similarity when the vectors were
+  /// normalized.
+  double dot(int a, int b) {
+    final x = this[a];
+    final y = this[b];
+    var sum = 0.0;
+    for (var i = 0; i < dimension; i++) {
+      sum += x[i] * y[i];
+    }
+    return sum;
+  }
+
+  /// Decodes the platform reply: `data` holds the little-endian floats.
+  factory Embeddings.fromMap(Map<Object?, Object?> map) {
+    final dimension = map['dimension'] as int;
+    final count = map['count'] as int;
+    final bytes = map['data'] as Uint8List;
+    if (bytes.length < count * dimension * 4) {
+      throw const FormatException('truncated embeddings');
+    }
+    final Float32List vectors;
+    if (bytes.offsetInBytes % 4 == 0 && Endian.host == Endian.little) {
+      vectors = bytes.buffer.asFloat32List(bytes.offsetInBytes, count * dimension);
+    } else {
+      final data = ByteData.sublistView(bytes);
+      vectors = Float32List(count * dimension);
+      for (var i = 0; i < vectors.length; i++) {
+        vectors[i] = data.getFloat32(i * 4, Endian.little);
+      }
+    }
+    return Embeddings(
+      dimension: dimension,
+      vectors: vectors,
+      pooling: map['pooling'] as String? ?? 'mean',
+      tokens: map['tokens'] as int? ?? 0,
+      truncated: map['truncated'] as int? ?? 0,
+      batches: map['batches'] as int? ?? 0,
+      elapsedMs: (map['elapsedMs'] as num?)?.toDouble() ?? 0,
+      textsPerSecond: (map['textsPerSecond'] as num?)?.toDouble() ?? 0,
+    );
+  }
+}
@@ -0,0 +1,303 @@
+/// Time spent in one request phase. Durations are in microseconds;
+/// percentiles are accurate to within about 12%.
+class PhaseStats {
+  const PhaseStats({
+    this.count = 0,
+    this.totalUs = 0,
+    this.meanUs = 0,
+    this.p50Us = 0,
+    this.p95Us = 0,
+    this.maxUs = 0,
+  });
+
+  /// Samples: one per request for `queue`, `template` and `tokenize`, one per
+  /// prompt chunk for `prefill`, one per token or decode step otherwise.
+  final int count;
+  final double totalUs;
+  final double meanUs;
+  final double p50Us;
+  final double p95Us;
+  final double maxUs;
+
+  factory PhaseStats.fromMap(Map<Object?, Object?>? map) {
+    if (map == null) return const PhaseStats();
+    double value(String key) => ((map[key] as num?) ?? 0).toDouble();
+    return PhaseStats(
+      count: ((map['count'] as num?) ?? 0).toInt(),
+      totalUs: value('totalUs'),
+      meanUs: value('meanUs'),
+      p50Us: value('p50Us'),
+      p95Us: value('p95Us'),
+      maxUs: value('maxUs'),
+    );
+  }
+}
+
+Map<String, PhaseStats> _phases(Object? map) {
+  final source = map is Map ? map : const {};
+  return {
+    for (final name in EngineStats.phaseNames) name: PhaseStats.fromMap(source[name] as Map<Object?, Object?>?),
+  };
+}
+
+/// One finished request.
+class RequestStats {
+  const RequestStats({
+    this.promptTokens = 0,
+    this.cachedTokens = 0,
+    this.generatedTokens = 0,
+    this.totalMs = 0,
+    this.cancelled = false,
+    this.cancelMs = 0,
+    this.phases = const {},
+  });
+
+  final int promptTokens;
+
+  /// Prompt tokens that were not decoded again (reused KV cache).
+  final int cachedTokens;
+  final int generatedTokens;
+
+  /// Submitted to finished, on the native side.
+  final double totalMs;
+
+  /// Ended by a cancel, and how long after `cancel()` the session was idle.
+  final bool cancelled;
+  final double cancelMs;
+
+  /// Keyed by [EngineStats.phaseNames].
+  final Map<String, PhaseStats> phases;
+
+  factory RequestStats.fromMap(Map<Object?, Object?>? map) {
+    if (map == null) return const RequestStats();
+    return RequestStats(
+      promptTokens: (map['promptTokens'] as int?) ?? 0,
+      cachedTokens: (map['cachedTokens'] as int?) ?? 0,
+      generatedTokens: (map['generatedTokens'] as int?) ?? 0,
+      totalMs: ((map['totalMs'] as num?) ?? 0).toDouble(),
+      cancelled: (map['cancelled'] as bool?) ?? false,
+      cancelMs: ((map['cancelMs'] as num?) ?? 0).toDouble(),
+      phases: _phases(map['phases']),
+    );
+  }
+}
+
+/// Where generation time goes, as returned by `getStats()` and delivered
+/// by `statsEvents` at the end of every request.
+class EngineStats {
+  const EngineStats({
+    this.session = 0,
+    this.requests = 0,
+    this.threads = 0,
+    this.threadsBatch = 0,
+    this.batchSize = 0,
+    this.ubatchSize = 0,
+    this.kvUsed = 0,
+    this.kvSession = 0,
+    this.kvSize = 0,
+    this.activeSessions = 0,
+    this.llama = const {},
+    this.last = const RequestStats(),
+    this.total = const {},
+    this.cancel = const PhaseStats(),
+    this.abortedDecodes = 0,
+    this.flush,
+  });
+
+  /// Request phases in the order a request passes through them. `queue` is
+  /// the wait for the scheduler, `handoff` the time from a token being
+  /// produced to the platform thread draining it.
+  static const List<String> phaseNames = [
+    'queue',
+    'template',
+    'tokenize',
+    'prefill',
+    'decode',
+    'sample',
+    'detokenize',
+    'handoff',
+  ];
+
+  final int session;
+
+  /// Requests finished on any session since the model was loaded.
+  final int requests;
+  final int threads;
+  final int threadsBatch;
+  final int batchSize;
+  final int ubatchSize;
+
+  /// KV cache cells held by all sessions, by [session], and available.
+  final int kvUsed;
+  final int kvSession;
+  final int kvSize;
+  final int activeSessions;
+
+  /// llama.cpp's own counters: `loadMs`, `promptMs`, `evalMs`,
+  /// `promptTokens`, `evalTokens`.
+  final Map<String, Object?> llama;
+
+  /// The most recent finished request on [session].
+  final RequestStats last;
+
+  /// Every request on every session since the model was loaded.
+  final Map<String, PhaseStats> total;
+
+  /// Cancel to idle, over every cancelled request: one sample each.
+  final PhaseStats cancel;
+
+  /// Batches stopped mid-decode for a cancel or a higher-priority request.
+  final int abortedDecodes;
+
+  /// Stream events only: `frames` delivered and the Android main-thread
+  /// delay before each (`meanUs`, `maxUs`).
+  final Map<String, Object?>? flush;
+
+  factory EngineStats.fromMap(Map<Object?, Object?> map) {
+    final llama = map['llama'];
+    final flush = map['flush'];
+    return EngineStats(
+      session: (map['session'] as int?) ?? 0,
+      requests: ((map['requests'] as num?) ?? 0).toInt(),
+      threads: (map['threads'] as int?) ?? 0,
+      threadsBatch: (map['threadsBatch'] as int?) ?? 0,
+      batchSize: (map['batchSize'] as int?) ?? 0,
+      ubatchSize: (map['ubatchSize'] as int?) ?? 0,
+      kvUsed: (map['kvUsed'] as int?) ?? 0,
+      kvSession: (map['kvSession'] as int?) ?? 0,
+      kvSize: (map['kvSize'] as int?) ?? 0,
+      activeSessions: (map['activeSessions'] as int?) ?? 0,
+      llama: llama is Map ? Map<String, Object?>.from(llama) : const {},
+      last: RequestStats.fromMap(map['last'] as Map<Object?, Object?>?),
+      total: _phases(map['total']),
+      cancel: PhaseStats.fromMap(map['cancel'] as Map<Object?, Object?>?),
+      abortedDecodes: ((map['abortedDecodes'] as num?) ?? 0).toInt(),
+      flush: flush is Map ? Map<String, Object?>.from(flush) : null,
+    );
+  }
+}
+
+/// A change the thread governor made, pushed by `threadEvents` while
+/// `setAdaptiveThreads(true)` is on.
+class ThreadChange {
+  const ThreadChange({
+    this.threads = 0,
+    this.threadsBatch = 0,
+    this.fromThreads = 0,
+    this.reason = 'probe',
+    this.tokS = 0,
+    this.tempC,
+  });
+
+  /// Decode and prefill threads from now on, and the decode count before.
+  final int threads;
+  final int threadsBatch;
+  final int fromThreads;
+
+  /// `probe` (trying a neighbouring count), `revert` (the probe was not
+  /// faster), `thermal` (the SoC is hot) or `slowdown` (the current count
+  /// got slower on its own, as when throttled).
+  final String reason;
+
+  /// Decode throughput of the window that led to the change.
+  final double tokS;
+
+  /// Hottest CPU thermal zone in °C; null when none can be read.
+  final double? tempC;
+
+  factory ThreadChange.fromMap(Map<Object?, Object?> map) => ThreadChange(
+        threads: (map['threads'] as int?) ?? 0,
+        threadsBatch: (map['threadsBatch'] as int?) ?? 0,
+        fromThreads: (map['fromThreads'] as int?) ?? 0,
+        reason: (map['reason'] as String?) ?? 'probe',
+        tokS: ((map['tokS'] as num?) ?? 0).toDouble(),
+        tempC: (map['tempC'] as num?)?.toDouble(),
+      );
+}
+
+/// A model kept loaded under a residency budget (see `setResidencyBudget`).
+class ResidentModel {
+  const ResidentModel({
+    this.handle = -1,
+    this.path = '',
+    this.weightsBytes = 0,
+    this.contextBytes = 0,
+    this.hasContext = true,
+    this.pinned = false,
+  });
+
+  /// What `switchModel`, `pinModel` and `unloadModel` take.
+  final int handle;
+  final String path;
+
+  /// Estimated bytes held until the model is evicted.
+  final int weightsBytes;
+
+  /// Estimated KV cache and compute buffers; freed on their own before any
+  /// model is evicted, and rebuilt on the next switch.
+  final int contextBytes;
+  final bool hasContext;
+
+  /// Never freed to make room.
+  final bool pinned;
+
+  factory ResidentModel.fromMap(Map<Object?, Object?> map) => ResidentModel(
+        handle: (map['handle'] as int?) ?? -1,
+        path: (map['path'] as String?) ?? '',
+        weightsBytes: (map['weightsBytes'] as int?) ?? 0,
+        contextBytes: (map['contextBytes'] as int?) ?? 0,
+        hasContext: (map['hasContext'] as bool?) ?? true,
+        pinned: (map['pinned'] as bool?) ?? false,
+      );
+}
+
+/// Counters of the residency policy since the plugin was loaded.
+class ResidencyStats {
+  const ResidencyStats({
+    this.budgetBytes = 0,
+    this.residentBytes = 0,
+    this.models = 0,
+    this.contexts = 0,
+    this.hits = 0,
+    this.misses = 0,
+    this.contextFrees = 0,
+    this.contextRestores = 0,
+    this.evictions = 0,
+    this.currentHandle,
+  });
+
+  /// 0 when residency is off.
+  final int budgetBytes;
+  final int residentBytes;
+  final int models;
+
+  /// Models whose context is live.
+  final int contexts;
+
+  /// `loadModel` calls that found the model resident, and those that read
+  /// the file.
+  final int hits;
+  final int misses;
+  final int contextFrees;
+  final int contextRestores;
+
+  /// Models freed to make room, not counting `unloadModel`.
+  final int evictions;
+  final int? currentHandle;
+
+  factory ResidencyStats.fromMap(Map<Object?, Object?> map) {
+    int value(String key) => ((map[key] as num?) ?? 0).toInt();
+    return ResidencyStats(
+      budgetBytes: value('budgetBytes'),
+      residentBytes: value('residentBytes'),
+      models: value('models'),
+      contexts: value('contexts'),
+      hits: value('hits'),
+      misses: value('misses'),
+      contextFrees: value('contextFrees'),
+      contextRestores: value('contextRestores'),
+      evictions: value('evictions'),
+      currentHandle: map['currentHandle'] as int?,
+    );
+  }
+}
@@ -1,5 +1,14 @@
 
+import 'embeddings.dart';
+import 'engine_stats.dart';
 import 'maathai_llamma_platform_interface.dart';
+import 'token_frame.dart';
+import 'vector_index.dart';
+
+export 'embeddings.dart';
+export 'engine_stats.dart';
+export 'token_frame.dart';
+export 'vector_index.dart';
 
 class MaathaiLlamma {
   Future<bool> initialize() => MaathaiLlammaPlatform.instance.initialize();
@@ -10,9 +19,19 @@ class MaathaiLlamma {
     int threads = 0,
     int? threadsBatch,
     int? batchSize,
+    int? ubatchSize,
     int gpuLayers = 0,
+    String? draftModelPath,
+    int? draftMax,
+    bool autoTune = false,
+    bool retune = false,
+    String? tuneDir,
     bool preferPerformanceCores = true,
     int? maxModelBytes,
+    int? memoryBudgetBytes,
+    String cacheTypeK = 'f16',
+    String cacheTypeV = 'f16',
+    bool? flashAttention,
     double temperature = 0.7,
     int topK = 40,
     double topP = 0.95,
@@ -27,6 +46,11 @@ class MaathaiLlamma {
     double? presencePenalty,
     int? repeatLastN,
     int? minKeep,
+    bool useMmap = true,
+    bool useMlock = false,
+    bool warmup = false,
+    bool swap = false,
+    void Function(String stage, int done, int total)? onProgress,
   }) {
     return MaathaiLlammaPlatform.instance.loadModel(
       modelPath: modelPath,
@@ -34,9 +58,19 @@ class MaathaiLlamma {
       threads: threads,
       threadsBatch: threadsBatch,
       batchSize: batchSize,
+      ubatchSize: ubatchSize,
       gpuLayers: gpuLayers,
+      draftModelPath: draftModelPath,
+      draftMax: draftMax,
+      autoTune: autoTune,
+      retune: retune,
+      tuneDir: tuneDir,
       preferPerformanceCores: preferPerformanceCores,
       maxModelBytes: maxModelBytes,
+      memoryBudgetBytes: memoryBudgetBytes,
+      cacheTypeK: cacheTypeK,
+      cacheTypeV: cacheTypeV,
+      flashAttention: flashAttention,
       temperature: temperature,
       topK: topK,
       topP: topP,
@@ -51,18 +85,53 @@ class MaathaiLlamma {
       presencePenalty: presencePenalty,
       repeatLastN: repeatLastN,
       minKeep: minKeep,
+      useMmap: useMmap,
+      useMlock: useMlock,
+      warmup: warmup,
+      swap: swap,
+      onProgress: onProgress,
     );
   }
 
+  Future<bool> cancelLoad() => MaathaiLlammaPlatform.instance.cancelLoad();
+
+  /// Keeps several models loaded within [budgetBytes]; see
+  /// [MaathaiLlammaPlatform.setResidencyBudget].
+  Future<void> setResidencyBudget(int budgetBytes) =>
+      MaathaiLlammaPlatform.instance.setResidencyBudget(budgetBytes);
+
+  Future<Map<String, Object?>> switchModel(int handle) => MaathaiLlammaPlatform.instance.switchModel(handle);
+
+  Future<bool> pinModel(int handle, {bool pinned = true}) =>
+      MaathaiLlammaPlatform.instance.pinModel(handle, pinned: pinned);
+
+  Future<bool> unloadModel(int handle) => MaathaiLlammaPlatform.instance.unloadModel(handle);
+
+  Future<List<ResidentModel>> residentModels() => MaathaiLlammaPlatform.instance.residentModels();
+
+  Future<ResidencyStats> residencyStats() => MaathaiLlammaPlatform.instance.residencyStats();
+
+  Future<int> openSession() => MaathaiLlammaPlatform.instance.openSession();
+
+  Future<void> closeSession(int session) => MaathaiLlammaPlatform.instance.closeSession(session);
+
   Future<String> generate({
     required String prompt,
     int maxTokens = 512,
     String? cancelToken,
+    List<Map<String, String>>? messages,
+    int session = 0,
+    Map<int, double>? adapters,
+    String? priority,
   }) {
     return MaathaiLlammaPlatform.instance.generate(
       prompt: prompt,
       maxTokens: maxTokens,
       cancelToken: cancelToken,
+      messages: messages,
+      session: session,
+      adapters: adapters,
+      priority: priority,
     );
   }
 
@@ -70,11 +139,25 @@ class MaathaiLlamma {
     required String prompt,
     int maxTokens = 512,
     String? cancelToken,
+    List<Map<String, String>>? messages,
+    void Function(int done, int total)? onPrefillProgress,
+    bool logprobs = false,
+    void Function(TokenFrame frame)? onTokens,
+    int session = 0,
+    Map<int, double>? adapters,
+    String? priority,
   }) {
     return MaathaiLlammaPlatform.instance.generateStream(
       prompt: prompt,
       maxTokens: maxTokens,
       cancelToken: cancelToken,
+      messages: messages,
+      onPrefillProgress: onPrefillProgress,
+      logprobs: logprobs,
+      onTokens: onTokens,
+      session: session,
+      adapters: adapters,
+      priority: priority,
     );
   }
 
@@ -112,9 +195,114 @@ class MaathaiLlamma {
     );
   }
 
-  Future<void> cancel() {
-    return MaathaiLlammaPlatform.instance.cancel();
+  Future<void> cancel({int? session}) {
+    return MaathaiLlammaPlatform.instance.cancel(session: session);
+  }
+
+  Future<void> setConversationMode(bool enabled) =>
+      MaathaiLlammaPlatform.instance.setConversationMode(enabled);
+
+  Future<void> resetConversation({int session = 0}) =>
+      MaathaiLlammaPlatform.instance.resetConversation(session: session);
+
+  Future<void> setAdaptiveThreads(bool enabled) => MaathaiLlammaPlatform.instance.setAdaptiveThreads(enabled);
+
+  /// Thread count changes made by the governor, see [setAdaptiveThreads].
+  Stream<ThreadChange> get threadEvents => MaathaiLlammaPlatform.instance.threadEvents;
+
+  Future<void> setContextShift({
+    required bool enabled,
+    int? keepTokens,
+    int? discardTokens,
+    int session = 0,
+  }) {
+    return MaathaiLlammaPlatform.instance.setContextShift(
+      enabled: enabled,
+      keepTokens: keepTokens,
+      discardTokens: discardTokens,
+      session: session,
+    );
+  }
+
+  Future<void> setPriority({required String priority, int session = 0}) =>
+      MaathaiLlammaPlatform.instance.setPriority(priority: priority, session: session);
+
+  Future<int> loadLora(String path) => MaathaiLlammaPlatform.instance.loadLora(path);
+
+  Future<bool> unloadLora(int id) => MaathaiLlammaPlatform.instance.unloadLora(id);
+
+  Future<void> setLoras({required Map<int, double> adapters, int session = 0}) =>
+      MaathaiLlammaPlatform.instance.setLoras(adapters: adapters, session: session);
+
+  Future<Embeddings> embed(
+    List<String> texts, {
+    String pooling = 'model',
+    bool normalize = true,
+    int? batchSize,
+    int? maxSequences,
+  }) {
+    return MaathaiLlammaPlatform.instance.embed(
+      texts,
+      pooling: pooling,
+      normalize: normalize,
+      batchSize: batchSize,
+      maxSequences: maxSequences,
+    );
+  }
+
+  /// Opens (or creates) a native vector index at [path]; see [VectorIndex].
+  Future<VectorIndex> openVectorIndex(String path, {required int dimension, bool quantized = false}) async {
+    final handle = await MaathaiLlammaPlatform.instance
+        .openVectorIndex(path, dimension: dimension, quantized: quantized);
+    return VectorIndex(handle, dimension: dimension, quantized: quantized);
+  }
+
+  Future<Map<String, Object?>> samplerTimings({int session = 0}) =>
+      MaathaiLlammaPlatform.instance.samplerTimings(session: session);
+
+  Future<EngineStats> getStats({int session = 0}) => MaathaiLlammaPlatform.instance.getStats(session: session);
+
+  /// Stats of every request as it finishes, on any session.
+  Stream<EngineStats> get statsEvents => MaathaiLlammaPlatform.instance.statsEvents;
+
+  Future<void> startTrace({int maxEvents = 0}) => MaathaiLlammaPlatform.instance.startTrace(maxEvents: maxEvents);
+
+  Future<bool> stopTrace({String? path}) => MaathaiLlammaPlatform.instance.stopTrace(path: path);
+
+  Future<Map<String, Object?>> primePrefix({
+    required List<Map<String, String>> messages,
+    String? cacheDir,
+    int session = 0,
+  }) {
+    return MaathaiLlammaPlatform.instance.primePrefix(messages: messages, cacheDir: cacheDir, session: session);
   }
 
+  Future<Map<String, Object?>> activeSettings() => MaathaiLlammaPlatform.instance.activeSettings();
+
+  Future<Map<String, Object?>> estimateMemory({
+    required String modelPath,
+    int contextLength = 4096,
+    int? batchSize,
+    int? ubatchSize,
+    String cacheTypeK = 'f16',
+    String cacheTypeV = 'f16',
+    bool? flashAttention,
+    int? memoryBudgetBytes,
+  }) {
+    return MaathaiLlammaPlatform.instance.estimateMemory(
+      modelPath: modelPath,
+      contextLength: contextLength,
+      batchSize: batchSize,
+      ubatchSize: ubatchSize,
+      cacheTypeK: cacheTypeK,
+      cacheTypeV: cacheTypeV,
+      flashAttention: flashAttention,
+      memoryBudgetBytes: memoryBudgetBytes,
+    );
+  }
+
+  Future<int> invalidateTuning({String? tuneDir}) =>
+      MaathaiLlammaPlatform.instance.invalidateTuning(tuneDir: tuneDir);
+
   Future<void> release() => MaathaiLlammaPlatform.instance.release();
 }
@@ -2,7 +2,11 @@ import 'dart:async';
 import 'package:flutter/foundation.dart';
 import 'package:flutter/services.dart';
 
+import 'embeddings.dart';
+import 'engine_stats.dart';
 import 'maathai_llamma_platform_interface.dart';
+import 'token_frame.dart';
+import 'vector_index.dart';
 
 /// An implementation of [MaathaiLlammaPlatform] that uses method channels.
 class MethodChannelMaathaiLlamma extends MaathaiLlammaPlatform {
@@ -12,6 +16,15 @@ class MethodChannelMaathaiLlamma extends MaathaiLlammaPlatform {
   @visibleForTesting
   final eventsChannel = const EventChannel('maathai_llamma/events');
 
+  // Reported by the platform with the last successful loadModel.
+  Map<String, Object?> _activeSettings = const {};
+  // Resident handle of the current model, with a residency budget.
+  int? _currentHandle;
+
+  // One platform subscription shared by every concurrent stream; each
+  // stream picks out the events tagged with its session.
+  late final Stream<dynamic> _events = eventsChannel.receiveBroadcastStream();
+
   @override
   Future<bool> initialize() async {
     if (kDebugMode) {
@@ -33,9 +46,19 @@ class MethodChannelMaathaiLlamma extends MaathaiLlammaPlatform {
     int threads = 0,
     int? threadsBatch,
     int? batchSize,
+    int? ubatchSize,
     int gpuLayers = 0,
+    String? draftModelPath,
+    int? draftMax,
+    bool autoTune = false,
+    bool retune = false,
+    String? tuneDir,
     bool preferPerformanceCores = true,
     int? maxModelBytes,
+    int? memoryBudgetBytes,
+    String cacheTypeK = 'f16',
+    String cacheTypeV = 'f16',
+    bool? flashAttention,
     double temperature = 0.7,
     int topK = 40,
     double topP = 0.95,
@@ -50,40 +73,154 @@ class MethodChannelMaathaiLlamma extends MaathaiLlammaPlatform {
     double? presencePenalty,
     int? repeatLastN,
     int? minKeep,
+    bool useMmap = true,
+    bool useMlock = false,
+    bool warmup = false,
+    bool swap = false,
+    void Function(String stage, int done, int total)? onProgress,
   }) async {
     if (kDebugMode) {
       // ignore: avoid_print
-      print('[MaathaiLlamma] loadModel(path=$modelPath, ctx=$contextLength, threads=$threads, threadsBatch=${threadsBatch ?? 0}, batchSize=${batchSize ?? 0}, gpuLayers=$gpuLayers, preferPerformanceCores=$preferPerformanceCores, maxModelBytes=${maxModelBytes ?? -1})');
+      print('[MaathaiLlamma] loadModel(path=$modelPath, ctx=$contextLength, threads=$threads, threadsBatch=${threadsBatch ?? 0}, batchSize=${batchSize ?? 0}, ubatchSize=${ubatchSize ?? 0}, gpuLayers=$gpuLayers, preferPerformanceCores=$preferPerformanceCores, maxModelBytes=${maxModelBytes ?? -1}, cache=$cacheTypeK/$cacheTypeV, flashAttention=${flashAttention ?? 'auto'}, mmap=$useMmap, mlock=$useMlock, warmup=$warmup, swap=$swap)');
+    }
+    // a swap keeps the current model, and its settings, until it succeeds
+    if (!swap) _activeSettings = const {};
+    final progress = onProgress == null
+        ? null
+        : _events.where((event) => event is Map && event['type'] == 'load').listen((event) {
+            final map = event as Map;
+            onProgress(
+              (map['stage'] as String?) ?? 'weights',
+              ((map['done'] as num?) ?? 0).toInt(),
+              ((map['total'] as num?) ?? 0).toInt(),
+            );
+          });
+    final Object? loaded;
+    try {
+      loaded = await methodChannel.invokeMethod<Object?>('loadModel', {
+        'modelPath': modelPath,
+        'contextLength': contextLength,
+        'threads': threads,
+        'threadsBatch': threadsBatch,
+        'batchSize': batchSize,
+        'ubatchSize': ubatchSize,
+        'gpuLayers': gpuLayers,
+        'draftModelPath': draftModelPath,
+        'draftMax': draftMax,
+        'autoTune': autoTune,
+        'retune': retune,
+        'tuneDir': tuneDir,
+        'preferPerformanceCores': preferPerformanceCores,
+        'maxModelBytes': maxModelBytes,
+        'memoryBudgetBytes': memoryBudgetBytes,
+        'cacheTypeK': cacheTypeK,
+        'cacheTypeV': cacheTypeV,
+        'flashAttention': flashAttention,
+        'temperature': temperature,
+        'topK': topK,
+        'topP': topP,
+        'minP': minP,
+        'typicalP': typicalP,
+        'topNSigma': topNSigma,
+        'mirostatType': mirostatType,
+        'mirostatTau': mirostatTau,
+        'mirostatEta': mirostatEta,
+        'repeatPenalty': repeatPenalty,
+        'frequencyPenalty': frequencyPenalty,
+        'presencePenalty': presencePenalty,
+        'repeatLastN': repeatLastN,
+        'minKeep': minKeep,
+        'useMmap': useMmap,
+        'useMlock': useMlock,
+        'warmup': warmup,
+        'swap': swap,
+      });
+    } finally {
+      await progress?.cancel();
     }
-    final loaded = await methodChannel.invokeMethod<bool>('loadModel', {
-      'modelPath': modelPath,
-      'contextLength': contextLength,
-      'threads': threads,
-      'threadsBatch': threadsBatch,
-      'batchSize': batchSize,
-      'gpuLayers': gpuLayers,
-      'preferPerformanceCores': preferPerformanceCores,
-      'maxModelBytes': maxModelBytes,
-      'temperature': temperature,
-      'topK': topK,
-      'topP': topP,
-      'minP': minP,
-      'typicalP': typicalP,
-      'topNSigma': topNSigma,
-      'mirostatType': mirostatType,
-      'mirostatTau': mirostatTau,
-      'mirostatEta': mirostatEta,
-      'repeatPenalty': repeatPenalty,
-      'frequencyPenalty': frequencyPenalty,
-      'presencePenalty': presencePenalty,
-      'repeatLastN': repeatLastN,
-      'minKeep': minKeep,
-    });
     if (kDebugMode) {
       // ignore: avoid_print
       print('[MaathaiLlamma] loadModel -> ${loaded ?? false}');
     }
-    return loaded ?? false;
+    // the platform replies with the active settings on success
+    if (loaded is Map) {
+      _activeSettings = Map<String, Object?>.from(loaded);
+      final load = loaded['load'];
+      _currentHandle = load is Map ? load['residentHandle'] as int? : null;
+      return true;
+    }
+    return loaded == true;
+  }
+
+  @override
+  Future<bool> cancelLoad() async {
+    final cancelled = await methodChannel.invokeMethod<bool>('cancelLoad');
+    return cancelled ?? false;
+  }
+
+  @override
+  Future<void> setResidencyBudget(int budgetBytes) async {
+    await methodChannel.invokeMethod<void>('setResidencyBudget', {'budgetBytes': budgetBytes});
+  }
+
+  @override
+  Future<Map<String, Object?>> switchModel(int handle) async {
+    final settings = await methodChannel.invokeMethod<Map<Object?, Object?>>('switchModel', {'handle': handle});
+    _activeSettings = Map<String, Object?>.from(settings ?? const {});
+    _currentHandle = handle;
+    return _activeSettings;
+  }
+
+  @override
+  Future<bool> pinModel(int handle, {bool pinned = true}) async {
+    final ok = await methodChannel.invokeMethod<bool>('pinModel', {'handle': handle, 'pinned': pinned});
+    return ok ?? false;
+  }
+
+  @override
+  Future<bool> unloadModel(int handle) async {
+    final ok = await methodChannel.invokeMethod<bool>('unloadModel', {'handle': handle});
+    if (ok == true && handle == _currentHandle) {
+      _activeSettings = const {};
+      _currentHandle = null;
+    }
+    return ok ?? false;
+  }
+
+  @override
+  Future<List<ResidentModel>> residentModels() async {
+    final models = await methodChannel.invokeMethod<List<Object?>>('residentModels');
+    return [
+      for (final model in models ?? const []) ResidentModel.fromMap(model as Map<Object?, Object?>),
+    ];
+  }
+
+  @override
+  Future<ResidencyStats> residencyStats() async {
+    final stats = await methodChannel.invokeMethod<Map<Object?, Object?>>('residencyStats');
+    return stats == null ? const ResidencyStats() : ResidencyStats.fromMap(stats);
+  }
+
+  @override
+  Future<Map<String, Object?>> activeSettings() async => _activeSettings;
+
+  @override
+  Future<int> openSession() async {
+    final session = await methodChannel.invokeMethod<int>('openSession');
+    if (kDebugMode) {
+      // ignore: avoid_print
+      print('[MaathaiLlamma] openSession -> $session');
+    }
+    return session ?? 0;
+  }
+
+  @override
+  Future<void> closeSession(int session) async {
+    if (kDebugMode) {
+      // ignore: avoid_print
+      print('[MaathaiLlamma] closeSession($session)');
+    }
+    await methodChannel.invokeMethod<void>('closeSession', {'session': session});
   }
 
   @override
@@ -91,15 +228,23 @@ class MethodChannelMaathaiLlamma extends MaathaiLlammaPlatform {
     required String prompt,
     int maxTokens = 512,
     String? cancelToken,
+    List<Map<String, String>>? messages,
+    int session = 0,
+    Map<int, double>? adapters,
+    String? priority,
   }) async {
     if (kDebugMode) {
       // ignore: avoid_print
-      print('[MaathaiLlamma] generate(maxTokens=$maxTokens) prompt="${prompt.substring(0, prompt.length > 64 ? 64 : prompt.length)}"');
+      print('[MaathaiLlamma] generate(session=$session, maxTokens=$maxTokens) prompt="${prompt.substring(0, prompt.length > 64 ? 64 : prompt.length)}"');
     }
     final response = await methodChannel.invokeMethod<String>('generate', {
       'prompt': prompt,
       'maxTokens': maxTokens,
       'cancelToken': cancelToken,
+      'messages': messages,
+      'session': session,
+      'adapters': adapters,
+      'priority': priority,
     });
     if (kDebugMode) {
       // ignore: avoid_print
@@ -113,24 +258,40 @@ class MethodChannelMaathaiLlamma extends MaathaiLlammaPlatform {
     required String prompt,
     int maxTokens = 512,
     String? cancelToken,
+    List<Map<String, String>>? messages,
+    void Function(int done, int total)? onPrefillProgress,
+    bool logprobs = false,
+    void Function(TokenFrame frame)? onTokens,
+    int session = 0,
+    Map<int, double>? adapters,
+    String? priority,
   }) {
     final controller = StreamController<String>();
     // Subscribe first so native onListen gets called and eventSink is available
-    final sub = eventsChannel.receiveBroadcastStream().listen((event) {
+    final sub = _events.listen((event) {
       if (event is Map) {
+        if (((event['session'] as int?) ?? 0) != session) return;
         final type = event['type'];
-        if (type == 'token') {
-          final text = (event['text'] as String?) ?? '';
-          if (text.isNotEmpty && !controller.isClosed) controller.add(text);
+        if (type == 'frame') {
+          final frame = TokenFrame.decode(event['data'] as Uint8List);
+          onTokens?.call(frame);
+          if (frame.text.isNotEmpty && !controller.isClosed) controller.add(frame.text);
+        } else if (type == 'prefill') {
+          onPrefillProgress?.call(
+            (event['done'] as int?) ?? 0,
+            (event['total'] as int?) ?? 0,
+          );
         } else if (type == 'done') {
           if (kDebugMode) {
             // ignore: avoid_print
-            print('[MaathaiLlamma] stream done');
+            print('[MaathaiLlamma] stream done (session=$session)');
           }
           if (!controller.isClosed) controller.close();
         }
       }
     }, onError: (error, stack) {
+      final details = error is PlatformException ? error.details : null;
+      if (details is Map && ((details['session'] as int?) ?? 0) != session) return;
       if (kDebugMode) {
         // ignore: avoid_print
         print('[MaathaiLlamma] stream error: $error');
@@ -142,12 +303,17 @@ class MethodChannelMaathaiLlamma extends MaathaiLlammaPlatform {
       try {
         if (kDebugMode) {
           // ignore: avoid_print
-          print('[MaathaiLlamma] startGenerateStream(maxTokens=$maxTokens)');
+          print('[MaathaiLlamma] startGenerateStream(session=$session, maxTokens=$maxTokens)');
         }
         final started = await methodChannel.invokeMethod<bool>('startGenerateStream', {
           'prompt': prompt,
           'maxTokens': maxTokens,
           'cancelToken': cancelToken,
+          'messages': messages,
+          'logprobs': logprobs,
+          'adapters': adapters,
+          'priority': priority,
+          'session': session,
         });
         if (started != true) {
           throw PlatformException(code: 'start_failed', message: 'Failed to start generation stream');
@@ -164,9 +330,9 @@ class MethodChannelMaathaiLlamma extends MaathaiLlammaPlatform {
     controller.onCancel = () async {
       if (kDebugMode) {
         // ignore: avoid_print
-        print('[MaathaiLlamma] cancelGenerate');
+        print('[MaathaiLlamma] cancelGenerate(session=$session)');
       }
-      await methodChannel.invokeMethod('cancelGenerate');
+      await methodChannel.invokeMethod('cancelGenerate', {'session': session});
       await sub.cancel();
     };
 
@@ -213,12 +379,257 @@ class MethodChannelMaathaiLlamma extends MaathaiLlammaPlatform {
   }
 
   @override
-  Future<void> cancel() async {
+  Future<void> cancel({int? session}) async {
+    if (kDebugMode) {
+      // ignore: avoid_print
+      print('[MaathaiLlamma] cancel(session=${session ?? 'all'})');
+    }
+    await methodChannel.invokeMethod('cancelGenerate', {'session': session});
+  }
+
+  @override
+  Future<void> setConversationMode(bool enabled) async {
+    if (kDebugMode) {
+      // ignore: avoid_print
+      print('[MaathaiLlamma] setConversationMode($enabled)');
+    }
+    await methodChannel.invokeMethod<void>('setConversationMode', {'enabled': enabled});
+  }
+
+  @override
+  Future<void> resetConversation({int session = 0}) async {
+    if (kDebugMode) {
+      // ignore: avoid_print
+      print('[MaathaiLlamma] resetConversation(session=$session)');
+    }
+    await methodChannel.invokeMethod<void>('resetConversation', {'session': session});
+  }
+
+  @override
+  Future<void> setContextShift({
+    required bool enabled,
+    int? keepTokens,
+    int? discardTokens,
+    int session = 0,
+  }) async {
+    if (kDebugMode) {
+      // ignore: avoid_print
+      print('[MaathaiLlamma] setContextShift(enabled=$enabled, keep=${keepTokens ?? -1}, discard=${discardTokens ?? 0}, session=$session)');
+    }
+    await methodChannel.invokeMethod<void>('setContextShift', {
+      'enabled': enabled,
+      'keepTokens': keepTokens,
+      'discardTokens': discardTokens,
+      'session': session,
+    });
+  }
+
+  @override
+  Future<int> loadLora(String path) async {
+    final id = await methodChannel.invokeMethod<int>('loadLora', {'path': path});
+    if (kDebugMode) {
+      // ignore: avoid_print
+      print('[MaathaiLlamma] loadLora($path) -> $id');
+    }
+    return id ?? -1;
+  }
+
+  @override
+  Future<void> setPriority({required String priority, int session = 0}) async {
+    if (kDebugMode) {
+      // ignore: avoid_print
+      print('[MaathaiLlamma] setPriority($priority, session=$session)');
+    }
+    await methodChannel.invokeMethod<void>('setPriority', {'priority': priority, 'session': session});
+  }
+
+  @override
+  Future<bool> unloadLora(int id) async {
+    final ok = await methodChannel.invokeMethod<bool>('unloadLora', {'id': id});
+    return ok ?? false;
+  }
+
+  @override
+  Future<void> setLoras({required Map<int, double> adapters, int session = 0}) async {
+    if (kDebugMode) {
+      // ignore: avoid_print
+      print('[MaathaiLlamma] setLoras($adapters, session=$session)');
+    }
+    await methodChannel.invokeMethod<void>('setLoras', {'adapters': adapters, 'session': session});
+  }
+
+  @override
+  Future<Embeddings> embed(
+    List<String> texts, {
+    String pooling = 'model',
+    bool normalize = true,
+    int? batchSize,
+    int? maxSequences,
+  }) async {
+    if (kDebugMode) {
+      // ignore: avoid_print
+      print('[MaathaiLlamma] embed(${texts.length} texts, pooling=$pooling)');
+    }
+    final result = await methodChannel.invokeMapMethod<String, Object?>('embed', {
+      'texts': texts,
+      'pooling': pooling,
+      'normalize': normalize,
+      'batchSize': batchSize,
+      'maxSequences': maxSequences,
+    });
+    if (result == null) {
+      throw PlatformException(code: 'embed_failed', message: 'No embeddings returned');
+    }
+    return Embeddings.fromMap(result);
+  }
+
+  @override
+  Future<int> openVectorIndex(String path, {required int dimension, bool quantized = false}) async {
+    final handle = await methodChannel.invokeMethod<int>('vectorIndexOpen', {
+      'path': path,
+      'dimension': dimension,
+      'quantized': quantized,
+    });
+    if (handle == null) {
+      throw PlatformException(code: 'vector_index_failed', message: 'No handle returned');
+    }
+    return handle;
+  }
+
+  @override
+  Future<void> closeVectorIndex(int handle) async {
+    await methodChannel.invokeMethod<void>('vectorIndexClose', {'handle': handle});
+  }
+
+  @override
+  Future<void> vectorIndexAdd(int handle, Int64List ids, Float32List vectors) async {
+    await methodChannel.invokeMethod<void>('vectorIndexAdd', {
+      'handle': handle,
+      'ids': ids,
+      'vectors': vectors,
+    });
+  }
+
+  @override
+  Future<int> vectorIndexRemove(int handle, Int64List ids) async {
+    final removed = await methodChannel.invokeMethod<int>('vectorIndexRemove', {'handle': handle, 'ids': ids});
+    return removed ?? 0;
+  }
+
+  @override
+  Future<VectorSearchResult> vectorIndexSearch(int handle, Float32List query, {int k = 10, int? threads}) async {
+    final result = await methodChannel.invokeMapMethod<String, Object?>('vectorIndexSearch', {
+      'handle': handle,
+      'query': query,
+      'k': k,
+      'threads': threads,
+    });
+    if (result == null) {
+      return VectorSearchResult(ids: Int64List(0), scores: Float32List(0));
+    }
+    return VectorSearchResult.fromMap(result);
+  }
+
+  @override
+  Future<Map<String, Object?>> vectorIndexInfo(int handle) async {
+    final info = await methodChannel.invokeMapMethod<String, Object?>('vectorIndexInfo', {'handle': handle});
+    return info ?? const {};
+  }
+
+  @override
+  Future<bool> vectorIndexCompact(int handle) async {
+    final ok = await methodChannel.invokeMethod<bool>('vectorIndexCompact', {'handle': handle});
+    return ok ?? false;
+  }
+
+  @override
+  Future<Map<String, Object?>> samplerTimings({int session = 0}) async {
+    final timings = await methodChannel.invokeMapMethod<String, Object?>('samplerTimings', {'session': session});
+    return timings ?? const {};
+  }
+
+  @override
+  Future<EngineStats> getStats({int session = 0}) async {
+    final stats = await methodChannel.invokeMapMethod<String, Object?>('getStats', {'session': session});
+    return EngineStats.fromMap({...?stats, 'session': session});
+  }
+
+  @override
+  Future<void> setAdaptiveThreads(bool enabled) async {
+    await methodChannel.invokeMethod<void>('setAdaptiveThreads', {'enabled': enabled});
+  }
+
+  @override
+  Stream<ThreadChange> get threadEvents => _events
+      .where((event) => event is Map && event['type'] == 'threads')
+      .map((event) => ThreadChange.fromMap(event as Map<Object?, Object?>));
+
+  @override
+  Stream<EngineStats> get statsEvents => _events
+      .where((event) => event is Map && event['type'] == 'stats')
+      .map((event) => EngineStats.fromMap(event as Map<Object?, Object?>));
+
+  @override
+  Future<void> startTrace({int maxEvents = 0}) async {
+    await methodChannel.invokeMethod<void>('startTrace', {'maxEvents': maxEvents});
+  }
+
+  @override
+  Future<bool> stopTrace({String? path}) async {
+    final ok = await methodChannel.invokeMethod<bool>('stopTrace', {'path': path});
+    return ok ?? false;
+  }
+
+  @override
+  Future<Map<String, Object?>> primePrefix({
+    required List<Map<String, String>> messages,
+    String? cacheDir,
+    int session = 0,
+  }) async {
     if (kDebugMode) {
       // ignore: avoid_print
-      print('[MaathaiLlamma] cancel()');
+      print('[MaathaiLlamma] primePrefix(messages=${messages.length})');
     }
-    await methodChannel.invokeMethod('cancelGenerate');
+    final result = await methodChannel.invokeMapMethod<String, Object?>('primePrefix', {
+      'messages': messages,
+      'cacheDir': cacheDir,
+      'session': session,
+    });
+    if (kDebugMode) {
+      // ignore: avoid_print
+      print('[MaathaiLlamma] primePrefix -> $result');
+    }
+    return result ?? const {'status': 'failed', 'tokens': 0, 'elapsedMs': 0};
+  }
+
+  @override
+  Future<Map<String, Object?>> estimateMemory({
+    required String modelPath,
+    int contextLength = 4096,
+    int? batchSize,
+    int? ubatchSize,
+    String cacheTypeK = 'f16',
+    String cacheTypeV = 'f16',
+    bool? flashAttention,
+    int? memoryBudgetBytes,
+  }) async {
+    final result = await methodChannel.invokeMapMethod<String, Object?>('estimateMemory', {
+      'modelPath': modelPath,
+      'contextLength': contextLength,
+      'batchSize': batchSize,
+      'ubatchSize': ubatchSize,
+      'cacheTypeK': cacheTypeK,
+      'cacheTypeV': cacheTypeV,
+      'flashAttention': flashAttention,
+      'memoryBudgetBytes': memoryBudgetBytes,
+    });
+    return result ?? const {};
+  }
+
+  @override
+  Future<int> invalidateTuning({String? tuneDir}) async {
+    final removed = await methodChannel.invokeMethod<int>('invalidateTuning', {'tuneDir': tuneDir});
+    return removed ?? 0;
   }
 
   @override
@@ -227,6 +638,8 @@ class MethodChannelMaathaiLlamma extends MaathaiLlammaPlatform {
       // ignore: avoid_print
       print('[MaathaiLlamma] release()');
     }
+    _activeSettings = const {};
+    _currentHandle = null;
     await methodChannel.invokeMethod<void>('release');
   }
 }
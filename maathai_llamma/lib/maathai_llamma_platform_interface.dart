@@ -1,6 +1,12 @@
+import 'dart:typed_data';
+
 import 'package:plugin_platform_interface/plugin_platform_interface.dart';
 
+import 'embeddings.dart';
+import 'engine_stats.dart';
 import 'maathai_llamma_method_channel.dart';
+import 'token_frame.dart';
+import 'vector_index.dart';
 
 abstract class MaathaiLlammaPlatform extends PlatformInterface {
   /// Constructs a MaathaiLlammaPlatform.
@@ -32,10 +38,29 @@ abstract class MaathaiLlammaPlatform extends PlatformInterface {
     int contextLength = 4096,
     int threads = 0,
     int? threadsBatch,
-    int? batchSize,
+    int? batchSize, // prompt tokens per prefill chunk
+    int? ubatchSize, // physical micro-batch for prefill, <= batchSize
     int gpuLayers = 0,
+    // Small model sharing the target's vocabulary; enables speculative decoding.
+    String? draftModelPath,
+    int? draftMax, // most tokens drafted per step
+    // Measure thread counts and batch size on first load of this model on this
+    // device and reuse the cached result; [retune] measures again.
+    bool autoTune = false,
+    bool retune = false,
+    String? tuneDir,
     bool preferPerformanceCores = true,
     int? maxModelBytes,
+    // Resident memory the model may use. When set, contextLength and
+    // batchSize become upper bounds and the loader picks the largest values
+    // that fit (see [estimateMemory]); a model that cannot fit fails to load.
+    int? memoryBudgetBytes,
+    // Element types of the K and V caches: 'f16' | 'q8_0' | 'q4_0'. q8_0
+    // halves the cache at a small quality cost; a quantized V cache needs
+    // flash attention, which is then turned on.
+    String cacheTypeK = 'f16',
+    String cacheTypeV = 'f16',
+    bool? flashAttention, // null lets the native side decide
     double temperature = 0.7,
     int topK = 40,
     double topP = 0.95,
@@ -50,22 +75,131 @@ abstract class MaathaiLlammaPlatform extends PlatformInterface {
     double? presencePenalty,
     int? repeatLastN,
     int? minKeep,
+    // The weights are memory-mapped (page cache: shared, loaded lazily,
+    // evictable) unless [useMmap] is false, which reads them into private
+    // memory up front. [useMlock] pins the mapped pages.
+    bool useMmap = true,
+    bool useMlock = false,
+    // Reads the file into the page cache and runs a short prefill and one
+    // decode step before returning, so the first request runs at
+    // steady-state speed instead of paying for page faults.
+    bool warmup = false,
+    // Loads next to the current model, which keeps serving (running
+    // streams finish on it), and switches over once the new one is ready.
+    // Both models are resident meanwhile; sessions other than 0 are closed.
+    bool swap = false,
+    // Called with stage 'weights' or 'prefault' (bytes of the file) or
+    // 'warmup' (steps), about once per percent.
+    void Function(String stage, int done, int total)? onProgress,
   }) {
     throw UnimplementedError('loadModel() has not been implemented.');
   }
 
+  /// Cancels the [loadModel] in flight, which then fails with a
+  /// `load_cancelled` PlatformException; a swap leaves the current model
+  /// serving. Returns false when nothing was loading.
+  Future<bool> cancelLoad() {
+    throw UnimplementedError('cancelLoad() has not been implemented.');
+  }
+
+  /// Keeps models loaded side by side within [budgetBytes] of estimated
+  /// resident memory. Every [loadModel] then loads next to the models
+  /// already resident, as with `swap`, and loading a resident model with the
+  /// same settings switches to it without reading the file. Making room
+  /// frees the KV cache and compute buffers of the least recently used idle
+  /// models first, and evicts whole models only when that is not enough;
+  /// pinned models and models still generating are left alone. 0 turns
+  /// residency off and frees every model but the current one.
+  Future<void> setResidencyBudget(int budgetBytes) {
+    throw UnimplementedError('setResidencyBudget() has not been implemented.');
+  }
+
+  /// Makes the resident model [handle] (`load.residentHandle` of
+  /// [loadModel]) the current one, rebuilding its context if it was freed.
+  /// Returns the active settings like [activeSettings], with `switchMs`;
+  /// throws a `not_resident` PlatformException when it was evicted.
+  Future<Map<String, Object?>> switchModel(int handle) {
+    throw UnimplementedError('switchModel() has not been implemented.');
+  }
+
+  /// Exempts a resident model from eviction, or makes it evictable again.
+  Future<bool> pinModel(int handle, {bool pinned = true}) {
+    throw UnimplementedError('pinModel() has not been implemented.');
+  }
+
+  /// Frees a resident model now. Unloading the current one leaves no model
+  /// loaded until the next [loadModel] or [switchModel].
+  Future<bool> unloadModel(int handle) {
+    throw UnimplementedError('unloadModel() has not been implemented.');
+  }
+
+  /// Resident models, most recently used first.
+  Future<List<ResidentModel>> residentModels() {
+    throw UnimplementedError('residentModels() has not been implemented.');
+  }
+
+  Future<ResidencyStats> residencyStats() {
+    throw UnimplementedError('residencyStats() has not been implemented.');
+  }
+
+  /// Settings the loaded model actually runs with, after the native side
+  /// resolved its heuristics, the memory plan and the tuner:
+  /// `{contextLength, threads, threadsBatch, batchSize, ubatchSize,
+  /// cacheTypeK, cacheTypeV, flashAttention, speculative, draftMax}`;
+  /// `flashAttention` is null when llama.cpp was left to decide. `load`
+  /// describes the load itself: `{fileBytes, useMmap, useMlock, weightsMs,
+  /// prefaultMs, warmupMs, totalMs, swapped, residentHandle, cacheHit}`;
+  /// `residentHandle` is null without a residency budget, and `cacheHit`
+  /// means the model was already resident and only switched to.
+  /// Empty when no model is loaded.
+  Future<Map<String, Object?>> activeSettings() {
+    throw UnimplementedError('activeSettings() has not been implemented.');
+  }
+
+  /// Opens an independent session (its own KV sequence and sampler state)
+  /// and returns its id. Requests on different sessions are decoded together
+  /// in shared batches. Session 0 always exists and is the default for every
+  /// request below.
+  Future<int> openSession() {
+    throw UnimplementedError('openSession() has not been implemented.');
+  }
+
+  /// Cancels anything running on [session] and frees its KV sequence.
+  Future<void> closeSession(int session) {
+    throw UnimplementedError('closeSession() has not been implemented.');
+  }
+
+  /// When [messages] is given (a list of `{role, content}` maps) it replaces
+  /// [prompt] and the whole conversation is templated natively. [adapters]
+  /// and [priority], when given, call [setLoras] and [setPriority] for
+  /// [session] first.
   Future<String> generate({
     required String prompt,
     int maxTokens = 512,
     String? cancelToken,
+    List<Map<String, String>>? messages,
+    int session = 0,
+    Map<int, double>? adapters,
+    String? priority,
   }) {
     throw UnimplementedError('generate() has not been implemented.');
   }
 
+  /// [onPrefillProgress] is called after each prompt chunk is decoded with
+  /// the number of prompt tokens processed so far and the total to process.
+  /// [onTokens] receives each native frame with token ids and timings (and
+  /// per-token log-probabilities when [logprobs] is true).
   Stream<String> generateStream({
     required String prompt,
     int maxTokens = 512,
     String? cancelToken,
+    List<Map<String, String>>? messages,
+    void Function(int done, int total)? onPrefillProgress,
+    bool logprobs = false,
+    void Function(TokenFrame frame)? onTokens,
+    int session = 0,
+    Map<int, double>? adapters,
+    String? priority,
   }) {
     throw UnimplementedError('generateStream() has not been implemented.');
   }
@@ -89,10 +223,205 @@ abstract class MaathaiLlammaPlatform extends PlatformInterface {
     throw UnimplementedError('updateSampler() has not been implemented.');
   }
 
-  Future<void> cancel() {
+  /// Cancels the request on [session], or on every session when omitted.
+  Future<void> cancel({int? session}) {
     throw UnimplementedError('cancel() has not been implemented.');
   }
 
+  /// Keeps the KV cache between requests and only prefills the part of each
+  /// new prompt that differs from what was already decoded.
+  Future<void> setConversationMode(bool enabled) {
+    throw UnimplementedError('setConversationMode() has not been implemented.');
+  }
+
+  Future<void> resetConversation({int session = 0}) {
+    throw UnimplementedError('resetConversation() has not been implemented.');
+  }
+
+  /// Lets the native side step the decode and prefill thread counts between
+  /// tokens, towards the fastest count for the current SoC temperature and
+  /// throttling, never above the counts [loadModel] chose. Turning it off
+  /// restores those counts. Stays on across model loads.
+  Future<void> setAdaptiveThreads(bool enabled) {
+    throw UnimplementedError('setAdaptiveThreads() has not been implemented.');
+  }
+
+  /// Every change the thread governor makes.
+  Stream<ThreadChange> get threadEvents {
+    throw UnimplementedError('threadEvents has not been implemented.');
+  }
+
+  /// Lets [session] keep generating past the context length: when its KV
+  /// cache is full, the oldest [discardTokens] tokens after the first
+  /// [keepTokens] are evicted and the rest moved down in place, without
+  /// decoding the history again. [keepTokens] defaults to the prefix pinned
+  /// by [primePrefix] and [discardTokens] to half of the context. In
+  /// conversation mode later prompts are matched with the evicted turns
+  /// skipped, so a long chat keeps its cache.
+  Future<void> setContextShift({
+    required bool enabled,
+    int? keepTokens,
+    int? discardTokens,
+    int session = 0,
+  }) {
+    throw UnimplementedError('setContextShift() has not been implemented.');
+  }
+
+  /// Sets [session]'s scheduling priority: `background`, `normal` (the
+  /// default) or `interactive`. A request waiting to start aborts a batch
+  /// made only of lower priorities, within one graph node, and prompts of a
+  /// lower priority wait while a higher one has work. Reset to `normal` when
+  /// the session is closed.
+  Future<void> setPriority({required String priority, int session = 0}) {
+    throw UnimplementedError('setPriority() has not been implemented.');
+  }
+
+  /// Loads a LoRA adapter (GGUF) for the loaded model and returns its id.
+  /// Loading the same path again returns the same id. Adapters share the
+  /// base weights, so each costs only its own size; they are dropped when a
+  /// model is loaded.
+  Future<int> loadLora(String path) {
+    throw UnimplementedError('loadLora() has not been implemented.');
+  }
+
+  /// Stops requests using the adapter and frees it. Returns false for an
+  /// unknown id.
+  Future<bool> unloadLora(int id) {
+    throw UnimplementedError('unloadLora() has not been implemented.');
+  }
+
+  /// Runs [session]'s next requests with [adapters] (id -> scale) applied;
+  /// an empty map is the base model. A request already running keeps its
+  /// adapters. Switching costs no reload, but the session's cached context,
+  /// pinned prefix included, was computed with the old adapters and is
+  /// decoded again. Sessions with different adapters take turns instead of
+  /// sharing batches.
+  Future<void> setLoras({required Map<int, double> adapters, int session = 0}) {
+    throw UnimplementedError('setLoras() has not been implemented.');
+  }
+
+  /// Embeds [texts] with the loaded model, one vector per text in input
+  /// order. Short texts are packed together, up to [maxSequences] texts and
+  /// [batchSize] tokens per native decode; longer texts are truncated to
+  /// [batchSize] tokens. [pooling] is `model` (the GGUF's own, mean if it has
+  /// none), `mean`, `cls` or `last`. With [normalize] the vectors have unit
+  /// length, so [Embeddings.dot] is the cosine similarity.
+  Future<Embeddings> embed(
+    List<String> texts, {
+    String pooling = 'model',
+    bool normalize = true,
+    int? batchSize,
+    int? maxSequences,
+  }) {
+    throw UnimplementedError('embed() has not been implemented.');
+  }
+
+  /// Opens (or creates) a vector index file for [dimension]-wide vectors and
+  /// returns its handle. An existing file must match [dimension] and
+  /// [quantized].
+  Future<int> openVectorIndex(String path, {required int dimension, bool quantized = false}) {
+    throw UnimplementedError('openVectorIndex() has not been implemented.');
+  }
+
+  Future<void> closeVectorIndex(int handle) {
+    throw UnimplementedError('closeVectorIndex() has not been implemented.');
+  }
+
+  Future<void> vectorIndexAdd(int handle, Int64List ids, Float32List vectors) {
+    throw UnimplementedError('vectorIndexAdd() has not been implemented.');
+  }
+
+  Future<int> vectorIndexRemove(int handle, Int64List ids) {
+    throw UnimplementedError('vectorIndexRemove() has not been implemented.');
+  }
+
+  Future<VectorSearchResult> vectorIndexSearch(int handle, Float32List query, {int k = 10, int? threads}) {
+    throw UnimplementedError('vectorIndexSearch() has not been implemented.');
+  }
+
+  Future<Map<String, Object?>> vectorIndexInfo(int handle) {
+    throw UnimplementedError('vectorIndexInfo() has not been implemented.');
+  }
+
+  Future<bool> vectorIndexCompact(int handle) {
+    throw UnimplementedError('vectorIndexCompact() has not been implemented.');
+  }
+
+  /// Time spent in each sampler stage of [session] since [loadModel]:
+  /// `samples` tokens drawn and `stagesUs`, the total microseconds per stage
+  /// (`topK`, `penalties`, `filters`, `temperature`, `dist`).
+  Future<Map<String, Object?>> samplerTimings({int session = 0}) {
+    throw UnimplementedError('samplerTimings() has not been implemented.');
+  }
+
+  /// Per-phase timings of the last request on [session] and of all
+  /// requests since [loadModel], with thread counts, KV cache usage and
+  /// llama.cpp's own counters.
+  Future<EngineStats> getStats({int session = 0}) {
+    throw UnimplementedError('getStats() has not been implemented.');
+  }
+
+  /// The same stats, pushed when any request on any session finishes.
+  Stream<EngineStats> get statsEvents {
+    throw UnimplementedError('statsEvents has not been implemented.');
+  }
+
+  /// Records every request phase as Chrome trace events (viewable in
+  /// chrome://tracing or ui.perfetto.dev), keeping the most recent
+  /// [maxEvents] (0: the native default).
+  Future<void> startTrace({int maxEvents = 0}) {
+    throw UnimplementedError('startTrace() has not been implemented.');
+  }
+
+  /// Stops recording and writes the trace JSON to [path], if given.
+  Future<bool> stopTrace({String? path}) {
+    throw UnimplementedError('stopTrace() has not been implemented.');
+  }
+
+  /// Decodes a fixed preamble ([messages], e.g. the system prompt) once and
+  /// keeps it in the KV cache for every later request that starts with it.
+  /// The decoded state is saved under [cacheDir] (defaults to the app cache)
+  /// and restored on the next launch instead of being decoded again.
+  ///
+  /// Returns `{status: 'restored' | 'created' | 'failed', tokens, elapsedMs}`.
+  Future<Map<String, Object?>> primePrefix({
+    required List<Map<String, String>> messages,
+    String? cacheDir,
+    int session = 0,
+  }) {
+    throw UnimplementedError('primePrefix() has not been implemented.');
+  }
+
+  /// Estimates the resident memory of loading [modelPath] with the given
+  /// settings from its GGUF header, without loading the weights.
+  /// [contextLength] 0 means the model's training context. With
+  /// [memoryBudgetBytes] (defaults to the memory the OS reports as available)
+  /// it also plans the largest context and batch that fit.
+  ///
+  /// Returns `{weightsBytes, kvBytes, computeBytes, overheadBytes, totalBytes,
+  /// trainContextLength, availableBytes, budgetBytes, fits,
+  /// plannedContextLength, plannedBatchSize, plannedUbatchSize,
+  /// plannedTotalBytes}`.
+  Future<Map<String, Object?>> estimateMemory({
+    required String modelPath,
+    int contextLength = 4096,
+    int? batchSize,
+    int? ubatchSize,
+    String cacheTypeK = 'f16', // 'f16' | 'q8_0' | 'q4_0'
+    String cacheTypeV = 'f16',
+    bool? flashAttention,
+    int? memoryBudgetBytes,
+  }) {
+    throw UnimplementedError('estimateMemory() has not been implemented.');
+  }
+
+  /// Deletes the cached tuning profiles in [tuneDir] (defaults to the app
+  /// cache) so the next `autoTune` load calibrates again. Returns how many
+  /// profiles were removed.
+  Future<int> invalidateTuning({String? tuneDir}) {
+    throw UnimplementedError('invalidateTuning() has not been implemented.');
+  }
+
   Future<void> release() {
     throw UnimplementedError('release() has not been implemented.');
   }
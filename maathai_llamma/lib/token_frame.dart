@@ -0,0 +1,75 @@
+import 'dart:convert';
+import 'dart:typed_data';
+
+/// A batch of streamed tokens as delivered by the native decoder.
+///
+/// Frames arrive as raw bytes (layout documented in
+/// `native/src/stream_frame.h`). [text] always ends on a complete UTF-8
+/// character: bytes of a character split across tokens are held back
+/// natively until the rest arrives.
+class TokenFrame {
+  TokenFrame({
+    required this.tokens,
+    required this.timesMs,
+    required this.text,
+    this.logprobs,
+  });
+
+  static const int version = 1;
+  static const int _flagLogprobs = 1;
+  static const int _headerBytes = 12;
+
+  /// Token ids in generation order.
+  final Int32List tokens;
+
+  /// Milliseconds from request start to each token being emitted.
+  final Float32List timesMs;
+
+  /// Log-probability of each token, when the stream was started with
+  /// `logprobs: true`.
+  final Float32List? logprobs;
+
+  /// Decoded text of [tokens].
+  final String text;
+
+  factory TokenFrame.decode(Uint8List bytes) {
+    if (bytes.length < _headerBytes) {
+      throw const FormatException('token frame shorter than its header');
+    }
+    final data = ByteData.sublistView(bytes);
+    final frameVersion = data.getUint16(0, Endian.little);
+    if (frameVersion != version) {
+      throw FormatException('unsupported token frame version $frameVersion');
+    }
+    final flags = data.getUint16(2, Endian.little);
+    final count = data.getUint32(4, Endian.little);
+    final textBytes = data.getUint32(8, Endian.little);
+    final hasLogprobs = (flags & _flagLogprobs) != 0;
+    final expected = _headerBytes + count * (hasLogprobs ? 12 : 8) + textBytes;
+    if (bytes.length < expected) {
+      throw const FormatException('truncated token frame');
+    }
+
+    var offset = _headerBytes;
+    final tokens = Int32List(count);
+    for (var i = 0; i < count; i++, offset += 4) {
+      tokens[i] = data.getInt32(offset, Endian.little);
+    }
+    final timesMs = Float32List(count);
+    for (var i = 0; i < count; i++, offset += 4) {
+      timesMs[i] = data.getFloat32(offset, Endian.little);
+    }
+    Float32List? logprobs;
+    if (hasLogprobs) {
+      logprobs = Float32List(count);
+      for (var i = 0; i < count; i++, offset += 4) {
+        logprobs[i] = data.getFloat32(offset, Endian.little);
+      }
+    }
+    final text = utf8.decode(
+      Uint8List.sublistView(bytes, offset, offset + textBytes),
+      allowMalformed: true,
+    );
+    return TokenFrame(tokens: tokens, timesMs: timesMs, logprobs: logprobs, text: text);
+  }
+}
@@ -0,0 +1,77 @@
+import 'dart:typed_data';
+
+import 'embeddings.dart';
+import 'maathai_llamma_platform_interface.dart';
+
+/// Best matches of one query, best first, as two parallel lists.
+class VectorSearchResult {
+  VectorSearchResult({required this.ids, required this.scores});
+
+  final Int64List ids;
+
+  /// Cosine similarity of each hit to the query.
+  final Float32List scores;
+
+  int get length => ids.length;
+
+  factory VectorSearchResult.fromMap(Map<Object?, Object?> map) {
+    final ids = map['ids'];
+    final scores = map['scores'];
+    return VectorSearchResult(
+      ids: ids is Int64List ? ids : Int64List.fromList((ids as List).cast<int>()),
+      scores: scores is Float32List
+          ? scores
+          : Float32List.fromList((scores as List).map((s) => (s as num).toDouble()).toList()),
+    );
+  }
+}
+
+/// A native nearest-neighbour store backed by a memory-mapped file.
+///
+/// Vectors are normalized on insert, so scores are cosine similarities.
+/// Obtain one with `MaathaiLlamma.openVectorIndex` and [close] it when done;
+/// the file keeps its contents across launches.
+class VectorIndex {
+  VectorIndex(this.handle, {required this.dimension, required this.quantized});
+
+  final int handle;
+  final int dimension;
+
+  /// Stored as int8 rows with a per-vector scale instead of float32.
+  final bool quantized;
+
+  MaathaiLlammaPlatform get _platform => MaathaiLlammaPlatform.instance;
+
+  /// Stores `ids.length` rows of [dimension] floats; existing ids are
+  /// replaced.
+  Future<void> add(List<int> ids, Float32List vectors) {
+    if (vectors.length != ids.length * dimension) {
+      throw ArgumentError('expected ${ids.length * dimension} floats, got ${vectors.length}');
+    }
+    return _platform.vectorIndexAdd(handle, Int64List.fromList(ids), vectors);
+  }
+
+  /// Stores the rows of [embeddings] under [ids], in order.
+  Future<void> addEmbeddings(List<int> ids, Embeddings embeddings) => add(ids, embeddings.vectors);
+
+  /// Returns how many of [ids] were present.
+  Future<int> remove(List<int> ids) => _platform.vectorIndexRemove(handle, Int64List.fromList(ids));
+
+  /// The [k] stored vectors closest to [query]. Large collections are
+  /// scanned on up to [threads] threads (default: one per core).
+  Future<VectorSearchResult> search(Float32List query, {int k = 10, int? threads}) {
+    if (query.length != dimension) {
+      throw ArgumentError('query has ${query.length} floats, index has $dimension');
+    }
+    return _platform.vectorIndexSearch(handle, query, k: k, threads: threads);
+  }
+
+  /// `size` (live vectors), `slots` (records including removed ones),
+  /// `dimension` and `quantized`.
+  Future<Map<String, Object?>> info() => _platform.vectorIndexInfo(handle);
+
+  /// Rewrites the file without removed records.
+  Future<bool> compact() => _platform.vectorIndexCompact(handle);
+
+  Future<void> close() => _platform.closeVectorIndex(handle);
+}
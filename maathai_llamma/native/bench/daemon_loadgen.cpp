@@ -0,0 +1,257 @@
+// maathai_daemon_loadgen: drives a running maathai_daemon with concurrent
+// clients and prints throughput and tail latency per concurrency level as
+// JSON.
+//
+//   maathai_daemon_loadgen [--socket path] [--clients 1,4,16] [--requests 8]
+//                          [-n n_predict] [-p prompts.txt] [--no-stream]
+//
+// Every level opens that many connections, one thread each, and each client
+// sends --requests requests back to back, cycling through the prompts from a
+// different starting point. "ttft_ms" is measured by the client from sending
+// the request to the first streamed token, "latency_ms" to the kDone frame;
+// "queue_ms" is the part of it spent waiting for an engine session, as the
+// daemon reports it. "tok_s" is all generated tokens over the level's wall
+// time. Levels above the daemon's session count show the queueing cost.
+// Needs no model itself, so it builds without the llama.cpp submodule.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "daemon_client.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char * const kDefaultPrompts[] = {
+    "Hello!",
+    "Explain in two sentences why the sky is blue.",
+    "Write a short story about a farmer in Nyeri who plants trees on a hillside "
+    "to stop soil erosion.",
+    "List three ways to save water at home.",
+};
+
+struct Options {
+    std::string socket_path = maathai::default_daemon_socket_path();
+    std::vector<int> clients = {1, 4, 16};
+    int requests = 8;
+    int n_predict = 64;
+    std::string prompts_path;
+    bool stream = true;
+};
+
+// One request as the client saw it.
+struct Sample {
+    double ttft_ms = 0.0;
+    double latency_ms = 0.0;
+    double queue_ms = 0.0;
+    uint32_t tokens = 0;
+};
+
+void print_usage(const char * argv0) {
+    std::fprintf(stderr,
+                 "usage: %s [--socket path] [--clients 1,4,16] [--requests 8] [-n n_predict]\n"
+                 "          [-p prompts.txt] [--no-stream]\n",
+                 argv0);
+}
+
+bool parse_args(int argc, char ** argv, Options & opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char * arg = argv[i];
+        if (std::strcmp(arg, "--no-stream") == 0) {
+            opts.stream = false;
+            continue;
+        }
+        if (std::strcmp(arg, "-h") == 0 || std::strcmp(arg, "--help") == 0 || i + 1 >= argc) {
+            return false;
+        }
+        const char * value = argv[++i];
+        if (std::strcmp(arg, "-s") == 0 || std::strcmp(arg, "--socket") == 0) {
+            opts.socket_path = value;
+        } else if (std::strcmp(arg, "--clients") == 0) {
+            opts.clients.clear();
+            for (const char * p = value; *p != '\0';) {
+                char * end = nullptr;
+                const long n = std::strtol(p, &end, 10);
+                if (end == p || n < 1) {
+                    return false;
+                }
+                opts.clients.push_back((int) n);
+                p = *end == ',' ? end + 1 : end;
+            }
+        } else if (std::strcmp(arg, "--requests") == 0) {
+            opts.requests = std::max(1, std::atoi(value));
+        } else if (std::strcmp(arg, "-n") == 0 || std::strcmp(arg, "--n-predict") == 0) {
+            opts.n_predict = std::atoi(value);
+        } else if (std::strcmp(arg, "-p") == 0 || std::strcmp(arg, "--prompts") == 0) {
+            opts.prompts_path = value;
+        } else {
+            std::fprintf(stderr, "unknown argument: %s\n", arg);
+            return false;
+        }
+    }
+    return !opts.clients.empty();
+}
+
+std::vector<std::string> load_prompts(const std::string & path) {
+    std::vector<std::string> prompts;
+    if (path.empty()) {
+        for (const char * prompt : kDefaultPrompts) {
+            prompts.emplace_back(prompt);
+        }
+        return prompts;
+    }
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty()) {
+            prompts.push_back(line);
+        }
+    }
+    return prompts;
+}
+
+double elapsed_ms(Clock::time_point from) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - from).count();
+}
+
+double percentile(std::vector<double> values, double q) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    const size_t idx = std::min(values.size() - 1, (size_t) std::ceil(q * (double) values.size()) - (q > 0.0 ? 1 : 0));
+    return values[idx];
+}
+
+void print_latency(const char * name, const std::vector<double> & values) {
+    std::printf("      \"%s\": {\"p50\": %.2f, \"p95\": %.2f, \"p99\": %.2f, \"max\": %.2f},\n", name,
+                percentile(values, 0.50), percentile(values, 0.95), percentile(values, 0.99), percentile(values, 1.0));
+}
+
+// Runs one client's requests; false if it could not connect.
+bool run_client(const Options & opts, const std::vector<std::string> & prompts, int index,
+                std::vector<Sample> & samples, int & errors) {
+    maathai::DaemonClient client;
+    if (!client.connect(opts.socket_path)) {
+        std::fprintf(stderr, "client %d: %s\n", index, client.error().c_str());
+        return false;
+    }
+    maathai::DaemonGenerate request;
+    request.n_predict = opts.n_predict;
+    request.stream = opts.stream;
+    request.messages.resize(1);
+    request.messages[0].role = "user";
+    for (int i = 0; i < opts.requests; ++i) {
+        request.messages[0].content = prompts[(size_t) (index + i) % prompts.size()];
+        Sample sample;
+        const auto t_send = Clock::now();
+        maathai::DaemonResult result;
+        const bool ok = client.generate(request, result, [&](const maathai::StreamFrame & frame) {
+            if (sample.ttft_ms == 0.0 && !frame.tokens.empty()) {
+                sample.ttft_ms = elapsed_ms(t_send);
+            }
+        });
+        sample.latency_ms = elapsed_ms(t_send);
+        if (!ok || !result.ok) {
+            std::fprintf(stderr, "client %d: %s\n", index, ok ? "generation failed" : client.error().c_str());
+            ++errors;
+            if (!client.connected()) {
+                return true;
+            }
+            continue;
+        }
+        if (!opts.stream) {
+            sample.ttft_ms = sample.latency_ms;
+        }
+        sample.queue_ms = result.queue_ms;
+        sample.tokens = result.generated_tokens;
+        samples.push_back(sample);
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char ** argv) {
+    Options opts;
+    if (!parse_args(argc, argv, opts)) {
+        print_usage(argv[0]);
+        return 2;
+    }
+    const std::vector<std::string> prompts = load_prompts(opts.prompts_path);
+    if (prompts.empty()) {
+        std::fprintf(stderr, "no prompts to run\n");
+        return 2;
+    }
+
+    maathai::DaemonClient probe;
+    maathai::DaemonInfo info;
+    if (!probe.connect(opts.socket_path) || !probe.info(info)) {
+        std::fprintf(stderr, "no daemon on %s: %s\n", opts.socket_path.c_str(), probe.error().c_str());
+        return 1;
+    }
+    probe.close();
+
+    std::printf("{\n  \"socket\": \"%s\",\n  \"model\": \"%s\",\n  \"n_ctx\": %u,\n  \"sessions\": %u,\n"
+                "  \"n_predict\": %d,\n  \"requests_per_client\": %d,\n  \"stream\": %s,\n  \"levels\": [\n",
+                opts.socket_path.c_str(), info.model.c_str(), info.n_ctx, info.sessions, opts.n_predict,
+                opts.requests, opts.stream ? "true" : "false");
+    for (size_t level = 0; level < opts.clients.size(); ++level) {
+        const int n_clients = opts.clients[level];
+        std::vector<std::vector<Sample>> samples((size_t) n_clients);
+        std::vector<int> errors((size_t) n_clients, 0);
+        std::atomic_int failed_connects{0};
+        std::vector<std::thread> threads;
+        const auto t_start = Clock::now();
+        for (int c = 0; c < n_clients; ++c) {
+            threads.emplace_back([&, c]() {
+                if (!run_client(opts, prompts, c, samples[(size_t) c], errors[(size_t) c])) {
+                    ++failed_connects;
+                }
+            });
+        }
+        for (std::thread & thread : threads) {
+            thread.join();
+        }
+        const double wall_ms = elapsed_ms(t_start);
+
+        std::vector<double> ttft;
+        std::vector<double> latency;
+        std::vector<double> queue;
+        uint64_t tokens = 0;
+        int n_errors = failed_connects.load();
+        for (int c = 0; c < n_clients; ++c) {
+            n_errors += errors[(size_t) c];
+            for (const Sample & sample : samples[(size_t) c]) {
+                ttft.push_back(sample.ttft_ms);
+                latency.push_back(sample.latency_ms);
+                queue.push_back(sample.queue_ms);
+                tokens += sample.tokens;
+            }
+        }
+        std::printf("    {\n      \"clients\": %d,\n      \"requests\": %zu,\n      \"errors\": %d,\n"
+                    "      \"wall_ms\": %.1f,\n      \"tokens\": %llu,\n      \"tok_s\": %.2f,\n"
+                    "      \"requests_per_s\": %.2f,\n",
+                    n_clients, latency.size(), n_errors, wall_ms, (unsigned long long) tokens,
+                    wall_ms > 0.0 ? (double) tokens * 1000.0 / wall_ms : 0.0,
+                    wall_ms > 0.0 ? (double) latency.size() * 1000.0 / wall_ms : 0.0);
+        print_latency("ttft_ms", ttft);
+        print_latency("queue_ms", queue);
+        std::printf("      \"latency_ms\": {\"p50\": %.2f, \"p95\": %.2f, \"p99\": %.2f, \"max\": %.2f}\n    }%s\n",
+                    percentile(latency, 0.50), percentile(latency, 0.95), percentile(latency, 0.99),
+                    percentile(latency, 1.0), level + 1 < opts.clients.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,811 @@
+// maathai_bench: runs a fixed prompt set against a GGUF model through the same
+// engine the Android plugin uses and prints throughput/latency as JSON.
+//
+//   maathai_bench -m model.gguf [-c n_ctx] [-t threads] [-n n_predict]
+//                 [-b n_batch] [-ub n_ubatch]
+//                 [-r repetitions] [-p prompts.txt] [--no-warmup]
+//                 [--conversation] [--system system.txt [--snapshot-dir dir]]
+//                 [--parallel N] [--draft draft.gguf [--n-draft N]]
+//                 [--tune dir [--retune]] [--all-cores] [--memory-budget MiB]
+//                 [--cache-type-k f16|q8_0|q4_0] [--cache-type-v f16|q8_0|q4_0]
+//                 [--flash-attn auto|on|off] [--context-shift N_KEEP]
+//                 [--embed N_SEQ [--pooling model|mean|cls|last]]
+//                 [--trace trace.json] [--cold] [--no-mmap] [--mlock] [--load-warmup]
+//                 [--lora adapter.gguf[:scale]]... [--cancel-after MS]
+//                 [--adaptive-threads [--thermal-root dir]]
+//
+// With --conversation each repetition plays the prompts as consecutive turns
+// of one chat, re-sending the transcript like the app does, so TTFT per turn
+// shows how much of the history is served from the KV cache.
+//
+// With --system the file's contents are sent as a system message ahead of
+// every prompt and primed once per repetition through prime_prefix(); with
+// --snapshot-dir the primed state is persisted, so a second invocation
+// reports the restore cost instead of the prefill cost.
+//
+// With --parallel N every repetition runs the prompt set on N sessions at
+// once, one client thread each, so the scheduler batches their decode steps.
+// "aggregate_tok_s" is all generated tokens over the wall time.
+//
+// With --draft the engine decodes speculatively. Each run reports how many
+// drafted tokens the target accepted, and the summary gives the acceptance
+// rate and generated tokens per target decode (1.0 without speculation);
+// compare decode_tok_s_mean against a run without --draft for the speedup.
+//
+// With --tune the loader calibrates threads and batch size on first use and
+// caches the profile in dir; "tune" reports whether it was measured or read
+// back, and load_ms includes the calibration. --retune measures again.
+//
+// On big.LITTLE hosts the engine pins decode and prefill threads to the
+// performance cores ("decode_cpus"/"batch_cpus"); --all-cores disables that
+// for an A/B comparison.
+//
+// "memory" compares the GGUF-header estimate for the settings in use with the
+// measured peak RSS. --memory-budget lets the loader plan n_ctx/n_batch to fit
+// that many MiB (-c/-b become upper bounds).
+//
+// --cache-type-k/--cache-type-v/--flash-attn select the KV cache element
+// types and attention kernel; the header echoes what the engine resolved
+// (a quantized V cache turns flash attention on), so one run per setting
+// gives the speed and memory numbers to choose defaults from.
+//
+// --context-shift enables the sliding context on every session, keeping
+// N_KEEP tokens (-1: the --system prefix). Combine with a small -c and a
+// large -n to check that token_ms_p95 stays flat across the shifts each run
+// reports in "context_shifts".
+//
+// --embed switches to the embeddings path: every prompt line is a text to
+// embed, once with one text per decode and once packed N_SEQ texts per
+// decode, and the JSON reports texts/s for both instead of generation runs.
+//
+// "phases_us" breaks every run down by request phase (queue, template,
+// tokenize, prefill chunk, decode step, sample, detokenize) with mean and
+// percentiles. --trace also writes the measured runs as a Chrome trace.
+//
+// "load" splits load_ms into reading the weights, the page-cache prefault
+// and the priming decodes, with the share of the file in the page cache
+// before and after. --cold asks the kernel to drop the file's pages first;
+// --no-mmap and --mlock select how the weights are held, and --load-warmup
+// runs the loader's warmup. With --no-warmup, "first_ttft_ms" against
+// "ttft_ms_p50" shows what the first request pays after loading, e.g.
+// `--cold --no-warmup` versus `--cold --no-warmup --load-warmup`.
+//
+// Each --lora loads an adapter over the base model once ("loras" reports its
+// size and load time). Request i on the k-th session then runs with adapter
+// (k + i) mod (adapters + 1), the last slot being the base model, so every
+// request switches; each run's "lora" is the adapter id or -1. TTFT and
+// cached_tokens show what a switch costs, and peak_rss_kb that the adapters
+// add only their own size to the base model.
+//
+// --cancel-after plays every prompt once more after the measured runs and
+// cancels it MS into the request, mid-prefill for a long prompt and a short
+// MS. "cancel" reports how long cancel() took to return the blocked
+// generate() and the engine's own cancel-to-idle latency, with the number of
+// llama_decode calls aborted midway.
+//
+// --adaptive-threads lets the thread governor step the thread counts during
+// the runs; "threads" lists every change with its reason, throughput and
+// temperature, and the counts it ended on. Use a large -n and -r to let a
+// device heat up. --thermal-root reads thermal zones from a directory laid
+// out like /sys/class/thermal instead, so a script can replay a throttling
+// trace by rewriting its temp files.
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "llama_engine.h"
+
+namespace {
+
+const char * const kDefaultPrompts[] = {
+    "Hello!",
+    "Explain in two sentences why the sky is blue.",
+    "Write a short story about a farmer in Nyeri who plants trees on a hillside "
+    "to stop soil erosion. Describe the landscape, the seasons, and how the "
+    "community reacts over the years.",
+    "Summarize the following notes into three bullet points: the meeting started "
+    "late because the projector failed; the budget for the water project was "
+    "approved with a ten percent contingency; volunteers for the tree nursery "
+    "are needed every Saturday in March; the next meeting moves to the school "
+    "hall; minutes will be shared by email before Friday.",
+};
+
+struct Options {
+    std::string model_path;
+    std::string prompts_path;
+    std::string system_path;
+    std::string snapshot_dir;
+    std::string draft_path;
+    std::string tune_dir;
+    int n_draft = 0;
+    int n_ctx = 0;
+    int n_threads = 0;
+    int n_batch = 0;
+    int n_ubatch = 0;
+    int n_predict = 128;
+    int repetitions = 3;
+    int parallel = 1;
+    bool warmup = true;
+    bool conversation = false;
+    bool retune = false;
+    bool all_cores = false;
+    uint64_t memory_budget_mib = 0;
+    maathai::KvCacheType type_k = maathai::KvCacheType::kF16;
+    maathai::KvCacheType type_v = maathai::KvCacheType::kF16;
+    maathai::FlashAttention flash_attn = maathai::FlashAttention::kAuto;
+    bool context_shift = false;
+    int shift_keep = -1;
+    int embed_seqs = 0; // > 0: benchmark embed() instead of generation
+    maathai::EmbeddingPooling pooling = maathai::EmbeddingPooling::kModel;
+    std::string trace_path;
+    bool cold = false;
+    bool use_mmap = true;
+    bool use_mlock = false;
+    bool load_warmup = false;
+    std::vector<std::pair<std::string, float>> loras;
+    int cancel_after_ms = 0;
+    bool adaptive_threads = false;
+    std::string thermal_root;
+};
+
+struct RunResult {
+    int session = 0;
+    size_t prompt_index = 0;
+    int lora = -1;
+    maathai::GenerationStats stats;
+};
+
+void print_usage(const char * argv0) {
+    std::fprintf(stderr,
+                 "usage: %s -m model.gguf [-c n_ctx] [-t threads] [-n n_predict] [-b n_batch] [-ub n_ubatch]\n"
+                 "          [-r repetitions] [-p prompts.txt] [--no-warmup] [--conversation]\n"
+                 "          [--system system.txt [--snapshot-dir dir]] [--parallel N]\n"
+                 "          [--draft draft.gguf [--n-draft N]] [--tune dir [--retune]]\n"
+                 "          [--all-cores] [--memory-budget MiB]\n"
+                 "          [--cache-type-k f16|q8_0|q4_0] [--cache-type-v f16|q8_0|q4_0] [--flash-attn auto|on|off]\n"
+                 "          [--context-shift N_KEEP] [--embed N_SEQ [--pooling model|mean|cls|last]]\n"
+                 "          [--trace trace.json] [--cold] [--no-mmap] [--mlock] [--load-warmup]\n"
+                 "          [--lora adapter.gguf[:scale]]... [--cancel-after MS]\n"
+                 "          [--adaptive-threads [--thermal-root dir]]\n",
+                 argv0);
+}
+
+bool parse_args(int argc, char ** argv, Options & opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char * arg = argv[i];
+        auto next = [&]() -> const char * {
+            return i + 1 < argc ? argv[++i] : nullptr;
+        };
+        const char * value = nullptr;
+        if (std::strcmp(arg, "--no-warmup") == 0) {
+            opts.warmup = false;
+            continue;
+        }
+        if (std::strcmp(arg, "--conversation") == 0) {
+            opts.conversation = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--all-cores") == 0) {
+            opts.all_cores = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--retune") == 0) {
+            opts.retune = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--cold") == 0) {
+            opts.cold = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--no-mmap") == 0) {
+            opts.use_mmap = false;
+            continue;
+        }
+        if (std::strcmp(arg, "--mlock") == 0) {
+            opts.use_mlock = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--load-warmup") == 0) {
+            opts.load_warmup = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--adaptive-threads") == 0) {
+            opts.adaptive_threads = true;
+            continue;
+        }
+        if (std::strcmp(arg, "-h") == 0 || std::strcmp(arg, "--help") == 0) {
+            return false;
+        }
+        if ((value = next()) == nullptr) {
+            std::fprintf(stderr, "missing value for %s\n", arg);
+            return false;
+        }
+        if (std::strcmp(arg, "-m") == 0 || std::strcmp(arg, "--model") == 0) {
+            opts.model_path = value;
+        } else if (std::strcmp(arg, "-p") == 0 || std::strcmp(arg, "--prompts") == 0) {
+            opts.prompts_path = value;
+        } else if (std::strcmp(arg, "--system") == 0) {
+            opts.system_path = value;
+        } else if (std::strcmp(arg, "--snapshot-dir") == 0) {
+            opts.snapshot_dir = value;
+        } else if (std::strcmp(arg, "-c") == 0 || std::strcmp(arg, "--ctx") == 0) {
+            opts.n_ctx = std::atoi(value);
+        } else if (std::strcmp(arg, "-t") == 0 || std::strcmp(arg, "--threads") == 0) {
+            opts.n_threads = std::atoi(value);
+        } else if (std::strcmp(arg, "-b") == 0 || std::strcmp(arg, "--batch") == 0) {
+            opts.n_batch = std::atoi(value);
+        } else if (std::strcmp(arg, "-ub") == 0 || std::strcmp(arg, "--ubatch") == 0) {
+            opts.n_ubatch = std::atoi(value);
+        } else if (std::strcmp(arg, "-n") == 0 || std::strcmp(arg, "--n-predict") == 0) {
+            opts.n_predict = std::atoi(value);
+        } else if (std::strcmp(arg, "-r") == 0 || std::strcmp(arg, "--repetitions") == 0) {
+            opts.repetitions = std::max(1, std::atoi(value));
+        } else if (std::strcmp(arg, "--draft") == 0) {
+            opts.draft_path = value;
+        } else if (std::strcmp(arg, "--n-draft") == 0) {
+            opts.n_draft = std::atoi(value);
+        } else if (std::strcmp(arg, "--memory-budget") == 0) {
+            opts.memory_budget_mib = std::strtoull(value, nullptr, 10);
+        } else if (std::strcmp(arg, "--cache-type-k") == 0 || std::strcmp(arg, "--cache-type-v") == 0) {
+            maathai::KvCacheType & type = arg[13] == 'k' ? opts.type_k : opts.type_v;
+            if (!maathai::parse_kv_cache_type(value, type)) {
+                std::fprintf(stderr, "unknown cache type: %s\n", value);
+                return false;
+            }
+        } else if (std::strcmp(arg, "--flash-attn") == 0) {
+            if (std::strcmp(value, "on") == 0) {
+                opts.flash_attn = maathai::FlashAttention::kOn;
+            } else if (std::strcmp(value, "off") == 0) {
+                opts.flash_attn = maathai::FlashAttention::kOff;
+            } else if (std::strcmp(value, "auto") == 0) {
+                opts.flash_attn = maathai::FlashAttention::kAuto;
+            } else {
+                std::fprintf(stderr, "--flash-attn takes auto, on or off\n");
+                return false;
+            }
+        } else if (std::strcmp(arg, "--context-shift") == 0) {
+            opts.context_shift = true;
+            opts.shift_keep = std::atoi(value);
+        } else if (std::strcmp(arg, "--embed") == 0) {
+            opts.embed_seqs = std::max(1, std::atoi(value));
+        } else if (std::strcmp(arg, "--pooling") == 0) {
+            bool known = false;
+            for (const auto pooling : {maathai::EmbeddingPooling::kModel, maathai::EmbeddingPooling::kMean,
+                                       maathai::EmbeddingPooling::kCls, maathai::EmbeddingPooling::kLast}) {
+                if (std::strcmp(value, maathai::embedding_pooling_name(pooling)) == 0) {
+                    opts.pooling = pooling;
+                    known = true;
+                }
+            }
+            if (!known) {
+                std::fprintf(stderr, "--pooling takes model, mean, cls or last\n");
+                return false;
+            }
+        } else if (std::strcmp(arg, "--lora") == 0) {
+            std::string path = value;
+            float scale = 1.0f;
+            const size_t colon = path.rfind(':');
+            if (colon != std::string::npos) {
+                char * end = nullptr;
+                const float parsed = std::strtof(path.c_str() + colon + 1, &end);
+                if (end != path.c_str() + colon + 1 && *end == '\0') {
+                    scale = parsed;
+                    path.resize(colon);
+                }
+            }
+            opts.loras.emplace_back(path, scale);
+        } else if (std::strcmp(arg, "--trace") == 0) {
+            opts.trace_path = value;
+        } else if (std::strcmp(arg, "--thermal-root") == 0) {
+            opts.thermal_root = value;
+            opts.adaptive_threads = true;
+        } else if (std::strcmp(arg, "--cancel-after") == 0) {
+            opts.cancel_after_ms = std::max(1, std::atoi(value));
+        } else if (std::strcmp(arg, "--tune") == 0) {
+            opts.tune_dir = value;
+        } else if (std::strcmp(arg, "--parallel") == 0) {
+            opts.parallel = std::min(std::max(1, std::atoi(value)), maathai::LlamaEngine::kMaxSessions);
+        } else {
+            std::fprintf(stderr, "unknown argument: %s\n", arg);
+            return false;
+        }
+    }
+    return !opts.model_path.empty();
+}
+
+std::vector<std::string> load_prompts(const std::string & path) {
+    std::vector<std::string> prompts;
+    if (path.empty()) {
+        for (const char * prompt : kDefaultPrompts) {
+            prompts.emplace_back(prompt);
+        }
+        return prompts;
+    }
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty()) {
+            prompts.push_back(line);
+        }
+    }
+    return prompts;
+}
+
+std::string read_file(const std::string & path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+const char * prefix_status_name(maathai::PrefixStatus status) {
+    switch (status) {
+        case maathai::PrefixStatus::kRestored: return "restored";
+        case maathai::PrefixStatus::kCreated: return "created";
+        case maathai::PrefixStatus::kFailed: break;
+    }
+    return "failed";
+}
+
+double mib(uint64_t bytes) {
+    return (double) bytes / (1024.0 * 1024.0);
+}
+
+void print_json_ints(const std::vector<int> & values) {
+    std::printf("[");
+    for (size_t i = 0; i < values.size(); ++i) {
+        std::printf("%s%d", i == 0 ? "" : ", ", values[i]);
+    }
+    std::printf("]");
+}
+
+const char * tune_status_name(maathai::TuneStatus status) {
+    switch (status) {
+        case maathai::TuneStatus::kCached: return "cached";
+        case maathai::TuneStatus::kCalibrated: return "calibrated";
+        case maathai::TuneStatus::kFailed: return "failed";
+        case maathai::TuneStatus::kOff: break;
+    }
+    return "off";
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    const double rank = p * (double) (values.size() - 1);
+    const size_t lo = (size_t) rank;
+    const size_t hi = std::min(lo + 1, values.size() - 1);
+    const double frac = rank - (double) lo;
+    return values[lo] + (values[hi] - values[lo]) * frac;
+}
+
+double per_second(int count, double ms) {
+    return ms > 0.0 ? (double) count * 1000.0 / ms : 0.0;
+}
+
+long peak_rss_kb() {
+    struct rusage usage {};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    return usage.ru_maxrss; // kilobytes on Linux
+}
+
+void print_json_string(const std::string & value) {
+    std::fputc('"', stdout);
+    for (const unsigned char ch : value) {
+        switch (ch) {
+            case '"':  std::fputs("\\\"", stdout); break;
+            case '\\': std::fputs("\\\\", stdout); break;
+            case '\n': std::fputs("\\n", stdout); break;
+            case '\r': std::fputs("\\r", stdout); break;
+            case '\t': std::fputs("\\t", stdout); break;
+            default:
+                if (ch < 0x20) {
+                    std::fprintf(stdout, "\\u%04x", ch);
+                } else {
+                    std::fputc(ch, stdout);
+                }
+        }
+    }
+    std::fputc('"', stdout);
+}
+
+// Embeds the prompt set `repetitions` times one text per decode, then packed
+// `embed_seqs` per decode, and prints both throughputs.
+int run_embed_bench(maathai::LlamaEngine & engine, const Options & opts,
+                    const std::vector<std::string> & texts, double load_ms) {
+    const int modes[] = {1, opts.embed_seqs};
+    std::vector<float> vectors;
+    if (opts.warmup) {
+        maathai::EmbedOptions warm;
+        warm.pooling = opts.pooling;
+        engine.embed({texts.front()}, warm, vectors);
+    }
+    std::printf("{\n  \"model\": ");
+    print_json_string(opts.model_path);
+    std::printf(",\n  \"n_params\": %llu,\n  \"n_embd\": %d,\n  \"texts\": %zu,\n  \"repetitions\": %d,\n  \"load_ms\": %.3f,\n",
+                (unsigned long long) engine.model_params(), engine.n_embd(), texts.size(), opts.repetitions, load_ms);
+    std::printf("  \"embed\": [\n");
+    for (size_t m = 0; m < 2; ++m) {
+        maathai::EmbedOptions options;
+        options.pooling = opts.pooling;
+        options.n_seq = modes[m];
+        maathai::EmbedStats total;
+        double ms = 0.0;
+        for (int rep = 0; rep < opts.repetitions; ++rep) {
+            maathai::EmbedStats stats;
+            if (!engine.embed(texts, options, vectors, &stats)) {
+                std::fprintf(stderr, "embed failed\n");
+                return 1;
+            }
+            total.pooling = stats.pooling;
+            total.texts += stats.texts;
+            total.tokens += stats.tokens;
+            total.truncated += stats.truncated;
+            total.batches += stats.batches;
+            ms += stats.ms;
+        }
+        std::printf("    {\"n_seq\": %d, \"pooling\": \"%s\", \"tokens\": %d, \"truncated\": %d, \"batches\": %d, "
+                    "\"ms\": %.3f, \"texts_per_s\": %.2f, \"tok_s\": %.2f}%s\n",
+                    modes[m], maathai::embedding_pooling_name(total.pooling), total.tokens, total.truncated,
+                    total.batches, ms, per_second(total.texts, ms), per_second(total.tokens, ms),
+                    m == 0 ? "," : "");
+    }
+    std::printf("  ],\n  \"peak_rss_kb\": %ld\n}\n", peak_rss_kb());
+    return 0;
+}
+
+}  // namespace
+
+int main(int argc, char ** argv) {
+    Options opts;
+    if (!parse_args(argc, argv, opts)) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    const std::vector<std::string> prompts = load_prompts(opts.prompts_path);
+    if (prompts.empty()) {
+        std::fprintf(stderr, "no prompts to run\n");
+        return 2;
+    }
+
+    maathai::LlamaEngine engine;
+    maathai::EngineConfig config;
+    config.model_path = opts.model_path;
+    config.n_ctx = opts.n_ctx;
+    config.n_threads = opts.n_threads;
+    config.n_batch = opts.n_batch;
+    config.n_ubatch = opts.n_ubatch;
+    config.draft_model_path = opts.draft_path;
+    config.n_draft = opts.n_draft;
+    config.prefer_performance_cores = !opts.all_cores;
+    config.memory_budget_bytes = opts.memory_budget_mib << 20;
+    config.type_k = opts.type_k;
+    config.type_v = opts.type_v;
+    config.flash_attn = opts.flash_attn;
+    config.use_mmap = opts.use_mmap;
+    config.use_mlock = opts.use_mlock;
+    config.warmup = opts.load_warmup;
+    if (!opts.tune_dir.empty()) {
+        config.tune = opts.retune ? maathai::TuneMode::kForce : maathai::TuneMode::kAuto;
+        config.tune_dir = opts.tune_dir;
+    }
+
+    if (opts.cold && !maathai::evict_file_pages(opts.model_path)) {
+        std::fprintf(stderr, "could not drop %s from the page cache\n", opts.model_path.c_str());
+    }
+    const double residency_before = maathai::page_cache_residency(opts.model_path);
+    const auto t_load = std::chrono::steady_clock::now();
+    if (!engine.load(config)) {
+        std::fprintf(stderr, "failed to load %s\n", opts.model_path.c_str());
+        return 1;
+    }
+    const double load_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - t_load).count();
+    const double residency_after = maathai::page_cache_residency(opts.model_path);
+
+    if (opts.embed_seqs > 0) {
+        return run_embed_bench(engine, opts, prompts, load_ms);
+    }
+
+    std::vector<maathai::LoraSet> lora_sets;
+    for (const auto & lora : opts.loras) {
+        const int id = engine.load_lora(lora.first);
+        if (id < 0) {
+            std::fprintf(stderr, "failed to load adapter %s\n", lora.first.c_str());
+            return 1;
+        }
+        lora_sets.push_back({{id, lora.second}});
+    }
+    if (!lora_sets.empty()) {
+        lora_sets.emplace_back(); // the base model
+    }
+
+    if (opts.warmup) {
+        engine.generate(prompts.front(), 4);
+        engine.reset_context();
+    }
+
+    std::mutex changes_mutex;
+    std::vector<maathai::GovernorDecision> thread_changes;
+    if (opts.adaptive_threads) {
+        engine.set_governor_callback([&](const maathai::GovernorDecision & decision) {
+            std::lock_guard<std::mutex> lock(changes_mutex);
+            thread_changes.push_back(decision);
+        });
+        engine.set_adaptive_threads(true, opts.thermal_root.empty() ? nullptr
+                                                                    : std::make_shared<maathai::SysfsThermalSource>(opts.thermal_root));
+    }
+
+    engine.set_conversation_mode(opts.conversation);
+    if (!opts.trace_path.empty()) {
+        engine.start_trace();
+    }
+
+    std::vector<maathai::ChatMessage> preamble;
+    if (!opts.system_path.empty()) {
+        preamble.push_back({"system", read_file(opts.system_path)});
+    }
+    std::vector<maathai::PrefixResult> primes;
+
+    std::vector<int> sessions = {maathai::LlamaEngine::kDefaultSession};
+    while ((int) sessions.size() < opts.parallel) {
+        sessions.push_back(engine.open_session());
+    }
+    if (opts.context_shift) {
+        maathai::ContextShift shift;
+        shift.enabled = true;
+        shift.n_keep = opts.shift_keep;
+        for (const int session : sessions) {
+            engine.set_context_shift(session, shift);
+        }
+    }
+
+    // Plays the whole prompt set on one session, as one client would.
+    auto run_prompts = [&](int session, std::vector<RunResult> & out) {
+        std::vector<maathai::ChatMessage> transcript = preamble;
+        for (size_t i = 0; i < prompts.size(); ++i) {
+            RunResult run;
+            run.session = session;
+            run.prompt_index = i;
+            if (!lora_sets.empty()) {
+                const size_t slot = (size_t) std::distance(sessions.begin(), std::find(sessions.begin(), sessions.end(), session));
+                const maathai::LoraSet & set = lora_sets[(slot + i) % lora_sets.size()];
+                engine.set_session_loras(session, set);
+                run.lora = set.empty() ? -1 : set.front().id;
+            }
+            run.stats.token_ms.reserve((size_t) std::max(opts.n_predict, 0));
+            if (opts.conversation) {
+                transcript.push_back({"user", prompts[i]});
+                transcript.push_back({"assistant", engine.generate(session, transcript, opts.n_predict, &run.stats)});
+            } else {
+                std::vector<maathai::ChatMessage> request = preamble;
+                request.push_back({"user", prompts[i]});
+                engine.generate(session, request, opts.n_predict, &run.stats);
+            }
+            out.push_back(std::move(run));
+        }
+    };
+
+    std::vector<RunResult> runs;
+    double wall_ms = 0.0;
+    for (int rep = 0; rep < opts.repetitions; ++rep) {
+        if (!preamble.empty()) {
+            for (const int session : sessions) {
+                primes.push_back(engine.prime_prefix(preamble, opts.snapshot_dir, session));
+            }
+        }
+        std::vector<std::vector<RunResult>> per_session(sessions.size());
+        const auto t_rep = std::chrono::steady_clock::now();
+        if (sessions.size() == 1) {
+            run_prompts(sessions[0], per_session[0]);
+        } else {
+            std::vector<std::thread> clients;
+            for (size_t k = 0; k < sessions.size(); ++k) {
+                clients.emplace_back(run_prompts, sessions[k], std::ref(per_session[k]));
+            }
+            for (auto & client : clients) {
+                client.join();
+            }
+        }
+        wall_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_rep).count();
+        for (auto & session_runs : per_session) {
+            std::move(session_runs.begin(), session_runs.end(), std::back_inserter(runs));
+        }
+        for (const int session : sessions) {
+            engine.reset_context(session);
+        }
+    }
+
+    std::vector<double> cancel_return_ms;
+    for (size_t i = 0; opts.cancel_after_ms > 0 && i < prompts.size(); ++i) {
+        std::vector<maathai::ChatMessage> request = preamble;
+        request.push_back({"user", prompts[i]});
+        std::thread client([&] { engine.generate(sessions[0], request, opts.n_predict); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(opts.cancel_after_ms));
+        const auto t_cancel = std::chrono::steady_clock::now();
+        engine.cancel(sessions[0]);
+        client.join();
+        cancel_return_ms.push_back(
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_cancel).count());
+        engine.reset_context(sessions[0]);
+    }
+
+    std::vector<double> all_token_ms;
+    std::vector<double> ttft;
+    double prefill_tok_s_sum = 0.0;
+    double decode_tok_s_sum = 0.0;
+    int generated_total = 0;
+    int decode_steps = 0;
+    int draft_tokens = 0;
+    int draft_accepted = 0;
+
+    std::printf("{\n  \"model\": ");
+    print_json_string(opts.model_path);
+    std::printf(",\n  \"n_params\": %llu,\n", (unsigned long long) engine.model_params());
+    std::printf("  \"n_ctx\": %d,\n  \"n_threads\": %d,\n  \"n_threads_batch\": %d,\n  \"n_batch\": %d,\n  \"n_ubatch\": %d,\n",
+                engine.n_ctx(), engine.n_threads(), engine.n_threads_batch(), engine.n_batch(), engine.n_ubatch());
+    std::printf("  \"n_predict\": %d,\n  \"repetitions\": %d,\n  \"conversation\": %s,\n  \"load_ms\": %.3f,\n",
+                opts.n_predict, opts.repetitions, opts.conversation ? "true" : "false", load_ms);
+    const maathai::LoadReport & report = engine.load_report();
+    std::printf("  \"load\": {\"file_mib\": %.1f, \"mmap\": %s, \"mlock\": %s, \"weights_ms\": %.3f, "
+                "\"prefault_ms\": %.3f, \"warmup_ms\": %.3f, \"residency_before\": %.3f, \"residency_after\": %.3f},\n",
+                (double) report.file_bytes / (1024.0 * 1024.0), report.use_mmap ? "true" : "false",
+                report.use_mlock ? "true" : "false", report.weights_ms, report.prefault_ms, report.warmup_ms,
+                residency_before, residency_after);
+    if (!opts.loras.empty()) {
+        const std::vector<maathai::LoraAdapterInfo> loras = engine.loras();
+        std::printf("  \"loras\": [");
+        for (size_t i = 0; i < loras.size(); ++i) {
+            std::printf("%s{\"id\": %d, \"path\": ", i == 0 ? "" : ", ", loras[i].id);
+            print_json_string(loras[i].path);
+            std::printf(", \"mib\": %.1f, \"load_ms\": %.3f}", mib(loras[i].file_bytes), loras[i].load_ms);
+        }
+        std::printf("],\n");
+    }
+    std::printf("  \"parallel\": %d,\n  \"speculative\": %s,\n  \"n_draft\": %d,\n",
+                (int) sessions.size(), engine.speculative() ? "true" : "false", engine.n_draft());
+    std::printf("  \"type_k\": \"%s\",\n  \"type_v\": \"%s\",\n  \"flash_attn\": \"%s\",\n",
+                maathai::kv_cache_type_name(engine.type_k()), maathai::kv_cache_type_name(engine.type_v()),
+                maathai::flash_attention_name(engine.flash_attn()));
+    maathai::GgufModelInfo gguf;
+    if (maathai::read_gguf_info(opts.model_path, gguf)) {
+        const maathai::MemoryEstimate estimate = maathai::estimate_memory(
+            gguf, engine.n_ctx(), engine.n_batch(), engine.n_ubatch(), engine.type_k(), engine.type_v(),
+            engine.flash_attn() == maathai::FlashAttention::kOn);
+        std::printf("  \"memory\": {\"budget_mib\": %llu, \"planned\": %s, \"weights_mib\": %.1f, \"kv_mib\": %.1f, "
+                    "\"compute_mib\": %.1f, \"overhead_mib\": %.1f, \"estimate_mib\": %.1f},\n",
+                    (unsigned long long) opts.memory_budget_mib, engine.memory_plan().fits ? "true" : "false",
+                    mib(estimate.weights), mib(estimate.kv), mib(estimate.compute), mib(estimate.overhead),
+                    mib(estimate.total()));
+    }
+    const maathai::CpuTopology & topology = engine.cpu_topology();
+    std::printf("  \"clusters\": %zu,\n  \"performance_cores\": ", topology.clusters.size());
+    print_json_ints(topology.performance_cores());
+    std::printf(",\n  \"decode_cpus\": ");
+    print_json_ints(engine.decode_cpus());
+    std::printf(",\n  \"batch_cpus\": ");
+    print_json_ints(engine.batch_cpus());
+    std::printf(",\n");
+    if (!opts.tune_dir.empty()) {
+        const auto & tune = engine.tune_result();
+        std::printf("  \"tune\": {\"status\": \"%s\", \"ms\": %.3f, \"prefill_tok_s\": %.2f, \"decode_tok_s\": %.2f},\n",
+                    tune_status_name(tune.status), tune.ms, tune.profile.prefill_tok_s, tune.profile.decode_tok_s);
+    }
+    if (!primes.empty()) {
+        std::printf("  \"prefix\": [");
+        for (size_t i = 0; i < primes.size(); ++i) {
+            std::printf("%s{\"status\": \"%s\", \"tokens\": %d, \"ms\": %.3f}",
+                        i == 0 ? "" : ", ", prefix_status_name(primes[i].status), primes[i].n_tokens, primes[i].ms);
+        }
+        std::printf("],\n");
+    }
+    maathai::SamplerTimings sampling;
+    maathai::PhaseMetrics phases;
+    std::printf("  \"runs\": [\n");
+    for (size_t i = 0; i < runs.size(); ++i) {
+        const auto & s = runs[i].stats;
+        const double prefill_tok_s = per_second(s.prompt_tokens - s.cached_tokens, s.prefill_ms);
+        // the first token is accounted to TTFT, so decode rate covers the rest
+        const double decode_tok_s = per_second(std::max(0, s.generated_tokens - 1), s.decode_ms);
+        prefill_tok_s_sum += prefill_tok_s;
+        decode_tok_s_sum += decode_tok_s;
+        ttft.push_back(s.ttft_ms);
+        all_token_ms.insert(all_token_ms.end(), s.token_ms.begin(), s.token_ms.end());
+        generated_total += s.generated_tokens;
+        decode_steps += s.decode_steps;
+        draft_tokens += s.draft_tokens;
+        draft_accepted += s.draft_accepted;
+        sampling.samples += s.sampling.samples;
+        for (int stage = 0; stage < maathai::kSamplerStageCount; ++stage) {
+            sampling.us[stage] += s.sampling.us[stage];
+        }
+        phases.merge(s.phases);
+        std::printf("    {\"session\": %d, \"prompt\": %zu, \"lora\": %d, \"prompt_tokens\": %d, \"cached_tokens\": %d, \"generated_tokens\": %d, "
+                    "\"ttft_ms\": %.3f, \"prefill_ms\": %.3f, \"prefill_tok_s\": %.2f, "
+                    "\"decode_ms\": %.3f, \"decode_tok_s\": %.2f, "
+                    "\"token_ms_p50\": %.3f, \"token_ms_p95\": %.3f, "
+                    "\"draft_tokens\": %d, \"draft_accepted\": %d, \"context_shifts\": %d}%s\n",
+                    runs[i].session, runs[i].prompt_index, runs[i].lora, s.prompt_tokens, s.cached_tokens, s.generated_tokens,
+                    s.ttft_ms, s.prefill_ms, prefill_tok_s,
+                    s.decode_ms, decode_tok_s,
+                    percentile(s.token_ms, 0.50), percentile(s.token_ms, 0.95),
+                    s.draft_tokens, s.draft_accepted, s.context_shifts,
+                    i + 1 < runs.size() ? "," : "");
+    }
+    std::printf("  ],\n");
+
+    const double n_runs = (double) runs.size();
+    std::printf("  \"summary\": {\"first_ttft_ms\": %.3f, \"ttft_ms_p50\": %.3f, \"ttft_ms_p95\": %.3f, "
+                "\"prefill_tok_s_mean\": %.2f, \"decode_tok_s_mean\": %.2f, "
+                "\"token_ms_p50\": %.3f, \"token_ms_p95\": %.3f, "
+                "\"wall_ms\": %.3f, \"aggregate_tok_s\": %.2f, "
+                "\"draft_acceptance\": %.3f, \"tokens_per_target_step\": %.3f},\n",
+                runs.empty() ? 0.0 : runs.front().stats.ttft_ms, percentile(ttft, 0.50), percentile(ttft, 0.95),
+                prefill_tok_s_sum / n_runs, decode_tok_s_sum / n_runs,
+                percentile(all_token_ms, 0.50), percentile(all_token_ms, 0.95),
+                wall_ms, per_second(generated_total, wall_ms),
+                draft_tokens > 0 ? (double) draft_accepted / draft_tokens : 0.0,
+                decode_steps > 0 ? (double) generated_total / decode_steps : 0.0);
+    // mean microseconds per sampled token, stage by stage
+    std::printf("  \"sampler_us\": {");
+    for (int stage = 0; stage < maathai::kSamplerStageCount; ++stage) {
+        std::printf("%s\"%s\": %.2f", stage == 0 ? "" : ", ", maathai::sampler_stage_name(stage),
+                    sampling.samples > 0 ? sampling.us[stage] / (double) sampling.samples : 0.0);
+    }
+    std::printf("},\n");
+    std::printf("  \"phases_us\": {");
+    for (int phase = 0; phase < maathai::kMetricPhaseCount; ++phase) {
+        if (phase == maathai::kPhaseHandoff) {
+            continue; // generate() hands pieces over synchronously
+        }
+        const maathai::PhaseStat & stat = phases[phase];
+        std::printf("%s\"%s\": {\"n\": %llu, \"mean\": %.1f, \"p50\": %.1f, \"p95\": %.1f, \"max\": %.1f}",
+                    phase == 0 ? "" : ", ", maathai::metric_phase_name(phase),
+                    static_cast<unsigned long long>(stat.count), stat.mean_us(),
+                    stat.percentile_us(0.50), stat.percentile_us(0.95), stat.max_us);
+    }
+    std::printf("},\n");
+    if (opts.cancel_after_ms > 0) {
+        const maathai::EngineStats stats = engine.get_stats(sessions[0]);
+        std::printf("  \"cancel\": {\"after_ms\": %d, \"n\": %zu, \"return_ms_p50\": %.3f, \"return_ms_max\": %.3f, "
+                    "\"idle_ms_p50\": %.3f, \"idle_ms_p95\": %.3f, \"idle_ms_max\": %.3f, \"aborted_decodes\": %llu},\n",
+                    opts.cancel_after_ms, cancel_return_ms.size(), percentile(cancel_return_ms, 0.50),
+                    percentile(cancel_return_ms, 1.0), stats.cancel.percentile_us(0.50) / 1000.0,
+                    stats.cancel.percentile_us(0.95) / 1000.0, stats.cancel.max_us / 1000.0,
+                    static_cast<unsigned long long>(stats.aborted_decodes));
+    }
+    if (opts.adaptive_threads) {
+        const maathai::EngineStats stats = engine.get_stats();
+        std::lock_guard<std::mutex> lock(changes_mutex);
+        std::printf("  \"threads\": {\"final\": %d, \"final_batch\": %d, \"changes\": [", stats.n_threads,
+                    stats.n_threads_batch);
+        for (size_t i = 0; i < thread_changes.size(); ++i) {
+            const maathai::GovernorDecision & change = thread_changes[i];
+            std::printf("%s{\"from\": %d, \"to\": %d, \"batch\": %d, \"reason\": \"%s\", \"tok_s\": %.2f, \"temp_c\": %.1f}",
+                        i == 0 ? "" : ", ", change.from_threads, change.n_threads, change.n_threads_batch,
+                        maathai::governor_reason_name(change.reason), change.tok_s, change.temp_c);
+        }
+        std::printf("]},\n");
+    }
+    if (!opts.trace_path.empty() && !engine.stop_trace(opts.trace_path)) {
+        std::fprintf(stderr, "could not write %s\n", opts.trace_path.c_str());
+    }
+    std::printf("  \"peak_rss_kb\": %ld\n}\n", peak_rss_kb());
+    return 0;
+}
@@ -0,0 +1,249 @@
+// maathai_vector_bench: recall and query latency of the memory-mapped vector
+// index on synthetic embeddings, printed as JSON.
+//
+//   maathai_vector_bench [--dim 384] [--sizes 10000,100000] [--queries 100]
+//                        [-k 10] [--threads N] [--dir /tmp]
+//
+// Vectors are drawn around sqrt(n) random centres, like topic clusters in a
+// notes collection; each query is a stored vector plus noise. Recall@k is
+// measured against an exact double-precision scan, for float32 and int8
+// storage, and latency is reported single-threaded and with --threads
+// (default: one per core) so the effect of the split is visible.
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "embed_batch.h"
+#include "vector_index.h"
+
+namespace {
+
+struct Options {
+    uint32_t dim = 384;
+    std::vector<size_t> sizes = {10000, 100000};
+    size_t queries = 100;
+    size_t k = 10;
+    int threads = 0;
+    std::string dir = "/tmp";
+};
+
+void print_usage(const char * argv0) {
+    std::fprintf(stderr,
+                 "usage: %s [--dim 384] [--sizes 10000,100000] [--queries 100] [-k 10]\n"
+                 "          [--threads N] [--dir /tmp]\n",
+                 argv0);
+}
+
+bool parse_args(int argc, char ** argv, Options & opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char * arg = argv[i];
+        if (std::strcmp(arg, "-h") == 0 || std::strcmp(arg, "--help") == 0 || i + 1 >= argc) {
+            return false;
+        }
+        const char * value = argv[++i];
+        if (std::strcmp(arg, "--dim") == 0) {
+            opts.dim = (uint32_t) std::max(1, std::atoi(value));
+        } else if (std::strcmp(arg, "--sizes") == 0) {
+            opts.sizes.clear();
+            for (const char * p = value; *p != '\0';) {
+                char * end = nullptr;
+                const unsigned long long n = std::strtoull(p, &end, 10);
+                if (end == p) {
+                    return false;
+                }
+                opts.sizes.push_back((size_t) n);
+                p = *end == ',' ? end + 1 : end;
+            }
+        } else if (std::strcmp(arg, "--queries") == 0) {
+            opts.queries = (size_t) std::max(1, std::atoi(value));
+        } else if (std::strcmp(arg, "-k") == 0) {
+            opts.k = (size_t) std::max(1, std::atoi(value));
+        } else if (std::strcmp(arg, "--threads") == 0) {
+            opts.threads = std::atoi(value);
+        } else if (std::strcmp(arg, "--dir") == 0) {
+            opts.dir = value;
+        } else {
+            std::fprintf(stderr, "unknown argument: %s\n", arg);
+            return false;
+        }
+    }
+    return !opts.sizes.empty();
+}
+
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(Clock::time_point from) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - from).count();
+}
+
+double percentile(std::vector<double> values, double q) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    const size_t idx = std::min(values.size() - 1, (size_t) std::ceil(q * (double) values.size()) - (q > 0.0 ? 1 : 0));
+    return values[idx];
+}
+
+// Ids of the k stored vectors with the highest exact cosine similarity.
+std::vector<int64_t> exact_top_k(const std::vector<float> & unit, uint32_t dim, const float * query, size_t k) {
+    const size_t n = unit.size() / dim;
+    std::vector<std::pair<double, int64_t>> scored(n);
+    for (size_t i = 0; i < n; ++i) {
+        double dot = 0.0;
+        for (uint32_t d = 0; d < dim; ++d) {
+            dot += (double) unit[i * dim + d] * query[d];
+        }
+        scored[i] = {dot, (int64_t) i};
+    }
+    const size_t top = std::min(k, n);
+    std::partial_sort(scored.begin(), scored.begin() + (std::ptrdiff_t) top, scored.end(),
+                      [](const auto & a, const auto & b) { return a.first > b.first; });
+    std::vector<int64_t> ids(top);
+    for (size_t i = 0; i < top; ++i) {
+        ids[i] = scored[i].second;
+    }
+    return ids;
+}
+
+struct Latency {
+    double mean_us = 0.0;
+    double p50_us = 0.0;
+    double p95_us = 0.0;
+};
+
+Latency time_queries(const maathai::VectorIndex & index, const std::vector<float> & queries, uint32_t dim,
+                     size_t k, int threads, std::vector<std::vector<int64_t>> * ids) {
+    const size_t n = queries.size() / dim;
+    std::vector<maathai::VectorHit> hits(k);
+    std::vector<double> us;
+    us.reserve(n);
+    for (size_t q = 0; q < n; ++q) {
+        const auto t = Clock::now();
+        const size_t found = index.search(queries.data() + q * dim, k, hits.data(), threads);
+        us.push_back(elapsed_ms(t) * 1000.0);
+        if (ids != nullptr) {
+            std::vector<int64_t> row(found);
+            for (size_t i = 0; i < found; ++i) {
+                row[i] = hits[i].id;
+            }
+            ids->push_back(std::move(row));
+        }
+    }
+    Latency out;
+    for (const double v : us) {
+        out.mean_us += v / (double) n;
+    }
+    out.p50_us = percentile(us, 0.50);
+    out.p95_us = percentile(us, 0.95);
+    return out;
+}
+
+}  // namespace
+
+int main(int argc, char ** argv) {
+    Options opts;
+    if (!parse_args(argc, argv, opts)) {
+        print_usage(argv[0]);
+        return 2;
+    }
+    const uint32_t dim = opts.dim;
+    std::mt19937 rng(42);
+    std::normal_distribution<float> normal;
+
+    std::printf("{\n  \"simd\": \"%s\",\n  \"dim\": %u,\n  \"queries\": %zu,\n  \"k\": %zu,\n  \"results\": [\n",
+                maathai::vector_simd_name(), dim, opts.queries, opts.k);
+    bool first = true;
+    for (const size_t n : opts.sizes) {
+        // clustered data, then the unit vectors the exact scan compares to
+        const size_t n_centres = std::max<size_t>(1, (size_t) std::sqrt((double) n));
+        std::vector<float> centres(n_centres * dim);
+        for (float & x : centres) {
+            x = normal(rng);
+        }
+        std::vector<float> data(n * dim);
+        std::uniform_int_distribution<size_t> pick_centre(0, n_centres - 1);
+        for (size_t i = 0; i < n; ++i) {
+            const float * c = centres.data() + pick_centre(rng) * dim;
+            for (uint32_t d = 0; d < dim; ++d) {
+                data[i * dim + d] = c[d] + 0.5f * normal(rng);
+            }
+        }
+        std::vector<float> unit = data;
+        for (size_t i = 0; i < n; ++i) {
+            maathai::l2_normalize(unit.data() + i * dim, dim);
+        }
+        std::vector<float> queries(opts.queries * dim);
+        std::uniform_int_distribution<size_t> pick_row(0, n - 1);
+        for (size_t q = 0; q < opts.queries; ++q) {
+            const float * row = unit.data() + pick_row(rng) * dim;
+            for (uint32_t d = 0; d < dim; ++d) {
+                queries[q * dim + d] = row[d] + 0.05f * normal(rng);
+            }
+            maathai::l2_normalize(queries.data() + q * dim, dim);
+        }
+        std::vector<std::vector<int64_t>> truth;
+        for (size_t q = 0; q < opts.queries; ++q) {
+            truth.push_back(exact_top_k(unit, dim, queries.data() + q * dim, opts.k));
+        }
+        std::vector<int64_t> ids(n);
+        for (size_t i = 0; i < n; ++i) {
+            ids[i] = (int64_t) i;
+        }
+
+        for (const auto type : {maathai::VectorType::kF32, maathai::VectorType::kI8}) {
+            const std::string path = opts.dir + "/maathai_vector_bench_" + std::to_string(getpid()) + "_" +
+                                     maathai::vector_type_name(type) + ".mvix";
+            std::remove(path.c_str());
+            maathai::VectorIndex index;
+            if (!index.open(path, dim, type)) {
+                std::fprintf(stderr, "cannot create %s\n", path.c_str());
+                return 1;
+            }
+            const auto t_build = Clock::now();
+            if (!index.add(ids.data(), data.data(), n)) {
+                std::fprintf(stderr, "add failed\n");
+                return 1;
+            }
+            const double build_ms = elapsed_ms(t_build);
+
+            std::vector<std::vector<int64_t>> found;
+            const Latency single = time_queries(index, queries, dim, opts.k, 1, &found);
+            const Latency multi = time_queries(index, queries, dim, opts.k, opts.threads, nullptr);
+            double hit_sum = 0.0;
+            for (size_t q = 0; q < opts.queries; ++q) {
+                size_t hits = 0;
+                for (const int64_t id : found[q]) {
+                    hits += std::find(truth[q].begin(), truth[q].end(), id) != truth[q].end() ? 1 : 0;
+                }
+                hit_sum += truth[q].empty() ? 1.0 : (double) hits / (double) truth[q].size();
+            }
+            struct stat st {};
+            const double file_mib = stat(path.c_str(), &st) == 0 ? (double) st.st_size / (1024.0 * 1024.0) : 0.0;
+            std::printf("%s    {\"n\": %zu, \"type\": \"%s\", \"build_ms\": %.1f, \"file_mib\": %.1f, "
+                        "\"recall_at_k\": %.4f, "
+                        "\"latency_us_1t\": {\"mean\": %.1f, \"p50\": %.1f, \"p95\": %.1f}, "
+                        "\"latency_us_mt\": {\"mean\": %.1f, \"p50\": %.1f, \"p95\": %.1f}}",
+                        first ? "" : ",\n", n, maathai::vector_type_name(type), build_ms,
+                        file_mib, hit_sum / (double) opts.queries,
+                        single.mean_us, single.p50_us, single.p95_us,
+                        multi.mean_us, multi.p50_us, multi.p95_us);
+            std::fflush(stdout);
+            first = false;
+            index.close();
+            std::remove(path.c_str());
+        }
+    }
+    std::printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,494 @@
+// maathai_daemon: keeps a model resident and serves generate, stream and
+// cancel requests from local processes over a Unix domain socket, using the
+// same engine the Android plugin drives.
+//
+//   maathai_daemon -m model.gguf [--socket path] [-c n_ctx] [-t threads]
+//                  [-b n_batch] [--sessions N] [--max-clients N]
+//                  [--conversation] [--adaptive-threads]
+//
+// Framing is described in src/daemon_wire.h and spoken by DaemonClient
+// (src/daemon_client.h). Each connection is a client; requests from all
+// clients are multiplexed onto --sessions engine sessions (at most
+// LlamaEngine::kMaxSessions) so the scheduler batches their decode steps.
+// A request waits in arrival order for a free session and gets the one its
+// client used last when that is free, so with --conversation a client's
+// chat keeps reusing its KV sequence. A client that disconnects has its
+// request cancelled. SIGINT/SIGTERM stop accepting, cancel everything and
+// remove the socket.
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "daemon_wire.h"
+#include "llama_engine.h"
+#include "maathai_log.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kFrameWaitMs = 50;
+constexpr size_t kMaxPiecesPerFrame = 64;
+
+volatile sig_atomic_t g_stop = 0;
+
+void on_signal(int) {
+    g_stop = 1;
+}
+
+struct Options {
+    std::string model_path;
+    std::string socket_path = maathai::default_daemon_socket_path();
+    int n_ctx = 0;
+    int n_threads = 0;
+    int n_batch = 0;
+    int sessions = maathai::LlamaEngine::kMaxSessions;
+    int max_clients = 64;
+    bool conversation = false;
+    bool adaptive_threads = false;
+};
+
+void print_usage(const char * argv0) {
+    std::fprintf(stderr,
+                 "usage: %s -m model.gguf [--socket path] [-c n_ctx] [-t threads] [-b n_batch]\n"
+                 "          [--sessions N] [--max-clients N] [--conversation] [--adaptive-threads]\n",
+                 argv0);
+}
+
+bool parse_args(int argc, char ** argv, Options & opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char * arg = argv[i];
+        if (std::strcmp(arg, "--conversation") == 0) {
+            opts.conversation = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--adaptive-threads") == 0) {
+            opts.adaptive_threads = true;
+            continue;
+        }
+        if (std::strcmp(arg, "-h") == 0 || std::strcmp(arg, "--help") == 0) {
+            return false;
+        }
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "missing value for %s\n", arg);
+            return false;
+        }
+        const char * value = argv[++i];
+        if (std::strcmp(arg, "-m") == 0 || std::strcmp(arg, "--model") == 0) {
+            opts.model_path = value;
+        } else if (std::strcmp(arg, "-s") == 0 || std::strcmp(arg, "--socket") == 0) {
+            opts.socket_path = value;
+        } else if (std::strcmp(arg, "-c") == 0 || std::strcmp(arg, "--ctx") == 0) {
+            opts.n_ctx = std::atoi(value);
+        } else if (std::strcmp(arg, "-t") == 0 || std::strcmp(arg, "--threads") == 0) {
+            opts.n_threads = std::atoi(value);
+        } else if (std::strcmp(arg, "-b") == 0 || std::strcmp(arg, "--batch") == 0) {
+            opts.n_batch = std::atoi(value);
+        } else if (std::strcmp(arg, "--sessions") == 0) {
+            opts.sessions = std::min(std::max(1, std::atoi(value)), maathai::LlamaEngine::kMaxSessions);
+        } else if (std::strcmp(arg, "--max-clients") == 0) {
+            opts.max_clients = std::max(1, std::atoi(value));
+        } else {
+            std::fprintf(stderr, "unknown argument: %s\n", arg);
+            return false;
+        }
+    }
+    return !opts.model_path.empty();
+}
+
+double ms_since(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Engine sessions lent to requests, one request per session at a time.
+// Waiters are served in arrival order so a busy daemon's tail latency is
+// bounded by the queue ahead, not by which thread the condvar wakes.
+class SessionPool {
+public:
+    explicit SessionPool(std::vector<int> ids) : free_(std::move(ids)) {}
+
+    // Blocks until this caller is first in line and a session is free, and
+    // returns `preferred` if that one is free, else any. Returns -1 when
+    // `abandon` becomes true first; call wake() after setting it.
+    int acquire(int preferred, const std::atomic_bool & abandon) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        const uint64_t ticket = next_ticket_++;
+        waiting_.push_back(ticket);
+        cv_.wait(lock, [&] {
+            return abandon.load() || (!free_.empty() && waiting_.front() == ticket);
+        });
+        waiting_.remove(ticket);
+        if (abandon.load()) {
+            cv_.notify_all(); // the next in line may be able to go now
+            return -1;
+        }
+        auto it = std::find(free_.begin(), free_.end(), preferred);
+        if (it == free_.end()) {
+            it = free_.begin();
+        }
+        const int id = *it;
+        free_.erase(it);
+        cv_.notify_all();
+        return id;
+    }
+
+    void release(int id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(id);
+        cv_.notify_all();
+    }
+
+    void wake() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cv_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<int> free_;
+    std::list<uint64_t> waiting_;
+    uint64_t next_ticket_ = 0;
+};
+
+// One connection. Its thread reads frames; a generate runs on a worker
+// thread so cancel frames are read while it streams.
+struct Client {
+    int fd = -1;
+    std::thread thread;
+    std::atomic_bool finished{false};
+    std::mutex write_mutex;
+
+    std::thread worker;
+    std::atomic<uint32_t> request{0}; // running request id, 0 when idle
+    std::atomic_bool cancel{false};
+    // Guards `session` from lease to release, so cancel() can never reach a
+    // session the worker already handed back to another client.
+    std::mutex lease_mutex;
+    int session = -1;                 // leased engine session, -1 when none
+    int last_session = -1;            // affinity for the next lease
+
+    bool send(maathai::DaemonMessage type, uint32_t id, const uint8_t * body, size_t size) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        return maathai::write_daemon_frame(fd, type, id, body, size);
+    }
+    bool send(maathai::DaemonMessage type, uint32_t id, const std::vector<uint8_t> & body) {
+        return send(type, id, body.data(), body.size());
+    }
+    bool send_error(uint32_t id, const std::string & message) {
+        std::vector<uint8_t> body;
+        maathai::encode_daemon_string(message, body);
+        return send(maathai::DaemonMessage::kError, id, body);
+    }
+};
+
+class Daemon {
+public:
+    Daemon(maathai::LlamaEngine & engine, const Options & opts, std::vector<int> sessions)
+        : engine_(engine), opts_(opts), pool_(sessions), n_sessions_((uint32_t) sessions.size()) {}
+
+    void serve(int listen_fd) {
+        while (!g_stop) {
+            pollfd pfd = {listen_fd, POLLIN, 0};
+            const int ready = poll(&pfd, 1, 200);
+            reap();
+            if (ready <= 0) {
+                continue;
+            }
+            const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(clients_mutex_);
+            if ((int) clients_.size() >= opts_.max_clients) {
+                Client refused;
+                refused.fd = fd;
+                refused.send_error(0, "too many clients");
+                close(fd);
+                continue;
+            }
+            clients_.emplace_back(new Client());
+            Client * client = clients_.back().get();
+            client->fd = fd;
+            client->thread = std::thread(&Daemon::run_client, this, client);
+        }
+        // unblock every reader; each cancels its request and exits
+        {
+            std::lock_guard<std::mutex> lock(clients_mutex_);
+            for (auto & client : clients_) {
+                shutdown(client->fd, SHUT_RDWR);
+            }
+        }
+        for (auto & client : clients_) {
+            client->thread.join();
+        }
+        clients_.clear();
+    }
+
+private:
+    void reap() {
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        for (auto it = clients_.begin(); it != clients_.end();) {
+            if ((*it)->finished.load()) {
+                (*it)->thread.join();
+                it = clients_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void run_client(Client * client) {
+        LOGI("client %d connected", client->fd);
+        maathai::DaemonFrame frame;
+        while (maathai::read_daemon_frame(client->fd, frame)) {
+            if (frame.type == maathai::DaemonMessage::kGenerate) {
+                maathai::DaemonGenerate request;
+                if (!maathai::decode_daemon_generate(frame.body, request)) {
+                    client->send_error(frame.request, "malformed generate request");
+                } else if (request.messages.empty()) {
+                    client->send_error(frame.request, "no messages");
+                } else if (client->request.load() != 0) {
+                    client->send_error(frame.request, "a request is already running on this connection");
+                } else {
+                    if (client->worker.joinable()) {
+                        client->worker.join();
+                    }
+                    client->cancel.store(false);
+                    client->request.store(frame.request);
+                    client->worker = std::thread(&Daemon::run_request, this, client, frame.request,
+                                                 std::move(request), Clock::now());
+                }
+            } else if (frame.type == maathai::DaemonMessage::kCancel) {
+                if (frame.request != 0 && client->request.load() == frame.request) {
+                    cancel(client);
+                }
+            } else if (frame.type == maathai::DaemonMessage::kInfo) {
+                maathai::DaemonInfo info;
+                info.model = opts_.model_path;
+                info.n_ctx = (uint32_t) engine_.n_ctx();
+                info.sessions = n_sessions_;
+                {
+                    std::lock_guard<std::mutex> lock(clients_mutex_);
+                    info.clients = (uint32_t) clients_.size();
+                }
+                info.requests = requests_.load();
+                std::vector<uint8_t> body;
+                maathai::encode_daemon_info(info, body);
+                client->send(maathai::DaemonMessage::kInfoReply, frame.request, body);
+            } else {
+                client->send_error(frame.request, "unknown message type");
+            }
+        }
+        // disconnected, malformed framing or shutting down
+        cancel(client);
+        if (client->worker.joinable()) {
+            client->worker.join();
+        }
+        LOGI("client %d disconnected", client->fd);
+        close(client->fd);
+        client->finished.store(true);
+    }
+
+    void cancel(Client * client) {
+        client->cancel.store(true);
+        pool_.wake();
+        std::lock_guard<std::mutex> lock(client->lease_mutex);
+        if (client->session >= 0) {
+            engine_.cancel(client->session);
+        }
+    }
+
+    void run_request(Client * client, uint32_t id, maathai::DaemonGenerate request, Clock::time_point t_start) {
+        maathai::DaemonResult result;
+        const int session = pool_.acquire(client->last_session, client->cancel);
+        result.queue_ms = ms_since(t_start);
+        if (session < 0) {
+            result.ok = true;
+            result.cancelled = true;
+            finish(client, id, result, t_start);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(client->lease_mutex);
+            client->session = session;
+        }
+        client->last_session = session;
+
+        std::vector<maathai::ChatMessage> messages;
+        messages.reserve(request.messages.size());
+        for (maathai::DaemonChatMessage & message : request.messages) {
+            messages.push_back({std::move(message.role), std::move(message.content)});
+        }
+        const int priority = std::min<int>(request.priority, maathai::kRequestPriorityCount - 1);
+        engine_.set_session_priority(session, (maathai::RequestPriority) priority);
+
+        if (client->cancel.load()) {
+            result.ok = true;
+            result.cancelled = true;
+        } else if (engine_.start_stream(session, messages, request.n_predict, request.logprobs)) {
+            result.ok = true;
+            maathai::StreamFrame frame;
+            std::vector<uint8_t> body;
+            bool cancelled = false;
+            while (engine_.wait_for_frame(session, frame, kFrameWaitMs, kMaxPiecesPerFrame)) {
+                // also covers a cancel that raced start_stream()
+                if (client->cancel.load() && !cancelled) {
+                    cancelled = true;
+                    engine_.cancel(session);
+                }
+                // the last frame may hold only the text held back at the end
+                if (frame.tokens.empty() && frame.text.empty()) {
+                    continue;
+                }
+                if (!request.stream) {
+                    result.text += frame.text;
+                    continue;
+                }
+                body.resize(maathai::stream_frame_bytes(frame));
+                maathai::encode_stream_frame(frame, body.data(), body.size());
+                if (!client->send(maathai::DaemonMessage::kStream, id, body) && !cancelled) {
+                    cancelled = true; // the client is gone
+                    client->cancel.store(true);
+                    engine_.cancel(session);
+                }
+            }
+            const maathai::RequestMetrics last = engine_.get_stats(session).last;
+            result.cancelled = last.cancelled || client->cancel.load();
+            result.prompt_tokens = (uint32_t) last.prompt_tokens;
+            result.cached_tokens = (uint32_t) last.cached_tokens;
+            result.generated_tokens = (uint32_t) last.generated_tokens;
+        }
+        {
+            std::lock_guard<std::mutex> lock(client->lease_mutex);
+            client->session = -1;
+        }
+        engine_.set_session_priority(session, maathai::RequestPriority::kNormal);
+        pool_.release(session);
+        ++requests_;
+        finish(client, id, result, t_start);
+    }
+
+    void finish(Client * client, uint32_t id, maathai::DaemonResult & result, Clock::time_point t_start) {
+        result.total_ms = ms_since(t_start);
+        std::vector<uint8_t> body;
+        maathai::encode_daemon_result(result, body);
+        client->request.store(0);
+        client->send(maathai::DaemonMessage::kDone, id, body);
+    }
+
+    maathai::LlamaEngine & engine_;
+    const Options & opts_;
+    SessionPool pool_;
+    const uint32_t n_sessions_;
+    std::atomic<uint64_t> requests_{0};
+    std::mutex clients_mutex_;
+    std::vector<std::unique_ptr<Client>> clients_;
+};
+
+// Binds `path`, replacing a stale socket file but not a live daemon's.
+int listen_on(const std::string & path) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::fprintf(stderr, "socket path too long: %s\n", path.c_str());
+        return -1;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        std::perror("socket");
+        return -1;
+    }
+    if (connect(fd, (const sockaddr *) &addr, sizeof(addr)) == 0) {
+        std::fprintf(stderr, "another daemon is listening on %s\n", path.c_str());
+        close(fd);
+        return -1;
+    }
+    unlink(path.c_str());
+    // owner only: the socket serves whatever model is loaded to anyone who can connect
+    const mode_t old_mask = umask(0177);
+    const bool bound = bind(fd, (const sockaddr *) &addr, sizeof(addr)) == 0;
+    umask(old_mask);
+    if (!bound || listen(fd, 64) != 0) {
+        std::fprintf(stderr, "%s: %s\n", path.c_str(), std::strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+}  // namespace
+
+int main(int argc, char ** argv) {
+    Options opts;
+    if (!parse_args(argc, argv, opts)) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    maathai::LlamaEngine engine;
+    maathai::EngineConfig config;
+    config.model_path = opts.model_path;
+    config.n_ctx = opts.n_ctx;
+    config.n_threads = opts.n_threads;
+    config.n_batch = opts.n_batch;
+    if (!engine.load(config)) {
+        std::fprintf(stderr, "failed to load %s\n", opts.model_path.c_str());
+        return 1;
+    }
+    engine.set_conversation_mode(opts.conversation);
+    if (opts.adaptive_threads) {
+        engine.set_adaptive_threads(true);
+    }
+
+    std::vector<int> sessions = {maathai::LlamaEngine::kDefaultSession};
+    while ((int) sessions.size() < opts.sessions) {
+        const int session = engine.open_session();
+        if (session < 0) {
+            break;
+        }
+        sessions.push_back(session);
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    const int listen_fd = listen_on(opts.socket_path);
+    if (listen_fd < 0) {
+        return 1;
+    }
+    LOGI("serving %s on %s with %zu sessions", opts.model_path.c_str(), opts.socket_path.c_str(), sessions.size());
+
+    Daemon daemon(engine, opts, sessions);
+    daemon.serve(listen_fd);
+
+    close(listen_fd);
+    unlink(opts.socket_path.c_str());
+    engine.cancel_all();
+    LOGI("stopped");
+    return 0;
+}
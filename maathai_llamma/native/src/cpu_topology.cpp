@@ -0,0 +1,201 @@
+#include "cpu_topology.h"
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <tuple>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace maathai {
+
+namespace {
+
+std::string read_line(const std::string & path) {
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+long long read_number(const std::string & path) {
+    const std::string line = read_line(path);
+    return line.empty() ? 0 : std::atoll(line.c_str());
+}
+
+// Online cpus from "<root>/online", or every cpuN directory when it is missing.
+std::vector<int> online_cpus(const std::string & root) {
+    std::vector<int> cpus = parse_cpu_list(read_line(root + "/online"));
+    if (!cpus.empty()) {
+        return cpus;
+    }
+    DIR * dir = opendir(root.c_str());
+    if (dir == nullptr) {
+        return cpus;
+    }
+    while (dirent * entry = readdir(dir)) {
+        const char * name = entry->d_name;
+        if (name[0] == 'c' && name[1] == 'p' && name[2] == 'u' && std::isdigit((unsigned char) name[3])) {
+            char * end = nullptr;
+            const long id = std::strtol(name + 3, &end, 10);
+            if (*end == '\0') {
+                cpus.push_back((int) id);
+            }
+        }
+    }
+    closedir(dir);
+    std::sort(cpus.begin(), cpus.end());
+    return cpus;
+}
+
+}  // namespace
+
+std::vector<int> parse_cpu_list(const std::string & text) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        char * end = nullptr;
+        const long first = std::strtol(text.c_str() + pos, &end, 10);
+        if (end == text.c_str() + pos || first < 0) {
+            return {};
+        }
+        long last = first;
+        pos = (size_t) (end - text.c_str());
+        if (pos < text.size() && text[pos] == '-') {
+            const char * start = text.c_str() + pos + 1;
+            last = std::strtol(start, &end, 10);
+            if (end == start || last < first) {
+                return {};
+            }
+            pos = (size_t) (end - text.c_str());
+        }
+        for (long id = first; id <= last; ++id) {
+            cpus.push_back((int) id);
+        }
+        if (pos < text.size() && (text[pos] == ',' || text[pos] == '\n')) {
+            ++pos;
+        } else if (pos < text.size()) {
+            return {};
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+CpuTopology read_cpu_topology(const std::string & sysfs_root) {
+    CpuTopology topology;
+    const std::vector<int> cpus = online_cpus(sysfs_root);
+
+    // Per-core performance figures and the raw sibling list of each core.
+    std::vector<std::string> siblings;
+    bool all_have_capacity = true;
+    for (const int id : cpus) {
+        const std::string base = sysfs_root + "/cpu" + std::to_string(id);
+        CpuCore core;
+        core.id = id;
+        core.max_freq_khz = (uint64_t) std::max(0LL, read_number(base + "/cpufreq/cpuinfo_max_freq"));
+        core.capacity = (int) std::max(0LL, read_number(base + "/cpu_capacity"));
+        all_have_capacity = all_have_capacity && core.capacity > 0;
+        std::string group = read_line(base + "/cpufreq/related_cpus");
+        if (group.empty()) {
+            group = read_line(base + "/topology/cluster_cpus_list");
+        }
+        topology.cores.push_back(core);
+        siblings.push_back(group);
+    }
+
+    // Capacity is the scheduler's own ranking and folds in the
+    // microarchitecture; frequency is only a proxy for it.
+    auto performance = [&](const CpuCore & core) -> uint64_t {
+        return all_have_capacity ? (uint64_t) core.capacity : core.max_freq_khz;
+    };
+    using Key = std::tuple<uint64_t, uint64_t, int, std::string>;
+    std::map<Key, std::vector<int>> groups;
+    for (size_t i = 0; i < topology.cores.size(); ++i) {
+        const CpuCore & core = topology.cores[i];
+        // descending performance: negate through the complement
+        groups[Key(~performance(core), ~core.max_freq_khz, -core.capacity, siblings[i])].push_back(core.id);
+    }
+    for (auto & group : groups) {
+        const int cluster = (int) topology.clusters.size();
+        for (const int id : group.second) {
+            for (CpuCore & core : topology.cores) {
+                if (core.id == id) {
+                    core.cluster = cluster;
+                }
+            }
+        }
+        topology.clusters.push_back(std::move(group.second));
+        topology.cluster_performance.push_back(~std::get<0>(group.first));
+    }
+    return topology;
+}
+
+std::vector<int> CpuTopology::performance_cores() const {
+    std::vector<int> cpus;
+    for (size_t i = 0; i < clusters.size(); ++i) {
+        if (!heterogeneous() || cluster_performance[i] > cluster_performance.back()) {
+            cpus.insert(cpus.end(), clusters[i].begin(), clusters[i].end());
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    return cpus;
+}
+
+std::vector<int> CpuTopology::fastest_cores(int n) const {
+    std::vector<int> cpus;
+    for (const auto & cluster : clusters) {
+        for (const int id : cluster) {
+            if ((int) cpus.size() >= n) {
+                return cpus;
+            }
+            cpus.push_back(id);
+        }
+    }
+    return cpus;
+}
+
+std::vector<int> current_thread_cpus() {
+    std::vector<int> cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int id = 0; id < CPU_SETSIZE; ++id) {
+            if (CPU_ISSET(id, &set)) {
+                cpus.push_back(id);
+            }
+        }
+    }
+#endif
+    return cpus;
+}
+
+bool pin_current_thread(const std::vector<int> & cpus) {
+#if defined(__linux__)
+    if (cpus.empty()) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int id : cpus) {
+        if (id >= 0 && id < CPU_SETSIZE) {
+            CPU_SET(id, &set);
+        }
+    }
+    // pid 0 is the calling thread, not the whole process
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void) cpus;
+    return false;
+#endif
+}
+
+}  // namespace maathai
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace maathai {
+
+// One online CPU as described under /sys/devices/system/cpu/cpuN.
+struct CpuCore {
+    int id = 0;
+    uint64_t max_freq_khz = 0; // cpufreq/cpuinfo_max_freq, 0 if unknown
+    int capacity = 0;          // cpu_capacity (1024 = biggest core), 0 if unknown
+    int cluster = 0;           // index into CpuTopology::clusters
+};
+
+// Cores grouped into clusters of identical cores, fastest cluster first.
+// Cluster siblings come from cpufreq/related_cpus (one DVFS policy per core
+// type on big.LITTLE and DynamIQ parts), falling back to
+// topology/cluster_cpus_list; siblings that still differ in capacity or
+// frequency are split, since DynamIQ reports every core in one cluster.
+// Clusters are ranked by capacity when every core reports one, otherwise by
+// max frequency.
+struct CpuTopology {
+    std::vector<CpuCore> cores;              // ascending id
+    std::vector<std::vector<int>> clusters;  // cpu ids, fastest cluster first
+    std::vector<uint64_t> cluster_performance; // rank of each cluster
+
+    bool empty() const { return cores.empty(); }
+    bool heterogeneous() const {
+        return !cluster_performance.empty() && cluster_performance.front() != cluster_performance.back();
+    }
+    // Every core faster than the slowest cluster (all cores when homogeneous).
+    std::vector<int> performance_cores() const;
+    // The `n` fastest cores, fastest first; ties keep ascending ids.
+    std::vector<int> fastest_cores(int n) const;
+};
+
+// Reads the topology below `sysfs_root`; an empty result means it could not be
+// determined. Tests point `sysfs_root` at a fake tree.
+CpuTopology read_cpu_topology(const std::string & sysfs_root = "/sys/devices/system/cpu");
+
+// Parses kernel cpu lists such as "0-3,6"; malformed input yields an empty list.
+std::vector<int> parse_cpu_list(const std::string & text);
+
+// Affinity of the calling thread, so it can be restored after pinning.
+std::vector<int> current_thread_cpus();
+// Restricts the calling thread to `cpus`; false if the kernel refused or the
+// platform has no affinity API.
+bool pin_current_thread(const std::vector<int> & cpus);
+
+}  // namespace maathai
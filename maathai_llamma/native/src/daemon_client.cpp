@@ -0,0 +1,125 @@
+#include "daemon_client.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace maathai {
+
+DaemonClient::~DaemonClient() {
+    close();
+}
+
+bool DaemonClient::connect(const std::string & socket_path) {
+    close();
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        return fail("socket path too long: " + socket_path);
+    }
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return fail(std::string("socket: ") + std::strerror(errno));
+    }
+    if (::connect(fd, (const sockaddr *) &addr, sizeof(addr)) != 0) {
+        const int err = errno;
+        ::close(fd);
+        return fail(socket_path + ": " + std::strerror(err));
+    }
+    fd_ = fd;
+    error_.clear();
+    return true;
+}
+
+void DaemonClient::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool DaemonClient::generate(const DaemonGenerate & request, DaemonResult & result, const FrameCallback & on_frame) {
+    if (fd_ < 0) {
+        return fail("not connected");
+    }
+    const uint32_t id = next_request_++;
+    encode_daemon_generate(request, body_);
+    active_.store(id);
+    if (!send(DaemonMessage::kGenerate, id, body_)) {
+        active_.store(0);
+        return false;
+    }
+    bool ok = false;
+    while (true) {
+        if (!read_daemon_frame(fd_, frame_)) {
+            fail("connection closed");
+            close();
+            break;
+        }
+        if (frame_.request != id) {
+            continue; // a late reply to an earlier, cancelled request
+        }
+        if (frame_.type == DaemonMessage::kStream) {
+            if (!decode_stream_frame(frame_.body.data(), frame_.body.size(), stream_)) {
+                fail("malformed stream frame");
+                close();
+                break;
+            }
+            if (on_frame) {
+                on_frame(stream_);
+            }
+        } else if (frame_.type == DaemonMessage::kDone) {
+            ok = decode_daemon_result(frame_.body, result) || fail("malformed result");
+            break;
+        } else if (frame_.type == DaemonMessage::kError) {
+            std::string message;
+            fail(decode_daemon_string(frame_.body, message) ? message : "request refused");
+            break;
+        }
+    }
+    active_.store(0);
+    return ok;
+}
+
+bool DaemonClient::cancel() {
+    const uint32_t id = active_.load();
+    if (id == 0) {
+        return false;
+    }
+    // leaves error_ to the thread in generate()
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return write_daemon_frame(fd_, DaemonMessage::kCancel, id, nullptr, 0);
+}
+
+bool DaemonClient::info(DaemonInfo & out) {
+    if (fd_ < 0) {
+        return fail("not connected");
+    }
+    const uint32_t id = next_request_++;
+    if (!send(DaemonMessage::kInfo, id, {})) {
+        return false;
+    }
+    while (read_daemon_frame(fd_, frame_)) {
+        if (frame_.request == id && frame_.type == DaemonMessage::kInfoReply) {
+            return decode_daemon_info(frame_.body, out) || fail("malformed info");
+        }
+    }
+    close();
+    return fail("connection closed");
+}
+
+bool DaemonClient::send(DaemonMessage type, uint32_t request, const std::vector<uint8_t> & body) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    return write_daemon_frame(fd_, type, request, body) || fail(std::string("send: ") + std::strerror(errno));
+}
+
+bool DaemonClient::fail(const std::string & message) {
+    error_ = message;
+    return false;
+}
+
+}  // namespace maathai
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include "daemon_wire.h"
+#include "stream_frame.h"
+
+namespace maathai {
+
+// One connection to maathai_daemon. Requests on a connection run one at a
+// time; the daemon multiplexes connections onto its engine sessions, so
+// concurrency comes from opening several clients. cancel() may be called
+// from any thread while generate() blocks.
+class DaemonClient {
+public:
+    // Runs on the thread inside generate(), once per forwarded frame.
+    using FrameCallback = std::function<void(const StreamFrame & frame)>;
+
+    DaemonClient() = default;
+    ~DaemonClient();
+
+    DaemonClient(const DaemonClient &) = delete;
+    DaemonClient & operator=(const DaemonClient &) = delete;
+
+    bool connect(const std::string & socket_path);
+    void close();
+    // Turns false once the connection broke; connect() again to retry.
+    bool connected() const { return fd_ >= 0; }
+
+    // Runs `request` to completion. Streamed frames go to `on_frame`; the
+    // response text of a non-streaming request comes back in result.text.
+    // Returns false when the daemon refused the request or the connection
+    // broke (error() says which). A cancelled request still returns true,
+    // with result.cancelled set and whatever was generated up to then.
+    bool generate(const DaemonGenerate & request, DaemonResult & result, const FrameCallback & on_frame = {});
+    // Stops the request generate() is running; false when none is.
+    bool cancel();
+    bool info(DaemonInfo & out);
+
+    const std::string & error() const { return error_; }
+
+private:
+    bool send(DaemonMessage type, uint32_t request, const std::vector<uint8_t> & body);
+    bool fail(const std::string & message);
+
+    int fd_ = -1;
+    std::mutex write_mutex_;
+    std::atomic<uint32_t> active_{0}; // request generate() waits on; 0 when idle
+    uint32_t next_request_ = 1;
+    std::string error_;
+    // Reused between requests.
+    std::vector<uint8_t> body_;
+    DaemonFrame frame_;
+    StreamFrame stream_;
+};
+
+}  // namespace maathai
@@ -0,0 +1,234 @@
+#include "daemon_wire.h"
+
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace maathai {
+
+namespace {
+
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+constexpr uint8_t kGenerateStream = 1u << 0;
+constexpr uint8_t kGenerateLogprobs = 1u << 1;
+constexpr uint8_t kResultOk = 1u << 0;
+constexpr uint8_t kResultCancelled = 1u << 1;
+
+// Native order is the wire order on every target (see stream_frame.cpp).
+class Writer {
+public:
+    explicit Writer(std::vector<uint8_t> & out) : out_(out) { out_.clear(); }
+
+    template <typename T>
+    void put(T value) {
+        const size_t at = out_.size();
+        out_.resize(at + sizeof(T));
+        std::memcpy(out_.data() + at, &value, sizeof(T));
+    }
+
+    void put_string(const std::string & value) {
+        put((uint32_t) value.size());
+        out_.insert(out_.end(), value.begin(), value.end());
+    }
+
+private:
+    std::vector<uint8_t> & out_;
+};
+
+class Reader {
+public:
+    explicit Reader(const std::vector<uint8_t> & body) : data_(body.data()), left_(body.size()) {}
+
+    template <typename T>
+    bool get(T & value) {
+        if (left_ < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, data_, sizeof(T));
+        data_ += sizeof(T);
+        left_ -= sizeof(T);
+        return true;
+    }
+
+    bool get_string(std::string & value) {
+        uint32_t size = 0;
+        if (!get(size) || left_ < size) {
+            return false;
+        }
+        value.assign((const char *) data_, size);
+        data_ += size;
+        left_ -= size;
+        return true;
+    }
+
+    bool done() const { return left_ == 0; }
+
+private:
+    const uint8_t * data_;
+    size_t left_;
+};
+
+bool send_all(int fd, const uint8_t * data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = send(fd, data, size, kSendFlags);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= (size_t) n;
+    }
+    return true;
+}
+
+bool recv_all(int fd, uint8_t * data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= (size_t) n;
+    }
+    return true;
+}
+
+}  // namespace
+
+void encode_daemon_generate(const DaemonGenerate & in, std::vector<uint8_t> & out) {
+    Writer writer(out);
+    writer.put(in.n_predict);
+    writer.put((uint8_t) ((in.stream ? kGenerateStream : 0) | (in.logprobs ? kGenerateLogprobs : 0)));
+    writer.put(in.priority);
+    writer.put((uint32_t) in.messages.size());
+    for (const DaemonChatMessage & message : in.messages) {
+        writer.put_string(message.role);
+        writer.put_string(message.content);
+    }
+}
+
+bool decode_daemon_generate(const std::vector<uint8_t> & body, DaemonGenerate & out) {
+    Reader reader(body);
+    uint8_t flags = 0;
+    uint32_t n_messages = 0;
+    if (!reader.get(out.n_predict) || !reader.get(flags) || !reader.get(out.priority) || !reader.get(n_messages)) {
+        return false;
+    }
+    out.stream = (flags & kGenerateStream) != 0;
+    out.logprobs = (flags & kGenerateLogprobs) != 0;
+    // each message takes at least its two lengths
+    if (n_messages > body.size() / 8) {
+        return false;
+    }
+    out.messages.resize(n_messages);
+    for (DaemonChatMessage & message : out.messages) {
+        if (!reader.get_string(message.role) || !reader.get_string(message.content)) {
+            return false;
+        }
+    }
+    return reader.done();
+}
+
+void encode_daemon_result(const DaemonResult & in, std::vector<uint8_t> & out) {
+    Writer writer(out);
+    writer.put((uint8_t) ((in.ok ? kResultOk : 0) | (in.cancelled ? kResultCancelled : 0)));
+    writer.put(in.prompt_tokens);
+    writer.put(in.cached_tokens);
+    writer.put(in.generated_tokens);
+    writer.put(in.queue_ms);
+    writer.put(in.total_ms);
+    writer.put_string(in.text);
+}
+
+bool decode_daemon_result(const std::vector<uint8_t> & body, DaemonResult & out) {
+    Reader reader(body);
+    uint8_t flags = 0;
+    if (!reader.get(flags) || !reader.get(out.prompt_tokens) || !reader.get(out.cached_tokens) ||
+        !reader.get(out.generated_tokens) || !reader.get(out.queue_ms) || !reader.get(out.total_ms) ||
+        !reader.get_string(out.text)) {
+        return false;
+    }
+    out.ok = (flags & kResultOk) != 0;
+    out.cancelled = (flags & kResultCancelled) != 0;
+    return reader.done();
+}
+
+void encode_daemon_info(const DaemonInfo & in, std::vector<uint8_t> & out) {
+    Writer writer(out);
+    writer.put_string(in.model);
+    writer.put(in.n_ctx);
+    writer.put(in.sessions);
+    writer.put(in.clients);
+    writer.put(in.requests);
+}
+
+bool decode_daemon_info(const std::vector<uint8_t> & body, DaemonInfo & out) {
+    Reader reader(body);
+    return reader.get_string(out.model) && reader.get(out.n_ctx) && reader.get(out.sessions) &&
+           reader.get(out.clients) && reader.get(out.requests) && reader.done();
+}
+
+void encode_daemon_string(const std::string & in, std::vector<uint8_t> & out) {
+    Writer(out).put_string(in);
+}
+
+bool decode_daemon_string(const std::vector<uint8_t> & body, std::string & out) {
+    Reader reader(body);
+    return reader.get_string(out) && reader.done();
+}
+
+bool write_daemon_frame(int fd, DaemonMessage type, uint32_t request, const uint8_t * body, size_t size) {
+    if (size > kDaemonMaxFrameBytes - 5) {
+        return false;
+    }
+    std::vector<uint8_t> frame(kDaemonFrameHeaderBytes + size);
+    const uint32_t length = (uint32_t) size + 5;
+    const uint8_t kind = (uint8_t) type;
+    std::memcpy(frame.data(), &length, 4);
+    std::memcpy(frame.data() + 4, &kind, 1);
+    std::memcpy(frame.data() + 5, &request, 4);
+    if (size > 0) {
+        std::memcpy(frame.data() + kDaemonFrameHeaderBytes, body, size);
+    }
+    return send_all(fd, frame.data(), frame.size());
+}
+
+bool write_daemon_frame(int fd, DaemonMessage type, uint32_t request, const std::vector<uint8_t> & body) {
+    return write_daemon_frame(fd, type, request, body.data(), body.size());
+}
+
+bool read_daemon_frame(int fd, DaemonFrame & out) {
+    uint8_t header[kDaemonFrameHeaderBytes];
+    if (!recv_all(fd, header, sizeof(header))) {
+        return false;
+    }
+    uint32_t length = 0;
+    std::memcpy(&length, header, 4);
+    if (length < 5 || length > kDaemonMaxFrameBytes) {
+        return false;
+    }
+    out.type = (DaemonMessage) header[4];
+    std::memcpy(&out.request, header + 5, 4);
+    out.body.resize(length - 5);
+    return out.body.empty() || recv_all(fd, out.body.data(), out.body.size());
+}
+
+std::string default_daemon_socket_path() {
+    const char * runtime = std::getenv("XDG_RUNTIME_DIR");
+    const std::string dir = runtime != nullptr && runtime[0] != '\0' ? runtime : "/tmp";
+    return dir + "/maathai.sock";
+}
+
+}  // namespace maathai
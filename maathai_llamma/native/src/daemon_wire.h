@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace maathai {
+
+// Framing between maathai_daemon and its clients over a Unix stream socket
+// (little-endian, like the stream frames it carries):
+//
+//   u32 size     bytes after this field: 5 + body
+//   u8  type     DaemonMessage
+//   u32 request  picked by the client, echoed on every reply to it
+//   u8  body[size - 5]
+//
+// Strings in bodies are u32 byte count + UTF-8 bytes.
+constexpr uint32_t kDaemonFrameHeaderBytes = 9;
+constexpr uint32_t kDaemonMaxFrameBytes = 16u << 20;
+
+enum class DaemonMessage : uint8_t {
+    // client -> daemon
+    kGenerate = 1, // DaemonGenerate; answered by kStream frames (streams) and one kDone
+    kCancel = 2,   // empty body; `request` names the request to stop
+    kInfo = 3,     // empty body; answered by kInfoReply
+    // daemon -> client
+    kStream = 16,    // one encode_stream_frame() frame
+    kDone = 17,      // DaemonResult
+    kError = 18,     // string: why the request was refused
+    kInfoReply = 19, // DaemonInfo
+};
+
+struct DaemonChatMessage {
+    std::string role;
+    std::string content;
+};
+
+// Body of kGenerate:
+//   i32 n_predict, u8 flags (bit 0 stream, bit 1 logprobs), u8 priority
+//   (RequestPriority), u32 n_messages, then role and content per message.
+struct DaemonGenerate {
+    std::vector<DaemonChatMessage> messages;
+    int32_t n_predict = 256;
+    bool stream = true;
+    bool logprobs = false;
+    uint8_t priority = 1; // RequestPriority::kNormal
+};
+
+// Body of kDone:
+//   u8 flags (bit 0 ok, bit 1 cancelled), u32 prompt_tokens,
+//   u32 cached_tokens, u32 generated_tokens, f64 queue_ms, f64 total_ms,
+//   string text (the whole response without streaming, else empty).
+// queue_ms is the wait for a free engine session; total_ms runs from the
+// daemon reading the request to the end of generation.
+struct DaemonResult {
+    bool ok = false;
+    bool cancelled = false;
+    uint32_t prompt_tokens = 0;
+    uint32_t cached_tokens = 0;
+    uint32_t generated_tokens = 0;
+    double queue_ms = 0.0;
+    double total_ms = 0.0;
+    std::string text;
+};
+
+// Body of kInfoReply:
+//   string model, u32 n_ctx, u32 sessions, u32 clients, u64 requests.
+struct DaemonInfo {
+    std::string model;
+    uint32_t n_ctx = 0;
+    uint32_t sessions = 0; // engine sessions requests are multiplexed onto
+    uint32_t clients = 0;  // connections open now
+    uint64_t requests = 0; // served since start
+};
+
+struct DaemonFrame {
+    DaemonMessage type = DaemonMessage::kInfo;
+    uint32_t request = 0;
+    std::vector<uint8_t> body;
+};
+
+// Body codecs. Encoders overwrite `out`; decoders return false for a body
+// that is truncated or has trailing bytes.
+void encode_daemon_generate(const DaemonGenerate & in, std::vector<uint8_t> & out);
+bool decode_daemon_generate(const std::vector<uint8_t> & body, DaemonGenerate & out);
+void encode_daemon_result(const DaemonResult & in, std::vector<uint8_t> & out);
+bool decode_daemon_result(const std::vector<uint8_t> & body, DaemonResult & out);
+void encode_daemon_info(const DaemonInfo & in, std::vector<uint8_t> & out);
+bool decode_daemon_info(const std::vector<uint8_t> & body, DaemonInfo & out);
+void encode_daemon_string(const std::string & in, std::vector<uint8_t> & out);
+bool decode_daemon_string(const std::vector<uint8_t> & body, std::string & out);
+
+// Blocking socket I/O, retrying on EINTR and short transfers. Writes one
+// whole frame with a single send so concurrent writers holding the same
+// lock never interleave; never raises SIGPIPE. Reads return false on EOF,
+// an error or a frame over kDaemonMaxFrameBytes.
+bool write_daemon_frame(int fd, DaemonMessage type, uint32_t request, const uint8_t * body, size_t size);
+bool write_daemon_frame(int fd, DaemonMessage type, uint32_t request, const std::vector<uint8_t> & body);
+bool read_daemon_frame(int fd, DaemonFrame & out);
+
+// Where the daemon listens unless told otherwise: $XDG_RUNTIME_DIR (private
+// to the user on desktop Linux) or /tmp.
+std::string default_daemon_socket_path();
+
+}  // namespace maathai
@@ -0,0 +1,47 @@
+#include "embed_batch.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace maathai {
+
+std::vector<EmbedBatch> plan_embed_batches(const std::vector<int> & lengths, int n_batch, int n_seq) {
+    std::vector<EmbedBatch> batches;
+    if (n_batch <= 0 || n_seq <= 0) {
+        return batches;
+    }
+    EmbedBatch current;
+    for (size_t i = 0; i < lengths.size(); ++i) {
+        const int n = std::min(std::max(lengths[i], 0), n_batch);
+        if (current.count > 0 &&
+            (current.n_tokens + n > n_batch || current.count == (size_t) n_seq)) {
+            batches.push_back(current);
+            current = EmbedBatch{};
+        }
+        if (current.count == 0) {
+            current.first = i;
+        }
+        ++current.count;
+        current.n_tokens += n;
+    }
+    if (current.count > 0) {
+        batches.push_back(current);
+    }
+    return batches;
+}
+
+void l2_normalize(float * v, size_t n) {
+    double sum = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += (double) v[i] * v[i];
+    }
+    if (sum <= 0.0) {
+        return;
+    }
+    const float scale = (float) (1.0 / std::sqrt(sum));
+    for (size_t i = 0; i < n; ++i) {
+        v[i] *= scale;
+    }
+}
+
+}  // namespace maathai
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace maathai {
+
+// One llama_decode worth of texts: [first, first + count) in input order,
+// each on its own sequence id (0..count-1), `n_tokens` in total.
+struct EmbedBatch {
+    size_t first = 0;
+    size_t count = 0;
+    int n_tokens = 0;
+};
+
+// Packs texts of the given token lengths into as few batches as possible
+// while keeping their order: a batch closes when the next text would push it
+// past `n_batch` tokens or `n_seq` sequences. Pooled embeddings need a whole
+// sequence in one batch, so lengths must already be truncated to n_batch;
+// longer ones are clamped here. Empty texts still take a sequence.
+std::vector<EmbedBatch> plan_embed_batches(const std::vector<int> & lengths, int n_batch, int n_seq);
+
+// Scales `v` to unit L2 norm; an all-zero vector is left as is.
+void l2_normalize(float * v, size_t n);
+
+}  // namespace maathai
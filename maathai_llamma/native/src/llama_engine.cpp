@@ -0,0 +1,2945 @@
+#include "llama_engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "ggml-cpu.h"
+#include "maathai_log.h"
+#include "memory_plan.h"
+#include "tune_profile.h"
+
+namespace maathai {
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr int kUnboundedSafetyCap = 1024;
+
+constexpr uint64_t kSmallModelParamLimit = 2000000000ULL; // 2B params
+constexpr int kSmallModelCtxDefault = 1024;
+constexpr int kSmallModelCtxCap = 2048;
+constexpr int kSmallModelThreadCeil = 4;
+constexpr int kSmallModelBatch = 32;
+constexpr int kDefaultCtxFallback = 4096;
+constexpr int kDefaultBatch = 64;
+
+// Calibration prompt length; also the largest n_batch worth sweeping.
+constexpr int kTunePromptTokens = 128;
+constexpr int kTuneDecodeTokens = 16;
+constexpr const char * kTuneText =
+    "The quick brown fox jumps over the lazy dog near the river bank. "
+    "Farmers in the highlands plant trees to hold the soil after the rains. ";
+
+// Warmup prompt: enough tokens to run the batched (prefill) graph.
+constexpr int kWarmupPromptTokens = 32;
+constexpr int kWarmupSteps = 2; // the prompt, then one decode step
+
+constexpr int kDefaultDraft = 8;
+// Drafting stops at the first token the draft itself is unsure of; those are
+// the ones the target rejects anyway.
+constexpr float kDraftMinProb = 0.6f;
+// Vocabulary checks as in llama.cpp's speculative example: a few trailing
+// added tokens may differ, and the first ids are control tokens.
+constexpr int kDraftVocabSlack = 128;
+constexpr int kDraftVocabCheckStart = 5;
+
+// Embedding batches: plenty for note-sized snippets without the compute
+// buffers of a long-context prefill. 256 is llama.cpp's sequence limit.
+constexpr int kDefaultEmbedBatch = 1024;
+constexpr int kDefaultEmbedSeqs = 64;
+constexpr int kMaxEmbedSeqs = 256;
+
+double elapsed_ms(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+// ggml only has a flash-attention kernel for quantized V, so asking for one
+// turns flash attention on; with it explicitly off V stays f16.
+void resolve_attention(const EngineConfig & config, KvCacheType & type_v, FlashAttention & flash_attn) {
+    type_v = config.type_v;
+    flash_attn = config.flash_attn;
+    if (type_v != KvCacheType::kF16) {
+        if (flash_attn == FlashAttention::kOff) {
+            type_v = KvCacheType::kF16;
+        } else {
+            flash_attn = FlashAttention::kOn;
+        }
+    }
+}
+
+MemoryPlan plan_for_budget(const EngineConfig & config, const GgufModelInfo & info, KvCacheType type_v,
+                           FlashAttention flash_attn) {
+    return plan_memory(info, config.memory_budget_bytes, config.n_ctx,
+                       config.n_batch > 0 ? config.n_batch : kDefaultBatch, config.n_ubatch,
+                       config.type_k, type_v, flash_attn == FlashAttention::kOn);
+}
+
+// Context and batch before any tuning profile: the plan's when there is one,
+// the size heuristics otherwise.
+void resolve_context(const EngineConfig & config, const MemoryPlan & plan, bool small_model, int & n_ctx,
+                     int & n_batch) {
+    n_ctx = plan.fits ? plan.n_ctx : config.n_ctx;
+    if (n_ctx <= 0) {
+        n_ctx = small_model ? kSmallModelCtxDefault : kDefaultCtxFallback;
+    }
+    if (!plan.fits && small_model && n_ctx > kSmallModelCtxCap) {
+        n_ctx = kSmallModelCtxCap;
+    }
+    n_batch = config.n_batch > 0 ? config.n_batch : (small_model ? kSmallModelBatch : kDefaultBatch);
+    // the plan may have shrunk the batch to make room for context
+    n_batch = std::min(n_batch, plan.fits ? plan.n_batch : n_ctx);
+}
+
+int resolve_ubatch(const EngineConfig & config, int n_batch) {
+    return config.n_ubatch > 0 ? std::min(config.n_ubatch, n_batch) : n_batch;
+}
+
+double elapsed_us(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double, std::micro>(to - from).count();
+}
+
+int64_t clock_us(Clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+}
+
+// Trace lanes: the scheduler's batches, then each session's request phases,
+// then each session's stream consumer.
+constexpr uint32_t kSchedulerLane = 0;
+
+uint32_t session_lane(int session) {
+    return 1 + (uint32_t) session;
+}
+
+uint32_t consumer_lane(int session) {
+    return 1 + (uint32_t) (LlamaEngine::kMaxSessions + session);
+}
+
+void batch_add(llama_batch & batch, llama_token token, llama_pos pos, llama_seq_id seq_id, bool logits) {
+    const int i = batch.n_tokens;
+    batch.token[i] = token;
+    batch.pos[i] = pos;
+    batch.n_seq_id[i] = 1;
+    batch.seq_id[i][0] = seq_id;
+    batch.logits[i] = logits ? 1 : 0;
+    batch.n_tokens = i + 1;
+}
+
+ggml_type to_ggml_type(KvCacheType type) {
+    switch (type) {
+        case KvCacheType::kQ8_0: return GGML_TYPE_Q8_0;
+        case KvCacheType::kQ4_0: return GGML_TYPE_Q4_0;
+        case KvCacheType::kF16: break;
+    }
+    return GGML_TYPE_F16;
+}
+
+enum llama_pooling_type to_llama_pooling(EmbeddingPooling pooling) {
+    switch (pooling) {
+        case EmbeddingPooling::kMean: return LLAMA_POOLING_TYPE_MEAN;
+        case EmbeddingPooling::kCls: return LLAMA_POOLING_TYPE_CLS;
+        case EmbeddingPooling::kLast: return LLAMA_POOLING_TYPE_LAST;
+        case EmbeddingPooling::kModel: break;
+    }
+    return LLAMA_POOLING_TYPE_UNSPECIFIED;
+}
+
+std::string cpu_list_string(const std::vector<int> & cpus) {
+    std::string out;
+    for (const int id : cpus) {
+        out += (out.empty() ? "" : ",") + std::to_string(id);
+    }
+    return out;
+}
+
+// One worker per cpu in `cpus`, each held to its own core. The workers are
+// created while this thread carries the same mask, so they inherit it even
+// where ggml cannot set affinity itself (bionic has no
+// pthread_setaffinity_np).
+ggml_threadpool * new_pinned_threadpool(const std::vector<int> & cpus) {
+    ggml_threadpool_params params = ggml_threadpool_params_default((int) cpus.size());
+    for (const int id : cpus) {
+        if (id >= 0 && id < GGML_MAX_N_THREADS) {
+            params.cpumask[id] = true;
+        }
+    }
+    params.strict_cpu = true;
+    const std::vector<int> saved = current_thread_cpus();
+    pin_current_thread(cpus);
+    ggml_threadpool * pool = ggml_threadpool_new(&params);
+    pin_current_thread(saved);
+    return pool;
+}
+
+// Token ids from the draft must mean the same text to the target.
+bool vocabs_compatible(const llama_vocab * target, const llama_vocab * draft) {
+    if (llama_vocab_type(target) != llama_vocab_type(draft) ||
+        llama_vocab_bos(target) != llama_vocab_bos(draft) ||
+        llama_vocab_eos(target) != llama_vocab_eos(draft)) {
+        return false;
+    }
+    const int n_target = llama_vocab_n_tokens(target);
+    const int n_draft = llama_vocab_n_tokens(draft);
+    if (std::abs(n_target - n_draft) > kDraftVocabSlack) {
+        return false;
+    }
+    for (int i = kDraftVocabCheckStart; i < std::min(n_target, n_draft); ++i) {
+        if (std::strcmp(llama_vocab_get_text(target, i), llama_vocab_get_text(draft, i)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Most likely token among the first `n_vocab` logits and its probability.
+llama_token greedy_token(const float * logits, int n_vocab, float & prob) {
+    int best = 0;
+    for (int i = 1; i < n_vocab; ++i) {
+        if (logits[i] > logits[best]) {
+            best = i;
+        }
+    }
+    double sum = 0.0;
+    for (int i = 0; i < n_vocab; ++i) {
+        sum += std::exp((double) (logits[i] - logits[best]));
+    }
+    prob = (float) (1.0 / sum);
+    return best;
+}
+
+}  // namespace
+
+// A KV sequence plus the request currently running on it. Everything except
+// the atomics and the consumer-side stream state is guarded by mutex_.
+struct LlamaEngine::Session {
+    enum class Phase { kIdle, kPrefill, kDecode };
+
+    explicit Session(int session_id) : id(session_id) {}
+
+    const int id; // also the llama_seq_id
+    bool open = false;
+    TokenSampler sampler;
+    SamplerTimings sampling_base; // sampler.timings() when the request started
+    // Tokens currently held in this session's KV sequence, in position order.
+    std::vector<llama_token> history;
+    // Leading history tokens from prime_prefix() that survive requests
+    // outside conversation mode.
+    size_t pinned_prefix = 0;
+    // Context shifting. Tokens [shift_keep, shift_keep + dropped.size()) of
+    // the conversation were evicted from the KV sequence; history holds the
+    // rest with positions renumbered to stay contiguous.
+    ContextShift shift;
+    size_t shift_keep = 0;
+    std::vector<llama_token> dropped;
+    // LoRA adapters the KV sequence was computed with, and the set from
+    // set_session_loras() that the next request adopts.
+    LoraSet loras;
+    LoraSet loras_next;
+
+    // In-flight request, advanced by the scheduler.
+    Phase phase = Phase::kIdle;
+    Request request;
+    std::vector<llama_token> prompt;
+    size_t prompt_pos = 0;       // next prompt token to decode
+    size_t chunk_end = 0;        // prompt_pos after the batch being decoded
+    int n_past = 0;              // prompt tokens reused from the KV sequence
+    int target = 0;
+    int generated = 0;
+    llama_token next_token = -1; // sampled and emitted, decoded next step
+    bool stop_after_next = false;
+    bool decoding = false;       // next_token is in the current batch
+    int logits_index = -1;       // batch row holding this session's logits
+    bool batched = false;        // runs with this step's LoRA set
+    RequestPriority step_priority = RequestPriority::kNormal; // priority as of this step
+    uint64_t finished = 0;       // completed requests, for generate() waiters
+    Clock::time_point t_start;
+    Clock::time_point t_first_piece;
+    Clock::time_point t_token;
+    Clock::time_point t_queued;
+    bool queued = false;         // submitted, no prompt chunk decoded yet
+    RequestMetrics metrics;      // in-flight request
+    RequestMetrics last_metrics; // most recent finished request
+    std::atomic_bool cancel{false};
+    std::atomic_bool active{false};
+    // Read by the abort callback on ggml's threads while a batch decodes.
+    std::atomic_bool in_batch{false};
+    std::atomic<RequestPriority> priority{RequestPriority::kNormal};
+    std::atomic<int64_t> cancel_us{0}; // clock_us() of the cancel() being served
+
+    // Speculative decoding. The draft context keeps a sequence with the same
+    // id, synced to history + next_token lazily before each draft.
+    std::vector<llama_token> draft_history;
+    std::vector<llama_token> drafts; // proposed for the batch being built
+    int draft_len = 1;               // adapts to the acceptance rate
+
+    // Streaming: scheduler -> platform consumer. A piece that finds the ring
+    // full is parked here and the session sits out batches until it fits,
+    // so a slow consumer only stalls its own session.
+    TokenRing ring{1024};
+    std::atomic_bool stream_logprobs{false};
+    bool piece_parked = false;
+    char parked_bytes[TokenRing::kSlotBytes];
+    size_t parked_len = 0;
+    PieceMeta parked_meta;
+    // Consumer-side state, only touched by the thread calling wait_for_frame().
+    std::string raw;
+    Utf8Assembler utf8;
+    // Request start as clock_us(), so the consumer can age each piece, and
+    // the handoff times of the current request (under metrics_mutex_).
+    std::atomic<int64_t> stream_start_us{0};
+    PhaseStat handoff;
+};
+
+const char * flash_attention_name(FlashAttention mode) {
+    switch (mode) {
+        case FlashAttention::kOff: return "off";
+        case FlashAttention::kOn: return "on";
+        case FlashAttention::kAuto: break;
+    }
+    return "auto";
+}
+
+const char * load_stage_name(LoadStage stage) {
+    switch (stage) {
+        case LoadStage::kPrefault: return "prefault";
+        case LoadStage::kWarmup: return "warmup";
+        case LoadStage::kWeights: break;
+    }
+    return "weights";
+}
+
+const char * embedding_pooling_name(EmbeddingPooling pooling) {
+    switch (pooling) {
+        case EmbeddingPooling::kMean: return "mean";
+        case EmbeddingPooling::kCls: return "cls";
+        case EmbeddingPooling::kLast: return "last";
+        case EmbeddingPooling::kModel: break;
+    }
+    return "model";
+}
+
+LlamaEngine::LlamaEngine() {
+    sessions_.reserve(kMaxSessions);
+    for (int i = 0; i < kMaxSessions; ++i) {
+        sessions_.push_back(std::make_unique<Session>(i));
+    }
+    sessions_[kDefaultSession]->open = true;
+    trace_.name_lane(kSchedulerLane, "scheduler");
+    for (int i = 0; i < kMaxSessions; ++i) {
+        trace_.name_lane(session_lane(i), "session " + std::to_string(i));
+        trace_.name_lane(consumer_lane(i), "session " + std::to_string(i) + " consumer");
+    }
+}
+
+LlamaEngine::~LlamaEngine() {
+    release();
+}
+
+void LlamaEngine::init_backend() {
+    static std::once_flag init_flag;
+    std::call_once(init_flag, []() {
+        llama_backend_init();
+    });
+}
+
+bool LlamaEngine::load(const EngineConfig & config) {
+    init_backend();
+
+    if (config.model_path.empty()) {
+        LOGE("load(): empty path");
+        return false;
+    }
+
+    release();
+    const auto t_load = Clock::now();
+    load_report_ = LoadReport{};
+    load_report_.file_bytes = file_size_bytes(config.model_path);
+    load_report_.use_mmap = config.use_mmap;
+    load_report_.use_mlock = config.use_mlock;
+
+    KvCacheType type_v;
+    FlashAttention flash_attn;
+    resolve_attention(config, type_v, flash_attn);
+    if (type_v != config.type_v) {
+        LOGI("load(): %s V cache needs flash attention, using f16", kv_cache_type_name(config.type_v));
+    }
+
+    // With a budget, context and batch come from the GGUF header and the
+    // memory estimate instead of the size heuristics below, and a model that
+    // cannot fit is refused here rather than killed by the OOM killer later.
+    MemoryPlan plan;
+    if (config.memory_budget_bytes > 0) {
+        GgufModelInfo info;
+        if (read_gguf_info(config.model_path, info)) {
+            plan = plan_for_budget(config, info, type_v, flash_attn);
+            if (!plan.fits) {
+                LOGE("load(): needs at least %llu MiB, budget is %llu MiB",
+                     (unsigned long long) (plan.estimate.total() >> 20),
+                     (unsigned long long) (config.memory_budget_bytes >> 20));
+                return false;
+            }
+            LOGI("load(): planned n_ctx=%d n_batch=%d for a %llu MiB budget (estimate %llu MiB)",
+                 plan.n_ctx, plan.n_batch,
+                 (unsigned long long) (config.memory_budget_bytes >> 20),
+                 (unsigned long long) (plan.estimate.total() >> 20));
+        } else {
+            LOGE("load(): could not read the GGUF header, ignoring the memory budget");
+        }
+    }
+
+    llama_model_params model_params = llama_model_default_params();
+    model_params.n_gpu_layers = config.n_gpu_layers;
+    model_params.use_mmap = config.use_mmap;
+    model_params.use_mlock = config.use_mlock;
+
+    // llama.cpp reports the fraction of tensor data loaded; scaled to bytes
+    // of the file so every stage counts in the same unit. Returning false
+    // from here makes llama_model_load_from_file give up and return null.
+    struct WeightsProgress {
+        const LoadProgressCallback * callback;
+        ProgressGate gate;
+        uint64_t bytes;
+        bool cancelled;
+    } weights_progress{&config.on_progress, ProgressGate(load_report_.file_bytes), load_report_.file_bytes, false};
+    if (config.on_progress) {
+        model_params.progress_callback = [](float progress, void * user_data) {
+            auto * p = static_cast<WeightsProgress *>(user_data);
+            const uint64_t done = (uint64_t) ((double) std::clamp(progress, 0.0f, 1.0f) * (double) p->bytes);
+            if (p->gate.due(done) && !(*p->callback)(LoadStage::kWeights, done, p->bytes)) {
+                p->cancelled = true;
+                return false;
+            }
+            return true;
+        };
+        model_params.progress_callback_user_data = &weights_progress;
+    }
+
+    LOGI("load(): loading %s (mmap=%d, mlock=%d)", config.model_path.c_str(), config.use_mmap ? 1 : 0,
+         config.use_mlock ? 1 : 0);
+    const auto t_weights = Clock::now();
+    llama_model * model = llama_model_load_from_file(config.model_path.c_str(), model_params);
+    load_report_.weights_ms = elapsed_ms(t_weights, Clock::now());
+    if (model == nullptr) {
+        load_report_.cancelled = weights_progress.cancelled;
+        if (load_report_.cancelled) {
+            LOGI("load(): cancelled while reading weights");
+        } else {
+            LOGE("load(): llama_model_load_from_file failed");
+        }
+        return false;
+    }
+
+    const uint64_t n_params = llama_model_n_params(model);
+    const bool small_model = n_params > 0 && n_params <= kSmallModelParamLimit;
+
+    // On big.LITTLE parts every ggml barrier waits for the slowest worker, so
+    // threads placed on efficiency cores hold back the big ones; size the
+    // heuristics (and the tuner's sweep) from the performance cores only.
+    CpuTopology topology = read_cpu_topology();
+    const bool pin_threads = config.prefer_performance_cores && topology.heterogeneous();
+    const unsigned hw_concurrency = pin_threads
+        ? (unsigned) topology.performance_cores().size()
+        : std::max(1u, std::thread::hardware_concurrency());
+
+    int tuned_ctx = 0;
+    int tuned_batch = 0;
+    resolve_context(config, plan, small_model, tuned_ctx, tuned_batch);
+    if (!plan.fits && small_model && config.n_ctx > kSmallModelCtxCap) {
+        LOGI("load(): clamping context length to %d for small model", kSmallModelCtxCap);
+    }
+
+    int tuned_threads = config.n_threads > 0 ? config.n_threads : static_cast<int>(hw_concurrency);
+    if (small_model && config.n_threads <= 0) {
+        tuned_threads = static_cast<int>(std::min<unsigned>(hw_concurrency, kSmallModelThreadCeil));
+        if (hw_concurrency >= 2 && tuned_threads < 2) {
+            tuned_threads = 2;
+        }
+    }
+    if (tuned_threads <= 0) {
+        tuned_threads = 1;
+    }
+
+    int tuned_threads_batch = tuned_threads;
+    if (config.n_threads_batch > 0) {
+        tuned_threads_batch = config.n_threads_batch;
+    } else if (small_model) {
+        tuned_threads_batch = std::max(1, tuned_threads / 2);
+    }
+
+    const int batch_cap = plan.fits ? plan.n_batch : tuned_ctx;
+
+    // A cached profile replaces the heuristics above; explicit config values
+    // still win over it.
+    TuneResult tune;
+    TuneKey tune_key;
+    std::string tune_path;
+    if (config.tune != TuneMode::kOff && !config.tune_dir.empty()) {
+        tune_key.model_fingerprint = file_fingerprint(config.model_path);
+        tune_key.device = device_signature();
+        tune_key.n_ctx = tuned_ctx;
+        tune_key.n_gpu_layers = config.n_gpu_layers;
+        tune_path = config.tune_dir + "/" + tune_profile_file_name(tune_key);
+        if (config.tune == TuneMode::kAuto && read_tune_profile(tune_path, tune_key, tune.profile)) {
+            tune.status = TuneStatus::kCached;
+            tuned_threads = config.n_threads > 0 ? config.n_threads : tune.profile.n_threads;
+            tuned_threads_batch = config.n_threads_batch > 0 ? config.n_threads_batch : tune.profile.n_threads_batch;
+            tuned_batch = config.n_batch > 0 ? tuned_batch : std::min(tune.profile.n_batch, batch_cap);
+            LOGI("load(): using tuned profile %s", tune_path.c_str());
+        }
+    }
+    const bool calibrate_now = !tune_path.empty() && tune.status != TuneStatus::kCached;
+    const int calibrate_max_batch = config.n_batch > 0 ? tuned_batch
+        : std::min({kTunePromptTokens, tuned_ctx / 2, batch_cap});
+
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = tuned_ctx;
+    ctx_params.no_perf = false;
+    // One KV sequence per session, all sharing the n_ctx cells.
+    ctx_params.n_seq_max = kMaxSessions;
+    ctx_params.kv_unified = true;
+    ctx_params.type_k = to_ggml_type(config.type_k);
+    ctx_params.type_v = to_ggml_type(type_v);
+    ctx_params.flash_attn_type = flash_attn == FlashAttention::kOn ? LLAMA_FLASH_ATTN_TYPE_ENABLED
+        : flash_attn == FlashAttention::kOff ? LLAMA_FLASH_ATTN_TYPE_DISABLED : LLAMA_FLASH_ATTN_TYPE_AUTO;
+    auto set_batch = [&](int n_threads, int n_threads_batch, int n_batch) {
+        ctx_params.n_threads = n_threads;
+        ctx_params.n_threads_batch = n_threads_batch;
+        ctx_params.n_batch = n_batch;
+        // Decode steps submit a handful of tokens, so the micro-batch only
+        // shapes the prefill compute buffers; it can never exceed the
+        // logical batch.
+        ctx_params.n_ubatch = resolve_ubatch(config, n_batch);
+    };
+    set_batch(tuned_threads, tuned_threads_batch,
+              calibrate_now ? std::max(tuned_batch, calibrate_max_batch) : tuned_batch);
+
+    llama_context * ctx = llama_init_from_model(model, ctx_params);
+    if (ctx == nullptr) {
+        llama_model_free(model);
+        LOGE("load(): llama_init_from_model failed");
+        return false;
+    }
+
+    if (calibrate_now) {
+        const auto t_tune = Clock::now();
+        if (calibrate(model, ctx, config, hw_concurrency, calibrate_max_batch, tuned_threads, tuned_threads_batch,
+                      tuned_batch, tune.profile)) {
+            tune.status = TuneStatus::kCalibrated;
+            tuned_threads = tune.profile.n_threads;
+            tuned_threads_batch = tune.profile.n_threads_batch;
+            tuned_batch = tune.profile.n_batch;
+            if (!write_tune_profile(tune_path, tune_key, tune.profile)) {
+                LOGE("load(): could not write tuned profile %s", tune_path.c_str());
+            }
+        } else {
+            tune.status = TuneStatus::kFailed;
+        }
+        tune.ms = elapsed_ms(t_tune, Clock::now());
+        LOGI("load(): calibration %s in %.0f ms (threads=%d, threads_batch=%d, n_batch=%d)",
+             tune.status == TuneStatus::kCalibrated ? "done" : "failed", tune.ms,
+             tuned_threads, tuned_threads_batch, tuned_batch);
+
+        // the calibration context was sized for the largest batch tried
+        set_batch(tuned_threads, tuned_threads_batch, tuned_batch);
+        if (llama_n_batch(ctx) != (uint32_t) tuned_batch) {
+            llama_free(ctx);
+            ctx = llama_init_from_model(model, ctx_params);
+            if (ctx == nullptr) {
+                llama_model_free(model);
+                LOGE("load(): llama_init_from_model failed after calibration");
+                return false;
+            }
+        } else {
+            llama_set_n_threads(ctx, tuned_threads, tuned_threads_batch);
+        }
+    }
+    const int tuned_ubatch = (int) ctx_params.n_ubatch;
+
+    // Calibration (above) ran on ggml's own unpinned pool; the pinned pools
+    // are sized from its result.
+    std::vector<int> decode_cpus;
+    std::vector<int> batch_cpus;
+    ggml_threadpool * threadpool = nullptr;
+    ggml_threadpool * threadpool_batch = nullptr;
+    if (pin_threads) {
+        decode_cpus = topology.fastest_cores(tuned_threads);
+        batch_cpus = topology.fastest_cores(tuned_threads_batch);
+        threadpool = new_pinned_threadpool(decode_cpus);
+        if (threadpool != nullptr && batch_cpus != decode_cpus) {
+            threadpool_batch = new_pinned_threadpool(batch_cpus);
+        }
+        if (threadpool == nullptr || (batch_cpus != decode_cpus && threadpool_batch == nullptr)) {
+            LOGE("load(): could not create pinned threadpools, using ggml defaults");
+            if (threadpool != nullptr) {
+                ggml_threadpool_free(threadpool);
+                threadpool = nullptr;
+            }
+            decode_cpus.clear();
+            batch_cpus.clear();
+        } else {
+            llama_attach_threadpool(ctx, threadpool, threadpool_batch);
+            LOGI("load(): decode pinned to %s, prefill to %s",
+                 cpu_list_string(decode_cpus).c_str(), cpu_list_string(batch_cpus).c_str());
+        }
+    }
+
+    // after the pools are attached, so the warmup runs on them too
+    if (config.warmup && !warm_up(model, ctx, config, load_report_)) {
+        llama_free(ctx);
+        if (threadpool_batch != nullptr) {
+            ggml_threadpool_free(threadpool_batch);
+        }
+        if (threadpool != nullptr) {
+            ggml_threadpool_free(threadpool);
+        }
+        llama_model_free(model);
+        load_report_.cancelled = true;
+        load_report_.total_ms = elapsed_ms(t_load, Clock::now());
+        LOGI("load(): cancelled during warmup");
+        return false;
+    }
+    load_report_.total_ms = elapsed_ms(t_load, Clock::now());
+
+    MemoryEstimate resident;
+    GgufModelInfo resident_info;
+    if (read_gguf_info(config.model_path, resident_info)) {
+        resident = estimate_memory(resident_info, (int) llama_n_ctx(ctx), tuned_batch, tuned_ubatch,
+                                   config.type_k, type_v, flash_attn == FlashAttention::kOn);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    model_ = model;
+    ctx_ = ctx;
+    ctx_params_ = ctx_params;
+    // after warmup and calibration, which no cancel or waiter can abort
+    llama_set_abort_callback(ctx_, &LlamaEngine::abort_decode, this);
+    sampler_config_ = config.sampler;
+    const int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+    for (auto & session : sessions_) {
+        // the candidate buffers are the only allocation sampling makes
+        session->sampler.reserve(n_vocab);
+        session->sampler.set_config(config.sampler);
+        session->sampler.reset();
+        session->sampler.reset_timings();
+    }
+    batch_ = llama_batch_init(tuned_batch, 0, 1);
+    model_path_ = config.model_path;
+    model_fingerprint_ = 0;
+    small_model_ = small_model;
+    model_params_ = n_params;
+    tuned_ctx_ = tuned_ctx;
+    tuned_threads_ = tuned_threads;
+    tuned_threads_batch_ = tuned_threads_batch;
+    tuned_batch_ = tuned_batch;
+    tuned_ubatch_ = tuned_ubatch;
+    tune_result_ = tune;
+    memory_plan_ = plan;
+    type_k_ = config.type_k;
+    type_v_ = type_v;
+    flash_attn_ = flash_attn;
+    topology_ = std::move(topology);
+    threadpool_ = threadpool;
+    threadpool_batch_ = threadpool_batch;
+    decode_cpus_ = std::move(decode_cpus);
+    batch_cpus_ = std::move(batch_cpus);
+    resident_estimate_ = resident;
+    if (!config.draft_model_path.empty() && !load_draft(config, ctx_params)) {
+        LOGI("load(): continuing without speculative decoding");
+    }
+    if (draft_model_ != nullptr && resident.total() > 0) {
+        resident_estimate_.weights += file_size_bytes(config.draft_model_path);
+    }
+    start_governor_locked();
+
+    LOGI("load(): success in %.0f ms (weights %.0f ms, prefault %.0f ms, warmup %.0f ms; ctx=%u, threads=%d, "
+         "threads_batch=%d, n_batch=%d, n_ubatch=%d, params=%llu, small=%d, cache=%s/%s, flash_attn=%s)",
+         load_report_.total_ms,
+         load_report_.weights_ms,
+         load_report_.prefault_ms,
+         load_report_.warmup_ms,
+         llama_n_ctx(ctx_),
+         tuned_threads_,
+         tuned_threads_batch_,
+         tuned_batch_,
+         tuned_ubatch_,
+         static_cast<unsigned long long>(model_params_),
+         small_model_ ? 1 : 0,
+         kv_cache_type_name(type_k_),
+         kv_cache_type_name(type_v_),
+         flash_attention_name(flash_attn_));
+    lock.unlock();
+
+    scheduler_ = std::thread(&LlamaEngine::scheduler_loop, this);
+    return true;
+}
+
+void LlamaEngine::release() {
+    stop_scheduler();
+
+    std::lock_guard<std::mutex> lora_lock(lora_mutex_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto & session : sessions_) {
+        Session & s = *session;
+        if (s.phase != Session::Phase::kIdle) {
+            finish_locked(s, false);
+        }
+        s.sampler = TokenSampler{};
+        s.history.clear();
+        s.pinned_prefix = 0;
+        s.loras.clear();
+        s.loras_next.clear();
+        s.priority.store(RequestPriority::kNormal);
+        s.last_metrics = RequestMetrics{};
+    }
+    total_metrics_.clear();
+    requests_ = 0;
+    total_cancel_ = PhaseStat{};
+    aborted_decodes_ = 0;
+    {
+        std::lock_guard<std::mutex> metrics_lock(metrics_mutex_);
+        total_handoff_ = PhaseStat{};
+        for (auto & session : sessions_) {
+            session->handoff = PhaseStat{};
+        }
+    }
+    for (auto & session : sessions_) {
+        session->draft_history.clear();
+        session->drafts.clear();
+    }
+    if (draft_batch_.token != nullptr) {
+        llama_batch_free(draft_batch_);
+        draft_batch_ = {};
+    }
+    if (draft_ctx_ != nullptr) {
+        llama_free(draft_ctx_);
+        draft_ctx_ = nullptr;
+    }
+    if (draft_model_ != nullptr) {
+        llama_model_free(draft_model_);
+        draft_model_ = nullptr;
+    }
+    draft_max_ = 0;
+    free_embed_context_locked();
+    tune_result_ = TuneResult{};
+    memory_plan_ = MemoryPlan{};
+    resident_estimate_ = MemoryEstimate{};
+    if (batch_.token != nullptr) {
+        llama_batch_free(batch_);
+        batch_ = {};
+    }
+    if (ctx_ != nullptr) {
+        llama_free(ctx_);
+        ctx_ = nullptr;
+    }
+    // after the context that applied them, before their base model
+    for (LoraAdapter & lora : loras_) {
+        llama_adapter_lora_free(lora.adapter);
+    }
+    loras_.clear();
+    applied_loras_.clear();
+    next_lora_id_ = 0;
+    if (model_ != nullptr) {
+        llama_model_free(model_);
+        model_ = nullptr;
+    }
+    // only after every context using them is gone
+    if (threadpool_batch_ != nullptr) {
+        ggml_threadpool_free(threadpool_batch_);
+        threadpool_batch_ = nullptr;
+    }
+    if (threadpool_ != nullptr) {
+        ggml_threadpool_free(threadpool_);
+        threadpool_ = nullptr;
+    }
+    governor_.reset();
+    decode_cpus_.clear();
+    batch_cpus_.clear();
+    model_path_.clear();
+    model_fingerprint_ = 0;
+    small_model_ = false;
+    model_params_ = 0;
+    tuned_ctx_ = tuned_threads_ = tuned_threads_batch_ = tuned_batch_ = tuned_ubatch_ = 0;
+    type_k_ = type_v_ = KvCacheType::kF16;
+    flash_attn_ = FlashAttention::kAuto;
+}
+
+bool LlamaEngine::is_loaded() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ctx_ != nullptr;
+}
+
+bool LlamaEngine::suspend() {
+    cancel_all();
+    stop_scheduler();
+
+    std::lock_guard<std::mutex> embed_lock(embed_mutex_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ctx_ == nullptr) {
+        return false;
+    }
+    for (auto & session : sessions_) {
+        Session & s = *session;
+        if (s.phase != Session::Phase::kIdle) {
+            finish_locked(s, false);
+        }
+        // the sequences go with the context
+        s.history.clear();
+        s.pinned_prefix = 0;
+        s.dropped.clear();
+        s.shift_keep = 0;
+        s.draft_history.clear();
+        s.drafts.clear();
+        s.loras.clear();
+        s.sampler.reset();
+    }
+    free_embed_context_locked();
+    if (draft_ctx_ != nullptr) {
+        llama_free(draft_ctx_);
+        draft_ctx_ = nullptr;
+    }
+    governor_.reset();
+    llama_free(ctx_);
+    ctx_ = nullptr;
+    applied_loras_.clear();
+    LOGI("suspend(): context freed, weights kept (%llu MiB back)",
+         (unsigned long long) ((resident_estimate_.kv + resident_estimate_.compute) >> 20));
+    return true;
+}
+
+bool LlamaEngine::resume() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (ctx_ != nullptr) {
+        return true;
+    }
+    if (model_ == nullptr) {
+        return false;
+    }
+    const auto t_resume = Clock::now();
+    llama_context * ctx = llama_init_from_model(model_, ctx_params_);
+    if (ctx == nullptr) {
+        LOGE("resume(): llama_init_from_model failed");
+        return false;
+    }
+    if (threadpool_ != nullptr) {
+        llama_attach_threadpool(ctx, threadpool_, threadpool_batch_);
+    }
+    llama_set_abort_callback(ctx, &LlamaEngine::abort_decode, this);
+    ctx_ = ctx;
+    if (draft_model_ != nullptr) {
+        draft_ctx_ = llama_init_from_model(draft_model_, draft_ctx_params_);
+        if (draft_ctx_ == nullptr) {
+            LOGE("resume(): draft llama_init_from_model failed, continuing without speculative decoding");
+        } else if (threadpool_ != nullptr) {
+            llama_attach_threadpool(draft_ctx_, threadpool_, threadpool_batch_);
+        }
+    }
+    start_governor_locked();
+    LOGI("resume(): context rebuilt in %.1f ms", elapsed_ms(t_resume, Clock::now()));
+    lock.unlock();
+
+    scheduler_ = std::thread(&LlamaEngine::scheduler_loop, this);
+    return true;
+}
+
+bool LlamaEngine::suspended() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return model_ != nullptr && ctx_ == nullptr;
+}
+
+bool LlamaEngine::idle() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::all_of(sessions_.begin(), sessions_.end(), [](const std::unique_ptr<Session> & s) {
+        return s->phase == Session::Phase::kIdle;
+    });
+}
+
+MemoryEstimate LlamaEngine::estimate_load(const EngineConfig & config) {
+    GgufModelInfo info;
+    if (!read_gguf_info(config.model_path, info)) {
+        return {};
+    }
+    KvCacheType type_v;
+    FlashAttention flash_attn;
+    resolve_attention(config, type_v, flash_attn);
+    MemoryPlan plan;
+    if (config.memory_budget_bytes > 0) {
+        plan = plan_for_budget(config, info, type_v, flash_attn);
+        if (!plan.fits) {
+            return {}; // load() refuses it before allocating anything
+        }
+    }
+    const bool small_model = info.n_params > 0 && info.n_params <= kSmallModelParamLimit;
+    int n_ctx = 0;
+    int n_batch = 0;
+    resolve_context(config, plan, small_model, n_ctx, n_batch);
+    MemoryEstimate estimate = estimate_memory(info, n_ctx, n_batch, resolve_ubatch(config, n_batch), config.type_k,
+                                              type_v, flash_attn == FlashAttention::kOn);
+    if (!config.draft_model_path.empty()) {
+        estimate.weights += file_size_bytes(config.draft_model_path);
+    }
+    return estimate;
+}
+
+MemoryEstimate LlamaEngine::resident_estimate() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resident_estimate_;
+}
+
+int LlamaEngine::n_ctx() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ctx_ != nullptr ? static_cast<int>(llama_n_ctx(ctx_)) : 0;
+}
+
+bool LlamaEngine::update_sampler(const SamplerConfig & config) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (model_ == nullptr) {
+        return false;
+    }
+    sampler_config_ = config;
+    for (auto & session : sessions_) {
+        session->sampler.set_config(config);
+    }
+    return true;
+}
+
+EngineStats LlamaEngine::get_stats(int session) const {
+    EngineStats out;
+    const Session * s = session_at(session);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (s != nullptr) {
+        out.last = s->last_metrics;
+    }
+    out.total = total_metrics_;
+    out.requests = requests_;
+    out.cancel = total_cancel_;
+    out.aborted_decodes = aborted_decodes_;
+    out.n_threads = governor_ != nullptr ? governor_->n_threads() : tuned_threads_;
+    out.n_threads_batch = governor_ != nullptr ? governor_->n_threads_batch() : tuned_threads_batch_;
+    out.n_batch = tuned_batch_;
+    out.n_ubatch = tuned_ubatch_;
+    if (ctx_ != nullptr) {
+        out.kv_size = (int) llama_n_ctx(ctx_);
+        for (const auto & session : sessions_) {
+            out.kv_used += (int) session->history.size();
+            out.active_sessions += session->phase != Session::Phase::kIdle ? 1 : 0;
+        }
+        out.kv_session = s != nullptr ? (int) s->history.size() : 0;
+        const llama_perf_context_data perf = llama_perf_context(ctx_);
+        out.llama_load_ms = perf.t_load_ms;
+        out.llama_prompt_ms = perf.t_p_eval_ms;
+        out.llama_eval_ms = perf.t_eval_ms;
+        out.llama_prompt_tokens = perf.n_p_eval;
+        out.llama_eval_tokens = perf.n_eval;
+    }
+    std::lock_guard<std::mutex> metrics_lock(metrics_mutex_);
+    if (s != nullptr) {
+        out.last.phases[kPhaseHandoff] = s->handoff;
+    }
+    out.total[kPhaseHandoff] = total_handoff_;
+    return out;
+}
+
+void LlamaEngine::start_trace(size_t max_events) {
+    trace_.start(max_events);
+    LOGI("trace: recording up to %zu events", max_events);
+}
+
+bool LlamaEngine::stop_trace(const std::string & path) {
+    trace_.stop();
+    if (path.empty()) {
+        return true;
+    }
+    if (!trace_.write_json(path)) {
+        LOGE("trace: could not write %s", path.c_str());
+        return false;
+    }
+    LOGI("trace: %zu events written to %s (%llu dropped)", trace_.size(), path.c_str(),
+         static_cast<unsigned long long>(trace_.dropped()));
+    return true;
+}
+
+SamplerTimings LlamaEngine::sampler_timings(int session) const {
+    const Session * s = session_at(session);
+    if (s == nullptr) {
+        return SamplerTimings{};
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return s->sampler.timings();
+}
+
+void LlamaEngine::set_prefill_progress_callback(PrefillProgressCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    prefill_progress_ = std::move(callback);
+}
+
+LlamaEngine::Session * LlamaEngine::session_at(int session) const {
+    if (session < 0 || session >= kMaxSessions) {
+        return nullptr;
+    }
+    return sessions_[(size_t) session].get();
+}
+
+int LlamaEngine::open_session() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto & session : sessions_) {
+        if (!session->open) {
+            session->open = true;
+            LOGI("open_session(): %d", session->id);
+            return session->id;
+        }
+    }
+    LOGE("open_session(): all %d sessions in use", kMaxSessions);
+    return -1;
+}
+
+void LlamaEngine::close_session(int session) {
+    Session * s = session_at(session);
+    if (s == nullptr || session == kDefaultSession) {
+        return;
+    }
+    // before the lock, so a batch the session is in is aborted
+    request_cancel(*s);
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!s->open) {
+        return;
+    }
+    wait_idle_locked(lock, *s);
+    if (ctx_ != nullptr) {
+        drop_sequence_locked(*s);
+        s->sampler.reset();
+    }
+    s->shift = ContextShift{};
+    s->loras.clear();
+    s->loras_next.clear();
+    s->priority.store(RequestPriority::kNormal);
+    s->open = false;
+    LOGI("close_session(): %d", session);
+}
+
+void LlamaEngine::reset_context(int session) {
+    Session * s = session_at(session);
+    if (s == nullptr) {
+        return;
+    }
+    // an idle session ignores the flag: the next request clears it
+    request_cancel(*s);
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (ctx_ == nullptr) {
+        return;
+    }
+    if (s->phase != Session::Phase::kIdle) {
+        wait_idle_locked(lock, *s);
+        if (ctx_ == nullptr) {
+            return;
+        }
+    }
+    drop_sequence_locked(*s);
+    s->sampler.reset();
+}
+
+void LlamaEngine::drop_sequence_locked(Session & s) {
+    llama_memory_seq_rm(llama_get_memory(ctx_), s.id, -1, -1);
+    s.history.clear();
+    s.pinned_prefix = 0;
+    s.dropped.clear();
+    if (draft_ctx_ != nullptr) {
+        llama_memory_seq_rm(llama_get_memory(draft_ctx_), s.id, -1, -1);
+    }
+    s.draft_history.clear();
+}
+
+void LlamaEngine::request_cancel(Session & s) {
+    if (!s.cancel.exchange(true)) {
+        s.cancel_us.store(clock_us(Clock::now()), std::memory_order_relaxed);
+    }
+}
+
+// Polled by ggml between graph nodes on its compute threads, so it only
+// reads atomics. Returning true makes llama_decode return 2.
+bool LlamaEngine::abort_decode(void * data) {
+    const auto * engine = static_cast<const LlamaEngine *>(data);
+    for (const auto & session : engine->sessions_) {
+        if (session->in_batch.load(std::memory_order_relaxed) && session->cancel.load(std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return engine->preempt_.outranked();
+}
+
+// llama.cpp drops the ubatch it was computing from the KV cache; ubatches
+// that finished before the abort stay. Generating sessions decode their
+// step again, prefilling sessions keep the prompt tokens that made it.
+void LlamaEngine::rollback_aborted_locked() {
+    llama_memory_t mem = llama_get_memory(ctx_);
+    for (auto & session : sessions_) {
+        Session & s = *session;
+        s.drafts.clear();
+        if (s.decoding) {
+            llama_memory_seq_rm(mem, s.id, (llama_pos) s.history.size(), -1);
+        } else if (s.phase == Session::Phase::kPrefill && s.chunk_end > s.prompt_pos) {
+            // the final prompt token is always decoded again, for its logits
+            const size_t decoded = (size_t) (llama_memory_seq_pos_max(mem, s.id) + 1);
+            const size_t kept = std::min(std::max(decoded, s.prompt_pos), std::min(s.chunk_end, s.prompt.size() - 1));
+            llama_memory_seq_rm(mem, s.id, (llama_pos) kept, -1);
+            s.history.insert(s.history.end(), s.prompt.begin() + (long) s.prompt_pos, s.prompt.begin() + (long) kept);
+            s.prompt_pos = kept;
+        }
+        s.decoding = false;
+        s.in_batch.store(false, std::memory_order_relaxed);
+    }
+}
+
+bool LlamaEngine::load_draft(const EngineConfig & config, const llama_context_params & target_params) {
+    llama_model_params model_params = llama_model_default_params();
+    model_params.n_gpu_layers = config.n_gpu_layers;
+    LOGI("load(): loading draft %s", config.draft_model_path.c_str());
+    llama_model * draft = llama_model_load_from_file(config.draft_model_path.c_str(), model_params);
+    if (draft == nullptr) {
+        LOGE("load(): draft model failed to load");
+        return false;
+    }
+    if (!vocabs_compatible(llama_model_get_vocab(model_), llama_model_get_vocab(draft))) {
+        LOGE("load(): draft vocabulary does not match the target");
+        llama_model_free(draft);
+        return false;
+    }
+
+    // Same context and sessions as the target; the batch must also hold one
+    // draft token per session.
+    const int n_batch = std::max((int) target_params.n_batch, kMaxSessions);
+    llama_context_params ctx_params = target_params;
+    ctx_params.n_batch = n_batch;
+    ctx_params.n_ubatch = std::min((int) target_params.n_ubatch, n_batch);
+    llama_context * ctx = llama_init_from_model(draft, ctx_params);
+    if (ctx == nullptr) {
+        LOGE("load(): draft llama_init_from_model failed");
+        llama_model_free(draft);
+        return false;
+    }
+    draft_ctx_params_ = ctx_params;
+
+    if (threadpool_ != nullptr) {
+        llama_attach_threadpool(ctx, threadpool_, threadpool_batch_);
+    }
+    draft_model_ = draft;
+    draft_ctx_ = ctx;
+    draft_batch_ = llama_batch_init(n_batch, 0, 1);
+    draft_max_ = config.n_draft > 0 ? config.n_draft : kDefaultDraft;
+    for (auto & session : sessions_) {
+        session->draft_len = std::max(1, draft_max_ / 2);
+    }
+    LOGI("load(): speculative decoding on, params=%llu, n_draft=%d",
+         (unsigned long long) llama_model_n_params(draft), draft_max_);
+    return true;
+}
+
+bool LlamaEngine::embed_context_locked(const EmbedOptions & options, int n_batch, int n_seq) {
+    if (embd_ctx_ != nullptr && embd_requested_ == options.pooling &&
+        embd_n_batch_ == n_batch && embd_n_seq_ == n_seq) {
+        return true;
+    }
+    free_embed_context_locked();
+
+    // Pooled embeddings need every token of a sequence in one micro-batch,
+    // so context, batch and micro-batch are the same size. Sequences share
+    // the cells and are cleared before each batch.
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.embeddings = true;
+    ctx_params.pooling_type = to_llama_pooling(options.pooling);
+    ctx_params.n_ctx = (uint32_t) n_batch;
+    ctx_params.n_batch = (uint32_t) n_batch;
+    ctx_params.n_ubatch = (uint32_t) n_batch;
+    ctx_params.n_seq_max = (uint32_t) n_seq;
+    ctx_params.kv_unified = true;
+    ctx_params.n_threads = tuned_threads_batch_;
+    ctx_params.n_threads_batch = tuned_threads_batch_;
+    llama_context * ctx = llama_init_from_model(model_, ctx_params);
+    if (ctx == nullptr) {
+        LOGE("embed(): llama_init_from_model failed");
+        return false;
+    }
+    EmbeddingPooling pooling = options.pooling;
+    if (pooling == EmbeddingPooling::kModel) {
+        switch (llama_pooling_type(ctx)) {
+            case LLAMA_POOLING_TYPE_MEAN: pooling = EmbeddingPooling::kMean; break;
+            case LLAMA_POOLING_TYPE_CLS: pooling = EmbeddingPooling::kCls; break;
+            case LLAMA_POOLING_TYPE_LAST: pooling = EmbeddingPooling::kLast; break;
+            default:
+                // no pooling (or a reranker head): one vector per text is
+                // still what callers want, so average the tokens
+                llama_free(ctx);
+                ctx_params.pooling_type = LLAMA_POOLING_TYPE_MEAN;
+                ctx = llama_init_from_model(model_, ctx_params);
+                if (ctx == nullptr) {
+                    LOGE("embed(): llama_init_from_model failed");
+                    return false;
+                }
+                pooling = EmbeddingPooling::kMean;
+                break;
+        }
+    }
+    if (threadpool_ != nullptr) {
+        llama_attach_threadpool(ctx, threadpool_, threadpool_batch_);
+    }
+    embd_ctx_ = ctx;
+    embd_batch_ = llama_batch_init(n_batch, 0, 1);
+    embd_requested_ = options.pooling;
+    embd_pooling_ = pooling;
+    embd_n_batch_ = n_batch;
+    embd_n_seq_ = n_seq;
+    LOGI("embed(): context ready, pooling=%s n_batch=%d n_seq=%d n_embd=%d",
+         embedding_pooling_name(pooling), n_batch, n_seq, llama_model_n_embd(model_));
+    return true;
+}
+
+void LlamaEngine::free_embed_context_locked() {
+    if (embd_batch_.token != nullptr) {
+        llama_batch_free(embd_batch_);
+        embd_batch_ = {};
+    }
+    if (embd_ctx_ != nullptr) {
+        llama_free(embd_ctx_);
+        embd_ctx_ = nullptr;
+    }
+    embd_requested_ = embd_pooling_ = EmbeddingPooling::kModel;
+    embd_n_batch_ = embd_n_seq_ = 0;
+}
+
+int LlamaEngine::n_embd() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return model_ != nullptr ? llama_model_n_embd(model_) : 0;
+}
+
+bool LlamaEngine::embed(const std::vector<std::string> & texts,
+                        const EmbedOptions & options,
+                        std::vector<float> & out,
+                        EmbedStats * stats) {
+    const int width = n_embd();
+    if (width <= 0) {
+        LOGE("embed(): no model loaded");
+        return false;
+    }
+    out.resize(texts.size() * (size_t) width);
+    return embed(texts, options, out.data(), out.size(), stats);
+}
+
+bool LlamaEngine::embed(const std::vector<std::string> & texts,
+                        const EmbedOptions & options,
+                        float * out,
+                        size_t capacity,
+                        EmbedStats * stats) {
+    const auto t_start = Clock::now();
+    std::lock_guard<std::mutex> embed_lock(embed_mutex_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (model_ == nullptr) {
+        LOGE("embed(): no model loaded");
+        return false;
+    }
+    const size_t width = (size_t) llama_model_n_embd(model_);
+    if (capacity < texts.size() * width) {
+        LOGE("embed(): %zu floats do not hold %zu x %zu", capacity, texts.size(), width);
+        return false;
+    }
+    const int n_batch = std::min(options.n_batch > 0 ? options.n_batch : kDefaultEmbedBatch,
+                                 std::max(1, (int) llama_model_n_ctx_train(model_)));
+    const int n_seq = std::min(options.n_seq > 0 ? options.n_seq : kDefaultEmbedSeqs, kMaxEmbedSeqs);
+    if (!embed_context_locked(options, n_batch, n_seq)) {
+        return false;
+    }
+    llama_context * ctx = embd_ctx_;
+
+    EmbedStats local;
+    local.texts = (int) texts.size();
+    local.pooling = embd_pooling_;
+    // add_special: BOS/CLS and SEP/EOS as the model's tokenizer expects them,
+    // which CLS and last-token pooling rely on
+    const llama_vocab * vocab = llama_model_get_vocab(model_);
+    std::vector<std::vector<llama_token>> tokens(texts.size());
+    std::vector<int> lengths(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i) {
+        const std::string & text = texts[i];
+        const int n = -llama_tokenize(vocab, text.c_str(), (int32_t) text.size(), nullptr, 0, true, false);
+        tokens[i].resize((size_t) std::max(n, 0));
+        if (n > 0 && llama_tokenize(vocab, text.c_str(), (int32_t) text.size(), tokens[i].data(), n, true, false) < 0) {
+            LOGE("embed(): tokenization failed for text %zu", i);
+            return false;
+        }
+        if ((int) tokens[i].size() > n_batch) {
+            tokens[i].resize((size_t) n_batch);
+            ++local.truncated;
+        }
+        lengths[i] = (int) tokens[i].size();
+        local.tokens += lengths[i];
+    }
+
+    for (const EmbedBatch & batch : plan_embed_batches(lengths, n_batch, n_seq)) {
+        // release the scheduler between batches
+        lock.unlock();
+        lock.lock();
+        if (embd_ctx_ != ctx) {
+            LOGE("embed(): model released while embedding");
+            return false;
+        }
+        llama_memory_t mem = llama_get_memory(ctx);
+        if (mem != nullptr) {
+            llama_memory_clear(mem, true);
+        }
+        embd_batch_.n_tokens = 0;
+        for (size_t j = 0; j < batch.count; ++j) {
+            const std::vector<llama_token> & text = tokens[batch.first + j];
+            for (size_t pos = 0; pos < text.size(); ++pos) {
+                batch_add(embd_batch_, text[pos], (llama_pos) pos, (llama_seq_id) j, true);
+            }
+        }
+        // encoder-only models have no KV memory; llama_decode runs them
+        // through the encoder
+        if (embd_batch_.n_tokens > 0 && llama_decode(ctx, embd_batch_) != 0) {
+            LOGE("embed(): llama_decode failed on %d tokens", embd_batch_.n_tokens);
+            return false;
+        }
+        ++local.batches;
+        for (size_t j = 0; j < batch.count; ++j) {
+            float * row = out + (batch.first + j) * width;
+            const float * pooled = tokens[batch.first + j].empty() ? nullptr
+                : llama_get_embeddings_seq(ctx, (llama_seq_id) j);
+            if (pooled == nullptr) {
+                std::fill(row, row + width, 0.0f);
+                continue;
+            }
+            std::memcpy(row, pooled, width * sizeof(float));
+            if (options.normalize) {
+                l2_normalize(row, width);
+            }
+        }
+    }
+    lock.unlock();
+
+    local.ms = elapsed_ms(t_start, Clock::now());
+    local.texts_per_s = local.ms > 0.0 ? local.texts * 1000.0 / local.ms : 0.0;
+    LOGI("embed(): %d texts, %d tokens in %d batches, %.1f ms (%.1f texts/s)",
+         local.texts, local.tokens, local.batches, local.ms, local.texts_per_s);
+    if (stats != nullptr) {
+        *stats = local;
+    }
+    return true;
+}
+
+void LlamaEngine::set_conversation_mode(bool enabled) {
+    if (conversation_mode_.exchange(enabled) != enabled) {
+        LOGI("set_conversation_mode(): %s", enabled ? "on" : "off");
+    }
+}
+
+void LlamaEngine::set_adaptive_threads(bool enabled, std::shared_ptr<ThermalSource> thermal) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    adaptive_threads_ = enabled;
+    if (thermal != nullptr) {
+        thermal_ = std::move(thermal);
+    }
+    if (enabled) {
+        start_governor_locked();
+    } else if (governor_ != nullptr) {
+        governor_.reset();
+        llama_set_n_threads(ctx_, tuned_threads_, tuned_threads_batch_);
+    }
+    LOGI("set_adaptive_threads(): %s", enabled ? "on" : "off");
+}
+
+bool LlamaEngine::adaptive_threads() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return adaptive_threads_;
+}
+
+void LlamaEngine::set_governor_callback(GovernorCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    governor_callback_ = std::move(callback);
+}
+
+// Starts from the loaded thread counts, which are also the ceiling: the
+// threadpools are sized and pinned for them.
+void LlamaEngine::start_governor_locked() {
+    governor_.reset();
+    if (!adaptive_threads_ || ctx_ == nullptr) {
+        return;
+    }
+    if (thermal_ == nullptr) {
+        auto sysfs = std::make_shared<SysfsThermalSource>();
+        LOGI("thread governor: %zu thermal zones", sysfs->zones().size());
+        thermal_ = std::move(sysfs);
+    }
+    GovernorConfig config;
+    config.max_threads = tuned_threads_;
+    config.max_threads_batch = tuned_threads_batch_;
+    governor_ = std::make_unique<ThreadGovernor>(config, thermal_.get());
+    llama_set_n_threads(ctx_, tuned_threads_, tuned_threads_batch_);
+}
+
+bool LlamaEngine::set_context_shift(int session, const ContextShift & shift) {
+    Session * s = session_at(session);
+    if (s == nullptr) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    s->shift = shift;
+    LOGI("set_context_shift(): session %d %s (keep=%d, discard=%d)", session, shift.enabled ? "on" : "off",
+         shift.n_keep, shift.n_discard);
+    return true;
+}
+
+int LlamaEngine::load_lora(const std::string & path) {
+    std::lock_guard<std::mutex> lora_lock(lora_mutex_);
+    llama_model * model = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const LoraAdapter & lora : loras_) {
+            if (lora.path == path) {
+                return lora.id;
+            }
+        }
+        model = model_;
+    }
+    if (model == nullptr) {
+        LOGE("load_lora(): no model loaded");
+        return -1;
+    }
+    // Reading the adapter only needs the model, which release() cannot free
+    // while lora_mutex_ is held, so the scheduler keeps running meanwhile.
+    const auto t_start = Clock::now();
+    llama_adapter_lora * adapter = llama_adapter_lora_init(model, path.c_str());
+    if (adapter == nullptr) {
+        LOGE("load_lora(): %s is not a LoRA adapter for this model", path.c_str());
+        return -1;
+    }
+    LoraAdapter lora;
+    lora.path = path;
+    lora.adapter = adapter;
+    lora.fingerprint = file_fingerprint(path);
+    lora.file_bytes = file_size_bytes(path);
+    lora.load_ms = elapsed_ms(t_start, Clock::now());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    lora.id = next_lora_id_++;
+    loras_.push_back(lora);
+    LOGI("load_lora(): %s as adapter %d (%.1f MiB) in %.1f ms", path.c_str(), lora.id,
+         (double) lora.file_bytes / (1024.0 * 1024.0), lora.load_ms);
+    return lora.id;
+}
+
+bool LlamaEngine::unload_lora(int id) {
+    std::lock_guard<std::mutex> lora_lock(lora_mutex_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    const auto uses = [id](const LoraSet & set) {
+        return std::any_of(set.begin(), set.end(), [id](const LoraScale & lora) { return lora.id == id; });
+    };
+    const auto it = std::find_if(loras_.begin(), loras_.end(), [id](const LoraAdapter & lora) { return lora.id == id; });
+    if (it == loras_.end()) {
+        return false;
+    }
+    const auto erase = [id](LoraSet & set) {
+        set.erase(std::remove_if(set.begin(), set.end(), [id](const LoraScale & lora) { return lora.id == id; }),
+                  set.end());
+    };
+    // requests submitted from here on adopt a set without it
+    for (auto & session : sessions_) {
+        erase(session->loras_next);
+        if (session->phase != Session::Phase::kIdle && uses(session->loras)) {
+            request_cancel(*session);
+        }
+    }
+    for (auto & session : sessions_) {
+        if (uses(session->loras)) {
+            wait_idle_locked(lock, *session);
+        }
+    }
+    // lora_mutex_ kept release() and other unloads out while waiting
+    for (auto & session : sessions_) {
+        Session & s = *session;
+        if (uses(s.loras)) {
+            drop_sequence_locked(s);
+            s.loras = s.loras_next;
+        }
+    }
+    if (uses(applied_loras_)) {
+        apply_loras_locked({});
+    }
+    llama_adapter_lora_free(it->adapter);
+    LOGI("unload_lora(): adapter %d (%s)", id, it->path.c_str());
+    loras_.erase(it);
+    return true;
+}
+
+std::vector<LoraAdapterInfo> LlamaEngine::loras() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<LoraAdapterInfo> out;
+    out.reserve(loras_.size());
+    for (const LoraAdapter & lora : loras_) {
+        LoraAdapterInfo info;
+        info.id = lora.id;
+        info.path = lora.path;
+        info.file_bytes = lora.file_bytes;
+        info.load_ms = lora.load_ms;
+        for (const auto & session : sessions_) {
+            const auto has = [&lora](const LoraScale & entry) { return entry.id == lora.id; };
+            if (std::any_of(session->loras.begin(), session->loras.end(), has) ||
+                std::any_of(session->loras_next.begin(), session->loras_next.end(), has)) {
+                ++info.sessions;
+            }
+        }
+        out.push_back(std::move(info));
+    }
+    return out;
+}
+
+bool LlamaEngine::set_session_loras(int session, const LoraSet & set) {
+    Session * s = session_at(session);
+    LoraSet normalized = set;
+    if (s == nullptr || !normalize_lora_set(normalized)) {
+        LOGE("set_session_loras(): bad session %d or adapter list", session);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!s->open) {
+        return false;
+    }
+    for (const LoraScale & entry : normalized) {
+        if (std::none_of(loras_.begin(), loras_.end(), [&entry](const LoraAdapter & lora) { return lora.id == entry.id; })) {
+            LOGE("set_session_loras(): unknown adapter %d", entry.id);
+            return false;
+        }
+    }
+    s->loras_next = std::move(normalized);
+    return true;
+}
+
+LoraSet LlamaEngine::session_loras(int session) const {
+    Session * s = session_at(session);
+    if (s == nullptr) {
+        return {};
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return s->loras_next;
+}
+
+// The session's KV sequence holds activations computed with its adapters,
+// so a new set invalidates all of it.
+void LlamaEngine::adopt_loras_locked(Session & s) {
+    if (s.loras_next == s.loras) {
+        return;
+    }
+    LOGI("session %d adapters %s -> %s", s.id, format_lora_set(s.loras).c_str(), format_lora_set(s.loras_next).c_str());
+    drop_sequence_locked(s);
+    s.loras = s.loras_next;
+}
+
+// Costs a graph rebuild on the next decode, nothing more: the adapter
+// tensors stay resident whether or not they are applied.
+void LlamaEngine::apply_loras_locked(const LoraSet & set) {
+    if (set == applied_loras_) {
+        return;
+    }
+    llama_clear_adapter_lora(ctx_);
+    for (const LoraScale & entry : set) {
+        const auto it = std::find_if(loras_.begin(), loras_.end(), [&entry](const LoraAdapter & lora) {
+            return lora.id == entry.id;
+        });
+        if (it != loras_.end() && llama_set_adapter_lora(ctx_, it->adapter, entry.scale) != 0) {
+            LOGE("scheduler: could not apply adapter %d", entry.id);
+        }
+    }
+    applied_loras_ = set;
+}
+
+bool LlamaEngine::set_session_priority(int session, RequestPriority priority) {
+    Session * s = session_at(session);
+    if (s == nullptr) {
+        return false;
+    }
+    s->priority.store(priority);
+    LOGI("set_session_priority(): session %d %s", session, request_priority_name(priority));
+    return true;
+}
+
+RequestPriority LlamaEngine::session_priority(int session) const {
+    const Session * s = session_at(session);
+    return s != nullptr ? s->priority.load() : RequestPriority::kNormal;
+}
+
+std::string LlamaEngine::apply_chat_template(const std::vector<ChatMessage> & messages, bool add_assistant) const {
+    // Without a template the raw contents are concatenated, which matches the
+    // single-prompt behaviour for plain completion models.
+    std::string raw;
+    size_t total = 0;
+    for (const auto & message : messages) {
+        total += message.content.size();
+    }
+    const char * tmpl = llama_model_chat_template(model_, nullptr);
+    if (tmpl == nullptr || *tmpl == '\0') {
+        raw.reserve(total);
+        for (const auto & message : messages) {
+            raw += message.content;
+        }
+        return raw;
+    }
+    std::vector<llama_chat_message> msgs(messages.size());
+    for (size_t i = 0; i < messages.size(); ++i) {
+        msgs[i].role = messages[i].role.c_str();
+        msgs[i].content = messages[i].content.c_str();
+    }
+    std::vector<char> buf(total * 4 + 256);
+    int32_t n = llama_chat_apply_template(tmpl, msgs.data(), msgs.size(), add_assistant, buf.data(), (int32_t) buf.size());
+    if (n > (int32_t) buf.size()) {
+        buf.resize((size_t) n);
+        n = llama_chat_apply_template(tmpl, msgs.data(), msgs.size(), add_assistant, buf.data(), (int32_t) buf.size());
+    }
+    if (n <= 0) {
+        for (const auto & message : messages) {
+            raw += message.content;
+        }
+        return raw;
+    }
+    return std::string(buf.data(), (size_t) n);
+}
+
+bool LlamaEngine::tokenize(const std::string & text, std::vector<llama_token> & out) const {
+    const llama_vocab * vocab = llama_model_get_vocab(model_);
+    const int n_tokens = -llama_tokenize(vocab, text.c_str(), (int32_t) text.size(), nullptr, 0, true, true);
+    if (n_tokens <= 0) {
+        return false;
+    }
+    out.resize((size_t) n_tokens);
+    return llama_tokenize(vocab, text.c_str(), (int32_t) text.size(), out.data(), (int32_t) out.size(), true, true) >= 0;
+}
+
+int LlamaEngine::reuse_prefix(Session & s, std::vector<llama_token> & tokens) {
+    // Outside conversation mode only a pinned preamble may be reused.
+    const size_t reusable = conversation_mode_.load() ? s.history.size() : std::min(s.history.size(), s.pinned_prefix);
+    if (reusable == 0) {
+        drop_sequence_locked(s);
+        return 0;
+    }
+
+    size_t limit = std::min(reusable, tokens.size());
+    if (!s.dropped.empty()) {
+        // A shifted sequence lines up with the prompt once the evicted run is
+        // cut out of it too; if the prompt no longer contains that run, only
+        // the kept head is still valid.
+        const size_t keep = s.shift_keep;
+        const bool intact = limit > keep && tokens.size() > keep + s.dropped.size() &&
+                            std::equal(s.history.begin(), s.history.begin() + (long) keep, tokens.begin()) &&
+                            std::equal(s.dropped.begin(), s.dropped.end(), tokens.begin() + (long) keep);
+        if (intact) {
+            tokens.erase(tokens.begin() + (long) keep, tokens.begin() + (long) (keep + s.dropped.size()));
+            limit = std::min(reusable, tokens.size());
+        } else {
+            s.dropped.clear();
+            limit = std::min(limit, keep);
+        }
+    }
+
+    size_t n_past = 0;
+    while (n_past < limit && s.history[n_past] == tokens[n_past]) {
+        ++n_past;
+    }
+    // re-decoding the final token below rewrites the same token, so the pin
+    // only shrinks where the prompt actually diverges
+    s.pinned_prefix = std::min(s.pinned_prefix, n_past);
+    // Sampling needs logits for the last prompt token, so at least one token
+    // is always decoded even when the whole prompt is already cached.
+    if (n_past == tokens.size() && n_past > 0) {
+        --n_past;
+    }
+    if (n_past < s.history.size()) {
+        if (!llama_memory_seq_rm(llama_get_memory(ctx_), s.id, (llama_pos) n_past, -1)) {
+            // Some memory types (recurrent, SWA) cannot drop a partial range.
+            LOGI("reuse_prefix(): partial trim unsupported, clearing session %d", s.id);
+            drop_sequence_locked(s);
+            n_past = 0;
+        }
+        s.history.resize(n_past);
+    }
+    return (int) n_past;
+}
+
+bool LlamaEngine::prefill(Session & s, const std::vector<llama_token> & tokens, int n_past, const char * tag) {
+    const int n_total = (int) tokens.size();
+    const int n_chunk = std::max(1, tuned_batch_);
+    const int n_todo = n_total - n_past;
+    for (int start = n_past; start < n_total; start += n_chunk) {
+        if (s.cancel.load()) {
+            LOGI("%s cancelled during prefill at %d/%d", tag, start - n_past, n_todo);
+            return false;
+        }
+        const int end = std::min(n_total, start + n_chunk);
+        batch_.n_tokens = 0;
+        for (int i = start; i < end; ++i) {
+            // only the final prompt token needs logits for the first sample
+            batch_add(batch_, tokens[i], (llama_pos) i, s.id, i == n_total - 1);
+        }
+        s.in_batch.store(true, std::memory_order_relaxed);
+        const int rc = llama_decode(ctx_, batch_);
+        s.in_batch.store(false, std::memory_order_relaxed);
+        if (rc == 2) {
+            LOGI("%s cancelled during prefill at %d/%d", tag, start - n_past, n_todo);
+            return false;
+        }
+        if (rc != 0) {
+            LOGE("%s decode prompt chunk [%d, %d) failed", tag, start, end);
+            return false;
+        }
+        s.history.insert(s.history.end(), tokens.begin() + start, tokens.begin() + end);
+        if (prefill_progress_) {
+            prefill_progress_(s.id, end - n_past, n_todo);
+        }
+    }
+    return true;
+}
+
+// The kept head of a session's sequence: fixed once something was evicted,
+// since the positions behind it already depend on it.
+size_t LlamaEngine::shift_keep_locked(const Session & s) const {
+    if (!s.dropped.empty()) {
+        return s.shift_keep;
+    }
+    if (s.shift.n_keep >= 0) {
+        return (size_t) s.shift.n_keep;
+    }
+    if (s.pinned_prefix > 0) {
+        return s.pinned_prefix;
+    }
+    return llama_vocab_get_add_bos(llama_model_get_vocab(model_)) ? 1 : 0;
+}
+
+size_t LlamaEngine::shift_chunk_locked(const Session & s) const {
+    if (s.shift.n_discard > 0) {
+        return (size_t) s.shift.n_discard;
+    }
+    const size_t n_ctx_slots = llama_n_ctx(ctx_);
+    const size_t keep = shift_keep_locked(s);
+    return keep < n_ctx_slots ? std::max<size_t>(1, (n_ctx_slots - keep) / 2) : 1;
+}
+
+// Evicts up to `n_discard` tokens right after the kept head of the session's
+// KV sequence and moves every later position down by as many, which
+// re-rotates the cached keys instead of decoding them again. The draft
+// sequence follows. Returns how many tokens were evicted; 0 when nothing lies
+// past the head or the memory cannot shift (recurrent and some SWA models).
+size_t LlamaEngine::shift_context_locked(Session & s, size_t n_discard) {
+    const size_t keep = shift_keep_locked(s);
+    llama_memory_t mem = llama_get_memory(ctx_);
+    if (s.history.size() <= keep || n_discard == 0 || !llama_memory_can_shift(mem)) {
+        return 0;
+    }
+    n_discard = std::min(n_discard, s.history.size() - keep);
+    const llama_pos p0 = (llama_pos) keep;
+    const llama_pos p1 = (llama_pos) (keep + n_discard);
+    if (!llama_memory_seq_rm(mem, s.id, p0, p1)) {
+        return 0;
+    }
+    llama_memory_seq_add(mem, s.id, p1, -1, -(llama_pos) n_discard);
+    s.shift_keep = keep;
+    s.dropped.insert(s.dropped.end(), s.history.begin() + p0, s.history.begin() + p1);
+    s.history.erase(s.history.begin() + p0, s.history.begin() + p1);
+    s.pinned_prefix = std::min(s.pinned_prefix, keep);
+
+    if (draft_ctx_ != nullptr && s.draft_history.size() > keep) {
+        llama_memory_t draft_mem = llama_get_memory(draft_ctx_);
+        const size_t n_draft = std::min(n_discard, s.draft_history.size() - keep);
+        const llama_pos d1 = (llama_pos) (keep + n_draft);
+        if (llama_memory_can_shift(draft_mem) && llama_memory_seq_rm(draft_mem, s.id, p0, d1)) {
+            llama_memory_seq_add(draft_mem, s.id, d1, -1, -(llama_pos) n_draft);
+            s.draft_history.erase(s.draft_history.begin() + p0, s.draft_history.begin() + d1);
+        } else {
+            // sync_draft_locked() catches the draft up from the kept head
+            llama_memory_seq_rm(draft_mem, s.id, p0, -1);
+            s.draft_history.resize(keep);
+        }
+    }
+    LOGI("session %d: context shift evicted %zu tokens after %zu (%zu evicted in total)", s.id, n_discard, keep,
+         s.dropped.size());
+    return n_discard;
+}
+
+// Makes a prompt that outgrew the context fit, in discard chunks taken after
+// the kept head: the cached part of each chunk is shifted out of the KV
+// sequence, the rest is cut from the prompt before it is decoded. `n_past`
+// is the cached prompt length from reuse_prefix(), which equals the history.
+bool LlamaEngine::fit_prompt_locked(Session & s, std::vector<llama_token> & tokens, int & n_past) {
+    const size_t n_ctx_slots = llama_n_ctx(ctx_);
+    if (tokens.size() < n_ctx_slots) {
+        return true;
+    }
+    const size_t keep = shift_keep_locked(s);
+    if (!s.shift.enabled || keep + 1 >= n_ctx_slots) {
+        return false;
+    }
+    const size_t chunk = shift_chunk_locked(s);
+    while (tokens.size() >= n_ctx_slots) {
+        size_t n = std::min(chunk, tokens.size() - keep - 1);
+        if ((size_t) n_past > keep) {
+            const size_t n_cached = std::min(n, (size_t) n_past - keep);
+            if (shift_context_locked(s, n_cached) != n_cached) {
+                return false;
+            }
+            tokens.erase(tokens.begin() + (long) keep, tokens.begin() + (long) (keep + n_cached));
+            n_past -= (int) n_cached;
+            n -= n_cached;
+        }
+        if (n > 0) {
+            // nothing past the head is cached any more
+            s.shift_keep = keep;
+            s.dropped.insert(s.dropped.end(), tokens.begin() + (long) keep, tokens.begin() + (long) (keep + n));
+            tokens.erase(tokens.begin() + (long) keep, tokens.begin() + (long) (keep + n));
+        }
+    }
+    return true;
+}
+
+int LlamaEngine::resolve_target_tokens(int requested, int prompt_tokens, bool shifting) const {
+    if (requested > 0) {
+        return requested;
+    }
+    if (ctx_ == nullptr || shifting) {
+        return kUnboundedSafetyCap;
+    }
+    const int ctx_slots = (int) llama_n_ctx(ctx_);
+    const int available = ctx_slots - prompt_tokens;
+    if (available <= 0) {
+        return 1;
+    }
+    return std::min(kUnboundedSafetyCap, available);
+}
+
+uint64_t LlamaEngine::context_params_hash() const {
+    // Everything that changes the layout of the serialized sequence state.
+    const uint32_t fields[] = {
+        llama_n_ctx(ctx_),
+        (uint32_t) llama_model_n_layer(model_),
+        (uint32_t) llama_model_n_embd(model_),
+        (uint32_t) type_k_,
+        (uint32_t) type_v_,
+    };
+    return fnv1a64(fields, sizeof(fields));
+}
+
+// Base-model snapshots keep their old key; with adapters the key also
+// covers which files are applied and at what scale.
+uint64_t LlamaEngine::lora_set_hash_locked(const LoraSet & set) const {
+    uint64_t hash = context_params_hash();
+    for (const LoraScale & entry : set) {
+        const auto it = std::find_if(loras_.begin(), loras_.end(), [&entry](const LoraAdapter & lora) {
+            return lora.id == entry.id;
+        });
+        const uint64_t fingerprint = it != loras_.end() ? it->fingerprint : 0;
+        hash = fnv1a64(&fingerprint, sizeof(fingerprint), hash);
+        hash = fnv1a64(&entry.scale, sizeof(entry.scale), hash);
+    }
+    return hash;
+}
+
+PrefixResult LlamaEngine::prime_prefix(const std::vector<ChatMessage> & prefix,
+                                       const std::string & cache_dir,
+                                       int session) {
+    PrefixResult result;
+    const auto t_start = Clock::now();
+    Session * s = session_at(session);
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (ctx_ == nullptr || s == nullptr || !s->open || prefix.empty()) {
+        LOGE("prime_prefix(): %s", ctx_ == nullptr ? "context not ready" : "bad session or empty prefix");
+        return result;
+    }
+    wait_idle_locked(lock, *s);
+    if (ctx_ == nullptr) {
+        return result;
+    }
+    s->cancel.store(false);
+    s->cancel_us.store(0, std::memory_order_relaxed);
+
+    std::vector<llama_token> tokens;
+    if (!tokenize(apply_chat_template(prefix, false), tokens) || tokens.size() >= (size_t) llama_n_ctx(ctx_)) {
+        LOGE("prime_prefix(): prefix does not tokenize into the context");
+        return result;
+    }
+    result.n_tokens = (int) tokens.size();
+
+    if (model_fingerprint_ == 0) {
+        model_fingerprint_ = file_fingerprint(model_path_);
+    }
+    SnapshotHeader key;
+    key.model_fingerprint = model_fingerprint_;
+    adopt_loras_locked(*s);
+    key.params_hash = lora_set_hash_locked(s->loras);
+    key.tokens_hash = hash_tokens(tokens.data(), tokens.size());
+    key.n_tokens = (uint32_t) tokens.size();
+    const std::string path = cache_dir.empty() ? std::string() : cache_dir + "/" + snapshot_file_name(key);
+
+    if (!path.empty() && model_fingerprint_ != 0 && restore_prefix(*s, path, tokens, key)) {
+        result.status = PrefixStatus::kRestored;
+    } else {
+        drop_sequence_locked(*s);
+        apply_loras_locked(s->loras);
+        if (!prefill(*s, tokens, 0, "prime_prefix():")) {
+            drop_sequence_locked(*s);
+            return result;
+        }
+        if (!path.empty() && model_fingerprint_ != 0) {
+            save_prefix(*s, path, tokens, key);
+        }
+        result.status = PrefixStatus::kCreated;
+    }
+    s->pinned_prefix = tokens.size();
+    result.ms = elapsed_ms(t_start, Clock::now());
+    LOGI("prime_prefix(): session %d %s %d tokens in %.1f ms", s->id,
+         result.status == PrefixStatus::kRestored ? "restored" : "decoded", result.n_tokens, result.ms);
+    return result;
+}
+
+bool LlamaEngine::restore_prefix(Session & s,
+                                 const std::string & path,
+                                 const std::vector<llama_token> & tokens,
+                                 const SnapshotHeader & key) {
+    std::vector<uint8_t> state;
+    const SnapshotCheck check = read_snapshot(path, key, tokens, state);
+    if (check == SnapshotCheck::kMissing) {
+        return false;
+    }
+    if (check != SnapshotCheck::kOk) {
+        LOGI("prime_prefix(): discarding snapshot %s (%s)", path.c_str(), snapshot_check_name(check));
+        std::remove(path.c_str());
+        return false;
+    }
+    drop_sequence_locked(s);
+    if (llama_state_seq_set_data(ctx_, state.data(), state.size(), s.id) == 0) {
+        LOGI("prime_prefix(): llama rejected snapshot %s, discarding", path.c_str());
+        drop_sequence_locked(s);
+        std::remove(path.c_str());
+        return false;
+    }
+    s.history = tokens;
+    return true;
+}
+
+void LlamaEngine::save_prefix(Session & s,
+                              const std::string & path,
+                              const std::vector<llama_token> & tokens,
+                              const SnapshotHeader & key) {
+    std::vector<uint8_t> state(llama_state_seq_get_size(ctx_, s.id));
+    if (state.empty() || llama_state_seq_get_data(ctx_, state.data(), state.size(), s.id) != state.size()) {
+        LOGE("prime_prefix(): could not read sequence state");
+        return;
+    }
+    if (!write_snapshot(path, key, tokens, state)) {
+        LOGE("prime_prefix(): could not write %s", path.c_str());
+    }
+}
+
+float LlamaEngine::sampled_logprob(int logits_index, llama_token token) const {
+    const float * logits = llama_get_logits_ith(ctx_, logits_index);
+    const int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model_));
+    if (logits == nullptr || token < 0 || token >= n_vocab) {
+        return 0.0f;
+    }
+    float max_logit = logits[0];
+    for (int i = 1; i < n_vocab; ++i) {
+        max_logit = std::max(max_logit, logits[i]);
+    }
+    double sum = 0.0;
+    for (int i = 0; i < n_vocab; ++i) {
+        sum += std::exp((double) (logits[i] - max_logit));
+    }
+    return (float) ((double) (logits[token] - max_logit) - std::log(sum));
+}
+
+// ---- scheduler ------------------------------------------------------------
+
+bool LlamaEngine::submit_locked(Session & s, Request request) {
+    s.t_start = Clock::now();
+    const char * tag = request.tag;
+    s.sampler.reset();
+    s.sampling_base = s.sampler.timings();
+    s.metrics = RequestMetrics{};
+    s.stream_start_us.store(clock_us(s.t_start), std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> metrics_lock(metrics_mutex_);
+        s.handoff = PhaseStat{};
+    }
+
+    std::vector<llama_token> tokens;
+    const std::string text = apply_chat_template(request.messages);
+    const auto t_templated = Clock::now();
+    const bool tokenized = tokenize(text, tokens);
+    const auto t_tokenized = Clock::now();
+    s.metrics.phases[kPhaseTemplate].add(elapsed_us(s.t_start, t_templated));
+    s.metrics.phases[kPhaseTokenize].add(elapsed_us(t_templated, t_tokenized));
+    trace_.record("template", session_lane(s.id), s.t_start, t_templated, (int64_t) request.messages.size());
+    trace_.record("tokenize", session_lane(s.id), t_templated, t_tokenized, (int64_t) tokens.size());
+    if (!tokenized) {
+        LOGE("%s tokenize failed", tag);
+        return false;
+    }
+    const int n_prompt = (int) tokens.size();
+    if (n_prompt >= (int) llama_n_ctx(ctx_) && !s.shift.enabled) {
+        LOGE("%s prompt of %d tokens does not fit context of %u", tag, n_prompt, llama_n_ctx(ctx_));
+        return false;
+    }
+    adopt_loras_locked(s);
+    // with context shifting, `tokens` loses whatever was evicted
+    s.n_past = reuse_prefix(s, tokens);
+    if (!fit_prompt_locked(s, tokens, s.n_past)) {
+        LOGE("%s prompt of %d tokens does not fit context of %u", tag, n_prompt, llama_n_ctx(ctx_));
+        drop_sequence_locked(s);
+        return false;
+    }
+    const int n_cached = n_prompt - ((int) tokens.size() - s.n_past);
+    if (n_cached > 0) {
+        LOGI("%s session %d reuses %d/%d prompt tokens", tag, s.id, n_cached, n_prompt);
+    }
+    if (request.stats != nullptr) {
+        *request.stats = GenerationStats{};
+        request.stats->prompt_tokens = n_prompt;
+        request.stats->cached_tokens = n_cached;
+    }
+    s.metrics.prompt_tokens = n_prompt;
+    s.metrics.cached_tokens = n_cached;
+    s.queued = true;
+    s.t_queued = Clock::now();
+
+    s.prompt = std::move(tokens);
+    s.prompt_pos = (size_t) s.n_past;
+    s.target = resolve_target_tokens(request.n_predict, (int) s.prompt.size(), s.shift.enabled);
+    s.generated = 0;
+    s.stop_after_next = false;
+    s.piece_parked = false;
+    s.request = std::move(request);
+    s.phase = Session::Phase::kPrefill;
+    s.active.store(true);
+    work_cv_.notify_one();
+    return true;
+}
+
+// Takes mutex_ for a new request. While it waits, a batch of lower priority
+// than the session's is aborted and the scheduler holds off the next one.
+// Only the wait for the lock counts: anything after it waits on the session.
+std::unique_lock<std::mutex> LlamaEngine::lock_preempting(const Session * s) {
+    PreemptGate::Waiter waiter(preempt_, s != nullptr ? s->priority.load() : RequestPriority::kNormal);
+    return std::unique_lock<std::mutex>(mutex_);
+}
+
+void LlamaEngine::wait_idle_locked(std::unique_lock<std::mutex> & lock, Session & s) {
+    idle_cv_.wait(lock, [&s]() { return s.phase == Session::Phase::kIdle; });
+}
+
+void LlamaEngine::finish_locked(Session & s, bool ok) {
+    const auto now = Clock::now();
+    s.metrics.generated_tokens = s.generated;
+    s.metrics.total_ms = elapsed_ms(s.t_start, now);
+    if (s.cancel.load()) {
+        s.metrics.cancelled = true;
+        const int64_t cancel_us = s.cancel_us.exchange(0, std::memory_order_relaxed);
+        if (cancel_us > 0) {
+            const double us = std::max<double>(0.0, (double) (clock_us(now) - cancel_us));
+            s.metrics.cancel_ms = us / 1000.0;
+            total_cancel_.add(us);
+        }
+    }
+    total_metrics_.merge(s.metrics.phases);
+    ++requests_;
+    s.last_metrics = s.metrics;
+    trace_.record(s.request.on_piece ? "generate" : "stream", session_lane(s.id), s.t_start, now, s.generated);
+
+    GenerationStats * stats = s.request.stats;
+    if (stats != nullptr) {
+        stats->phases = s.metrics.phases;
+        stats->generated_tokens = s.generated;
+        const SamplerTimings & total = s.sampler.timings();
+        stats->sampling.samples = total.samples - s.sampling_base.samples;
+        for (int stage = 0; stage < kSamplerStageCount; ++stage) {
+            stats->sampling.us[stage] = total.us[stage] - s.sampling_base.us[stage];
+        }
+        if (s.generated > 0) {
+            stats->decode_ms = elapsed_ms(s.t_first_piece, now);
+        }
+    }
+    LOGI("%s session %d %s, tokens=%d", s.request.tag, s.id, ok ? "done" : "failed", s.generated);
+    s.phase = Session::Phase::kIdle;
+    s.request = Request{};
+    s.piece_parked = false;
+    s.decoding = false;
+    s.chunk_end = s.prompt_pos;
+    ++s.finished;
+    s.active.store(false);
+    s.ring.close();
+    idle_cv_.notify_all();
+}
+
+// Samples the session's next token from batch row `logits_index` and hands
+// the piece to its consumer. Returns false if the request finished instead.
+bool LlamaEngine::sample_locked(Session & s, int logits_index) {
+    const llama_vocab * vocab = llama_model_get_vocab(model_);
+    const auto t_sample = Clock::now();
+    const llama_token token = s.sampler.sample(llama_get_logits_ith(ctx_, logits_index),
+                                              llama_vocab_n_tokens(llama_model_get_vocab(model_)));
+    const auto t_sampled = Clock::now();
+    s.metrics.phases[kPhaseSample].add(elapsed_us(t_sample, t_sampled));
+    trace_.record("sample", session_lane(s.id), t_sample, t_sampled);
+    if (token < 0) {
+        LOGE("%s no logits for row %d", s.request.tag, logits_index);
+        finish_locked(s, false);
+        return false;
+    }
+    if (llama_vocab_is_eog(vocab, token)) {
+        LOGI("%s EOG reached after %d tokens", s.request.tag, s.generated);
+        finish_locked(s, true);
+        return false;
+    }
+
+    char piece[TokenRing::kSlotBytes];
+    const int piece_len = llama_token_to_piece(vocab, token, piece, sizeof(piece), 0, true);
+    const auto now = Clock::now();
+    s.metrics.phases[kPhaseDetokenize].add(elapsed_us(t_sampled, now));
+    trace_.record("detokenize", session_lane(s.id), t_sampled, now);
+    if (piece_len <= 0) {
+        LOGE("%s token_to_piece <= 0", s.request.tag);
+        finish_locked(s, true);
+        return false;
+    }
+    if (s.generated == 0) {
+        s.t_first_piece = now;
+        if (s.request.stats != nullptr) {
+            s.request.stats->ttft_ms = elapsed_ms(s.t_start, now);
+        }
+    }
+    PieceMeta meta;
+    meta.token = token;
+    meta.t_ms = (float) elapsed_ms(s.t_start, now);
+    meta.logprob = s.request.logprobs ? sampled_logprob(logits_index, token) : 0.0f;
+
+    if (s.request.on_piece) {
+        if (!s.request.on_piece(piece, (size_t) piece_len, meta)) {
+            s.stop_after_next = true;
+        }
+    } else if (!s.ring.try_push(piece, (size_t) piece_len, meta)) {
+        std::memcpy(s.parked_bytes, piece, (size_t) piece_len);
+        s.parked_len = (size_t) piece_len;
+        s.parked_meta = meta;
+        s.piece_parked = true;
+    }
+    s.next_token = token;
+    return true;
+}
+
+int LlamaEngine::invalidate_tune_profiles(const std::string & dir) {
+    return remove_tune_profiles(dir);
+}
+
+namespace {
+
+// Decodes `tokens` at positions [0, n) of sequence 0 in `n_chunk` pieces and
+// returns tokens/s, or 0 if a decode failed. Leaves the sequence empty.
+double measure_prefill(llama_context * ctx, llama_batch & batch, const std::vector<llama_token> & tokens, int n_chunk) {
+    llama_memory_clear(llama_get_memory(ctx), true);
+    const auto t_start = Clock::now();
+    for (size_t start = 0; start < tokens.size(); start += (size_t) n_chunk) {
+        const size_t end = std::min(tokens.size(), start + (size_t) n_chunk);
+        batch.n_tokens = 0;
+        for (size_t i = start; i < end; ++i) {
+            batch_add(batch, tokens[i], (llama_pos) i, 0, i + 1 == end);
+        }
+        if (llama_decode(ctx, batch) != 0) {
+            llama_memory_clear(llama_get_memory(ctx), true);
+            return 0.0;
+        }
+    }
+    const double ms = elapsed_ms(t_start, Clock::now());
+    llama_memory_clear(llama_get_memory(ctx), true);
+    return ms > 0.0 ? (double) tokens.size() * 1000.0 / ms : 0.0;
+}
+
+// One-token decode steps after a short prefix, the shape of generation.
+double measure_decode(llama_context * ctx, llama_batch & batch, const std::vector<llama_token> & tokens, int n_prefix) {
+    llama_memory_clear(llama_get_memory(ctx), true);
+    const int n_chunk = (int) llama_n_batch(ctx);
+    for (int start = 0; start < n_prefix; start += n_chunk) {
+        const int end = std::min(n_prefix, start + n_chunk);
+        batch.n_tokens = 0;
+        for (int i = start; i < end; ++i) {
+            batch_add(batch, tokens[(size_t) i], i, 0, i + 1 == end);
+        }
+        if (llama_decode(ctx, batch) != 0) {
+            llama_memory_clear(llama_get_memory(ctx), true);
+            return 0.0;
+        }
+    }
+    const auto t_start = Clock::now();
+    for (int i = 0; i < kTuneDecodeTokens; ++i) {
+        batch.n_tokens = 0;
+        batch_add(batch, tokens[(size_t) (n_prefix + i)], n_prefix + i, 0, true);
+        if (llama_decode(ctx, batch) != 0) {
+            llama_memory_clear(llama_get_memory(ctx), true);
+            return 0.0;
+        }
+    }
+    const double ms = elapsed_ms(t_start, Clock::now());
+    llama_memory_clear(llama_get_memory(ctx), true);
+    return ms > 0.0 ? kTuneDecodeTokens * 1000.0 / ms : 0.0;
+}
+
+}  // namespace
+
+// Coordinate sweep over a fixed synthetic prompt: prefill threads at the
+// current batch size, then batch sizes at the best prefill thread count,
+// then decode threads. Values set explicitly in `config` are not swept.
+bool LlamaEngine::calibrate(llama_model * model,
+                            llama_context * ctx,
+                            const EngineConfig & config,
+                            unsigned hw_threads,
+                            int max_batch,
+                            int n_threads,
+                            int n_threads_batch,
+                            int n_batch,
+                            TuneProfile & out) {
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+    const int n_prompt = std::min(kTunePromptTokens, (int) llama_n_ctx(ctx) / 2);
+    std::vector<llama_token> tokens((size_t) n_prompt);
+    std::string text;
+    int n_tokens = 0;
+    while (n_tokens < n_prompt) {
+        text += kTuneText;
+        n_tokens = llama_tokenize(vocab, text.data(), (int32_t) text.size(), tokens.data(), n_prompt, false, false);
+        if (n_tokens < 0) {
+            n_tokens = n_prompt; // more than fit: the buffer is full
+        }
+        if (text.size() > 64 * 1024) {
+            break;
+        }
+    }
+    if (n_tokens < n_prompt || n_prompt <= kTuneDecodeTokens) {
+        LOGE("calibrate(): could not build a %d token prompt", n_prompt);
+        return false;
+    }
+
+    const std::vector<int> thread_list = tune_thread_candidates((int) hw_threads);
+    const std::vector<int> batch_threads = config.n_threads_batch > 0 ? std::vector<int>{n_threads_batch} : thread_list;
+    const std::vector<int> decode_threads = config.n_threads > 0 ? std::vector<int>{n_threads} : thread_list;
+    const std::vector<int> batches = config.n_batch > 0 ? std::vector<int>{n_batch} : tune_batch_candidates(max_batch);
+
+    llama_batch batch = llama_batch_init((int32_t) llama_n_batch(ctx), 0, 1);
+    // first touch of the weights pages them in; keep it out of the numbers
+    measure_prefill(ctx, batch, tokens, std::min(n_batch, (int) llama_n_batch(ctx)));
+
+    TuneProfile best;
+    best.n_batch = std::min(n_batch, (int) llama_n_batch(ctx));
+    for (const int threads : batch_threads) {
+        llama_set_n_threads(ctx, n_threads, threads);
+        const double tok_s = measure_prefill(ctx, batch, tokens, best.n_batch);
+        LOGI("calibrate(): prefill threads=%d n_batch=%d -> %.1f tok/s", threads, best.n_batch, tok_s);
+        if (tok_s > best.prefill_tok_s) {
+            best.prefill_tok_s = tok_s;
+            best.n_threads_batch = threads;
+        }
+    }
+    for (const int size : batches) {
+        if (size == best.n_batch || size > (int) llama_n_batch(ctx)) {
+            continue;
+        }
+        llama_set_n_threads(ctx, n_threads, best.n_threads_batch);
+        const double tok_s = measure_prefill(ctx, batch, tokens, size);
+        LOGI("calibrate(): prefill threads=%d n_batch=%d -> %.1f tok/s", best.n_threads_batch, size, tok_s);
+        if (tok_s > best.prefill_tok_s) {
+            best.prefill_tok_s = tok_s;
+            best.n_batch = size;
+        }
+    }
+    for (const int threads : decode_threads) {
+        llama_set_n_threads(ctx, threads, best.n_threads_batch);
+        const double tok_s = measure_decode(ctx, batch, tokens, n_prompt - kTuneDecodeTokens);
+        LOGI("calibrate(): decode threads=%d -> %.1f tok/s", threads, tok_s);
+        if (tok_s > best.decode_tok_s) {
+            best.decode_tok_s = tok_s;
+            best.n_threads = threads;
+        }
+    }
+    llama_batch_free(batch);
+
+    if (best.n_threads <= 0 || best.n_threads_batch <= 0) {
+        LOGE("calibrate(): every measurement failed");
+        return false;
+    }
+    out = best;
+    return true;
+}
+
+// Moves the first request's one-off costs into load(): faulting the weights
+// in from storage, the first run of each compute graph and the threadpools'
+// start-up. A short prompt goes through as one batch (the prefill graph),
+// then a single token (the decode graph); that reads every layer's weights,
+// but only a few rows of the embedding table, hence the prefault first.
+// Returns false only when cancelled; a failed decode is logged and the
+// model loads without the rest of the warmup.
+bool LlamaEngine::warm_up(llama_model * model, llama_context * ctx, const EngineConfig & config, LoadReport & report) {
+    const LoadProgressCallback & progress = config.on_progress;
+    // mlock has already faulted every page in, and without mmap the weights
+    // were copied into private memory
+    if (config.use_mmap && !config.use_mlock) {
+        ByteProgress on_bytes;
+        if (progress) {
+            on_bytes = [&progress](uint64_t done, uint64_t total) {
+                return progress(LoadStage::kPrefault, done, total);
+            };
+        }
+        PrefaultResult prefault;
+        const bool read = prefault_file(config.model_path, on_bytes, &prefault);
+        report.prefault_ms = prefault.ms;
+        if (prefault.cancelled) {
+            return false;
+        }
+        if (!read) {
+            LOGE("warm_up(): could not read %s", config.model_path.c_str());
+        } else {
+            LOGI("warm_up(): read %llu MiB into the page cache in %.0f ms",
+                 (unsigned long long) (prefault.bytes >> 20), prefault.ms);
+        }
+    }
+
+    const auto t_warm = Clock::now();
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+    const int n_prompt = std::min({kWarmupPromptTokens, (int) llama_n_batch(ctx), (int) llama_n_ctx(ctx) / 2});
+    std::vector<llama_token> tokens((size_t) std::max(0, n_prompt));
+    int n_tokens = n_prompt < 2 ? 0
+        : llama_tokenize(vocab, kTuneText, (int32_t) std::strlen(kTuneText), tokens.data(), n_prompt, false, false);
+    if (n_tokens < 0) {
+        n_tokens = n_prompt; // more than fit: the buffer is full
+    }
+    if (n_tokens < 2) {
+        LOGE("warm_up(): could not build a warmup prompt, skipping the priming decodes");
+        return true;
+    }
+
+    llama_batch batch = llama_batch_init(n_tokens, 0, 1);
+    bool cancelled = false;
+    for (int step = 0; step < kWarmupSteps; ++step) {
+        batch.n_tokens = 0;
+        if (step == 0) {
+            for (int i = 0; i + 1 < n_tokens; ++i) {
+                batch_add(batch, tokens[(size_t) i], i, 0, i + 2 == n_tokens);
+            }
+        } else {
+            batch_add(batch, tokens[(size_t) (n_tokens - 1)], n_tokens - 1, 0, true);
+        }
+        if (llama_decode(ctx, batch) != 0) {
+            LOGE("warm_up(): llama_decode failed at step %d", step);
+            break;
+        }
+        if (progress && !progress(LoadStage::kWarmup, (uint64_t) step + 1, kWarmupSteps)) {
+            cancelled = true;
+            break;
+        }
+    }
+    llama_batch_free(batch);
+    // nothing of the warmup may leak into the first request or the stats
+    llama_memory_clear(llama_get_memory(ctx), true);
+    llama_perf_context_reset(ctx);
+    report.warmup_ms = elapsed_ms(t_warm, Clock::now());
+    LOGI("warm_up(): %d prompt tokens and one decode step in %.0f ms", n_tokens - 1, report.warmup_ms);
+    return !cancelled;
+}
+
+// Brings the session's draft sequence up to history + next_token, leaving the
+// draft's logits for the token after next_token in the last batch row.
+bool LlamaEngine::sync_draft_locked(Session & s) {
+    size_t n_keep = 0;
+    const size_t limit = std::min(s.draft_history.size(), s.history.size());
+    while (n_keep < limit && s.draft_history[n_keep] == s.history[n_keep]) {
+        ++n_keep;
+    }
+    if (n_keep < s.draft_history.size()) {
+        if (!llama_memory_seq_rm(llama_get_memory(draft_ctx_), s.id, (llama_pos) n_keep, -1)) {
+            llama_memory_seq_rm(llama_get_memory(draft_ctx_), s.id, -1, -1);
+            n_keep = 0;
+        }
+        s.draft_history.resize(n_keep);
+    }
+
+    const size_t n_target = s.history.size() + 1;
+    const size_t n_chunk = (size_t) std::max(tuned_batch_, kMaxSessions); // draft_batch_ capacity
+    for (size_t start = n_keep; start < n_target; start += n_chunk) {
+        const size_t end = std::min(n_target, start + n_chunk);
+        draft_batch_.n_tokens = 0;
+        for (size_t i = start; i < end; ++i) {
+            const llama_token token = i < s.history.size() ? s.history[i] : s.next_token;
+            batch_add(draft_batch_, token, (llama_pos) i, s.id, i + 1 == n_target);
+        }
+        if (llama_decode(draft_ctx_, draft_batch_) != 0) {
+            LOGE("scheduler: draft catch-up for session %d failed", s.id);
+            llama_memory_seq_rm(llama_get_memory(draft_ctx_), s.id, -1, -1);
+            s.draft_history.clear();
+            return false;
+        }
+        for (size_t i = start; i < end; ++i) {
+            s.draft_history.push_back(i < s.history.size() ? s.history[i] : s.next_token);
+        }
+    }
+    return true;
+}
+
+// Fills `drafts` for every session about to decode. The first draft token of
+// each session comes from its catch-up decode; the rest are extended one
+// position at a time with all sessions in a single draft batch.
+void LlamaEngine::draft_locked(int capacity) {
+    Session * ready[kMaxSessions];
+    int n_ready = 0;
+    for (auto & session : sessions_) {
+        session->drafts.clear();
+        if (session->phase == Session::Phase::kDecode && !session->piece_parked && session->batched) {
+            ready[n_ready++] = session.get();
+        }
+    }
+    if (draft_ctx_ == nullptr || n_ready == 0) {
+        return;
+    }
+
+    const int n_vocab = std::min(llama_vocab_n_tokens(llama_model_get_vocab(model_)),
+                                 llama_vocab_n_tokens(llama_model_get_vocab(draft_model_)));
+    const int n_ctx_slots = (int) llama_n_ctx(ctx_);
+    const int share = (capacity - n_ready) / n_ready;
+    int want[kMaxSessions] = {};
+    for (int i = 0; i < n_ready; ++i) {
+        Session & s = *ready[i];
+        // room for next_token and the drafts in the batch, the context and
+        // the request's token budget
+        want[i] = std::min({s.draft_len, share, n_ctx_slots - (int) s.history.size() - 1,
+                            s.target - s.generated - 1});
+        if (want[i] <= 0 || !sync_draft_locked(s)) {
+            want[i] = 0;
+            continue;
+        }
+        float prob = 0.0f;
+        const llama_token token = greedy_token(llama_get_logits_ith(draft_ctx_, -1), n_vocab, prob);
+        if (prob < kDraftMinProb) {
+            want[i] = 0;
+            continue;
+        }
+        s.drafts.push_back(token);
+    }
+
+    int rows[kMaxSessions];
+    for (;;) {
+        draft_batch_.n_tokens = 0;
+        for (int i = 0; i < n_ready; ++i) {
+            Session & s = *ready[i];
+            rows[i] = -1;
+            if (s.drafts.empty() || (int) s.drafts.size() >= want[i]) {
+                continue;
+            }
+            rows[i] = draft_batch_.n_tokens;
+            batch_add(draft_batch_, s.drafts.back(), (llama_pos) (s.history.size() + s.drafts.size()), s.id, true);
+        }
+        if (draft_batch_.n_tokens == 0) {
+            return;
+        }
+        if (llama_decode(draft_ctx_, draft_batch_) != 0) {
+            LOGE("scheduler: draft decode of %d tokens failed", draft_batch_.n_tokens);
+            for (int i = 0; i < n_ready; ++i) {
+                if (rows[i] >= 0) {
+                    // the target still verifies what was drafted so far
+                    llama_memory_seq_rm(llama_get_memory(draft_ctx_), ready[i]->id, -1, -1);
+                    ready[i]->draft_history.clear();
+                }
+            }
+            return;
+        }
+        for (int i = 0; i < n_ready; ++i) {
+            if (rows[i] < 0) {
+                continue;
+            }
+            Session & s = *ready[i];
+            s.draft_history.push_back(s.drafts.back());
+            float prob = 0.0f;
+            const llama_token token = greedy_token(llama_get_logits_ith(draft_ctx_, rows[i]), n_vocab, prob);
+            if (prob < kDraftMinProb) {
+                want[i] = 0;
+                continue;
+            }
+            s.drafts.push_back(token);
+        }
+    }
+}
+
+// Commits next_token and every drafted token the target's sampler chain
+// reproduces, sampling each from the batch row before it; the first
+// disagreement becomes the new next_token. Rejected drafts leave the KV
+// sequence. Returns the tokens committed.
+int LlamaEngine::accept_decoded_locked(Session & s, Clock::time_point now) {
+    // still valid after finish_locked(): the waiter needs mutex_ to return
+    GenerationStats * stats = s.request.stats;
+    const size_t n_drafted = s.drafts.size();
+    const double step_ms = elapsed_ms(s.t_token, now);
+    s.t_token = now;
+
+    size_t n_accepted = 0;
+    int n_committed = 0;
+    int row = s.logits_index;
+    llama_token decoded = s.next_token;
+    for (;;) {
+        s.history.push_back(decoded);
+        ++s.generated;
+        ++n_committed;
+        if (s.stop_after_next || s.generated >= s.target) {
+            finish_locked(s, true);
+            break;
+        }
+        if (!sample_locked(s, row)) {
+            break;
+        }
+        // a parked piece holds the only slot, so nothing further is emitted
+        if (n_accepted == n_drafted || s.piece_parked || s.next_token != s.drafts[n_accepted]) {
+            break;
+        }
+        decoded = s.drafts[n_accepted++];
+        ++row;
+    }
+
+    if (stats != nullptr) {
+        ++stats->decode_steps;
+        stats->draft_tokens += (int) n_drafted;
+        stats->draft_accepted += (int) n_accepted;
+        for (int i = 0; i < n_committed; ++i) {
+            stats->token_ms.push_back(step_ms / n_committed);
+        }
+    }
+    if (n_drafted > 0) {
+        llama_memory_seq_rm(llama_get_memory(ctx_), s.id, (llama_pos) s.history.size(), -1);
+        s.draft_len = n_accepted == n_drafted ? std::min(draft_max_, s.draft_len + 2)
+                                              : std::max(1, (int) n_accepted + 1);
+        s.drafts.clear();
+    }
+    return n_committed;
+}
+
+// Builds and decodes one batch: the next token (plus any drafted tokens) for
+// every generating session, then prefill chunks for new requests in whatever
+// room is left. Returns false when there was nothing to decode.
+bool LlamaEngine::step_locked() {
+    using Phase = Session::Phase;
+    const int capacity = std::max(1, tuned_batch_);
+    const int n_ctx_slots = (int) llama_n_ctx(ctx_);
+    batch_.n_tokens = 0;
+
+    for (auto & session : sessions_) {
+        Session & s = *session;
+        s.decoding = false;
+        s.logits_index = -1;
+        s.chunk_end = s.prompt_pos;
+        s.step_priority = s.priority.load(std::memory_order_relaxed);
+        if (s.phase == Phase::kIdle) {
+            continue;
+        }
+        if (s.cancel.load()) {
+            LOGI("%s cancel requested", s.request.tag);
+            finish_locked(s, true);
+            continue;
+        }
+        if (s.piece_parked && s.ring.try_push(s.parked_bytes, s.parked_len, s.parked_meta)) {
+            s.piece_parked = false;
+        }
+        if (s.phase == Phase::kDecode && s.shift.enabled && (int) s.history.size() >= n_ctx_slots &&
+            shift_context_locked(s, shift_chunk_locked(s)) > 0 && s.request.stats != nullptr) {
+            ++s.request.stats->context_shifts;
+        }
+    }
+    // Highest priority first, in rotation order within a level. Prompts
+    // below the top busy priority wait, so a background prefill cannot fill
+    // the batch an interactive request is in; decode steps, one token
+    // each, still ride along.
+    Session * order[kMaxSessions];
+    RequestPriority busy_top = RequestPriority::kBackground;
+    for (int k = 0; k < kMaxSessions; ++k) {
+        order[k] = sessions_[(size_t) ((next_session_ + k) % kMaxSessions)].get();
+        if (order[k]->phase != Phase::kIdle) {
+            busy_top = std::max(busy_top, order[k]->step_priority);
+        }
+    }
+    std::stable_sort(order, order + kMaxSessions, [](const Session * a, const Session * b) {
+        return a->step_priority > b->step_priority;
+    });
+    const auto runnable = [busy_top](const Session & s) {
+        return (s.phase == Phase::kDecode && !s.piece_parked) ||
+               (s.phase == Phase::kPrefill && s.step_priority >= busy_top);
+    };
+
+    // llama.cpp applies LoRA adapters to the whole context, so a batch runs
+    // one set: the first runnable session picks it and sessions on another
+    // set wait for a step that starts with one of them.
+    const Session * lead = nullptr;
+    for (int k = 0; k < kMaxSessions && lead == nullptr; ++k) {
+        if (runnable(*order[k])) {
+            lead = order[k];
+        }
+    }
+    if (lead != nullptr && preempt_.waiting_above(lead->step_priority)) {
+        // a request that outranks this batch is waiting for the lock
+        return true;
+    }
+    for (auto & session : sessions_) {
+        session->batched = lead != nullptr && session->loras == lead->loras;
+    }
+    draft_locked(capacity);
+
+    for (int k = 0; k < kMaxSessions && batch_.n_tokens < capacity; ++k) {
+        Session & s = *order[k];
+        if (s.phase != Phase::kDecode || s.piece_parked || !s.batched) {
+            continue;
+        }
+        if ((int) s.history.size() >= n_ctx_slots) {
+            LOGI("%s context full after %d tokens", s.request.tag, s.generated);
+            finish_locked(s, true);
+            continue;
+        }
+        s.decoding = true;
+        s.logits_index = batch_.n_tokens;
+        const llama_pos pos = (llama_pos) s.history.size();
+        batch_add(batch_, s.next_token, pos, s.id, true);
+        // each drafted token's row also yields the logits that verify the next
+        s.drafts.resize(std::min(s.drafts.size(), (size_t) (capacity - batch_.n_tokens)));
+        for (size_t j = 0; j < s.drafts.size(); ++j) {
+            batch_add(batch_, s.drafts[j], pos + 1 + (llama_pos) j, s.id, true);
+        }
+    }
+
+    for (int k = 0; k < kMaxSessions && batch_.n_tokens < capacity; ++k) {
+        Session & s = *order[k];
+        if (s.phase != Phase::kPrefill || !s.batched || !runnable(s)) {
+            continue;
+        }
+        if (s.queued) {
+            const auto now = Clock::now();
+            s.metrics.phases[kPhaseQueue].add(elapsed_us(s.t_queued, now));
+            trace_.record("queue", session_lane(s.id), s.t_queued, now);
+            s.queued = false;
+        }
+        const size_t room = (size_t) (capacity - batch_.n_tokens);
+        s.chunk_end = std::min(s.prompt.size(), s.prompt_pos + room);
+        for (size_t i = s.prompt_pos; i < s.chunk_end; ++i) {
+            // only the final prompt token needs logits for the first sample
+            const bool last = i + 1 == s.prompt.size();
+            if (last) {
+                s.logits_index = batch_.n_tokens;
+            }
+            batch_add(batch_, s.prompt[i], (llama_pos) i, s.id, last);
+        }
+    }
+
+    if (batch_.n_tokens == 0) {
+        return false;
+    }
+    next_session_ = (next_session_ + 1) % kMaxSessions;
+    apply_loras_locked(lead->loras);
+
+    // lets abort_decode() stop the batch for a cancel or a higher priority
+    for (auto & session : sessions_) {
+        Session & s = *session;
+        s.in_batch.store(s.decoding || s.chunk_end > s.prompt_pos, std::memory_order_relaxed);
+    }
+    preempt_.begin_batch(lead->step_priority);
+    const auto t_decode = Clock::now();
+    const int rc = llama_decode(ctx_, batch_);
+    const auto now = Clock::now();
+    preempt_.end_batch();
+    for (auto & session : sessions_) {
+        session->in_batch.store(false, std::memory_order_relaxed);
+    }
+    trace_.record("llama_decode", kSchedulerLane, t_decode, now, batch_.n_tokens);
+    if (rc == 2) {
+        ++aborted_decodes_;
+        trace_.record("aborted", kSchedulerLane, t_decode, now, batch_.n_tokens);
+        LOGI("scheduler: batch of %d tokens aborted after %.1f ms", batch_.n_tokens, elapsed_ms(t_decode, now));
+        rollback_aborted_locked();
+        return true;
+    }
+    if (rc == 1) {
+        // No free KV cells: the sessions share n_ctx, so one can run out
+        // before its own history is full. Generating sessions that may shift
+        // make room and the whole batch is retried; llama_decode left nothing
+        // behind. (A prefilling session's positions follow its prompt, so it
+        // is not shifted mid-prompt.)
+        bool shifted = false;
+        for (auto & session : sessions_) {
+            Session & s = *session;
+            if (s.decoding && s.shift.enabled && shift_context_locked(s, shift_chunk_locked(s)) > 0) {
+                shifted = true;
+                if (s.request.stats != nullptr) {
+                    ++s.request.stats->context_shifts;
+                }
+            }
+        }
+        if (shifted) {
+            for (auto & session : sessions_) {
+                session->drafts.clear();
+            }
+            return true;
+        }
+    }
+    if (rc != 0) {
+        LOGE("scheduler: llama_decode of %d tokens failed (%d)", batch_.n_tokens, rc);
+        for (auto & session : sessions_) {
+            Session & s = *session;
+            if (s.decoding || (s.phase == Phase::kPrefill && s.chunk_end > s.prompt_pos)) {
+                drop_sequence_locked(s);
+                finish_locked(s, false);
+            }
+        }
+        return true;
+    }
+
+    const double decode_us = elapsed_us(t_decode, now);
+    // prefill chunks would skew tokens/s; the governor watches decode steps
+    const bool decode_only = std::none_of(sessions_.begin(), sessions_.end(), [](const std::unique_ptr<Session> & s) {
+        return s->chunk_end > s->prompt_pos;
+    });
+    int n_generating = 0;
+    int n_committed = 0;
+    for (auto & session : sessions_) {
+        Session & s = *session;
+        if (s.decoding) {
+            s.metrics.phases[kPhaseDecode].add(decode_us);
+            trace_.record("decode", session_lane(s.id), t_decode, now, 1 + (int64_t) s.drafts.size());
+            ++n_generating;
+            n_committed += accept_decoded_locked(s, now);
+        } else if (s.phase == Phase::kPrefill && s.chunk_end > s.prompt_pos) {
+            s.metrics.phases[kPhasePrefill].add(decode_us);
+            trace_.record("prefill", session_lane(s.id), t_decode, now, (int64_t) (s.chunk_end - s.prompt_pos));
+            s.history.insert(s.history.end(), s.prompt.begin() + (long) s.prompt_pos, s.prompt.begin() + (long) s.chunk_end);
+            s.prompt_pos = s.chunk_end;
+            const int n_todo = (int) s.prompt.size() - s.n_past;
+            if (prefill_progress_) {
+                prefill_progress_(s.id, (int) s.prompt_pos - s.n_past, n_todo);
+            }
+            if (s.prompt_pos == s.prompt.size()) {
+                if (s.request.stats != nullptr) {
+                    s.request.stats->prefill_ms = elapsed_ms(s.t_start, now);
+                }
+                s.t_token = now;
+                s.phase = Phase::kDecode;
+                sample_locked(s, s.logits_index);
+            }
+        }
+    }
+
+    // rejected drafts are not throughput; committed tokens are
+    GovernorDecision decision;
+    if (governor_ != nullptr && decode_only &&
+        governor_->observe(n_generating, n_committed, decode_us, decision)) {
+        llama_set_n_threads(ctx_, decision.n_threads, decision.n_threads_batch);
+        trace_.record("threads", kSchedulerLane, now, now, decision.n_threads);
+        LOGI("thread governor: %d -> %d threads (batch %d), %s at %.1f tok/s, %.1f C", decision.from_threads,
+             decision.n_threads, decision.n_threads_batch, governor_reason_name(decision.reason), decision.tok_s,
+             decision.temp_c);
+        if (governor_callback_) {
+            governor_callback_(decision);
+        }
+    }
+    return true;
+}
+
+void LlamaEngine::scheduler_loop() {
+    LOGI("[scheduler] start");
+    std::unique_lock<std::mutex> lock(mutex_);
+    // This thread is worker 0 of whichever pool runs a batch; the larger
+    // cpu set contains the smaller one.
+    const std::vector<int> & cpus = batch_cpus_.size() > decode_cpus_.size() ? batch_cpus_ : decode_cpus_;
+    if (!cpus.empty() && !pin_current_thread(cpus)) {
+        LOGE("[scheduler] could not pin to %s", cpu_list_string(cpus).c_str());
+    }
+    while (!stop_scheduler_) {
+        if (step_locked()) {
+            // let callers queued on mutex_ in between two batches
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+            continue;
+        }
+        const bool any_active = std::any_of(sessions_.begin(), sessions_.end(), [](const std::unique_ptr<Session> & s) {
+            return s->phase != Session::Phase::kIdle;
+        });
+        if (any_active) {
+            // only sessions parked on a full ring: poll for the consumer
+            work_cv_.wait_for(lock, std::chrono::milliseconds(2));
+        } else {
+            work_cv_.wait(lock);
+        }
+    }
+    LOGI("[scheduler] stop");
+}
+
+void LlamaEngine::stop_scheduler() {
+    if (!scheduler_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_scheduler_ = true;
+    }
+    work_cv_.notify_all();
+    scheduler_.join();
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_scheduler_ = false;
+}
+
+// ---- public request API ---------------------------------------------------
+
+std::string LlamaEngine::generate(const std::string & prompt,
+                                  int n_predict,
+                                  GenerationStats * stats,
+                                  const PieceCallback & on_piece) {
+    return generate(kDefaultSession, std::vector<ChatMessage>{{"user", prompt}}, n_predict, stats, on_piece);
+}
+
+std::string LlamaEngine::generate(const std::vector<ChatMessage> & messages,
+                                  int n_predict,
+                                  GenerationStats * stats,
+                                  const PieceCallback & on_piece) {
+    return generate(kDefaultSession, messages, n_predict, stats, on_piece);
+}
+
+std::string LlamaEngine::generate(int session,
+                                  const std::vector<ChatMessage> & messages,
+                                  int n_predict,
+                                  GenerationStats * stats,
+                                  const PieceCallback & on_piece) {
+    Session * s = session_at(session);
+    std::unique_lock<std::mutex> lock = lock_preempting(s);
+    if (ctx_ == nullptr || s == nullptr || !s->open) {
+        LOGE("generate(): %s", ctx_ == nullptr ? "context not ready" : "session not open");
+        return "";
+    }
+    wait_idle_locked(lock, *s);
+    if (ctx_ == nullptr) {
+        return "";
+    }
+    s->cancel.store(false);
+    s->cancel_us.store(0, std::memory_order_relaxed);
+
+    std::string response;
+    Request request;
+    request.messages = messages;
+    request.n_predict = n_predict;
+    request.stats = stats;
+    request.tag = "generate():";
+    request.on_piece = [&response, &on_piece](const char * piece, size_t len, const PieceMeta & meta) {
+        response.append(piece, len);
+        return !on_piece || on_piece(piece, len, meta);
+    };
+    if (!submit_locked(*s, std::move(request))) {
+        return "";
+    }
+    const uint64_t ticket = s->finished;
+    idle_cv_.wait(lock, [s, ticket]() { return s->finished != ticket; });
+    return response;
+}
+
+bool LlamaEngine::start_stream(const std::string & prompt, int n_predict, bool logprobs) {
+    return start_stream(kDefaultSession, std::vector<ChatMessage>{{"user", prompt}}, n_predict, logprobs);
+}
+
+bool LlamaEngine::start_stream(const std::vector<ChatMessage> & messages, int n_predict, bool logprobs) {
+    return start_stream(kDefaultSession, messages, n_predict, logprobs);
+}
+
+bool LlamaEngine::start_stream(int session, const std::vector<ChatMessage> & messages, int n_predict, bool logprobs) {
+    Session * s = session_at(session);
+    if (s != nullptr) {
+        request_cancel(*s); // whatever it runs now is replaced
+    }
+    std::unique_lock<std::mutex> lock = lock_preempting(s);
+    if (ctx_ == nullptr || s == nullptr || !s->open) {
+        LOGE("start_stream(): %s", ctx_ == nullptr ? "context not ready" : "session not open");
+        return false;
+    }
+    if (s->phase != Session::Phase::kIdle) {
+        LOGI("start_stream(): cancelling running request on session %d", session);
+        wait_idle_locked(lock, *s);
+        if (ctx_ == nullptr) {
+            return false;
+        }
+    }
+    // the previous consumer has seen the ring close and returned
+    s->ring.reset();
+    s->utf8.reset();
+    s->stream_logprobs.store(logprobs);
+    s->cancel.store(false);
+    s->cancel_us.store(0, std::memory_order_relaxed);
+
+    Request request;
+    request.messages = messages;
+    request.n_predict = n_predict;
+    request.logprobs = logprobs;
+    request.tag = "[stream]";
+    LOGI("[stream] session %d start, messages=%zu, maxTokens=%d", session, messages.size(), n_predict);
+    if (!submit_locked(*s, std::move(request))) {
+        s->ring.close();
+        return false;
+    }
+    return true;
+}
+
+bool LlamaEngine::wait_for_frame(StreamFrame & frame, int timeout_ms, size_t max_count) {
+    return wait_for_frame(kDefaultSession, frame, timeout_ms, max_count);
+}
+
+bool LlamaEngine::wait_for_frame(int session, StreamFrame & frame, int timeout_ms, size_t max_count) {
+    Session * s = session_at(session);
+    frame.clear();
+    if (s == nullptr) {
+        return false;
+    }
+    frame.has_logprobs = s->stream_logprobs.load();
+    s->raw.clear();
+    s->ring.wait_and_drain(s->raw, timeout_ms, max_count, &frame.tokens);
+    if (!frame.tokens.empty()) {
+        // age of each piece: produced (request start + t_ms) -> drained now
+        const auto now = Clock::now();
+        const double start_us = (double) s->stream_start_us.load(std::memory_order_relaxed);
+        const double now_us = (double) clock_us(now);
+        {
+            std::lock_guard<std::mutex> metrics_lock(metrics_mutex_);
+            for (const PieceMeta & meta : frame.tokens) {
+                const double age_us = now_us - (start_us + (double) meta.t_ms * 1000.0);
+                s->handoff.add(age_us);
+                total_handoff_.add(age_us);
+            }
+        }
+        const auto oldest = Clock::time_point(std::chrono::microseconds(
+            (int64_t) (start_us + (double) frame.tokens.front().t_ms * 1000.0)));
+        trace_.record("handoff", consumer_lane(session), std::min(oldest, now), now, (int64_t) frame.tokens.size());
+    }
+    s->utf8.append(frame.text, s->raw.data(), s->raw.size());
+    if (s->ring.finished()) {
+        // a sequence cut off by EOG/cancel is passed through as-is
+        s->utf8.flush(frame.text);
+        return !frame.text.empty() || !frame.tokens.empty();
+    }
+    return true;
+}
+
+void LlamaEngine::cancel(int session) {
+    if (Session * s = session_at(session)) {
+        request_cancel(*s);
+    }
+}
+
+void LlamaEngine::cancel_all() {
+    for (auto & session : sessions_) {
+        request_cancel(*session);
+    }
+}
+
+bool LlamaEngine::stream_active(int session) const {
+    const Session * s = session_at(session);
+    return s != nullptr && s->active.load();
+}
+
+}  // namespace maathai
@@ -0,0 +1,658 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cpu_topology.h"
+#include "embed_batch.h"
+#include "llama.h"
+#include "lora_set.h"
+#include "memory_plan.h"
+#include "metrics.h"
+#include "page_cache.h"
+#include "preempt.h"
+#include "prefix_snapshot.h"
+#include "sampler.h"
+#include "stream_frame.h"
+#include "thread_governor.h"
+#include "token_ring.h"
+#include "tune_profile.h"
+#include "utf8.h"
+
+namespace maathai {
+
+struct ChatMessage {
+    std::string role;
+    std::string content;
+};
+
+enum class TuneMode {
+    kOff,
+    kAuto,  // reuse the cached profile for this model/device, calibrate if none
+    kForce, // calibrate and overwrite the cached profile
+};
+
+enum class FlashAttention {
+    kAuto, // llama.cpp decides per backend
+    kOff,
+    kOn,
+};
+
+const char * flash_attention_name(FlashAttention mode);
+
+enum class LoadStage {
+    kWeights,  // llama.cpp reading the model file; bytes
+    kPrefault, // warmup: pulling the file into the page cache; bytes
+    kWarmup,   // warmup: priming decodes; steps
+};
+
+const char * load_stage_name(LoadStage stage);
+
+// Reports load progress on the loading thread, about once per percent of
+// each stage. Returning false cancels: load() frees whatever it built and
+// fails with LoadReport::cancelled set.
+using LoadProgressCallback = std::function<bool(LoadStage stage, uint64_t done, uint64_t total)>;
+
+struct EngineConfig {
+    std::string model_path;
+    int n_ctx = 0;           // <= 0 picks a default from the model size
+    int n_threads = 0;       // decode threads; <= 0 uses the (performance) core count
+    int n_threads_batch = 0; // prefill threads; <= 0 derives from n_threads
+    int n_batch = 0;         // prefill chunk per llama_decode; <= 0 picks a default
+    int n_ubatch = 0;        // physical micro-batch for prefill; <= 0 uses n_batch
+    int n_gpu_layers = 0;
+    // On big.LITTLE parts, size the thread counts from the performance cores
+    // and run inference in threadpools pinned to them.
+    bool prefer_performance_cores = true;
+    // Resident memory allowed for weights, KV cache and compute buffers.
+    // When > 0, n_ctx and n_batch become upper bounds and load() picks the
+    // largest values that fit, or fails if even the smallest does not.
+    uint64_t memory_budget_bytes = 0;
+    // KV cache element types. A quantized V cache needs flash attention: it
+    // switches kAuto to kOn, and with kOff V falls back to f16.
+    KvCacheType type_k = KvCacheType::kF16;
+    KvCacheType type_v = KvCacheType::kF16;
+    FlashAttention flash_attn = FlashAttention::kAuto;
+    // Optional small model with the target's vocabulary for speculative
+    // decoding. Left empty, every decode step produces one token.
+    std::string draft_model_path;
+    int n_draft = 0;         // most tokens drafted per step; <= 0 picks a default
+    // On-device tuning of n_threads/n_threads_batch/n_batch. Profiles live in
+    // `tune_dir`; tuning is off without one.
+    TuneMode tune = TuneMode::kOff;
+    std::string tune_dir;
+    // With mmap the weights stay in the page cache, shared and evictable,
+    // and load lazily; without it they are read into private memory up
+    // front. mlock pins the mapped pages (llama.cpp warns and carries on
+    // when RLIMIT_MEMLOCK is too low).
+    bool use_mmap = true;
+    bool use_mlock = false;
+    // Moves first-request costs into load(): reads the file into the page
+    // cache (mmap without mlock), then runs a short prefill and one decode
+    // step so the weights are mapped and the compute buffers and threadpools
+    // have run once. The KV cache and perf counters are cleared afterwards.
+    bool warmup = false;
+    LoadProgressCallback on_progress;
+    SamplerConfig sampler;
+};
+
+// How the last load() went. Durations are in milliseconds.
+struct LoadReport {
+    bool cancelled = false;
+    uint64_t file_bytes = 0;
+    bool use_mmap = true;
+    bool use_mlock = false;
+    double weights_ms = 0.0;  // llama_model_load_from_file
+    double prefault_ms = 0.0;
+    double warmup_ms = 0.0;   // priming decodes
+    double total_ms = 0.0;    // all of load()
+};
+
+// Timings for a single generation. Durations are in milliseconds and measured
+// from the moment the request entered the engine.
+struct GenerationStats {
+    int prompt_tokens = 0;
+    int cached_tokens = 0; // prompt tokens not decoded: reused from the KV memory or evicted by context shifting
+    int generated_tokens = 0;
+    double prefill_ms = 0.0; // decode of the uncached prompt suffix
+    double ttft_ms = 0.0;    // request start -> first piece emitted
+    double decode_ms = 0.0;  // first piece -> end of generation
+    std::vector<double> token_ms; // per-token latency (sample + detokenize + decode)
+    int decode_steps = 0;    // target decodes that produced generated tokens
+    int draft_tokens = 0;    // tokens proposed by the draft model
+    int draft_accepted = 0;  // of those, confirmed by the target
+    int context_shifts = 0;  // evictions that let generation run past n_ctx
+    SamplerTimings sampling; // per-stage sampler time for this request
+    PhaseMetrics phases;     // per-phase time; handoff is measured by the stream consumer
+};
+
+// Receives each detokenized piece as it is produced. Pieces are raw token
+// bytes and may end inside a UTF-8 sequence. Returning false stops
+// generation after the current token.
+using PieceCallback = std::function<bool(const char * piece, size_t len, const PieceMeta & meta)>;
+
+// Reports prefill progress after each n_batch chunk. Counts cover only the
+// tokens that actually need decoding (cached prefix excluded).
+using PrefillProgressCallback = std::function<void(int session, int done, int total)>;
+
+// Reports every thread count change the governor makes.
+using GovernorCallback = std::function<void(const GovernorDecision & decision)>;
+
+enum class PrefixStatus {
+    kFailed,
+    kRestored, // loaded from a snapshot on disk, nothing decoded
+    kCreated,  // decoded now and written to disk for the next launch
+};
+
+enum class TuneStatus {
+    kOff,
+    kCached,     // settings read from the profile cache
+    kCalibrated, // measured during this load and cached
+    kFailed,     // calibration failed; heuristics in use
+};
+
+struct TuneResult {
+    TuneStatus status = TuneStatus::kOff;
+    double ms = 0.0; // calibration time
+    TuneProfile profile;
+};
+
+// Sliding context for one session. When its KV sequence fills n_ctx, the
+// oldest `n_discard` tokens after the first `n_keep` are evicted and the
+// positions behind them are moved down in place, so generation continues at
+// the same per-token cost instead of failing or re-decoding the history.
+struct ContextShift {
+    bool enabled = false;
+    int n_keep = -1;   // -1: the session's pinned prefix, else just BOS
+    int n_discard = 0; // 0: half of the context after n_keep
+};
+
+enum class EmbeddingPooling {
+    kModel, // the GGUF's own pooling; mean when it declares none
+    kMean,
+    kCls,
+    kLast,
+};
+
+const char * embedding_pooling_name(EmbeddingPooling pooling);
+
+struct EmbedOptions {
+    EmbeddingPooling pooling = EmbeddingPooling::kModel;
+    bool normalize = true; // unit L2 norm, so cosine similarity is a dot product
+    int n_batch = 0;       // tokens per decode and longest text; <= 0 picks a default
+    int n_seq = 0;         // texts per decode; <= 0 picks a default
+};
+
+struct EmbedStats {
+    int texts = 0;
+    int tokens = 0;
+    int truncated = 0; // texts cut to n_batch tokens
+    int batches = 0;   // llama_decode calls
+    double ms = 0.0;   // tokenize + decode + pooling read-back
+    double texts_per_s = 0.0;
+    EmbeddingPooling pooling = EmbeddingPooling::kModel; // as resolved
+};
+
+// One request as seen by get_stats().
+struct RequestMetrics {
+    int prompt_tokens = 0;
+    int cached_tokens = 0;
+    int generated_tokens = 0;
+    double total_ms = 0.0; // submitted -> finished
+    bool cancelled = false;
+    double cancel_ms = 0.0; // cancel() -> session idle, when cancelled
+    PhaseMetrics phases;
+};
+
+// Everything get_stats() reports. Phase times are in microseconds.
+struct EngineStats {
+    // The session's most recent finished request. For a stream, the handoff
+    // phase covers whatever the consumer has drained so far.
+    RequestMetrics last;
+    PhaseMetrics total; // every request on every session since load()
+    uint64_t requests = 0;
+    PhaseStat cancel;   // cancel() -> session idle, every cancelled request
+    uint64_t aborted_decodes = 0; // batches stopped inside llama_decode
+    int n_threads = 0;       // as the governor set them, when adaptive
+    int n_threads_batch = 0;
+    int n_batch = 0;
+    int n_ubatch = 0;
+    int kv_used = 0;    // cells held by all sessions
+    int kv_session = 0; // of those, held by this session
+    int kv_size = 0;
+    int active_sessions = 0;
+    // llama.cpp's own counters for the context since load()
+    double llama_load_ms = 0.0;
+    double llama_prompt_ms = 0.0;
+    double llama_eval_ms = 0.0;
+    int llama_prompt_tokens = 0;
+    int llama_eval_tokens = 0;
+};
+
+struct PrefixResult {
+    PrefixStatus status = PrefixStatus::kFailed;
+    int n_tokens = 0;
+    double ms = 0.0;
+};
+
+struct LoraAdapterInfo {
+    int id = -1;
+    std::string path;
+    uint64_t file_bytes = 0;
+    double load_ms = 0.0;
+    int sessions = 0; // sessions whose current or next set includes it
+};
+
+// Owns one model/context and the scheduler that drives generation on it.
+// The JNI bridge and the host tools are thin layers over this class.
+//
+// Requests run on sessions. Each session is a KV sequence with its own
+// sampler, token history and stream ring; session 0 always exists and is
+// what the session-less overloads use. A single scheduler thread merges the
+// next decode step of every generating session and the pending prefill
+// chunks of new requests into one llama_decode per iteration (continuous
+// batching), so concurrent sessions share the matrix multiplies instead of
+// taking turns.
+//
+// With a draft model loaded, each generating session first gets a few tokens
+// proposed by the draft; the target decodes them in the same batch and keeps
+// the longest run its own sampler chain agrees with. The accepted tokens are
+// exactly the ones the sampler would have produced one step at a time.
+//
+// Cancelling, and a request that outranks the running batch, stop a
+// llama_decode between graph nodes through llama.cpp's abort callback
+// instead of waiting for it to finish. The sessions in an aborted batch keep
+// whatever prompt chunks had reached the KV cache and redo the rest.
+class LlamaEngine {
+public:
+    static constexpr int kMaxSessions = 4;
+    static constexpr int kDefaultSession = 0;
+
+    LlamaEngine();
+    ~LlamaEngine();
+
+    LlamaEngine(const LlamaEngine &) = delete;
+    LlamaEngine & operator=(const LlamaEngine &) = delete;
+
+    // Calls llama_backend_init() once per process.
+    static void init_backend();
+
+    // Replaces any loaded model. Returns false (and leaves the engine empty)
+    // if the model or context cannot be created or config.on_progress
+    // cancelled the load.
+    bool load(const EngineConfig & config);
+    const LoadReport & load_report() const { return load_report_; }
+    void release();
+    bool is_loaded() const;
+
+    // Frees the context (KV cache, compute buffers, the draft and embeddings
+    // contexts) but keeps the weights, adapters and resolved settings, so
+    // resume() brings the model back in milliseconds instead of reading the
+    // file again. Running requests are cancelled, every session's next
+    // request starts from an empty KV sequence, and requests fail until
+    // resume(). Returns false when there is no context to free.
+    bool suspend();
+    // Rebuilds the context load() created. True if it is live afterwards.
+    bool resume();
+    // Weights loaded, context freed by suspend().
+    bool suspended() const;
+    // No session has a request queued or running.
+    bool idle() const;
+    // GGUF-header estimate of what load() keeps resident with the settings
+    // it resolved, draft weights included; kv + compute is what suspend()
+    // gives back. Zero when the header could not be read.
+    MemoryEstimate resident_estimate() const;
+    // The same estimate for a model not loaded yet, from its header and the
+    // context/batch/cache settings load(config) would resolve. A cached tune
+    // profile can still pick a smaller batch. Zero when the header cannot be
+    // read or the memory budget refuses the model.
+    static MemoryEstimate estimate_load(const EngineConfig & config);
+
+    // Applies to every session, including requests already running. The
+    // parameters are swapped in place; penalty windows carry over.
+    bool update_sampler(const SamplerConfig & config);
+    // Per-stage sampling time accumulated on the session since load().
+    SamplerTimings sampler_timings(int session = kDefaultSession) const;
+
+    // Per-phase timings of the session's last request and of all requests,
+    // with thread counts, KV usage and llama.cpp's perf counters.
+    EngineStats get_stats(int session = kDefaultSession) const;
+    // Records every phase of every request as Chrome trace events (one lane
+    // for the scheduler's batches, one per session and one per stream
+    // consumer) until stop_trace(), which writes them to `path` unless it
+    // is empty. Keeps the most recent `max_events`.
+    void start_trace(size_t max_events = TraceRecorder::kDefaultCapacity);
+    bool stop_trace(const std::string & path);
+
+    // Installed once by the platform layer; invoked on the scheduler thread.
+    void set_prefill_progress_callback(PrefillProgressCallback callback);
+
+    // Returns a free session id, or -1 when all sequences are taken.
+    int open_session();
+    // Cancels anything running on the session and drops its KV sequence.
+    // The default session cannot be closed.
+    void close_session(int session);
+
+    // Drops the session's KV sequence, token history and sampler state so
+    // its next prompt starts from position 0.
+    void reset_context(int session = kDefaultSession);
+
+    // In conversation mode the tokens already in a session's KV sequence are
+    // kept between requests. Each new templated prompt is matched against
+    // them by longest common prefix and only the divergent suffix is decoded.
+    // When off, every request starts from an empty sequence.
+    void set_conversation_mode(bool enabled);
+    bool conversation_mode() const { return conversation_mode_.load(); }
+
+    // Lets a ThreadGovernor re-pick the decode and prefill thread counts
+    // between decode steps, from measured tokens/s and the SoC temperature,
+    // never above what load() settled on; off restores those counts. Kept
+    // across loads. `thermal` replaces /sys/class/thermal, e.g. to replay a
+    // throttling trace.
+    void set_adaptive_threads(bool enabled, std::shared_ptr<ThermalSource> thermal = nullptr);
+    bool adaptive_threads() const;
+    // Installed once by the platform layer; invoked on the scheduler thread.
+    void set_governor_callback(GovernorCallback callback);
+
+    // Context shifting for the session, off by default. Without it a request
+    // stops when the sequence reaches n_ctx. In conversation mode the next
+    // prompt is matched with the evicted tokens skipped, so a long chat keeps
+    // reusing its KV sequence. Returns false for a bad session id.
+    bool set_context_shift(int session, const ContextShift & shift);
+
+    // Priority of the session's requests, kNormal by default. Batches are
+    // filled highest priority first, and a session's prompt chunks wait while
+    // a higher-priority session is busy (its decode steps still ride along).
+    // A request that arrives while a lower-priority batch is decoding aborts
+    // that batch. Returns false for a bad session id.
+    bool set_session_priority(int session, RequestPriority priority);
+    RequestPriority session_priority(int session = kDefaultSession) const;
+
+    // Puts a fixed preamble (system prompt, few-shot turns) into the
+    // session's KV sequence and pins it: later requests whose templated
+    // prompt starts with it skip those tokens even when conversation mode is
+    // off. The decoded state is snapshotted under `cache_dir`, keyed by model
+    // file, LoRA set, context parameters and prefix tokens, so the next launch restores
+    // it instead of decoding it again. Stale or foreign snapshots are
+    // discarded. Other sessions are paused while this runs.
+    PrefixResult prime_prefix(const std::vector<ChatMessage> & prefix,
+                              const std::string & cache_dir,
+                              int session = kDefaultSession);
+
+    // LoRA adapters over the resident base model. The first load_lora() of
+    // a path reads the adapter and returns a new id; later calls return the
+    // same id. Adapters hold only their own tensors, so any number of
+    // fine-tunes share one copy of the base weights. Returns -1 when nothing
+    // is loaded or the file is not an adapter for this model. Other sessions
+    // keep generating while the file is read. Adapters do not apply to
+    // embed() or to the draft model, whose proposals the target still
+    // verifies with its adapters applied.
+    int load_lora(const std::string & path);
+    // Cancels requests running with the adapter, takes it out of every
+    // session's set and frees it. Sessions that were using it start their
+    // next request from an empty KV sequence.
+    bool unload_lora(int id);
+    std::vector<LoraAdapterInfo> loras() const;
+    // Replaces the adapters the session runs with; an empty set is the base
+    // model. The set is adopted by the session's next request or
+    // prime_prefix(), so a running request finishes with the old one. If it
+    // differs from the set the session's KV sequence was computed with, that
+    // sequence (pinned prefix included) is dropped at that point. Switching
+    // is otherwise free: llama.cpp applies adapters per context, so each
+    // batch runs one set and sessions on different sets take turns.
+    // Returns false for a closed session, an unknown id or a bad scale.
+    bool set_session_loras(int session, const LoraSet & set);
+    LoraSet session_loras(int session = kDefaultSession) const;
+
+    // Embeds `texts` with the loaded model on a second, embeddings-enabled
+    // context created on first use (and again when the pooling or batch
+    // shape changes). Texts are packed into multi-sequence batches, one
+    // sequence id per text, so dozens of snippets share each llama_decode.
+    // Writes texts.size() * n_embd() floats, one row per text in input
+    // order. Returns false when nothing is loaded, `capacity` is too small or
+    // a decode fails. Generation keeps running: the scheduler is only held
+    // off for one batch at a time.
+    bool embed(const std::vector<std::string> & texts,
+               const EmbedOptions & options,
+               float * out,
+               size_t capacity,
+               EmbedStats * stats = nullptr);
+    bool embed(const std::vector<std::string> & texts,
+               const EmbedOptions & options,
+               std::vector<float> & out,
+               EmbedStats * stats = nullptr);
+    // Width of one embedding row; 0 when nothing is loaded.
+    int n_embd() const;
+
+    // Blocking generation. `stats` and `on_piece` are optional; `on_piece`
+    // runs on the scheduler thread. A plain prompt is templated as a single
+    // user message. Waits for any request already running on the session.
+    std::string generate(const std::string & prompt,
+                         int n_predict,
+                         GenerationStats * stats = nullptr,
+                         const PieceCallback & on_piece = {});
+    std::string generate(const std::vector<ChatMessage> & messages,
+                         int n_predict,
+                         GenerationStats * stats = nullptr,
+                         const PieceCallback & on_piece = {});
+    std::string generate(int session,
+                         const std::vector<ChatMessage> & messages,
+                         int n_predict,
+                         GenerationStats * stats = nullptr,
+                         const PieceCallback & on_piece = {});
+
+    // Streaming generation. Cancels whatever the session was doing, queues
+    // the request and returns; pieces are drained with wait_for_frame().
+    // With `logprobs` each token also carries the log-probability the model
+    // assigned to it (one log-softmax over the vocabulary per token).
+    bool start_stream(const std::string & prompt, int n_predict, bool logprobs = false);
+    bool start_stream(const std::vector<ChatMessage> & messages, int n_predict, bool logprobs = false);
+    bool start_stream(int session, const std::vector<ChatMessage> & messages, int n_predict, bool logprobs = false);
+    // Fills `frame` with up to `max_count` pieces, waiting up to `timeout_ms`
+    // for the first one. Returns false once the stream has ended and every
+    // piece was delivered; true otherwise (the frame may then be empty).
+    // One consumer per session.
+    bool wait_for_frame(StreamFrame & frame, int timeout_ms, size_t max_count);
+    bool wait_for_frame(int session, StreamFrame & frame, int timeout_ms, size_t max_count);
+    // Stops the session's request, aborting a llama_decode it is part of;
+    // the time until the session is idle is reported as cancel_ms.
+    void cancel(int session = kDefaultSession);
+    void cancel_all();
+    bool stream_active(int session = kDefaultSession) const;
+
+    int n_ctx() const;
+    int n_threads() const { return tuned_threads_; }
+    int n_threads_batch() const { return tuned_threads_batch_; }
+    int n_batch() const { return tuned_batch_; }
+    int n_ubatch() const { return tuned_ubatch_; }
+    uint64_t model_params() const { return model_params_; }
+    const TuneResult & tune_result() const { return tune_result_; }
+    // The plan load() followed; `fits` is false when no budget was given.
+    const MemoryPlan & memory_plan() const { return memory_plan_; }
+    // Removes every cached tuning profile in `dir`; returns how many.
+    static int invalidate_tune_profiles(const std::string & dir);
+    const CpuTopology & cpu_topology() const { return topology_; }
+    // CPUs the decode / prefill threadpools are pinned to; empty when unpinned.
+    const std::vector<int> & decode_cpus() const { return decode_cpus_; }
+    const std::vector<int> & batch_cpus() const { return batch_cpus_; }
+    bool speculative() const { return draft_ctx_ != nullptr; }
+    int n_draft() const { return draft_max_; }
+    // Cache types and flash-attention mode after load() resolved them.
+    KvCacheType type_k() const { return type_k_; }
+    KvCacheType type_v() const { return type_v_; }
+    FlashAttention flash_attn() const { return flash_attn_; }
+    bool small_model() const { return small_model_; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Session;
+    struct Request {
+        std::vector<ChatMessage> messages;
+        int n_predict = 0;
+        GenerationStats * stats = nullptr;
+        PieceCallback on_piece; // empty for streams, which go to the ring
+        bool logprobs = false;
+        const char * tag = "";
+    };
+
+    Session * session_at(int session) const;
+    std::unique_lock<std::mutex> lock_preempting(const Session * s);
+    void request_cancel(Session & s);
+    static bool abort_decode(void * data);
+    // All of the following run with mutex_ held.
+    bool submit_locked(Session & s, Request request);
+    void wait_idle_locked(std::unique_lock<std::mutex> & lock, Session & s);
+    void finish_locked(Session & s, bool ok);
+    bool step_locked();
+    bool sample_locked(Session & s, int logits_index);
+    int accept_decoded_locked(Session & s, Clock::time_point now);
+    void draft_locked(int capacity);
+    bool sync_draft_locked(Session & s);
+    void drop_sequence_locked(Session & s);
+    void rollback_aborted_locked();
+    void start_governor_locked();
+    size_t shift_keep_locked(const Session & s) const;
+    size_t shift_chunk_locked(const Session & s) const;
+    size_t shift_context_locked(Session & s, size_t n_discard);
+    bool fit_prompt_locked(Session & s, std::vector<llama_token> & tokens, int & n_past);
+    void adopt_loras_locked(Session & s);
+    void apply_loras_locked(const LoraSet & set);
+
+    void scheduler_loop();
+    void stop_scheduler();
+
+    std::string apply_chat_template(const std::vector<ChatMessage> & messages, bool add_assistant = true) const;
+    bool tokenize(const std::string & text, std::vector<llama_token> & out) const;
+    int reuse_prefix(Session & s, std::vector<llama_token> & tokens);
+    bool prefill(Session & s, const std::vector<llama_token> & tokens, int n_past, const char * tag);
+    int resolve_target_tokens(int requested, int prompt_tokens, bool shifting) const;
+    float sampled_logprob(int logits_index, llama_token token) const;
+    uint64_t context_params_hash() const;
+    uint64_t lora_set_hash_locked(const LoraSet & set) const;
+    bool restore_prefix(Session & s, const std::string & path, const std::vector<llama_token> & tokens, const SnapshotHeader & key);
+    void save_prefix(Session & s, const std::string & path, const std::vector<llama_token> & tokens, const SnapshotHeader & key);
+
+    bool load_draft(const EngineConfig & config, const llama_context_params & target_params);
+    static bool warm_up(llama_model * model, llama_context * ctx, const EngineConfig & config, LoadReport & report);
+    bool embed_context_locked(const EmbedOptions & options, int n_batch, int n_seq);
+    void free_embed_context_locked();
+    static bool calibrate(llama_model * model,
+                          llama_context * ctx,
+                          const EngineConfig & config,
+                          unsigned hw_threads,
+                          int max_batch,
+                          int n_threads,
+                          int n_threads_batch,
+                          int n_batch,
+                          TuneProfile & out);
+
+    llama_model * model_ = nullptr;
+    llama_context * ctx_ = nullptr;
+    // What load() built ctx_ and draft_ctx_ with, for resume().
+    llama_context_params ctx_params_ = {};
+    llama_context_params draft_ctx_params_ = {};
+    MemoryEstimate resident_estimate_;
+    SamplerConfig sampler_config_;
+    // Reused for every scheduler step and prefix prefill (n_batch capacity).
+    llama_batch batch_ = {};
+    PrefillProgressCallback prefill_progress_;
+    GovernorCallback governor_callback_;
+    bool adaptive_threads_ = false;
+    std::shared_ptr<ThermalSource> thermal_;
+    std::unique_ptr<ThreadGovernor> governor_; // while loaded and adaptive
+    std::atomic_bool conversation_mode_{false};
+    std::string model_path_;
+    uint64_t model_fingerprint_ = 0; // computed on first prime_prefix()
+
+    // Draft model for speculative decoding; null when not configured.
+    llama_model * draft_model_ = nullptr;
+    llama_context * draft_ctx_ = nullptr;
+    llama_batch draft_batch_ = {};
+    int draft_max_ = 0;
+
+    // Embeddings context on model_, built by the first embed().
+    llama_context * embd_ctx_ = nullptr;
+    llama_batch embd_batch_ = {};
+    EmbeddingPooling embd_requested_ = EmbeddingPooling::kModel;
+    EmbeddingPooling embd_pooling_ = EmbeddingPooling::kModel;
+    int embd_n_batch_ = 0;
+    int embd_n_seq_ = 0;
+    // Serializes embed() callers; taken before mutex_.
+    std::mutex embed_mutex_;
+
+    // LoRA adapters on model_, in load order. Ids are not reused until
+    // release(), so a stale id cannot name a different adapter.
+    struct LoraAdapter {
+        int id = -1;
+        std::string path;
+        llama_adapter_lora * adapter = nullptr;
+        uint64_t fingerprint = 0; // file_fingerprint(), for snapshot keys
+        uint64_t file_bytes = 0;
+        double load_ms = 0.0;
+    };
+    std::vector<LoraAdapter> loras_;
+    int next_lora_id_ = 0;
+    LoraSet applied_loras_; // what ctx_ currently runs with
+    // Serializes load_lora() and keeps release() from freeing model_ while
+    // an adapter file is read without mutex_; taken before mutex_.
+    std::mutex lora_mutex_;
+
+    bool small_model_ = false;
+    uint64_t model_params_ = 0;
+    int tuned_ctx_ = 0;
+    int tuned_threads_ = 0;
+    int tuned_threads_batch_ = 0;
+    int tuned_batch_ = 0;
+    int tuned_ubatch_ = 0;
+    TuneResult tune_result_;
+    MemoryPlan memory_plan_;
+    LoadReport load_report_;
+    KvCacheType type_k_ = KvCacheType::kF16;
+    KvCacheType type_v_ = KvCacheType::kF16;
+    FlashAttention flash_attn_ = FlashAttention::kAuto;
+
+    // Pinned ggml threadpools for single-token decodes and for batches; the
+    // batch pool is null when both would cover the same cores.
+    CpuTopology topology_;
+    ggml_threadpool * threadpool_ = nullptr;
+    ggml_threadpool * threadpool_batch_ = nullptr;
+    std::vector<int> decode_cpus_;
+    std::vector<int> batch_cpus_;
+
+    // Request metrics, updated by the scheduler under mutex_. Stream
+    // consumers add their handoff times under metrics_mutex_ instead.
+    PhaseMetrics total_metrics_;
+    uint64_t requests_ = 0;
+    PhaseStat total_cancel_;
+    uint64_t aborted_decodes_ = 0;
+    PhaseStat total_handoff_;
+    mutable std::mutex metrics_mutex_;
+    TraceRecorder trace_;
+
+    // Preallocated for the engine's lifetime so consumers can hold on to
+    // them across load()/release().
+    std::vector<std::unique_ptr<Session>> sessions_;
+    // First session considered when filling the next batch; rotates so a
+    // long prefill cannot starve the others.
+    int next_session_ = 0;
+
+    // Guards model/context/sessions. The scheduler holds it for one batch at
+    // a time, so other callers wait at most one llama_decode, or until
+    // preempt_ aborts it.
+    mutable std::mutex mutex_;
+    PreemptGate preempt_;
+    std::condition_variable work_cv_; // scheduler: new request / stop
+    std::condition_variable idle_cv_; // callers: a session finished
+    std::thread scheduler_;
+    bool stop_scheduler_ = false;
+};
+
+}  // namespace maathai
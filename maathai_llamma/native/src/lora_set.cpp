@@ -0,0 +1,37 @@
+#include "lora_set.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <utility>
+
+namespace maathai {
+
+bool normalize_lora_set(LoraSet & set) {
+    LoraSet out = set;
+    std::sort(out.begin(), out.end(), [](const LoraScale & a, const LoraScale & b) { return a.id < b.id; });
+    for (size_t i = 0; i < out.size(); ++i) {
+        if (out[i].id < 0 || !std::isfinite(out[i].scale) || (i > 0 && out[i].id == out[i - 1].id)) {
+            return false;
+        }
+    }
+    out.erase(std::remove_if(out.begin(), out.end(), [](const LoraScale & lora) { return lora.scale == 0.0f; }),
+              out.end());
+    set = std::move(out);
+    return true;
+}
+
+std::string format_lora_set(const LoraSet & set) {
+    if (set.empty()) {
+        return "none";
+    }
+    std::string out;
+    char entry[32];
+    for (const LoraScale & lora : set) {
+        std::snprintf(entry, sizeof(entry), "%s%d@%.2f", out.empty() ? "" : ",", lora.id, (double) lora.scale);
+        out += entry;
+    }
+    return out;
+}
+
+}  // namespace maathai
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace maathai {
+
+// One LoRA adapter, by the id LlamaEngine::load_lora() returned, applied at
+// `scale` on top of the base weights.
+struct LoraScale {
+    int id = -1;
+    float scale = 1.0f;
+
+    bool operator==(const LoraScale & other) const { return id == other.id && scale == other.scale; }
+    bool operator!=(const LoraScale & other) const { return !(*this == other); }
+};
+
+// The adapters one session runs with. Kept normalized (see below) so two
+// sets that produce the same weights compare equal, which is what decides
+// whether sessions can share a batch and whether a KV sequence is stale.
+using LoraSet = std::vector<LoraScale>;
+
+// Sorts by id and drops zero-scale entries. Returns false, leaving `set`
+// untouched, for a negative id, an id listed twice or a non-finite scale.
+bool normalize_lora_set(LoraSet & set);
+
+// "3@1.00,5@0.50"; "none" for the base model. For logs.
+std::string format_lora_set(const LoraSet & set);
+
+}  // namespace maathai
@@ -0,0 +1,36 @@
+#pragma once
+
+// Logging shared by the engine and the platform shims. Android builds route to
+// logcat; host builds (bench, tests) write to stderr so stdout stays clean for
+// machine-readable output.
+
+#define LOG_TAG "MaathaiLL-NATIVE"
+
+#if defined(__ANDROID__)
+
+#include <android/log.h>
+
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO,  LOG_TAG, __VA_ARGS__)
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+#else
+
+#include <cstdio>
+
+#define MAATHAI_HOST_LOG(level, ...)                          \
+    do {                                                      \
+        std::fprintf(stderr, "%s/" LOG_TAG ": ", level);      \
+        std::fprintf(stderr, __VA_ARGS__);                    \
+        std::fputc('\n', stderr);                             \
+    } while (0)
+
+#define LOGI(...) MAATHAI_HOST_LOG("I", __VA_ARGS__)
+#define LOGE(...) MAATHAI_HOST_LOG("E", __VA_ARGS__)
+#if defined(MAATHAI_DEBUG_LOG)
+#define LOGD(...) MAATHAI_HOST_LOG("D", __VA_ARGS__)
+#else
+#define LOGD(...) do { } while (0)
+#endif
+
+#endif
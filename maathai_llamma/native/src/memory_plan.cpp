@@ -0,0 +1,338 @@
+#include "memory_plan.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+
+namespace maathai {
+
+namespace {
+
+constexpr uint32_t kGgufMagic = 0x46554747u; // "GGUF"
+constexpr uint64_t kGgufDefaultAlignment = 32;
+// Sanity limits so a corrupt header cannot make the reader loop for ages.
+constexpr uint64_t kMaxKeyLength = 1u << 16;
+constexpr uint64_t kMaxEntries = 1u << 20;
+constexpr uint32_t kMaxDims = 8;
+
+constexpr int kPlanCtxStep = 256;
+constexpr int kPlanMinBatch = 16;
+constexpr uint64_t kBaseOverheadBytes = 32ull << 20;
+constexpr uint64_t kBytesPerVocabEntry = 64; // token text, scores, lookup maps
+
+enum GgufType : uint32_t {
+    kU8 = 0, kI8, kU16, kI16, kU32, kI32, kF32, kBool, kString, kArray, kU64, kI64, kF64,
+};
+
+struct FileCloser {
+    void operator()(std::FILE * file) const {
+        if (file != nullptr) {
+            std::fclose(file);
+        }
+    }
+};
+using File = std::unique_ptr<std::FILE, FileCloser>;
+
+// Little-endian GGUF header reader; only integers and counts are kept.
+class GgufReader {
+public:
+    explicit GgufReader(std::FILE * file) : file_(file) {}
+
+    template <typename T>
+    bool read(T & value) {
+        return std::fread(&value, sizeof(T), 1, file_) == 1;
+    }
+
+    bool skip(uint64_t bytes) {
+        return std::fseek(file_, (long) bytes, SEEK_CUR) == 0;
+    }
+
+    bool read_string(std::string & out) {
+        uint64_t len = 0;
+        if (!read(len) || len > kMaxKeyLength) {
+            return false;
+        }
+        out.resize((size_t) len);
+        return len == 0 || std::fread(&out[0], 1, (size_t) len, file_) == len;
+    }
+
+    bool skip_string() {
+        uint64_t len = 0;
+        return read(len) && skip(len);
+    }
+
+    // Integer scalars are widened; floats, bools and strings are skipped
+    // (`has` false).
+    bool read_scalar(uint32_t type, uint64_t & value, bool & has) {
+        has = false;
+        switch (type) {
+            case kU8: case kI8: return read_as<uint8_t>(value, has);
+            case kU16: case kI16: return read_as<uint16_t>(value, has);
+            case kU32: return read_as<uint32_t>(value, has);
+            case kI32: {
+                int32_t v = 0;
+                has = read(v);
+                value = (uint64_t) std::max(0, v);
+                return has;
+            }
+            case kU64: case kI64: return read_as<uint64_t>(value, has);
+            case kBool: return skip(1);
+            case kF32: return skip(4);
+            case kF64: return skip(8);
+            case kString: return skip_string();
+            default: return false;
+        }
+    }
+
+    long tell() const { return std::ftell(file_); }
+
+private:
+    template <typename T>
+    bool read_as(uint64_t & value, bool & has) {
+        T v = 0;
+        has = read(v);
+        value = v;
+        return has;
+    }
+
+    std::FILE * file_;
+};
+
+int as_int(const std::map<std::string, uint64_t> & values, const std::string & key, int fallback = 0) {
+    const auto it = values.find(key);
+    return it == values.end() ? fallback : (int) std::min<uint64_t>(it->second, 1u << 30);
+}
+
+}  // namespace
+
+const char * kv_cache_type_name(KvCacheType type) {
+    switch (type) {
+        case KvCacheType::kF16: return "f16";
+        case KvCacheType::kQ8_0: return "q8_0";
+        case KvCacheType::kQ4_0: return "q4_0";
+    }
+    return "f16";
+}
+
+bool parse_kv_cache_type(const std::string & name, KvCacheType & type) {
+    for (const KvCacheType candidate : {KvCacheType::kF16, KvCacheType::kQ8_0, KvCacheType::kQ4_0}) {
+        if (name == kv_cache_type_name(candidate)) {
+            type = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+double kv_cache_type_bytes(KvCacheType type) {
+    switch (type) {
+        case KvCacheType::kF16: return 2.0;
+        case KvCacheType::kQ8_0: return 34.0 / 32.0;
+        case KvCacheType::kQ4_0: return 18.0 / 32.0;
+    }
+    return 2.0;
+}
+
+bool read_gguf_info(const std::string & path, GgufModelInfo & info) {
+    File file(std::fopen(path.c_str(), "rb"));
+    if (!file) {
+        return false;
+    }
+    GgufReader reader(file.get());
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint64_t n_tensors = 0;
+    uint64_t n_kv = 0;
+    if (!reader.read(magic) || magic != kGgufMagic || !reader.read(version) || version < 2 || version > 3 ||
+        !reader.read(n_tensors) || !reader.read(n_kv) || n_tensors > kMaxEntries || n_kv > kMaxEntries) {
+        return false;
+    }
+
+    // Integer values by key; integer arrays keep their maximum and any other
+    // array its length (tokenizer.ggml.tokens gives the vocabulary size).
+    std::map<std::string, uint64_t> values;
+    GgufModelInfo out;
+    std::string key;
+    for (uint64_t i = 0; i < n_kv; ++i) {
+        uint32_t type = 0;
+        if (!reader.read_string(key) || !reader.read(type)) {
+            return false;
+        }
+        if (type == kString) {
+            if (key == "general.architecture") {
+                if (!reader.read_string(out.architecture)) {
+                    return false;
+                }
+            } else if (!reader.skip_string()) {
+                return false;
+            }
+            continue;
+        }
+        if (type != kArray) {
+            uint64_t value = 0;
+            bool has = false;
+            if (!reader.read_scalar(type, value, has)) {
+                return false;
+            }
+            if (has) {
+                values[key] = value;
+            }
+            continue;
+        }
+        uint32_t elem_type = 0;
+        uint64_t n = 0;
+        if (!reader.read(elem_type) || !reader.read(n) || elem_type == kArray) {
+            return false;
+        }
+        uint64_t max_value = 0;
+        bool numeric = false;
+        for (uint64_t j = 0; j < n; ++j) {
+            uint64_t value = 0;
+            bool has = false;
+            if (!reader.read_scalar(elem_type, value, has)) {
+                return false;
+            }
+            numeric = has;
+            max_value = std::max(max_value, value);
+        }
+        values[key] = numeric ? max_value : n;
+    }
+
+    std::string name;
+    for (uint64_t i = 0; i < n_tensors; ++i) {
+        uint32_t n_dims = 0;
+        if (!reader.read_string(name) || !reader.read(n_dims) || n_dims > kMaxDims) {
+            return false;
+        }
+        uint64_t elements = 1;
+        for (uint32_t d = 0; d < n_dims; ++d) {
+            uint64_t dim = 0;
+            if (!reader.read(dim)) {
+                return false;
+            }
+            elements *= dim;
+        }
+        uint32_t type = 0;
+        uint64_t offset = 0;
+        if (!reader.read(type) || !reader.read(offset)) {
+            return false;
+        }
+        out.n_params += elements;
+    }
+
+    const long header_end = reader.tell();
+    if (header_end < 0 || std::fseek(file.get(), 0, SEEK_END) != 0) {
+        return false;
+    }
+    out.file_bytes = (uint64_t) std::ftell(file.get());
+    uint64_t alignment = kGgufDefaultAlignment;
+    if (values.count("general.alignment") != 0 && values["general.alignment"] > 0) {
+        alignment = values["general.alignment"];
+    }
+    const uint64_t data_offset = ((uint64_t) header_end + alignment - 1) / alignment * alignment;
+    out.weights_bytes = out.file_bytes > data_offset ? out.file_bytes - data_offset : 0;
+
+    const std::string & arch = out.architecture;
+    out.n_ctx_train = as_int(values, arch + ".context_length");
+    out.n_layer = as_int(values, arch + ".block_count");
+    out.n_embd = as_int(values, arch + ".embedding_length");
+    out.n_ff = as_int(values, arch + ".feed_forward_length");
+    out.n_head = as_int(values, arch + ".attention.head_count");
+    out.n_head_kv = as_int(values, arch + ".attention.head_count_kv", out.n_head);
+    if (arch.empty() || out.n_layer <= 0 || out.n_embd <= 0 || out.n_head <= 0) {
+        return false;
+    }
+    out.n_embd_head_k = as_int(values, arch + ".attention.key_length", out.n_embd / out.n_head);
+    out.n_embd_head_v = as_int(values, arch + ".attention.value_length", out.n_embd / out.n_head);
+    out.n_vocab = as_int(values, arch + ".vocab_size", as_int(values, "tokenizer.ggml.tokens"));
+    info = out;
+    return true;
+}
+
+MemoryEstimate estimate_memory(const GgufModelInfo & info,
+                               int n_ctx,
+                               int n_batch,
+                               int n_ubatch,
+                               KvCacheType type_k,
+                               KvCacheType type_v,
+                               bool flash_attn) {
+    MemoryEstimate estimate;
+    const uint64_t ctx = (uint64_t) std::max(0, n_ctx);
+    const uint64_t ubatch = (uint64_t) std::max(1, n_ubatch > 0 ? std::min(n_ubatch, n_batch) : n_batch);
+    estimate.weights = info.weights_bytes;
+
+    const double heads = (double) info.n_layer * (double) info.n_head_kv;
+    const double k_bytes = heads * info.n_embd_head_k * kv_cache_type_bytes(type_k);
+    const double v_bytes = heads * info.n_embd_head_v * kv_cache_type_bytes(type_v);
+    estimate.kv = (uint64_t) ((double) ctx * (k_bytes + v_bytes));
+
+    // f32 activations of one layer (ggml reuses them across layers): KQ
+    // scores over the whole cache unless flash attention tiles them, the FFN
+    // intermediates, the residual stream, plus the output logits for the
+    // micro-batch.
+    const uint64_t scores = flash_attn ? 0 : ctx * (uint64_t) info.n_head;
+    const uint64_t per_token = scores + 3ull * (uint64_t) info.n_ff +
+                               6ull * (uint64_t) info.n_embd + (uint64_t) info.n_vocab;
+    estimate.compute = 4ull * ubatch * per_token + 4ull * (uint64_t) info.n_vocab * (uint64_t) std::max(1, n_batch);
+
+    estimate.overhead = kBaseOverheadBytes + kBytesPerVocabEntry * (uint64_t) info.n_vocab;
+    return estimate;
+}
+
+MemoryPlan plan_memory(const GgufModelInfo & info,
+                       uint64_t budget_bytes,
+                       int max_ctx,
+                       int max_batch,
+                       int n_ubatch,
+                       KvCacheType type_k,
+                       KvCacheType type_v,
+                       bool flash_attn) {
+    int ctx_limit = max_ctx > 0 ? max_ctx : info.n_ctx_train;
+    if (ctx_limit <= 0) {
+        ctx_limit = 4096;
+    }
+    const int batch_limit = max_batch > 0 ? max_batch : kPlanDefaultBatch;
+    const int n_steps = (ctx_limit + kPlanCtxStep - 1) / kPlanCtxStep;
+    auto ctx_at = [&](int step) { return std::min(step * kPlanCtxStep, ctx_limit); };
+
+    MemoryPlan best;
+    for (int batch = batch_limit;; batch = std::max(kPlanMinBatch, batch / 2)) {
+        const int ubatch = n_ubatch > 0 ? std::min(n_ubatch, batch) : batch;
+        auto fits = [&](int step) {
+            const int ctx = ctx_at(step);
+            return estimate_memory(info, ctx, std::min(batch, ctx), std::min(ubatch, ctx), type_k, type_v, flash_attn)
+                       .total() <= budget_bytes;
+        };
+        // the estimate grows with the context, so the steps that fit are a prefix
+        int lo = 0;
+        int hi = n_steps;
+        while (lo < hi) {
+            const int mid = (lo + hi + 1) / 2;
+            if (fits(mid)) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        if (lo > 0 && ctx_at(lo) > best.n_ctx) {
+            best.fits = true;
+            best.n_ctx = ctx_at(lo);
+            best.n_batch = std::min(batch, best.n_ctx);
+            best.n_ubatch = std::min(ubatch, best.n_ctx);
+        }
+        if (best.n_ctx == ctx_limit || batch <= kPlanMinBatch) {
+            break;
+        }
+    }
+    if (best.fits) {
+        best.estimate = estimate_memory(info, best.n_ctx, best.n_batch, best.n_ubatch, type_k, type_v, flash_attn);
+    } else {
+        const int ctx = ctx_at(1);
+        best.estimate = estimate_memory(info, ctx, std::min(kPlanMinBatch, ctx), std::min(kPlanMinBatch, ctx),
+                                        type_k, type_v, flash_attn);
+    }
+    return best;
+}
+
+}  // namespace maathai
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace maathai {
+
+// Element type of the K and V caches.
+enum class KvCacheType {
+    kF16,
+    kQ8_0,
+    kQ4_0,
+};
+
+const char * kv_cache_type_name(KvCacheType type);
+// Accepts the names above ("f16", "q8_0", "q4_0"); false for anything else.
+bool parse_kv_cache_type(const std::string & name, KvCacheType & type);
+// Bytes per cached element; the quantized types store 32-element blocks with
+// an f16 scale.
+double kv_cache_type_bytes(KvCacheType type);
+
+// What the estimator needs from a GGUF file, read from its header without
+// touching the tensor data. Per-layer arrays (head_count_kv, ff length) are
+// reduced to their maximum.
+struct GgufModelInfo {
+    std::string architecture;
+    uint64_t file_bytes = 0;
+    uint64_t weights_bytes = 0; // the tensor data section
+    uint64_t n_params = 0;
+    int n_ctx_train = 0;
+    int n_layer = 0;
+    int n_embd = 0;
+    int n_head = 0;
+    int n_head_kv = 0;
+    int n_embd_head_k = 0;
+    int n_embd_head_v = 0;
+    int n_ff = 0;
+    int n_vocab = 0;
+};
+
+// False when the file is missing, not GGUF (v2/v3) or lacks the
+// architecture's block_count/embedding_length/head_count keys.
+bool read_gguf_info(const std::string & path, GgufModelInfo & info);
+
+// Resident memory of a loaded context, in bytes. Weights are mmapped, so they
+// are file-backed and reclaimable, but every page is touched on each decode
+// and evicting them thrashes; they count in full. Compute covers the graph
+// buffers of one n_ubatch step plus the logits buffer; without flash
+// attention the KQ scores over the whole cache dominate it.
+struct MemoryEstimate {
+    uint64_t weights = 0;
+    uint64_t kv = 0;
+    uint64_t compute = 0;
+    uint64_t overhead = 0; // vocab, ggml contexts, thread stacks
+
+    uint64_t total() const { return weights + kv + compute + overhead; }
+};
+
+MemoryEstimate estimate_memory(const GgufModelInfo & info,
+                               int n_ctx,
+                               int n_batch,
+                               int n_ubatch,
+                               KvCacheType type_k,
+                               KvCacheType type_v,
+                               bool flash_attn);
+
+struct MemoryPlan {
+    bool fits = false;
+    int n_ctx = 0;
+    int n_batch = 0;
+    int n_ubatch = 0;
+    MemoryEstimate estimate; // for the planned values, or the smallest tried
+};
+
+// Largest context, then largest batch, whose estimate stays within
+// `budget_bytes`. `max_ctx` (<= 0: the training context) and `max_batch`
+// (<= 0: kPlanDefaultBatch) are upper bounds; the context moves in 256-token
+// steps and the batch halves down to 16 when that buys more context.
+// `n_ubatch` <= 0 follows the batch.
+constexpr int kPlanDefaultBatch = 64;
+MemoryPlan plan_memory(const GgufModelInfo & info,
+                       uint64_t budget_bytes,
+                       int max_ctx,
+                       int max_batch,
+                       int n_ubatch,
+                       KvCacheType type_k,
+                       KvCacheType type_v,
+                       bool flash_attn);
+
+}  // namespace maathai
@@ -0,0 +1,204 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace maathai {
+
+namespace {
+
+int bucket_index(double us) {
+    if (!(us >= 1.0)) {
+        return 0;
+    }
+    int exp = 0;
+    const double mantissa = std::frexp(us, &exp); // us = mantissa * 2^exp, mantissa in [0.5, 1)
+    const int octave = exp - 1;
+    if (octave >= PhaseStat::kOctaves) {
+        return PhaseStat::kBuckets - 1;
+    }
+    const int sub = std::min(PhaseStat::kSubBuckets - 1, (int) ((mantissa * 2.0 - 1.0) * PhaseStat::kSubBuckets));
+    return 1 + octave * PhaseStat::kSubBuckets + sub;
+}
+
+double bucket_upper_us(int index) {
+    if (index == 0) {
+        return 1.0;
+    }
+    const int octave = (index - 1) / PhaseStat::kSubBuckets;
+    const int sub = (index - 1) % PhaseStat::kSubBuckets;
+    return std::ldexp(1.0 + (double) (sub + 1) / PhaseStat::kSubBuckets, octave);
+}
+
+void append_escaped(std::string & out, const std::string & value) {
+    for (const char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char) c < 0x20) {
+            out += ' ';
+        } else {
+            out += c;
+        }
+    }
+}
+
+}  // namespace
+
+const char * metric_phase_name(int phase) {
+    switch (phase) {
+        case kPhaseQueue: return "queue";
+        case kPhaseTemplate: return "template";
+        case kPhaseTokenize: return "tokenize";
+        case kPhasePrefill: return "prefill";
+        case kPhaseDecode: return "decode";
+        case kPhaseSample: return "sample";
+        case kPhaseDetokenize: return "detokenize";
+        case kPhaseHandoff: return "handoff";
+        default: break;
+    }
+    return "unknown";
+}
+
+void PhaseStat::add(double us) {
+    us = std::max(0.0, us);
+    ++count;
+    total_us += us;
+    max_us = std::max(max_us, us);
+    ++buckets[bucket_index(us)];
+}
+
+void PhaseStat::merge(const PhaseStat & other) {
+    count += other.count;
+    total_us += other.total_us;
+    max_us = std::max(max_us, other.max_us);
+    for (int i = 0; i < kBuckets; ++i) {
+        buckets[i] += other.buckets[i];
+    }
+}
+
+double PhaseStat::percentile_us(double q) const {
+    if (count == 0) {
+        return 0.0;
+    }
+    const uint64_t rank = std::max<uint64_t>(1, (uint64_t) std::ceil(std::clamp(q, 0.0, 1.0) * (double) count));
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            // the last bucket also collects everything past the top octave
+            return i == kBuckets - 1 ? max_us : std::min(max_us, bucket_upper_us(i));
+        }
+    }
+    return max_us;
+}
+
+void PhaseMetrics::merge(const PhaseMetrics & other) {
+    for (int phase = 0; phase < kMetricPhaseCount; ++phase) {
+        phases[phase].merge(other.phases[phase]);
+    }
+}
+
+void TraceRecorder::start(size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_.assign(std::max<size_t>(1, capacity), Event{});
+    next_ = 0;
+    recorded_ = 0;
+    origin_ = Clock::now();
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+void TraceRecorder::stop() {
+    enabled_.store(false, std::memory_order_relaxed);
+}
+
+void TraceRecorder::record(const char * name, uint32_t tid, Clock::time_point begin, Clock::time_point end, int64_t arg) {
+    if (!enabled()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (events_.empty()) {
+        return;
+    }
+    Event & event = events_[next_];
+    event.name = name;
+    event.tid = tid;
+    event.ts_us = std::chrono::duration_cast<std::chrono::microseconds>(begin - origin_).count();
+    event.dur_us = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+    event.arg = arg;
+    next_ = (next_ + 1) % events_.size();
+    ++recorded_;
+}
+
+void TraceRecorder::name_lane(uint32_t tid, const std::string & name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto & lane : lanes_) {
+        if (lane.first == tid) {
+            lane.second = name;
+            return;
+        }
+    }
+    lanes_.emplace_back(tid, name);
+}
+
+size_t TraceRecorder::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (size_t) std::min<uint64_t>(recorded_, events_.size());
+}
+
+uint64_t TraceRecorder::dropped() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return recorded_ > events_.size() ? recorded_ - events_.size() : 0;
+}
+
+std::string TraceRecorder::to_json() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    char line[256];
+    for (const auto & lane : lanes_) {
+        out += first ? "\n" : ",\n";
+        first = false;
+        std::snprintf(line, sizeof(line), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"",
+                      lane.first);
+        out += line;
+        append_escaped(out, lane.second);
+        out += "\"}}";
+    }
+    // oldest first
+    const size_t n = (size_t) std::min<uint64_t>(recorded_, events_.size());
+    const size_t begin = recorded_ > events_.size() ? next_ : 0;
+    for (size_t i = 0; i < n; ++i) {
+        const Event & event = events_[(begin + i) % events_.size()];
+        out += first ? "\n" : ",\n";
+        first = false;
+        std::snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld",
+                      event.name, event.tid, (long long) event.ts_us, (long long) event.dur_us);
+        out += line;
+        if (event.arg >= 0) {
+            std::snprintf(line, sizeof(line), ",\"args\":{\"n\":%lld}", (long long) event.arg);
+            out += line;
+        }
+        out += '}';
+    }
+    out += "\n]}\n";
+    return out;
+}
+
+bool TraceRecorder::write_json(const std::string & path) const {
+    const std::string json = to_json();
+    const std::string tmp = path + ".tmp";
+    std::FILE * file = std::fopen(tmp.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    const bool written = std::fwrite(json.data(), 1, json.size(), file) == json.size();
+    if (std::fclose(file) != 0 || !written || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+}  // namespace maathai
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace maathai {
+
+// Where a request spends its time, in the order it passes through.
+enum MetricPhase {
+    kPhaseQueue,      // submitted -> first batch that includes its prompt
+    kPhaseTemplate,   // chat template
+    kPhaseTokenize,
+    kPhasePrefill,    // llama_decode of each prompt chunk
+    kPhaseDecode,     // llama_decode of each generation step
+    kPhaseSample,
+    kPhaseDetokenize, // token -> piece
+    kPhaseHandoff,    // piece produced -> drained by the platform consumer
+    kMetricPhaseCount,
+};
+
+const char * metric_phase_name(int phase);
+
+// Running summary of one phase. add() is O(1) and never allocates, so it can
+// sit on the per-token path; percentiles come from log-spaced buckets (four
+// per octave of microseconds) and are accurate to within about 12%.
+struct PhaseStat {
+    static constexpr int kOctaves = 28; // 1 us .. ~4.5 minutes
+    static constexpr int kSubBuckets = 4;
+    static constexpr int kBuckets = 1 + kOctaves * kSubBuckets; // [0] holds < 1 us
+
+    uint64_t count = 0;
+    double total_us = 0.0;
+    double max_us = 0.0;
+    uint32_t buckets[kBuckets] = {};
+
+    void add(double us);
+    void merge(const PhaseStat & other);
+    double mean_us() const { return count > 0 ? total_us / (double) count : 0.0; }
+    // Upper edge of the bucket holding the q-th sample, capped at max_us.
+    double percentile_us(double q) const;
+};
+
+struct PhaseMetrics {
+    PhaseStat phases[kMetricPhaseCount];
+
+    PhaseStat & operator[](int phase) { return phases[phase]; }
+    const PhaseStat & operator[](int phase) const { return phases[phase]; }
+    void merge(const PhaseMetrics & other);
+    void clear() { *this = PhaseMetrics{}; }
+};
+
+// Chrome trace ("Trace Event Format") recorder for offline analysis: load
+// the output in chrome://tracing or ui.perfetto.dev. Events go to a ring
+// sized by start(), so a long session keeps the most recent ones. record()
+// is a relaxed load and nothing else while tracing is off.
+class TraceRecorder {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t kDefaultCapacity = 1 << 16;
+
+    // Clears previous events and starts recording. Timestamps are relative
+    // to this call.
+    void start(size_t capacity = kDefaultCapacity);
+    void stop();
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    // A complete ("X") event on lane `tid`. `name` must be a string literal
+    // or otherwise outlive the recorder; `arg` >= 0 is shown as "n".
+    void record(const char * name, uint32_t tid, Clock::time_point begin, Clock::time_point end, int64_t arg = -1);
+    // Label for a lane in the viewer.
+    void name_lane(uint32_t tid, const std::string & name);
+
+    size_t size() const;
+    uint64_t dropped() const; // overwritten because the ring was full
+    std::string to_json() const;
+    bool write_json(const std::string & path) const;
+
+private:
+    struct Event {
+        const char * name;
+        uint32_t tid;
+        int64_t ts_us;
+        int64_t dur_us;
+        int64_t arg;
+    };
+
+    std::atomic_bool enabled_{false};
+    mutable std::mutex mutex_;
+    Clock::time_point origin_;
+    std::vector<Event> events_;
+    size_t next_ = 0;
+    uint64_t recorded_ = 0;
+    std::vector<std::pair<uint32_t, std::string>> lanes_;
+};
+
+}  // namespace maathai
@@ -0,0 +1,183 @@
+#include "model_residency.h"
+
+#include <algorithm>
+
+namespace maathai {
+
+int ModelResidency::find(const std::string & key) {
+    for (ResidentModel & model : models_) {
+        if (model.key == key) {
+            ++hits_;
+            model.last_use = ++clock_;
+            return model.handle;
+        }
+    }
+    ++misses_;
+    return -1;
+}
+
+void ModelResidency::add(int handle, const std::string & key, uint64_t weights_bytes, uint64_t context_bytes) {
+    remove(handle);
+    ResidentModel model;
+    model.handle = handle;
+    model.key = key;
+    model.weights_bytes = weights_bytes;
+    model.context_bytes = context_bytes;
+    model.last_use = ++clock_;
+    models_.push_back(std::move(model));
+}
+
+void ModelResidency::touch(int handle) {
+    if (ResidentModel * model = find_handle(handle)) {
+        model->last_use = ++clock_;
+    }
+}
+
+bool ModelResidency::set_pinned(int handle, bool pinned) {
+    ResidentModel * model = find_handle(handle);
+    if (model == nullptr) {
+        return false;
+    }
+    model->pinned = pinned;
+    return true;
+}
+
+void ModelResidency::context_freed(int handle) {
+    ResidentModel * model = find_handle(handle);
+    if (model != nullptr && model->has_context) {
+        model->has_context = false;
+        ++context_frees_;
+    }
+}
+
+void ModelResidency::context_restored(int handle) {
+    ResidentModel * model = find_handle(handle);
+    if (model != nullptr && !model->has_context) {
+        model->has_context = true;
+        ++context_restores_;
+    }
+}
+
+void ModelResidency::evicted(int handle) {
+    if (find_handle(handle) != nullptr) {
+        remove(handle);
+        ++evictions_;
+    }
+}
+
+void ModelResidency::remove(int handle) {
+    models_.erase(std::remove_if(models_.begin(), models_.end(),
+                                 [handle](const ResidentModel & model) { return model.handle == handle; }),
+                  models_.end());
+}
+
+bool ModelResidency::plan(uint64_t incoming, const std::vector<int> & in_use, std::vector<ResidencyAction> & out) const {
+    out.clear();
+    const uint64_t resident = resident_bytes();
+    if (budget_ == 0 || resident + incoming <= budget_) {
+        return true;
+    }
+    uint64_t excess = resident + incoming - budget_;
+
+    const uint64_t needed = excess;
+
+    std::vector<const ResidentModel *> candidates;
+    for (const ResidentModel & model : models_) {
+        if (!model.pinned && std::find(in_use.begin(), in_use.end(), model.handle) == in_use.end()) {
+            candidates.push_back(&model);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const ResidentModel * a, const ResidentModel * b) {
+        return a->last_use < b->last_use;
+    });
+
+    // contexts first: cheap to rebuild
+    std::vector<bool> context_gone(candidates.size(), false);
+    for (size_t i = 0; i < candidates.size() && excess > 0; ++i) {
+        const ResidentModel & model = *candidates[i];
+        if (model.has_context && model.context_bytes > 0) {
+            out.push_back({ResidencyActionKind::kFreeContext, model.handle, model.context_bytes});
+            excess -= std::min(excess, model.context_bytes);
+            context_gone[i] = true;
+        }
+    }
+    // then weights; an evicted model's context goes with it, so its
+    // separate context action is dropped (those bytes are counted already)
+    for (size_t i = 0; i < candidates.size() && excess > 0; ++i) {
+        const ResidentModel & model = *candidates[i];
+        if (context_gone[i]) {
+            out.erase(std::find_if(out.begin(), out.end(),
+                                   [&model](const ResidencyAction & action) { return action.handle == model.handle; }));
+        }
+        out.push_back({ResidencyActionKind::kEvict, model.handle, model.resident_bytes()});
+        excess -= std::min(excess, model.weights_bytes + (model.has_context && !context_gone[i] ? model.context_bytes : 0));
+    }
+    if (excess > 0) {
+        return false;
+    }
+    // the evictions may cover what earlier context frees were planned for;
+    // keep the more recently used contexts that are no longer needed
+    uint64_t freed = 0;
+    for (const ResidencyAction & action : out) {
+        freed += action.bytes;
+    }
+    uint64_t spare = freed - needed;
+    for (size_t i = out.size(); i-- > 0;) {
+        if (out[i].kind == ResidencyActionKind::kFreeContext && out[i].bytes <= spare) {
+            spare -= out[i].bytes;
+            out.erase(out.begin() + (long) i);
+        }
+    }
+    return true;
+}
+
+const ResidentModel * ModelResidency::model(int handle) const {
+    for (const ResidentModel & model : models_) {
+        if (model.handle == handle) {
+            return &model;
+        }
+    }
+    return nullptr;
+}
+
+std::vector<ResidentModel> ModelResidency::models() const {
+    std::vector<ResidentModel> out = models_;
+    std::sort(out.begin(), out.end(), [](const ResidentModel & a, const ResidentModel & b) {
+        return a.last_use > b.last_use;
+    });
+    return out;
+}
+
+uint64_t ModelResidency::resident_bytes() const {
+    uint64_t total = 0;
+    for (const ResidentModel & model : models_) {
+        total += model.resident_bytes();
+    }
+    return total;
+}
+
+ResidencyStats ModelResidency::stats() const {
+    ResidencyStats out;
+    out.budget_bytes = budget_;
+    out.resident_bytes = resident_bytes();
+    out.models = (int) models_.size();
+    out.contexts = (int) std::count_if(models_.begin(), models_.end(),
+                                       [](const ResidentModel & model) { return model.has_context; });
+    out.hits = hits_;
+    out.misses = misses_;
+    out.context_frees = context_frees_;
+    out.context_restores = context_restores_;
+    out.evictions = evictions_;
+    return out;
+}
+
+ResidentModel * ModelResidency::find_handle(int handle) {
+    for (ResidentModel & model : models_) {
+        if (model.handle == handle) {
+            return &model;
+        }
+    }
+    return nullptr;
+}
+
+}  // namespace maathai
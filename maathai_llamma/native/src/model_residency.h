@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace maathai {
+
+// One model the platform layer keeps loaded, as the residency policy sees
+// it. Bytes are estimates (see estimate_memory()): the weights stay until the
+// model is evicted, the context (KV cache and compute buffers) can be freed
+// on its own and rebuilt without touching the file.
+struct ResidentModel {
+    int handle = -1;
+    std::string key; // model file and every setting that shapes the engine
+    uint64_t weights_bytes = 0;
+    uint64_t context_bytes = 0;
+    bool has_context = true;
+    bool pinned = false;
+    uint64_t last_use = 0; // logical clock; larger is more recent
+
+    uint64_t resident_bytes() const { return weights_bytes + (has_context ? context_bytes : 0); }
+};
+
+enum class ResidencyActionKind {
+    kFreeContext, // keep the weights, free the KV cache and compute buffers
+    kEvict,       // free the model entirely
+};
+
+struct ResidencyAction {
+    ResidencyActionKind kind = ResidencyActionKind::kFreeContext;
+    int handle = -1;
+    uint64_t bytes = 0; // what it gives back
+};
+
+struct ResidencyStats {
+    uint64_t budget_bytes = 0;
+    uint64_t resident_bytes = 0;
+    int models = 0;
+    int contexts = 0;          // models whose context is live
+    uint64_t hits = 0;         // find() that named a resident model
+    uint64_t misses = 0;
+    uint64_t context_frees = 0;
+    uint64_t context_restores = 0;
+    uint64_t evictions = 0;    // models freed to make room
+};
+
+// Least-recently-used residency under a byte budget. Making room frees idle
+// contexts first, oldest first, since rebuilding one costs milliseconds;
+// only when that is not enough are whole models evicted, again oldest
+// first, since reloading weights costs seconds. Pinned models and the ones
+// the caller names as in use are never touched. The policy only plans; the
+// caller frees what it names and reports back. Not thread-safe.
+class ModelResidency {
+public:
+    // 0 means no budget: nothing is ever planned for eviction.
+    explicit ModelResidency(uint64_t budget_bytes = 0) : budget_(budget_bytes) {}
+
+    void set_budget(uint64_t budget_bytes) { budget_ = budget_bytes; }
+    uint64_t budget() const { return budget_; }
+
+    // The resident model loaded under `key`, or -1; counts a hit or a miss
+    // and marks a hit as used.
+    int find(const std::string & key);
+    // Registers a freshly loaded model, context live, as the most recent.
+    void add(int handle, const std::string & key, uint64_t weights_bytes, uint64_t context_bytes);
+    void touch(int handle);
+    bool set_pinned(int handle, bool pinned);
+    // Record what the caller did with a planned (or explicit) action.
+    void context_freed(int handle);
+    void context_restored(int handle);
+    void evicted(int handle);
+    // Forgets a model the caller unloaded on request; not an eviction.
+    void remove(int handle);
+
+    // Actions that bring the resident total plus `incoming` bytes within the
+    // budget, in the order to run them. `in_use` lists handles that must not
+    // be touched besides the pinned ones. Returns false when even all of
+    // them would not make room; `out` then holds everything that could go.
+    bool plan(uint64_t incoming, const std::vector<int> & in_use, std::vector<ResidencyAction> & out) const;
+
+    const ResidentModel * model(int handle) const;
+    // Most recently used first.
+    std::vector<ResidentModel> models() const;
+    uint64_t resident_bytes() const;
+    ResidencyStats stats() const;
+
+private:
+    ResidentModel * find_handle(int handle);
+
+    uint64_t budget_;
+    uint64_t clock_ = 0;
+    std::vector<ResidentModel> models_;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t context_frees_ = 0;
+    uint64_t context_restores_ = 0;
+    uint64_t evictions_ = 0;
+};
+
+}  // namespace maathai
@@ -0,0 +1,145 @@
+#include "page_cache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace maathai {
+
+namespace {
+
+// Large enough that readahead streams at full storage bandwidth, small
+// enough that the throwaway buffer does not matter next to the model.
+constexpr size_t kPrefaultChunk = 4u << 20;
+
+struct Fd {
+    int fd = -1;
+    explicit Fd(const std::string & path) : fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC)) {}
+    ~Fd() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    Fd(const Fd &) = delete;
+    Fd & operator=(const Fd &) = delete;
+};
+
+uint64_t fd_size(int fd) {
+    struct stat st {};
+    return fstat(fd, &st) == 0 && st.st_size > 0 ? (uint64_t) st.st_size : 0;
+}
+
+}  // namespace
+
+ProgressGate::ProgressGate(uint64_t total, unsigned steps)
+    : total_(total), step_(std::max<uint64_t>(1, total / std::max(1u, steps))), next_(step_) {}
+
+bool ProgressGate::due(uint64_t done) {
+    if (finished_) {
+        return false;
+    }
+    if (done >= total_) {
+        finished_ = true;
+        return true;
+    }
+    if (done < next_) {
+        return false;
+    }
+    next_ = (done / step_ + 1) * step_;
+    return true;
+}
+
+bool prefault_file(const std::string & path, const ByteProgress & progress, PrefaultResult * result) {
+    const auto t_start = std::chrono::steady_clock::now();
+    PrefaultResult local;
+    PrefaultResult & out = result != nullptr ? *result : local;
+    out = PrefaultResult{};
+
+    Fd file(path);
+    if (file.fd < 0) {
+        return false;
+    }
+    const uint64_t total = fd_size(file.fd);
+#if defined(POSIX_FADV_SEQUENTIAL)
+    // doubles the readahead window on Linux
+    posix_fadvise(file.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    std::unique_ptr<char[]> buffer(new char[kPrefaultChunk]);
+    ProgressGate gate(total);
+    bool ok = true;
+    while (out.bytes < total) {
+        const ssize_t n = pread(file.fd, buffer.get(), kPrefaultChunk, (off_t) out.bytes);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ok = false; // truncated underneath us, or an I/O error
+            break;
+        }
+        out.bytes += (uint64_t) n;
+        if (progress && gate.due(out.bytes) && !progress(out.bytes, total)) {
+            out.cancelled = true;
+            ok = false;
+            break;
+        }
+    }
+    if (ok && total == 0 && progress) {
+        progress(0, 0);
+    }
+    out.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+    return ok;
+}
+
+double page_cache_residency(const std::string & path) {
+    Fd file(path);
+    if (file.fd < 0) {
+        return -1.0;
+    }
+    const uint64_t size = fd_size(file.fd);
+    if (size == 0) {
+        return -1.0;
+    }
+    void * addr = mmap(nullptr, (size_t) size, PROT_READ, MAP_SHARED, file.fd, 0);
+    if (addr == MAP_FAILED) {
+        return -1.0;
+    }
+    const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    const size_t pages = (size_t) ((size + page - 1) / page);
+    std::vector<unsigned char> resident(pages);
+    const bool ok = mincore(addr, (size_t) size, resident.data()) == 0;
+    munmap(addr, (size_t) size);
+    if (!ok) {
+        return -1.0;
+    }
+    size_t in_cache = 0;
+    for (const unsigned char flags : resident) {
+        in_cache += flags & 1u;
+    }
+    return (double) in_cache / (double) pages;
+}
+
+bool evict_file_pages(const std::string & path) {
+    Fd file(path);
+    if (file.fd < 0) {
+        return false;
+    }
+#if defined(POSIX_FADV_DONTNEED)
+    return posix_fadvise(file.fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+#else
+    return false;
+#endif
+}
+
+uint64_t file_size_bytes(const std::string & path) {
+    struct stat st {};
+    return stat(path.c_str(), &st) == 0 && st.st_size > 0 ? (uint64_t) st.st_size : 0;
+}
+
+}  // namespace maathai
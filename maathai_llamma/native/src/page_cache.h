@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace maathai {
+
+// Bytes done out of `total`. Returning false stops the operation.
+using ByteProgress = std::function<bool(uint64_t done, uint64_t total)>;
+
+// Thins a stream of progress updates to one per `1/steps` of the total plus
+// the final one, so a callback that crosses into Java or posts to the UI
+// thread runs about a hundred times per load rather than once per tensor.
+class ProgressGate {
+public:
+    explicit ProgressGate(uint64_t total, unsigned steps = 100);
+
+    // True when `done` reached the next step or the total. The total is
+    // reported once; later calls return false.
+    bool due(uint64_t done);
+    uint64_t total() const { return total_; }
+
+private:
+    uint64_t total_;
+    uint64_t step_;
+    uint64_t next_;
+    bool finished_ = false;
+};
+
+struct PrefaultResult {
+    uint64_t bytes = 0; // read before finishing or stopping
+    double ms = 0.0;
+    bool cancelled = false;
+};
+
+// Reads the whole file sequentially in large chunks so it sits in the page
+// cache before anything maps it. llama.cpp mmaps the weights and otherwise
+// faults them in from storage, a page at a time and in tensor order, during
+// the first request. `progress` is optional, gated as above, and may cancel.
+// Returns false when the file cannot be read or the read was cancelled.
+bool prefault_file(const std::string & path, const ByteProgress & progress = {}, PrefaultResult * result = nullptr);
+
+// Fraction of the file's pages resident in the page cache (mincore), or -1
+// when it cannot be determined.
+double page_cache_residency(const std::string & path);
+
+// Asks the kernel to drop the file's clean pages, for cold-start
+// measurements. Best effort: pages mapped by a process or on tmpfs stay.
+bool evict_file_pages(const std::string & path);
+
+// 0 when the file is missing or empty.
+uint64_t file_size_bytes(const std::string & path);
+
+}  // namespace maathai
@@ -0,0 +1,53 @@
+#include "preempt.h"
+
+#include <cstring>
+
+namespace maathai {
+
+const char * request_priority_name(RequestPriority priority) {
+    switch (priority) {
+        case RequestPriority::kBackground: return "background";
+        case RequestPriority::kNormal: return "normal";
+        case RequestPriority::kInteractive: return "interactive";
+    }
+    return "unknown";
+}
+
+bool parse_request_priority(const char * name, RequestPriority & out) {
+    for (int level = 0; level < kRequestPriorityCount; ++level) {
+        const auto priority = (RequestPriority) level;
+        if (name != nullptr && std::strcmp(name, request_priority_name(priority)) == 0) {
+            out = priority;
+            return true;
+        }
+    }
+    return false;
+}
+
+PreemptGate::Waiter::Waiter(PreemptGate & gate, RequestPriority priority)
+    : gate_(&gate), level_((int) priority) {
+    gate_->waiting_[level_].fetch_add(1, std::memory_order_relaxed);
+}
+
+void PreemptGate::Waiter::release() {
+    if (gate_ != nullptr) {
+        gate_->waiting_[level_].fetch_sub(1, std::memory_order_relaxed);
+        gate_ = nullptr;
+    }
+}
+
+bool PreemptGate::waiting_above(RequestPriority priority) const {
+    for (int level = (int) priority + 1; level < kRequestPriorityCount; ++level) {
+        if (waiting_[level].load(std::memory_order_relaxed) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PreemptGate::outranked() const {
+    const int top = batch_top_.load(std::memory_order_relaxed);
+    return top >= 0 && waiting_above((RequestPriority) top);
+}
+
+}  // namespace maathai
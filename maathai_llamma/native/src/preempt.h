@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+
+namespace maathai {
+
+enum class RequestPriority {
+    kBackground,  // yields the batch to anything above it
+    kNormal,
+    kInteractive, // a user waiting on the first token
+};
+
+constexpr int kRequestPriorityCount = 3;
+
+const char * request_priority_name(RequestPriority priority);
+bool parse_request_priority(const char * name, RequestPriority & out);
+
+// Lets a request that is waiting for the engine stop the batch in flight when
+// it outranks everything in that batch. The scheduler holds the engine lock
+// for a whole llama_decode, so a new prompt cannot even be queued until the
+// batch ends; with a long background prefill that is seconds. Waiters
+// register here before taking the lock, and llama.cpp's abort callback polls
+// outranked() between graph nodes. Lock-free; every call is a few relaxed
+// atomics, cheap enough for the abort callback.
+class PreemptGate {
+public:
+    // Registers a waiter for its lifetime; release once the request is queued.
+    class Waiter {
+    public:
+        Waiter(PreemptGate & gate, RequestPriority priority);
+        ~Waiter() { release(); }
+        void release();
+
+        Waiter(const Waiter &) = delete;
+        Waiter & operator=(const Waiter &) = delete;
+
+    private:
+        PreemptGate * gate_;
+        int level_;
+    };
+
+    // Scheduler side: a batch whose highest priority is `top` is decoding.
+    void begin_batch(RequestPriority top) { batch_top_.store((int) top, std::memory_order_relaxed); }
+    void end_batch() { batch_top_.store(-1, std::memory_order_relaxed); }
+
+    // True when someone is waiting with a priority above `priority`.
+    bool waiting_above(RequestPriority priority) const;
+    // True when a waiter outranks the batch in flight; false between batches.
+    bool outranked() const;
+
+private:
+    std::atomic<int> waiting_[kRequestPriorityCount] = {};
+    std::atomic<int> batch_top_{-1};
+};
+
+}  // namespace maathai
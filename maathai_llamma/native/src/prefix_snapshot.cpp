@@ -0,0 +1,178 @@
+#include "prefix_snapshot.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+
+namespace maathai {
+
+namespace {
+
+constexpr size_t kFingerprintWindow = 4u << 20; // 4 MiB from each end
+
+struct FileCloser {
+    void operator()(std::FILE * file) const {
+        if (file != nullptr) {
+            std::fclose(file);
+        }
+    }
+};
+using File = std::unique_ptr<std::FILE, FileCloser>;
+
+bool read_exact(std::FILE * file, void * dst, size_t len) {
+    return len == 0 || std::fread(dst, 1, len, file) == len;
+}
+
+bool write_exact(std::FILE * file, const void * src, size_t len) {
+    return len == 0 || std::fwrite(src, 1, len, file) == len;
+}
+
+uint64_t hash_window(std::FILE * file, long offset, size_t len, uint64_t seed) {
+    if (std::fseek(file, offset, SEEK_SET) != 0) {
+        return seed;
+    }
+    std::vector<unsigned char> buf(64 * 1024);
+    while (len > 0) {
+        const size_t n = std::fread(buf.data(), 1, std::min(len, buf.size()), file);
+        if (n == 0) {
+            break;
+        }
+        seed = fnv1a64(buf.data(), n, seed);
+        len -= n;
+    }
+    return seed;
+}
+
+}  // namespace
+
+const char * snapshot_check_name(SnapshotCheck check) {
+    switch (check) {
+        case SnapshotCheck::kOk: return "ok";
+        case SnapshotCheck::kMissing: return "missing";
+        case SnapshotCheck::kCorrupt: return "corrupt";
+        case SnapshotCheck::kVersionMismatch: return "version mismatch";
+        case SnapshotCheck::kModelMismatch: return "model mismatch";
+        case SnapshotCheck::kParamsMismatch: return "params mismatch";
+        case SnapshotCheck::kPrefixMismatch: return "prefix mismatch";
+    }
+    return "unknown";
+}
+
+uint64_t fnv1a64(const void * data, size_t len, uint64_t seed) {
+    const auto * bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < len; ++i) {
+        seed ^= bytes[i];
+        seed *= 0x100000001b3ULL;
+    }
+    return seed;
+}
+
+uint64_t hash_tokens(const int32_t * tokens, size_t n_tokens) {
+    return fnv1a64(tokens, n_tokens * sizeof(int32_t));
+}
+
+uint64_t file_fingerprint(const std::string & path) {
+    File file(std::fopen(path.c_str(), "rb"));
+    if (!file || std::fseek(file.get(), 0, SEEK_END) != 0) {
+        return 0;
+    }
+    const long size = std::ftell(file.get());
+    if (size <= 0) {
+        return 0;
+    }
+    uint64_t hash = fnv1a64(&size, sizeof(size));
+    const size_t window = std::min((size_t) size, kFingerprintWindow);
+    hash = hash_window(file.get(), 0, window, hash);
+    if ((size_t) size > window) {
+        hash = hash_window(file.get(), size - (long) window, window, hash);
+    }
+    return hash;
+}
+
+std::string snapshot_file_name(const SnapshotHeader & key) {
+    uint64_t hash = fnv1a64(&key.model_fingerprint, sizeof(key.model_fingerprint));
+    hash = fnv1a64(&key.params_hash, sizeof(key.params_hash), hash);
+    hash = fnv1a64(&key.tokens_hash, sizeof(key.tokens_hash), hash);
+    hash = fnv1a64(&key.n_tokens, sizeof(key.n_tokens), hash);
+    char name[48];
+    std::snprintf(name, sizeof(name), "prefix-%016llx.mstate", (unsigned long long) hash);
+    return name;
+}
+
+bool write_snapshot(const std::string & path,
+                    const SnapshotHeader & key,
+                    const std::vector<int32_t> & tokens,
+                    const std::vector<uint8_t> & state) {
+    SnapshotHeader header = key;
+    header.magic = kSnapshotMagic;
+    header.version = kSnapshotVersion;
+    header.n_tokens = (uint32_t) tokens.size();
+    header.state_bytes = state.size();
+
+    const std::string tmp = path + ".tmp";
+    {
+        File file(std::fopen(tmp.c_str(), "wb"));
+        if (!file ||
+            !write_exact(file.get(), &header, sizeof(header)) ||
+            !write_exact(file.get(), tokens.data(), tokens.size() * sizeof(int32_t)) ||
+            !write_exact(file.get(), state.data(), state.size()) ||
+            std::fflush(file.get()) != 0) {
+            file.reset();
+            std::remove(tmp.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+SnapshotCheck read_snapshot(const std::string & path,
+                            const SnapshotHeader & key,
+                            const std::vector<int32_t> & tokens,
+                            std::vector<uint8_t> & state) {
+    File file(std::fopen(path.c_str(), "rb"));
+    if (!file) {
+        return SnapshotCheck::kMissing;
+    }
+    SnapshotHeader header;
+    if (!read_exact(file.get(), &header, sizeof(header)) || header.magic != kSnapshotMagic) {
+        return SnapshotCheck::kCorrupt;
+    }
+    if (header.version != kSnapshotVersion) {
+        return SnapshotCheck::kVersionMismatch;
+    }
+    if (header.model_fingerprint != key.model_fingerprint) {
+        return SnapshotCheck::kModelMismatch;
+    }
+    if (header.params_hash != key.params_hash) {
+        return SnapshotCheck::kParamsMismatch;
+    }
+    if (header.tokens_hash != key.tokens_hash || header.n_tokens != tokens.size()) {
+        return SnapshotCheck::kPrefixMismatch;
+    }
+    std::vector<int32_t> stored(header.n_tokens);
+    if (!read_exact(file.get(), stored.data(), stored.size() * sizeof(int32_t))) {
+        return SnapshotCheck::kCorrupt;
+    }
+    if (stored != tokens) {
+        return SnapshotCheck::kPrefixMismatch;
+    }
+    // the header must agree with the file size before we allocate for it
+    const long body = std::ftell(file.get());
+    if (body < 0 || std::fseek(file.get(), 0, SEEK_END) != 0 ||
+        (uint64_t) (std::ftell(file.get()) - body) != header.state_bytes ||
+        std::fseek(file.get(), body, SEEK_SET) != 0) {
+        return SnapshotCheck::kCorrupt;
+    }
+    state.resize((size_t) header.state_bytes);
+    if (!read_exact(file.get(), state.data(), state.size())) {
+        state.clear();
+        return SnapshotCheck::kCorrupt;
+    }
+    return SnapshotCheck::kOk;
+}
+
+}  // namespace maathai
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace maathai {
+
+// On-disk snapshot of the KV/sequence state after a fixed prefix (system
+// prompt, few-shot preamble) has been decoded. A snapshot is only valid for
+// the exact model file, the context parameters that shape the KV layout and
+// the prefix tokens; all three are part of the header and of the file name.
+//
+// File layout (native endianness; snapshots never leave the device):
+//   SnapshotHeader
+//   int32 tokens[n_tokens]
+//   uint8 state[state_bytes]     (llama_state_seq_get_data for seq 0)
+constexpr uint32_t kSnapshotMagic = 0x504E534Du; // "MSNP"
+constexpr uint32_t kSnapshotVersion = 1;
+
+struct SnapshotHeader {
+    uint32_t magic = kSnapshotMagic;
+    uint32_t version = kSnapshotVersion;
+    uint64_t model_fingerprint = 0;
+    uint64_t params_hash = 0;
+    uint64_t tokens_hash = 0;
+    uint32_t n_tokens = 0;
+    uint32_t reserved = 0;
+    uint64_t state_bytes = 0;
+};
+
+enum class SnapshotCheck {
+    kOk,
+    kMissing,
+    kCorrupt,
+    kVersionMismatch,
+    kModelMismatch,
+    kParamsMismatch,
+    kPrefixMismatch,
+};
+
+const char * snapshot_check_name(SnapshotCheck check);
+
+uint64_t fnv1a64(const void * data, size_t len, uint64_t seed = 0xcbf29ce484222325ULL);
+uint64_t hash_tokens(const int32_t * tokens, size_t n_tokens);
+
+// Cheap identity for a multi-GB model file: its size plus the first and last
+// few MiB (GGUF metadata and tensor tail). Returns 0 if it cannot be read.
+uint64_t file_fingerprint(const std::string & path);
+
+// "prefix-<16 hex digits>.mstate", derived from the header's key fields.
+std::string snapshot_file_name(const SnapshotHeader & key);
+
+// Writes to a temporary file and renames it into place, so a crash never
+// leaves a truncated snapshot under the final name.
+bool write_snapshot(const std::string & path,
+                    const SnapshotHeader & key,
+                    const std::vector<int32_t> & tokens,
+                    const std::vector<uint8_t> & state);
+
+// Validates the file against `key` and `tokens`; on kOk `state` holds the
+// sequence state to restore.
+SnapshotCheck read_snapshot(const std::string & path,
+                            const SnapshotHeader & key,
+                            const std::vector<int32_t> & tokens,
+                            std::vector<uint8_t> & state);
+
+}  // namespace maathai
@@ -0,0 +1,433 @@
+#include "sampler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace maathai {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kDefaultPenaltyWindow = 64;
+constexpr float kDefaultMirostatTau = 5.0f;
+constexpr float kDefaultMirostatEta = 0.1f;
+constexpr size_t kMirostatM = 100; // tokens used to estimate the Zipf exponent
+
+double micros(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double, std::micro>(to - from).count();
+}
+
+bool penalties_enabled(const SamplerConfig & c) {
+    return c.repeat_penalty > 0.0f || c.frequency_penalty > 0.0f || c.presence_penalty > 0.0f;
+}
+
+size_t penalty_window(const SamplerConfig & c) {
+    if (!penalties_enabled(c)) {
+        return 0;
+    }
+    return (size_t) (c.repeat_last_n > 0 ? c.repeat_last_n : kDefaultPenaltyWindow);
+}
+
+float mirostat_tau(const SamplerConfig & c) {
+    return c.mirostat_tau > 0.0f ? c.mirostat_tau : kDefaultMirostatTau;
+}
+
+float mirostat_eta(const SamplerConfig & c) {
+    return c.mirostat_eta > 0.0f ? c.mirostat_eta : kDefaultMirostatEta;
+}
+
+}  // namespace
+
+const char * sampler_stage_name(int stage) {
+    switch (stage) {
+        case kStageTopK: return "top_k";
+        case kStagePenalties: return "penalties";
+        case kStageFilters: return "filters";
+        case kStageTemperature: return "temperature";
+        case kStageDist: return "dist";
+        default: return "unknown";
+    }
+}
+
+TokenSampler::TokenSampler(uint32_t seed) : rng_(seed) {
+    reset();
+}
+
+void TokenSampler::reserve(int n_vocab) {
+    const size_t n = (size_t) std::max(0, n_vocab);
+    candidates_.resize(n);
+    scratch_.resize(n);
+}
+
+void TokenSampler::set_config(const SamplerConfig & config) {
+    const size_t window = penalty_window(config);
+    const bool new_window = window != window_.size();
+    const bool new_mirostat = config.mirostat_type != config_.mirostat_type ||
+                              mirostat_tau(config) != mirostat_tau(config_);
+    config_ = config;
+    if (new_window) {
+        window_.assign(window, -1);
+        counts_.clear();
+        counts_.reserve(window);
+        window_pos_ = 0;
+        window_len_ = 0;
+    }
+    if (new_mirostat) {
+        mirostat_mu_ = 2.0f * mirostat_tau(config_);
+    }
+}
+
+void TokenSampler::reset() {
+    window_pos_ = 0;
+    window_len_ = 0;
+    counts_.clear();
+    mirostat_mu_ = 2.0f * mirostat_tau(config_);
+}
+
+size_t TokenSampler::min_keep() const {
+    return (size_t) (config_.min_keep > 0 ? config_.min_keep : 1);
+}
+
+int32_t TokenSampler::sample(const float * logits, int n_vocab) {
+    if (logits == nullptr || n_vocab <= 0 || (size_t) n_vocab > candidates_.size()) {
+        return -1;
+    }
+    const bool mirostat_on = config_.mirostat_type == 1 || config_.mirostat_type == 2;
+    const auto t0 = Clock::now();
+
+    for (int i = 0; i < n_vocab; ++i) {
+        candidates_[(size_t) i] = Candidate{i, logits[i], 0.0f};
+    }
+    n_candidates_ = (size_t) n_vocab;
+    sorted_ = false;
+    full_vocab_ = true;
+    if (!mirostat_on && config_.top_k > 0 && config_.top_k < n_vocab) {
+        const auto begin = candidates_.begin();
+        const auto kth = begin + config_.top_k;
+        const auto by_logit = [](const Candidate & a, const Candidate & b) { return a.logit > b.logit; };
+        std::nth_element(begin, kth - 1, begin + n_vocab, by_logit);
+        std::sort(begin, kth, by_logit);
+        n_candidates_ = (size_t) config_.top_k;
+        sorted_ = true;
+        full_vocab_ = false;
+    }
+    const auto t1 = Clock::now();
+
+    apply_penalties();
+    const auto t2 = Clock::now();
+
+    if (!mirostat_on) {
+        apply_top_n_sigma();
+        apply_typical();
+        apply_top_p();
+        apply_min_p();
+    }
+    const auto t3 = Clock::now();
+
+    const bool greedy = config_.temperature <= 0.0f;
+    if (!greedy && config_.temperature != 1.0f) {
+        const float inv = 1.0f / config_.temperature;
+        for (size_t i = 0; i < n_candidates_; ++i) {
+            candidates_[i].logit *= inv;
+        }
+    }
+    const auto t4 = Clock::now();
+
+    int32_t token;
+    if (greedy) {
+        const auto best = std::max_element(candidates_.begin(), candidates_.begin() + (long) n_candidates_,
+                                           [](const Candidate & a, const Candidate & b) { return a.logit < b.logit; });
+        token = best->id;
+    } else if (mirostat_on) {
+        token = mirostat(n_vocab);
+    } else {
+        softmax();
+        token = draw();
+    }
+    record(token);
+    const auto t5 = Clock::now();
+
+    timings_.us[kStageTopK] += micros(t0, t1);
+    timings_.us[kStagePenalties] += micros(t1, t2);
+    timings_.us[kStageFilters] += micros(t2, t3);
+    timings_.us[kStageTemperature] += micros(t3, t4);
+    timings_.us[kStageDist] += micros(t4, t5);
+    ++timings_.samples;
+    return token;
+}
+
+void TokenSampler::apply_penalties() {
+    if (window_len_ == 0) {
+        return;
+    }
+    const float repeat = config_.repeat_penalty > 0.0f ? config_.repeat_penalty : 1.0f;
+    const float frequency = config_.frequency_penalty > 0.0f ? config_.frequency_penalty : 0.0f;
+    const float presence = config_.presence_penalty > 0.0f ? config_.presence_penalty : 0.0f;
+    // at most repeat_last_n distinct tokens, each looked up in the (small)
+    // candidate set, or indexed directly when it is still the whole vocabulary
+    for (const auto & entry : counts_) {
+        Candidate * c = nullptr;
+        if (full_vocab_) {
+            c = (size_t) entry.first < n_candidates_ ? &candidates_[(size_t) entry.first] : nullptr;
+        } else {
+            for (size_t i = 0; i < n_candidates_; ++i) {
+                if (candidates_[i].id == entry.first) {
+                    c = &candidates_[i];
+                    break;
+                }
+            }
+        }
+        if (c == nullptr) {
+            continue;
+        }
+        c->logit = c->logit <= 0.0f ? c->logit * repeat : c->logit / repeat;
+        c->logit -= (float) entry.second * frequency + presence;
+        sorted_ = false;
+    }
+}
+
+void TokenSampler::sort_by_logit() {
+    if (sorted_) {
+        return;
+    }
+    std::sort(candidates_.begin(), candidates_.begin() + (long) n_candidates_,
+              [](const Candidate & a, const Candidate & b) { return a.logit > b.logit; });
+    sorted_ = true;
+    full_vocab_ = false;
+}
+
+void TokenSampler::softmax() {
+    float max_logit = -INFINITY;
+    for (size_t i = 0; i < n_candidates_; ++i) {
+        max_logit = std::max(max_logit, candidates_[i].logit);
+    }
+    double sum = 0.0;
+    for (size_t i = 0; i < n_candidates_; ++i) {
+        candidates_[i].p = std::exp(candidates_[i].logit - max_logit);
+        sum += candidates_[i].p;
+    }
+    for (size_t i = 0; i < n_candidates_; ++i) {
+        candidates_[i].p = (float) (candidates_[i].p / sum);
+    }
+}
+
+// Keeps the logits within n standard deviations of the maximum.
+void TokenSampler::apply_top_n_sigma() {
+    if (config_.top_n_sigma <= 0.0f || n_candidates_ <= 1) {
+        return;
+    }
+    float max_logit = -INFINITY;
+    double sum = 0.0;
+    size_t n_finite = 0;
+    for (size_t i = 0; i < n_candidates_; ++i) {
+        const float logit = candidates_[i].logit;
+        if (std::isfinite(logit)) {
+            max_logit = std::max(max_logit, logit);
+            sum += logit;
+            ++n_finite;
+        }
+    }
+    if (n_finite == 0) {
+        return;
+    }
+    const double mean = sum / (double) n_finite;
+    double var = 0.0;
+    for (size_t i = 0; i < n_candidates_; ++i) {
+        const float logit = candidates_[i].logit;
+        if (std::isfinite(logit)) {
+            var += (logit - mean) * (logit - mean);
+        }
+    }
+    const float threshold = max_logit - config_.top_n_sigma * (float) std::sqrt(var / (double) n_finite);
+    size_t kept = 0;
+    for (size_t i = 0; i < n_candidates_; ++i) {
+        if (candidates_[i].logit >= threshold) {
+            candidates_[kept++] = candidates_[i]; // order-preserving
+        }
+    }
+    full_vocab_ = full_vocab_ && kept == n_candidates_;
+    n_candidates_ = kept;
+}
+
+// Locally typical sampling: keeps the tokens whose surprise is closest to the
+// distribution's entropy until they cover typical_p of the mass.
+void TokenSampler::apply_typical() {
+    if (config_.typical_p <= 0.0f || config_.typical_p >= 1.0f || n_candidates_ <= min_keep()) {
+        return;
+    }
+    softmax();
+    double entropy = 0.0;
+    for (size_t i = 0; i < n_candidates_; ++i) {
+        const float p = candidates_[i].p;
+        if (p > 0.0f) {
+            entropy -= p * std::log(p);
+        }
+    }
+    std::copy(candidates_.begin(), candidates_.begin() + (long) n_candidates_, scratch_.begin());
+    const auto shift = [entropy](const Candidate & c) {
+        return std::fabs(-std::log(std::max(c.p, 1e-30f)) - (float) entropy);
+    };
+    std::sort(scratch_.begin(), scratch_.begin() + (long) n_candidates_,
+              [&](const Candidate & a, const Candidate & b) { return shift(a) < shift(b); });
+    double cum = 0.0;
+    size_t kept = n_candidates_;
+    for (size_t i = 0; i < n_candidates_; ++i) {
+        cum += scratch_[i].p;
+        if (cum >= config_.typical_p && i + 1 >= min_keep()) {
+            kept = i + 1;
+            break;
+        }
+    }
+    std::copy(scratch_.begin(), scratch_.begin() + (long) kept, candidates_.begin());
+    n_candidates_ = kept;
+    sorted_ = false;
+    full_vocab_ = false;
+}
+
+void TokenSampler::apply_top_p() {
+    if (config_.top_p <= 0.0f || config_.top_p >= 1.0f || n_candidates_ <= min_keep()) {
+        return;
+    }
+    sort_by_logit();
+    softmax();
+    double cum = 0.0;
+    for (size_t i = 0; i < n_candidates_; ++i) {
+        cum += candidates_[i].p;
+        if (cum >= config_.top_p && i + 1 >= min_keep()) {
+            n_candidates_ = i + 1;
+            return;
+        }
+    }
+}
+
+// Drops tokens less likely than min_p times the most likely one, which in
+// logit space is a fixed offset from the maximum.
+void TokenSampler::apply_min_p() {
+    if (config_.min_p <= 0.0f || config_.min_p >= 1.0f || n_candidates_ <= min_keep()) {
+        return;
+    }
+    sort_by_logit();
+    const float threshold = candidates_[0].logit + std::log(config_.min_p);
+    size_t kept = min_keep();
+    while (kept < n_candidates_ && candidates_[kept].logit >= threshold) {
+        ++kept;
+    }
+    n_candidates_ = kept;
+}
+
+// Inverse-CDF draw over the candidates' (normalized) probabilities.
+int32_t TokenSampler::draw() {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    double sum = 0.0;
+    for (size_t i = 0; i < n_candidates_; ++i) {
+        sum += candidates_[i].p;
+    }
+    const double target = uniform(rng_) * sum;
+    double cum = 0.0;
+    for (size_t i = 0; i < n_candidates_; ++i) {
+        cum += candidates_[i].p;
+        if (target < cum) {
+            return candidates_[i].id;
+        }
+    }
+    return candidates_[n_candidates_ - 1].id;
+}
+
+// Mirostat v1 and v2: truncates the distribution so the sampled token's
+// surprise tracks tau, adapting the cut-off (mu) after every token.
+int32_t TokenSampler::mirostat(int n_vocab) {
+    const float tau = mirostat_tau(config_);
+    const float eta = mirostat_eta(config_);
+    const auto by_logit = [](const Candidate & a, const Candidate & b) { return a.logit > b.logit; };
+    const auto begin = candidates_.begin();
+
+    if (config_.mirostat_type == 1) {
+        // Zipf exponent from the top m tokens; log(p_i / p_i+1) is a logit
+        // difference, so the whole vocabulary need not be normalized.
+        const size_t m = std::min(kMirostatM, n_candidates_ - 1);
+        std::partial_sort(begin, begin + (long) (m + 1), begin + (long) n_candidates_, by_logit);
+        double sum_ti_bi = 0.0;
+        double sum_ti_sq = 0.0;
+        for (size_t i = 0; i < m; ++i) {
+            const double t_i = std::log((double) (i + 2) / (double) (i + 1));
+            const double b_i = (double) (candidates_[i].logit - candidates_[i + 1].logit);
+            sum_ti_bi += t_i * b_i;
+            sum_ti_sq += t_i * t_i;
+        }
+        const double s_hat = sum_ti_sq > 0.0 ? sum_ti_bi / sum_ti_sq : 1.0;
+        const double epsilon_hat = s_hat - 1.0;
+        double k = (double) n_candidates_;
+        if (epsilon_hat > 0.0) {
+            k = std::pow(epsilon_hat * std::pow(2.0, mirostat_mu_) / (1.0 - std::pow((double) n_vocab, -epsilon_hat)),
+                         1.0 / s_hat);
+        }
+        const size_t keep = (size_t) std::min(std::max(k, 1.0), (double) n_candidates_);
+        if (keep > m + 1) {
+            std::nth_element(begin + (long) (m + 1), begin + (long) (keep - 1), begin + (long) n_candidates_, by_logit);
+        }
+        n_candidates_ = keep;
+        softmax();
+    } else {
+        // v2: keep the tokens whose surprise is at most mu (at least the top one)
+        softmax();
+        size_t best = 0;
+        size_t kept = 0;
+        for (size_t i = 0; i < n_candidates_; ++i) {
+            if (candidates_[i].p > candidates_[best].p) {
+                best = i;
+            }
+        }
+        const Candidate top = candidates_[best];
+        for (size_t i = 0; i < n_candidates_; ++i) {
+            if (-std::log2(candidates_[i].p) <= mirostat_mu_) {
+                candidates_[kept++] = candidates_[i];
+            }
+        }
+        if (kept == 0) {
+            candidates_[kept++] = top;
+        }
+        n_candidates_ = kept;
+        softmax();
+    }
+    const int32_t token = draw();
+    for (size_t i = 0; i < n_candidates_; ++i) {
+        if (candidates_[i].id == token) {
+            mirostat_mu_ -= eta * (-std::log2(candidates_[i].p) - tau);
+            break;
+        }
+    }
+    return token;
+}
+
+void TokenSampler::record(int32_t token) {
+    if (window_.empty() || token < 0) {
+        return;
+    }
+    if (window_len_ == window_.size()) {
+        const int32_t evicted = window_[window_pos_];
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            if (counts_[i].first == evicted) {
+                if (--counts_[i].second == 0) {
+                    counts_[i] = counts_.back();
+                    counts_.pop_back();
+                }
+                break;
+            }
+        }
+    } else {
+        ++window_len_;
+    }
+    window_[window_pos_] = token;
+    window_pos_ = (window_pos_ + 1) % window_.size();
+    for (auto & entry : counts_) {
+        if (entry.first == token) {
+            ++entry.second;
+            return;
+        }
+    }
+    counts_.emplace_back(token, 1); // within the capacity reserved by set_config()
+}
+
+}  // namespace maathai
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace maathai {
+
+// Sampler knobs as they arrive from loadModel()/updateSampler(). Any optional
+// stage whose value is <= 0 is left out of the pipeline.
+struct SamplerConfig {
+    float temperature = 0.7f; // <= 0: greedy
+    int top_k = 40;
+    float top_p = 0.95f;
+    float min_p = -1.0f;
+    float typical_p = -1.0f;
+    float top_n_sigma = -1.0f;
+    int mirostat_type = 0; // 0=off, 1=mirostat, 2=mirostat_v2
+    float mirostat_tau = -1.0f;
+    float mirostat_eta = -1.0f;
+    float repeat_penalty = -1.0f;
+    float frequency_penalty = -1.0f;
+    float presence_penalty = -1.0f;
+    int repeat_last_n = -1;
+    int min_keep = -1;
+};
+
+enum SamplerStage {
+    kStageTopK,        // copying the logits into candidates and cutting to top_k
+    kStagePenalties,   // repeat/frequency/presence over the recent window
+    kStageFilters,     // top-n-sigma, typical, top-p, min-p
+    kStageTemperature,
+    kStageDist,        // softmax and the draw (or mirostat)
+    kSamplerStageCount,
+};
+
+const char * sampler_stage_name(int stage);
+
+// Cumulative wall time per stage since the last reset_timings().
+struct SamplerTimings {
+    uint64_t samples = 0;
+    double us[kSamplerStageCount] = {};
+};
+
+// The per-session sampling pipeline. Stages run on a shrinking candidate set:
+//
+//   top-k -> penalties -> top-n-sigma -> typical -> top-p -> min-p
+//         -> temperature -> dist
+//
+// so everything after the first stage touches top_k entries instead of the
+// whole vocabulary. With mirostat the truncating stages are skipped and
+// mirostat replaces dist, as it picks its own cut-off. Candidate and
+// scratch buffers are sized once by reserve(); sample() never allocates, and
+// set_config() swaps parameters without rebuilding anything.
+class TokenSampler {
+public:
+    explicit TokenSampler(uint32_t seed = 0);
+
+    // Sizes the buffers for `n_vocab` candidates.
+    void reserve(int n_vocab);
+    // Takes effect from the next sample(). The penalty window and mirostat
+    // state are kept unless their shape changes.
+    void set_config(const SamplerConfig & config);
+    const SamplerConfig & config() const { return config_; }
+    // Forgets the penalty window and mirostat state (a new request).
+    void reset();
+
+    // Picks the next token from one row of raw logits and records it in the
+    // penalty window. Returns -1 if `n_vocab` exceeds the reserved size.
+    int32_t sample(const float * logits, int n_vocab);
+
+    const SamplerTimings & timings() const { return timings_; }
+    void reset_timings() { timings_ = SamplerTimings{}; }
+
+private:
+    struct Candidate {
+        int32_t id;
+        float logit;
+        float p;
+    };
+
+    void apply_penalties();
+    void apply_top_n_sigma();
+    void apply_typical();
+    void apply_top_p();
+    void apply_min_p();
+    void softmax();
+    void sort_by_logit();
+    int32_t draw();
+    int32_t mirostat(int n_vocab);
+    void record(int32_t token);
+    size_t min_keep() const;
+
+    SamplerConfig config_;
+    std::mt19937 rng_;
+    std::vector<Candidate> candidates_; // reserved to n_vocab
+    std::vector<Candidate> scratch_;
+    size_t n_candidates_ = 0;
+    bool sorted_ = false;
+    bool full_vocab_ = false; // candidates_[i].id == i
+
+    // Last repeat_last_n sampled tokens and their distinct counts.
+    std::vector<int32_t> window_;
+    size_t window_pos_ = 0;
+    size_t window_len_ = 0;
+    std::vector<std::pair<int32_t, int>> counts_;
+
+    float mirostat_mu_ = 0.0f;
+    SamplerTimings timings_;
+};
+
+}  // namespace maathai
@@ -0,0 +1,105 @@
+#include "stream_frame.h"
+
+#include <cstring>
+
+namespace maathai {
+
+namespace {
+
+constexpr size_t kPerTokenBytes = 3 * sizeof(uint32_t);
+constexpr size_t kUtf8CarryBytes = 3;
+
+// Every target ABI (arm64-v8a, armeabi-v7a, x86, x86_64) is little-endian,
+// so native-order copies already match the wire format.
+uint8_t * put(uint8_t * dst, const void * src, size_t n) {
+    std::memcpy(dst, src, n);
+    return dst + n;
+}
+
+const uint8_t * get(const uint8_t * src, void * dst, size_t n) {
+    std::memcpy(dst, src, n);
+    return src + n;
+}
+
+}  // namespace
+
+size_t stream_frame_max_pieces(size_t capacity) {
+    const size_t fixed = kStreamFrameHeaderBytes + kUtf8CarryBytes;
+    if (capacity <= fixed) {
+        return 0;
+    }
+    return (capacity - fixed) / (kPerTokenBytes + TokenRing::kSlotBytes);
+}
+
+size_t stream_frame_bytes(const StreamFrame & frame) {
+    const size_t per_token = frame.has_logprobs ? 3 * sizeof(float) : 2 * sizeof(float);
+    return kStreamFrameHeaderBytes + frame.tokens.size() * per_token + frame.text.size();
+}
+
+size_t encode_stream_frame(const StreamFrame & frame, uint8_t * dst, size_t capacity) {
+    const uint32_t n_tokens = (uint32_t) frame.tokens.size();
+    const uint32_t text_bytes = (uint32_t) frame.text.size();
+    if (stream_frame_bytes(frame) > capacity) {
+        return 0;
+    }
+
+    const uint16_t version = kStreamFrameVersion;
+    const uint16_t flags = frame.has_logprobs ? kStreamFrameLogprobs : 0;
+    uint8_t * out = dst;
+    out = put(out, &version, sizeof(version));
+    out = put(out, &flags, sizeof(flags));
+    out = put(out, &n_tokens, sizeof(n_tokens));
+    out = put(out, &text_bytes, sizeof(text_bytes));
+    for (const PieceMeta & meta : frame.tokens) {
+        out = put(out, &meta.token, sizeof(meta.token));
+    }
+    for (const PieceMeta & meta : frame.tokens) {
+        out = put(out, &meta.t_ms, sizeof(meta.t_ms));
+    }
+    if (frame.has_logprobs) {
+        for (const PieceMeta & meta : frame.tokens) {
+            out = put(out, &meta.logprob, sizeof(meta.logprob));
+        }
+    }
+    out = put(out, frame.text.data(), text_bytes);
+    return (size_t) (out - dst);
+}
+
+bool decode_stream_frame(const uint8_t * src, size_t size, StreamFrame & out) {
+    if (size < kStreamFrameHeaderBytes) {
+        return false;
+    }
+    uint16_t version = 0;
+    uint16_t flags = 0;
+    uint32_t n_tokens = 0;
+    uint32_t text_bytes = 0;
+    const uint8_t * in = src;
+    in = get(in, &version, sizeof(version));
+    in = get(in, &flags, sizeof(flags));
+    in = get(in, &n_tokens, sizeof(n_tokens));
+    in = get(in, &text_bytes, sizeof(text_bytes));
+    const bool logprobs = (flags & kStreamFrameLogprobs) != 0;
+    const uint64_t per_token = logprobs ? 3 * sizeof(float) : 2 * sizeof(float);
+    if (version != kStreamFrameVersion ||
+        kStreamFrameHeaderBytes + (uint64_t) n_tokens * per_token + text_bytes != size) {
+        return false;
+    }
+    out.has_logprobs = logprobs;
+    out.tokens.resize(n_tokens);
+    for (PieceMeta & meta : out.tokens) {
+        in = get(in, &meta.token, sizeof(meta.token));
+    }
+    for (PieceMeta & meta : out.tokens) {
+        in = get(in, &meta.t_ms, sizeof(meta.t_ms));
+    }
+    for (PieceMeta & meta : out.tokens) {
+        meta.logprob = 0.0f;
+        if (logprobs) {
+            in = get(in, &meta.logprob, sizeof(meta.logprob));
+        }
+    }
+    out.text.assign((const char *) in, text_bytes);
+    return true;
+}
+
+}  // namespace maathai
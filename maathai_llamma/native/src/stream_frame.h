@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "token_ring.h"
+
+namespace maathai {
+
+// One drain of the streaming ring: the tokens decoded since the previous
+// drain and their text, cut at a UTF-8 character boundary. Buffers are kept
+// between drains so steady-state streaming does not allocate.
+struct StreamFrame {
+    std::string text;
+    std::vector<PieceMeta> tokens;
+    bool has_logprobs = false;
+
+    void clear() {
+        text.clear();
+        tokens.clear();
+    }
+};
+
+// Wire format handed to the platform layer (little-endian, 4-byte aligned):
+//
+//   u16 version (= kStreamFrameVersion)
+//   u16 flags   (bit 0: logprobs present)
+//   u32 n_tokens
+//   u32 text_bytes
+//   i32 token[n_tokens]
+//   f32 t_ms[n_tokens]
+//   f32 logprob[n_tokens]        (only with the logprobs flag)
+//   u8  text[text_bytes]         (complete UTF-8)
+constexpr uint16_t kStreamFrameVersion = 1;
+constexpr uint16_t kStreamFrameLogprobs = 1u << 0;
+constexpr size_t kStreamFrameHeaderBytes = 12;
+
+// Largest number of ring pieces whose frame is guaranteed to fit in
+// `capacity` bytes (pieces are at most TokenRing::kSlotBytes; the UTF-8
+// assembler can carry up to 3 extra bytes from the previous drain).
+size_t stream_frame_max_pieces(size_t capacity);
+
+// Serialises `frame` into `dst`. Returns the number of bytes written, or 0
+// if it does not fit in `capacity`.
+size_t encode_stream_frame(const StreamFrame & frame, uint8_t * dst, size_t capacity);
+
+// Bytes encode_stream_frame() needs for `frame`.
+size_t stream_frame_bytes(const StreamFrame & frame);
+
+// Parses one frame of exactly `size` bytes into `out` (reusing its
+// buffers). Returns false for a truncated frame or an unknown version.
+bool decode_stream_frame(const uint8_t * src, size_t size, StreamFrame & out);
+
+}  // namespace maathai
@@ -0,0 +1,197 @@
+#include "thread_governor.h"
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+namespace maathai {
+
+namespace {
+
+std::string read_line(const std::string & path) {
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+bool names_cpu(std::string type) {
+    std::transform(type.begin(), type.end(), type.begin(), [](unsigned char c) { return (char) std::tolower(c); });
+    return type.find("cpu") != std::string::npos;
+}
+
+}  // namespace
+
+SysfsThermalSource::SysfsThermalSource(const std::string & root) {
+    std::vector<std::string> all;
+    DIR * dir = opendir(root.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+    while (dirent * entry = readdir(dir)) {
+        if (std::strncmp(entry->d_name, "thermal_zone", 12) != 0) {
+            continue;
+        }
+        const std::string zone = root + "/" + entry->d_name;
+        all.push_back(zone + "/temp");
+        if (names_cpu(read_line(zone + "/type"))) {
+            zones_.push_back(zone + "/temp");
+        }
+    }
+    closedir(dir);
+    if (zones_.empty()) {
+        zones_ = std::move(all);
+    }
+    std::sort(zones_.begin(), zones_.end());
+}
+
+bool SysfsThermalSource::read(double & celsius) {
+    bool found = false;
+    for (const std::string & path : zones_) {
+        const std::string line = read_line(path);
+        if (line.empty()) {
+            continue; // disabled zones fail the read
+        }
+        double value = (double) std::atoll(line.c_str());
+        if (value >= 1000.0) {
+            value /= 1000.0;
+        }
+        if (value <= 0.0) {
+            continue;
+        }
+        celsius = found ? std::max(celsius, value) : value;
+        found = true;
+    }
+    return found;
+}
+
+const char * governor_reason_name(GovernorReason reason) {
+    switch (reason) {
+        case GovernorReason::kProbe: return "probe";
+        case GovernorReason::kRevert: return "revert";
+        case GovernorReason::kThermal: return "thermal";
+        case GovernorReason::kSlowdown: return "slowdown";
+    }
+    return "probe";
+}
+
+ThreadGovernor::ThreadGovernor(const GovernorConfig & config, ThermalSource * thermal)
+    : config_(config), thermal_(thermal) {
+    config_.max_threads = std::max(1, config_.max_threads);
+    config_.min_threads = std::min(std::max(1, config_.min_threads), config_.max_threads);
+    config_.max_threads_batch = std::max(1, config_.max_threads_batch);
+    config_.window = std::max(1, config_.window);
+    current_ = config_.max_threads;
+    peak_tok_s_.assign((size_t) config_.max_threads + 1, 0.0);
+}
+
+int ThreadGovernor::n_threads_batch() const {
+    return std::max(1, config_.max_threads_batch - (config_.max_threads - current_));
+}
+
+bool ThreadGovernor::observe(int sessions, int tokens, double us, GovernorDecision & out) {
+    if (++thermal_steps_ >= config_.window) {
+        thermal_steps_ = 0;
+        if (thermal_ == nullptr || !thermal_->read(temp_c_)) {
+            temp_c_ = -1.0;
+        }
+        if (temp_c_ >= config_.hot_c && current_ > config_.min_threads) {
+            const double tok_s = window_us_ + us > 0.0 ? (window_tokens_ + tokens) * 1e6 / (window_us_ + us) : 0.0;
+            window_steps_ = window_tokens_ = 0;
+            window_us_ = 0.0;
+            probing_ = false;
+            direction_ = -1;
+            hold_ = config_.hold_windows;
+            return move(current_ - 1, GovernorReason::kThermal, tok_s, temp_c_, out);
+        }
+    }
+    if (sessions != shape_sessions_) {
+        shape_sessions_ = sessions;
+        window_steps_ = window_tokens_ = 0;
+        window_us_ = 0.0;
+        std::fill(peak_tok_s_.begin(), peak_tok_s_.end(), 0.0);
+        if (probing_) {
+            // never judged: go back rather than keep an unmeasured count
+            probing_ = false;
+            return move(from_, GovernorReason::kRevert, 0.0, temp_c_, out);
+        }
+    }
+    ++window_steps_;
+    window_tokens_ += tokens;
+    window_us_ += us;
+    if (window_steps_ < config_.window) {
+        return false;
+    }
+    const double tok_s = window_us_ > 0.0 ? window_tokens_ * 1e6 / window_us_ : 0.0;
+    window_steps_ = window_tokens_ = 0;
+    window_us_ = 0.0;
+    const double temp_c = temp_c_;
+
+    double & peak = peak_tok_s_[(size_t) current_];
+    const bool slowed = peak > 0.0 && tok_s < peak * (1.0 - config_.slowdown);
+    // a throttled count is judged against what it does now
+    peak = slowed ? tok_s : std::max(peak, tok_s);
+
+    if (probing_) {
+        probing_ = false;
+        if (tok_s > from_tok_s_ * (1.0 + config_.margin)) {
+            // paid off: keep going the same way, or settle at the edge
+            const int next = current_ + direction_;
+            if (next >= config_.min_threads && next <= config_.max_threads && !(direction_ > 0 && temp_c >= config_.warm_c)) {
+                return probe(tok_s, temp_c, out);
+            }
+            hold_ = config_.hold_windows;
+            return false;
+        }
+        direction_ = -direction_;
+        hold_ = config_.hold_windows;
+        return move(from_, GovernorReason::kRevert, tok_s, temp_c, out);
+    }
+    if (slowed) {
+        direction_ = -1;
+        hold_ = 0;
+        if (probe(tok_s, temp_c, out)) {
+            out.reason = GovernorReason::kSlowdown;
+            return true;
+        }
+        return false;
+    }
+    if (hold_ > 0) {
+        --hold_;
+        return false;
+    }
+    return probe(tok_s, temp_c, out);
+}
+
+bool ThreadGovernor::probe(double tok_s, double temp_c, GovernorDecision & out) {
+    for (int turn = 0; turn < 2; ++turn) {
+        const int to = current_ + direction_;
+        if (to >= config_.min_threads && to <= config_.max_threads && !(direction_ > 0 && temp_c >= config_.warm_c)) {
+            probing_ = true;
+            from_ = current_;
+            from_tok_s_ = tok_s;
+            return move(to, GovernorReason::kProbe, tok_s, temp_c, out);
+        }
+        direction_ = -direction_;
+    }
+    hold_ = config_.hold_windows;
+    return false;
+}
+
+bool ThreadGovernor::move(int to, GovernorReason reason, double tok_s, double temp_c, GovernorDecision & out) {
+    out.from_threads = current_;
+    current_ = to;
+    out.n_threads = current_;
+    out.n_threads_batch = n_threads_batch();
+    out.reason = reason;
+    out.tok_s = tok_s;
+    out.temp_c = temp_c;
+    ++decisions_;
+    return true;
+}
+
+}  // namespace maathai
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace maathai {
+
+// Where the governor reads the SoC temperature from. Tests and benchmarks
+// replay synthetic throttling traces through their own implementation.
+class ThermalSource {
+public:
+    virtual ~ThermalSource() = default;
+    // Hottest reading in degrees Celsius; false when none is available.
+    virtual bool read(double & celsius) = 0;
+};
+
+// Thermal zones under /sys/class/thermal. Zones whose type names a CPU
+// (cpu-1-0-usr, cpuss-0, mtktscpu, ...) are watched; when no type does,
+// every zone is. Temperatures are millidegrees on every kernel that matters,
+// but a value under 1000 is taken as whole degrees.
+class SysfsThermalSource : public ThermalSource {
+public:
+    explicit SysfsThermalSource(const std::string & root = "/sys/class/thermal");
+    bool read(double & celsius) override;
+    // The temp files being read, for logs.
+    const std::vector<std::string> & zones() const { return zones_; }
+
+private:
+    std::vector<std::string> zones_;
+};
+
+struct GovernorConfig {
+    int min_threads = 1;
+    int max_threads = 0;       // the count load() settled on
+    int max_threads_batch = 0;
+    int window = 16;           // decode steps per measurement
+    double margin = 0.05;      // throughput gain a move must show to stay
+    double slowdown = 0.15;    // drop at an unchanged count read as throttling
+    double hot_c = 75.0;       // at or above: one thread fewer per window
+    double warm_c = 65.0;      // at or above: no probing upwards
+    int hold_windows = 8;      // windows to stay put after settling
+};
+
+enum class GovernorReason {
+    kProbe,    // trying a neighbouring count
+    kRevert,   // the probe was not faster; back to where it came from
+    kThermal,  // the SoC is hot
+    kSlowdown, // same count, lower throughput: probe downwards now
+};
+
+const char * governor_reason_name(GovernorReason reason);
+
+struct GovernorDecision {
+    int n_threads = 0;
+    int n_threads_batch = 0;
+    int from_threads = 0;
+    GovernorReason reason = GovernorReason::kProbe;
+    double tok_s = 0.0;        // throughput of the window that decided
+    double temp_c = -1.0;      // -1 when no thermal reading
+};
+
+// Steps the decode thread count between tokens towards the fastest one, by
+// hill climbing on measured tokens/s: every `window` decode steps it compares
+// the window's throughput with the previous count's and keeps a move only if
+// it paid off, otherwise reverts and holds. Throttled cores make fewer
+// threads faster (they contend for less bandwidth and heat less), so probes
+// start downwards, a hot SoC forces a step down and a count that got slower
+// on its own triggers a downward probe at once. The prefill count moves by
+// the same steps. Windows only compare steps with the same number of
+// generating sessions: a session joining or leaving changes tokens per step
+// without saying anything about the thread count, so it starts a new window,
+// forgets the measured peaks and reverts a probe it interrupted. Draft
+// lengths may vary freely, since only committed tokens count. The
+// temperature is read every `window` steps whatever the sessions do, so a
+// hot SoC steps down even while windows keep restarting. Not thread-safe;
+// the scheduler owns it.
+class ThreadGovernor {
+public:
+    // `thermal` may be null and must outlive the governor.
+    ThreadGovernor(const GovernorConfig & config, ThermalSource * thermal);
+
+    // Feeds one decode step of `sessions` generating sessions, which took
+    // `us` microseconds and committed `tokens` (accepted drafts included).
+    // Returns true, filling `out`, when the thread counts should change.
+    bool observe(int sessions, int tokens, double us, GovernorDecision & out);
+
+    int n_threads() const { return current_; }
+    int n_threads_batch() const;
+    uint64_t decisions() const { return decisions_; }
+
+private:
+    bool move(int to, GovernorReason reason, double tok_s, double temp_c, GovernorDecision & out);
+    bool probe(double tok_s, double temp_c, GovernorDecision & out);
+
+    GovernorConfig config_;
+    ThermalSource * thermal_;
+    int current_;
+    int direction_ = -1;
+    int hold_ = 0;
+    bool probing_ = false;
+    int from_ = 0;
+    double from_tok_s_ = 0.0;
+    int shape_sessions_ = 0;
+    int thermal_steps_ = 0;
+    double temp_c_ = -1.0; // last reading, -1 when none
+    int window_steps_ = 0;
+    int window_tokens_ = 0;
+    double window_us_ = 0.0;
+    std::vector<double> peak_tok_s_; // best seen at each count
+    uint64_t decisions_ = 0;
+};
+
+}  // namespace maathai
@@ -0,0 +1,123 @@
+#include "token_ring.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace maathai {
+
+namespace {
+
+size_t round_up_pow2(size_t value) {
+    size_t out = 1;
+    while (out < value) {
+        out <<= 1;
+    }
+    return out;
+}
+
+}  // namespace
+
+TokenRing::TokenRing(size_t capacity)
+    : capacity_(round_up_pow2(std::max<size_t>(capacity, 2))),
+      mask_(capacity_ - 1),
+      slots_(new Slot[capacity_]) {
+}
+
+size_t TokenRing::size() const {
+    return tail_.load() - head_.load();
+}
+
+bool TokenRing::push(const char * data, size_t len, const PieceMeta & meta) {
+    bool first = true;
+    while (len > 0) {
+        if (closed_.load()) {
+            return false;
+        }
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load() == capacity_) {
+            std::unique_lock<std::mutex> lock(wait_mutex_);
+            producer_waiting_.store(true);
+            space_cv_.wait_for(lock, std::chrono::milliseconds(10), [&]() {
+                return closed_.load() || tail_.load() - head_.load() < capacity_;
+            });
+            producer_waiting_.store(false);
+            continue;
+        }
+        const size_t n = std::min(len, kSlotBytes);
+        Slot & slot = slots_[tail & mask_];
+        std::memcpy(slot.bytes, data, n);
+        slot.len = (uint16_t) n;
+        slot.meta = first ? meta : PieceMeta{};
+        first = false;
+        tail_.store(tail + 1);
+        data += n;
+        len -= n;
+
+        // seq_cst store above pairs with the waiter's flag store + recheck,
+        // so a sleeping consumer can never miss this piece.
+        if (consumer_waiting_.load()) {
+            std::lock_guard<std::mutex> lock(wait_mutex_);
+            data_cv_.notify_one();
+        }
+    }
+    return true;
+}
+
+bool TokenRing::try_push(const char * data, size_t len, const PieceMeta & meta) {
+    const size_t needed = std::max<size_t>(1, (len + kSlotBytes - 1) / kSlotBytes);
+    if (closed_.load() || capacity_ - size() < needed) {
+        return false;
+    }
+    // single producer: the space checked above can only grow meanwhile
+    return push(data, len, meta);
+}
+
+void TokenRing::close() {
+    closed_.store(true);
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    data_cv_.notify_all();
+    space_cv_.notify_all();
+}
+
+size_t TokenRing::wait_and_drain(std::string & out, int timeout_ms, size_t max_count,
+                                 std::vector<PieceMeta> * meta) {
+    if (size() == 0 && !closed_.load() && timeout_ms > 0) {
+        std::unique_lock<std::mutex> lock(wait_mutex_);
+        consumer_waiting_.store(true);
+        data_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&]() {
+            return size() > 0 || closed_.load();
+        });
+        consumer_waiting_.store(false);
+    }
+
+    size_t head = head_.load(std::memory_order_relaxed);
+    const size_t available = tail_.load() - head;
+    const size_t n = std::min(available, max_count);
+    for (size_t i = 0; i < n; ++i) {
+        const Slot & slot = slots_[(head + i) & mask_];
+        out.append(slot.bytes, slot.len);
+        if (meta != nullptr && slot.meta.token >= 0) {
+            meta->push_back(slot.meta);
+        }
+    }
+    if (n > 0) {
+        head_.store(head + n);
+        if (producer_waiting_.load()) {
+            std::lock_guard<std::mutex> lock(wait_mutex_);
+            space_cv_.notify_one();
+        }
+    }
+    return n;
+}
+
+bool TokenRing::finished() const {
+    return closed_.load() && size() == 0;
+}
+
+void TokenRing::reset() {
+    head_.store(0);
+    tail_.store(0);
+    closed_.store(false);
+}
+
+}  // namespace maathai
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace maathai {
+
+// Per-token side data carried next to the piece bytes.
+struct PieceMeta {
+    int32_t token = -1;
+    float t_ms = 0.0f;    // request start -> piece emitted
+    float logprob = 0.0f; // log-probability of the sampled token, if computed
+};
+
+// Single-producer/single-consumer ring of detokenized pieces between the
+// decode worker and the platform consumer. Slots are preallocated, so the hot
+// path never allocates. The data path is lock-free; the mutex/condvar pair is
+// only touched when one side actually has to sleep.
+class TokenRing {
+public:
+    static constexpr size_t kSlotBytes = 256; // matches the detokenizer buffer
+
+    // `capacity` is rounded up to a power of two.
+    explicit TokenRing(size_t capacity);
+
+    TokenRing(const TokenRing &) = delete;
+    TokenRing & operator=(const TokenRing &) = delete;
+
+    // Producer side. Blocks while the ring is full; returns false once the
+    // ring is closed. Pieces longer than kSlotBytes are split across slots;
+    // only the first slot carries `meta`.
+    bool push(const char * data, size_t len, const PieceMeta & meta = {});
+    // Non-blocking push: writes the whole piece, or nothing and returns false
+    // when the ring is closed or lacks the slots for it.
+    bool try_push(const char * data, size_t len, const PieceMeta & meta = {});
+    // Marks the end of the stream and wakes the consumer.
+    void close();
+
+    // Consumer side. Waits up to `timeout_ms` for at least one piece, then
+    // appends up to `max_count` pieces to `out` (and their metadata to
+    // `meta`, if given). Returns the number of slots drained.
+    size_t wait_and_drain(std::string & out, int timeout_ms, size_t max_count,
+                          std::vector<PieceMeta> * meta = nullptr);
+    // True once close() was called and every piece has been drained.
+    bool finished() const;
+
+    // Empties and reopens the ring. Must not race with push/drain.
+    void reset();
+
+private:
+    struct Slot {
+        PieceMeta meta;
+        uint16_t len;
+        char bytes[kSlotBytes];
+    };
+
+    size_t size() const;
+
+    const size_t capacity_;
+    const size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+
+    alignas(64) std::atomic<size_t> head_{0}; // next slot to read (consumer)
+    alignas(64) std::atomic<size_t> tail_{0}; // next slot to write (producer)
+    std::atomic_bool closed_{true};
+
+    std::atomic_bool consumer_waiting_{false};
+    std::atomic_bool producer_waiting_{false};
+    std::mutex wait_mutex_;
+    std::condition_variable data_cv_;
+    std::condition_variable space_cv_;
+};
+
+}  // namespace maathai
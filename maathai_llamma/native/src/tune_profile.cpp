@@ -0,0 +1,192 @@
+#include "tune_profile.h"
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "prefix_snapshot.h"
+
+namespace maathai {
+
+namespace {
+
+constexpr const char * kProfilePrefix = "tune-";
+constexpr const char * kProfileSuffix = ".txt";
+
+const char * const kCpuinfoKeys[] = {
+    "CPU implementer",
+    "CPU architecture",
+    "CPU variant",
+    "CPU part",
+    "CPU revision",
+    "Hardware",
+    "model name",
+    "vendor_id",
+    "cpu family",
+    "model\t",
+};
+
+bool starts_with(const std::string & text, const char * prefix) {
+    return text.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+bool ends_with(const std::string & text, const char * suffix) {
+    const size_t n = std::strlen(suffix);
+    return text.size() >= n && text.compare(text.size() - n, n, suffix) == 0;
+}
+
+}  // namespace
+
+uint64_t device_signature(const std::string & cpuinfo_path) {
+    std::ifstream in(cpuinfo_path);
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a offset basis
+    uint32_t n_cores = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (starts_with(line, "processor")) {
+            ++n_cores;
+            continue;
+        }
+        for (const char * key : kCpuinfoKeys) {
+            if (starts_with(line, key)) {
+                hash = fnv1a64(line.data(), line.size(), hash);
+                break;
+            }
+        }
+    }
+    return fnv1a64(&n_cores, sizeof(n_cores), hash);
+}
+
+std::string tune_profile_file_name(const TuneKey & key) {
+    uint64_t hash = fnv1a64(&key.model_fingerprint, sizeof(key.model_fingerprint));
+    hash = fnv1a64(&key.device, sizeof(key.device), hash);
+    hash = fnv1a64(&key.n_ctx, sizeof(key.n_ctx), hash);
+    hash = fnv1a64(&key.n_gpu_layers, sizeof(key.n_gpu_layers), hash);
+    char name[40];
+    std::snprintf(name, sizeof(name), "%s%016llx%s", kProfilePrefix, (unsigned long long) hash, kProfileSuffix);
+    return name;
+}
+
+bool write_tune_profile(const std::string & path, const TuneKey & key, const TuneProfile & profile) {
+    const std::string tmp = path + ".tmp";
+    std::FILE * file = std::fopen(tmp.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    const int written = std::fprintf(file,
+        "maathai-tune %d\n"
+        "model %016" PRIx64 "\n"
+        "device %016" PRIx64 "\n"
+        "n_ctx %d\n"
+        "n_gpu_layers %d\n"
+        "n_threads %d\n"
+        "n_threads_batch %d\n"
+        "n_batch %d\n"
+        "prefill_tok_s %.3f\n"
+        "decode_tok_s %.3f\n",
+        kTuneProfileVersion, key.model_fingerprint, key.device, key.n_ctx, key.n_gpu_layers,
+        profile.n_threads, profile.n_threads_batch, profile.n_batch,
+        profile.prefill_tok_s, profile.decode_tok_s);
+    const bool ok = written > 0 && std::fclose(file) == 0;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool read_tune_profile(const std::string & path, const TuneKey & key, TuneProfile & profile) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    TuneKey stored;
+    TuneProfile loaded;
+    int version = -1;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        fields >> name;
+        if (name == "maathai-tune") {
+            fields >> version;
+        } else if (name == "model") {
+            fields >> std::hex >> stored.model_fingerprint;
+        } else if (name == "device") {
+            fields >> std::hex >> stored.device;
+        } else if (name == "n_ctx") {
+            fields >> stored.n_ctx;
+        } else if (name == "n_gpu_layers") {
+            fields >> stored.n_gpu_layers;
+        } else if (name == "n_threads") {
+            fields >> loaded.n_threads;
+        } else if (name == "n_threads_batch") {
+            fields >> loaded.n_threads_batch;
+        } else if (name == "n_batch") {
+            fields >> loaded.n_batch;
+        } else if (name == "prefill_tok_s") {
+            fields >> loaded.prefill_tok_s;
+        } else if (name == "decode_tok_s") {
+            fields >> loaded.decode_tok_s;
+        }
+    }
+    if (version != kTuneProfileVersion ||
+        stored.model_fingerprint != key.model_fingerprint ||
+        stored.device != key.device ||
+        stored.n_ctx != key.n_ctx ||
+        stored.n_gpu_layers != key.n_gpu_layers ||
+        loaded.n_threads <= 0 || loaded.n_threads_batch <= 0 || loaded.n_batch <= 0) {
+        return false;
+    }
+    profile = loaded;
+    return true;
+}
+
+int remove_tune_profiles(const std::string & dir) {
+    DIR * handle = opendir(dir.c_str());
+    if (handle == nullptr) {
+        return 0;
+    }
+    int removed = 0;
+    while (const dirent * entry = readdir(handle)) {
+        const std::string name = entry->d_name;
+        if (starts_with(name, kProfilePrefix) && ends_with(name, kProfileSuffix) &&
+            std::remove((dir + "/" + name).c_str()) == 0) {
+            ++removed;
+        }
+    }
+    closedir(handle);
+    return removed;
+}
+
+std::vector<int> tune_thread_candidates(int hw_threads) {
+    hw_threads = std::max(1, hw_threads);
+    // Past 8 threads the curve on phones is flat or falling; the half and
+    // full counts cover big.LITTLE splits.
+    std::vector<int> out = {1, 2, 4, 6, 8, hw_threads / 2, hw_threads};
+    out.erase(std::remove_if(out.begin(), out.end(), [hw_threads](int n) {
+        return n < 1 || n > hw_threads;
+    }), out.end());
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    // one thread is only worth measuring on single-core devices
+    if (out.size() > 1 && out.front() == 1) {
+        out.erase(out.begin());
+    }
+    return out;
+}
+
+std::vector<int> tune_batch_candidates(int max_batch) {
+    std::vector<int> out;
+    for (int n_batch = 16; n_batch <= std::max(16, max_batch); n_batch *= 2) {
+        out.push_back(n_batch);
+    }
+    return out;
+}
+
+}  // namespace maathai
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace maathai {
+
+// Thread/batch settings measured on this device for one model, cached on disk
+// so only the first load of a model/device pair pays for calibration.
+//
+// Profiles are small text files ("tune-<16 hex digits>.txt"):
+//   maathai-tune <version>
+//   model <hex>  device <hex>  n_ctx <n>  n_gpu_layers <n>
+//   n_threads <n>  n_threads_batch <n>  n_batch <n>
+//   prefill_tok_s <f>  decode_tok_s <f>
+// one "key value" pair per line.
+constexpr int kTuneProfileVersion = 1;
+
+struct TuneKey {
+    uint64_t model_fingerprint = 0;
+    uint64_t device = 0;
+    int n_ctx = 0;
+    int n_gpu_layers = 0;
+};
+
+struct TuneProfile {
+    int n_threads = 0;
+    int n_threads_batch = 0;
+    int n_batch = 0;
+    double prefill_tok_s = 0.0;
+    double decode_tok_s = 0.0;
+};
+
+// Identity of the CPU complex: the per-core description lines of
+// /proc/cpuinfo (implementer, part, model name, ...) plus the core count.
+// Frequencies and BogoMIPS are ignored, they change with DVFS.
+uint64_t device_signature(const std::string & cpuinfo_path = "/proc/cpuinfo");
+
+std::string tune_profile_file_name(const TuneKey & key);
+
+// Written to a temporary file and renamed into place.
+bool write_tune_profile(const std::string & path, const TuneKey & key, const TuneProfile & profile);
+// False when the file is missing, from another version or for another key.
+bool read_tune_profile(const std::string & path, const TuneKey & key, TuneProfile & profile);
+// Deletes every cached profile in `dir`; returns how many were removed.
+int remove_tune_profiles(const std::string & dir);
+
+// Values swept during calibration, ascending and without duplicates.
+std::vector<int> tune_thread_candidates(int hw_threads);
+std::vector<int> tune_batch_candidates(int max_batch);
+
+}  // namespace maathai
@@ -0,0 +1,135 @@
+#include "utf8.h"
+
+#include <cstring>
+
+namespace maathai {
+
+namespace {
+
+constexpr char32_t kReplacement = 0xFFFD;
+
+bool is_continuation(unsigned char byte) {
+    return (byte & 0xC0) == 0x80;
+}
+
+// Sequence length announced by a lead byte; 0 for bytes that cannot start one.
+size_t sequence_length(unsigned char lead) {
+    if (lead < 0x80) return 1;
+    if (lead >= 0xC2 && lead <= 0xDF) return 2;
+    if (lead >= 0xE0 && lead <= 0xEF) return 3;
+    if (lead >= 0xF0 && lead <= 0xF4) return 4;
+    return 0;
+}
+
+void append_utf8(std::string & out, char32_t cp) {
+    if (cp < 0x80) {
+        out.push_back((char) cp);
+    } else if (cp < 0x800) {
+        out.push_back((char) (0xC0 | (cp >> 6)));
+        out.push_back((char) (0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back((char) (0xE0 | (cp >> 12)));
+        out.push_back((char) (0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back((char) (0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back((char) (0xF0 | (cp >> 18)));
+        out.push_back((char) (0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back((char) (0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back((char) (0x80 | (cp & 0x3F)));
+    }
+}
+
+}  // namespace
+
+void Utf8Assembler::append(std::string & out, const char * data, size_t len) {
+    const size_t start = out.size();
+    out.append(pending_, pending_len_);
+    out.append(data, len);
+    pending_len_ = 0;
+
+    // Find the lead byte of the last sequence (at most 3 continuation bytes
+    // back) and hold it back if it is still missing bytes.
+    const size_t end = out.size();
+    size_t lead = end;
+    for (size_t back = 1; back <= 4 && back <= end - start; ++back) {
+        const unsigned char byte = (unsigned char) out[end - back];
+        if (!is_continuation(byte)) {
+            lead = end - back;
+            break;
+        }
+    }
+    if (lead == end) {
+        return;
+    }
+    const size_t want = sequence_length((unsigned char) out[lead]);
+    const size_t have = end - lead;
+    if (want > have) {
+        pending_len_ = have;
+        std::memcpy(pending_, out.data() + lead, have);
+        out.resize(lead);
+    }
+}
+
+void Utf8Assembler::flush(std::string & out) {
+    out.append(pending_, pending_len_);
+    pending_len_ = 0;
+}
+
+std::u16string utf8_to_utf16(const char * data, size_t len) {
+    std::u16string out;
+    out.reserve(len);
+    size_t i = 0;
+    while (i < len) {
+        const unsigned char lead = (unsigned char) data[i];
+        const size_t n = sequence_length(lead);
+        char32_t cp = kReplacement;
+        size_t used = 1;
+        if (n == 1) {
+            cp = lead;
+        } else if (n > 1 && i + n <= len) {
+            char32_t value = lead & (0x7F >> n);
+            bool ok = true;
+            for (size_t k = 1; k < n; ++k) {
+                const unsigned char byte = (unsigned char) data[i + k];
+                if (!is_continuation(byte)) {
+                    ok = false;
+                    break;
+                }
+                value = (value << 6) | (byte & 0x3F);
+            }
+            // reject overlongs, surrogates and out-of-range values
+            static const char32_t kMin[] = {0, 0, 0x80, 0x800, 0x10000};
+            if (ok && value >= kMin[n] && value <= 0x10FFFF && (value < 0xD800 || value > 0xDFFF)) {
+                cp = value;
+                used = n;
+            }
+        }
+        i += used;
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            out.push_back((char16_t) (0xD800 + (cp >> 10)));
+            out.push_back((char16_t) (0xDC00 + (cp & 0x3FF)));
+        } else {
+            out.push_back((char16_t) cp);
+        }
+    }
+    return out;
+}
+
+std::string utf16_to_utf8(const char16_t * data, size_t len) {
+    std::string out;
+    out.reserve(len);
+    for (size_t i = 0; i < len; ++i) {
+        char32_t cp = data[i];
+        if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < len && data[i + 1] >= 0xDC00 && data[i + 1] <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (data[i + 1] - 0xDC00);
+            ++i;
+        } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+            cp = kReplacement;
+        }
+        append_utf8(out, cp);
+    }
+    return out;
+}
+
+}  // namespace maathai
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace maathai {
+
+// Re-assembles UTF-8 text from token pieces. A multibyte character can be
+// split across tokens (byte-fallback vocabularies do this for emoji and most
+// non-Latin scripts), so the trailing incomplete sequence of each chunk is
+// held back until the bytes that complete it arrive.
+class Utf8Assembler {
+public:
+    // Appends the complete part of (held-back bytes + data) to `out`.
+    void append(std::string & out, const char * data, size_t len);
+    // Appends whatever is still held back (end of stream) and resets.
+    void flush(std::string & out);
+    void reset() { pending_len_ = 0; }
+    size_t pending() const { return pending_len_; }
+
+private:
+    char pending_[4] = {};
+    size_t pending_len_ = 0;
+};
+
+// Standard UTF-8 <-> UTF-16 conversion for the JNI boundary, where
+// GetStringUTFChars/NewStringUTF would use "modified" UTF-8 and mangle
+// supplementary characters. Invalid input becomes U+FFFD.
+std::u16string utf8_to_utf16(const char * data, size_t len);
+std::string utf16_to_utf8(const char16_t * data, size_t len);
+
+}  // namespace maathai
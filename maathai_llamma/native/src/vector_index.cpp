@@ -0,0 +1,588 @@
+#include "vector_index.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "embed_batch.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace maathai {
+
+namespace {
+
+constexpr uint32_t kRecordDead = 1;
+constexpr uint64_t kInitialCapacity = 1024;
+// Below this many records per thread, starting the thread costs more than
+// the scan it takes over.
+constexpr uint64_t kSlotsPerThread = 8192;
+
+static_assert(sizeof(VectorIndexHeader) == 64, "header layout is part of the file format");
+static_assert(sizeof(VectorRecord) == 16, "record layout is part of the file format");
+
+uint32_t record_stride(uint32_t dim, VectorType type) {
+    const size_t payload = (size_t) dim * (type == VectorType::kI8 ? 1 : sizeof(float));
+    return (uint32_t) ((sizeof(VectorRecord) + payload + 15) / 16 * 16);
+}
+
+size_t file_bytes(uint64_t capacity, uint32_t stride) {
+    return sizeof(VectorIndexHeader) + (size_t) capacity * stride;
+}
+
+// Symmetric int8: q = round(v / scale) with scale = max|v| / 127.
+float quantize(const float * v, size_t n, int8_t * out) {
+    float amax = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        amax = std::max(amax, std::fabs(v[i]));
+    }
+    if (amax == 0.0f) {
+        std::memset(out, 0, n);
+        return 0.0f;
+    }
+    const float scale = amax / 127.0f;
+    const float inv = 1.0f / scale;
+    for (size_t i = 0; i < n; ++i) {
+        const long q = std::lrintf(v[i] * inv);
+        out[i] = (int8_t) std::min(127L, std::max(-127L, q));
+    }
+    return scale;
+}
+
+#if !defined(__ARM_NEON) && !defined(__SSE2__)
+
+float dot_f32_scalar(const float * a, const float * b, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+int32_t dot_i8_scalar(const int8_t * a, const int8_t * b, size_t n) {
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += (int32_t) a[i] * b[i];
+    }
+    return sum;
+}
+
+#elif defined(__ARM_NEON)
+
+float dot_f32_neon(const float * a, const float * b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+#if defined(__aarch64__)
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+#else
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+#endif
+    }
+    acc0 = vaddq_f32(acc0, acc1);
+#if defined(__aarch64__)
+    float sum = vaddvq_f32(acc0);
+#else
+    const float32x2_t pair = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+    float sum = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+int32_t dot_i8_neon(const int8_t * a, const int8_t * b, size_t n) {
+    int32x4_t acc = vdupq_n_s32(0);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const int8x16_t x = vld1q_s8(a + i);
+        const int8x16_t y = vld1q_s8(b + i);
+#if defined(__ARM_FEATURE_DOTPROD)
+        acc = vdotq_s32(acc, x, y);
+#else
+        // |q| <= 127, so each product fits in int16
+        acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(x), vget_low_s8(y)));
+        acc = vpadalq_s16(acc, vmull_s8(vget_high_s8(x), vget_high_s8(y)));
+#endif
+    }
+#if defined(__aarch64__)
+    int32_t sum = vaddvq_s32(acc);
+#else
+    const int32x2_t pair = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    int32_t sum = vget_lane_s32(vpadd_s32(pair, pair), 0);
+#endif
+    for (; i < n; ++i) {
+        sum += (int32_t) a[i] * b[i];
+    }
+    return sum;
+}
+
+#elif defined(__SSE2__)
+
+float dot_f32_sse2(const float * a, const float * b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    float sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+int32_t dot_i8_sse2(const int8_t * a, const int8_t * b, size_t n) {
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        // sign-extend to int16 by unpacking each byte into the high half
+        const __m128i x_lo = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+        const __m128i x_hi = _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8);
+        const __m128i y_lo = _mm_srai_epi16(_mm_unpacklo_epi8(y, y), 8);
+        const __m128i y_hi = _mm_srai_epi16(_mm_unpackhi_epi8(y, y), 8);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(x_lo, y_lo));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(x_hi, y_hi));
+    }
+    int32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), acc);
+    int32_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < n; ++i) {
+        sum += (int32_t) a[i] * b[i];
+    }
+    return sum;
+}
+
+#if defined(__GNUC__)
+#define MAATHAI_HAVE_AVX2 1
+
+__attribute__((target("avx2,fma")))
+float dot_f32_avx2(const float * a, const float * b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    const __m256 acc = _mm256_add_ps(acc0, acc1);
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1)));
+    float sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+__attribute__((target("avx2")))
+int32_t dot_i8_avx2(const int8_t * a, const int8_t * b, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        const __m256i x_lo = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(x));
+        const __m256i x_hi = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(x, 1));
+        const __m256i y_lo = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(y));
+        const __m256i y_hi = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(y, 1));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(x_lo, y_lo));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(x_hi, y_hi));
+    }
+    int32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes),
+                     _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)));
+    int32_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < n; ++i) {
+        sum += (int32_t) a[i] * b[i];
+    }
+    return sum;
+}
+#endif
+
+#endif
+
+struct Kernels {
+    float (*f32)(const float *, const float *, size_t);
+    int32_t (*i8)(const int8_t *, const int8_t *, size_t);
+    const char * name;
+};
+
+Kernels pick_kernels() {
+#if defined(__ARM_NEON)
+    return {dot_f32_neon, dot_i8_neon, "neon"};
+#elif defined(__SSE2__)
+#if defined(MAATHAI_HAVE_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return {dot_f32_avx2, dot_i8_avx2, "avx2"};
+    }
+#endif
+    return {dot_f32_sse2, dot_i8_sse2, "sse2"};
+#else
+    return {dot_f32_scalar, dot_i8_scalar, "scalar"};
+#endif
+}
+
+const Kernels & kernels() {
+    static const Kernels picked = pick_kernels();
+    return picked;
+}
+
+// Min-heap on score, so the weakest of the current top-k sits in front.
+bool weaker(const VectorHit & a, const VectorHit & b) {
+    return a.score > b.score;
+}
+
+void offer(VectorHit * heap, size_t & n_heap, size_t k, int64_t id, float score) {
+    if (n_heap < k) {
+        heap[n_heap++] = VectorHit{id, score};
+        std::push_heap(heap, heap + n_heap, weaker);
+    } else if (score > heap[0].score) {
+        std::pop_heap(heap, heap + n_heap, weaker);
+        heap[n_heap - 1] = VectorHit{id, score};
+        std::push_heap(heap, heap + n_heap, weaker);
+    }
+}
+
+}  // namespace
+
+const char * vector_type_name(VectorType type) {
+    return type == VectorType::kI8 ? "i8" : "f32";
+}
+
+float dot_f32(const float * a, const float * b, size_t n) {
+    return kernels().f32(a, b, n);
+}
+
+int32_t dot_i8(const int8_t * a, const int8_t * b, size_t n) {
+    return kernels().i8(a, b, n);
+}
+
+const char * vector_simd_name() {
+    return kernels().name;
+}
+
+VectorIndex::~VectorIndex() {
+    close();
+}
+
+bool VectorIndex::open(const std::string & path, uint32_t dim, VectorType type) {
+    close();
+    if (dim == 0 || (type != VectorType::kF32 && type != VectorType::kI8)) {
+        return false;
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    fd_ = fd;
+    dim_ = dim;
+    type_ = type;
+    stride_ = record_stride(dim, type);
+
+    if (st.st_size == 0) {
+        if (!map_locked(kInitialCapacity)) {
+            unmap_locked();
+            return false;
+        }
+        VectorIndexHeader header;
+        header.dim = dim;
+        header.type = (uint32_t) type;
+        header.stride = stride_;
+        header.capacity = kInitialCapacity;
+        *header_ = header;
+        return true;
+    }
+
+    VectorIndexHeader header;
+    const bool valid = (size_t) st.st_size >= sizeof(header) &&
+        pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header) &&
+        header.magic == kVectorIndexMagic && header.version == kVectorIndexVersion &&
+        header.dim == dim && header.type == (uint32_t) type && header.stride == stride_ &&
+        header.count <= header.capacity &&
+        (uint64_t) st.st_size >= file_bytes(header.capacity, stride_);
+    if (!valid || !map_locked(header.capacity)) {
+        unmap_locked();
+        return false;
+    }
+    // Later records win: a crash between writing a replacement and marking
+    // the old record dead (or in the middle of compact()) leaves both.
+    for (uint64_t slot = 0; slot < header_->count; ++slot) {
+        VectorRecord * rec = record(slot);
+        if ((rec->flags & kRecordDead) != 0) {
+            continue;
+        }
+        auto inserted = slots_.emplace(rec->id, slot);
+        if (!inserted.second) {
+            record(inserted.first->second)->flags |= kRecordDead;
+            inserted.first->second = slot;
+        }
+    }
+    header_->live = slots_.size();
+    return true;
+}
+
+void VectorIndex::close() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    unmap_locked();
+}
+
+bool VectorIndex::is_open() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return header_ != nullptr;
+}
+
+size_t VectorIndex::size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return header_ != nullptr ? (size_t) header_->live : 0;
+}
+
+size_t VectorIndex::slots() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return header_ != nullptr ? (size_t) header_->count : 0;
+}
+
+bool VectorIndex::map_locked(uint64_t capacity) {
+    const size_t bytes = file_bytes(capacity, stride_);
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        return false;
+    }
+    if ((size_t) st.st_size < bytes && ftruncate(fd_, (off_t) bytes) != 0) {
+        return false;
+    }
+    void * map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    map_ = static_cast<uint8_t *>(map);
+    map_bytes_ = bytes;
+    header_ = reinterpret_cast<VectorIndexHeader *>(map_);
+    return true;
+}
+
+void VectorIndex::unmap_locked() {
+    if (map_ != nullptr) {
+        munmap(map_, map_bytes_);
+        map_ = nullptr;
+        map_bytes_ = 0;
+        header_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    slots_.clear();
+}
+
+bool VectorIndex::reserve_locked(uint64_t capacity) {
+    const uint64_t current = header_->capacity;
+    if (capacity <= current) {
+        return true;
+    }
+    const uint64_t grown = std::max(capacity, current * 2);
+    munmap(map_, map_bytes_);
+    map_ = nullptr;
+    header_ = nullptr;
+    if (!map_locked(grown)) {
+        // keep serving the records we have
+        if (!map_locked(current)) {
+            unmap_locked();
+        }
+        return false;
+    }
+    header_->capacity = grown;
+    return true;
+}
+
+VectorRecord * VectorIndex::record(uint64_t slot) const {
+    return reinterpret_cast<VectorRecord *>(map_ + sizeof(VectorIndexHeader) + (size_t) slot * stride_);
+}
+
+bool VectorIndex::add(const int64_t * ids, const float * vectors, size_t n) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (header_ == nullptr || (n > 0 && (ids == nullptr || vectors == nullptr))) {
+        return false;
+    }
+    if (!reserve_locked(header_->count + n)) {
+        return false;
+    }
+    std::vector<float> unit(dim_);
+    for (size_t i = 0; i < n; ++i) {
+        std::memcpy(unit.data(), vectors + i * dim_, dim_ * sizeof(float));
+        l2_normalize(unit.data(), dim_);
+
+        const uint64_t slot = header_->count;
+        VectorRecord * rec = record(slot);
+        rec->id = ids[i];
+        rec->flags = 0;
+        auto * payload = reinterpret_cast<uint8_t *>(rec + 1);
+        if (type_ == VectorType::kI8) {
+            rec->scale = quantize(unit.data(), dim_, reinterpret_cast<int8_t *>(payload));
+        } else {
+            rec->scale = 1.0f;
+            std::memcpy(payload, unit.data(), dim_ * sizeof(float));
+        }
+        header_->count = slot + 1;
+
+        auto inserted = slots_.emplace(ids[i], slot);
+        if (!inserted.second) {
+            record(inserted.first->second)->flags |= kRecordDead;
+            inserted.first->second = slot;
+        }
+    }
+    header_->live = slots_.size();
+    return true;
+}
+
+size_t VectorIndex::remove(const int64_t * ids, size_t n) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (header_ == nullptr) {
+        return 0;
+    }
+    size_t removed = 0;
+    for (size_t i = 0; i < n; ++i) {
+        auto it = slots_.find(ids[i]);
+        if (it == slots_.end()) {
+            continue;
+        }
+        record(it->second)->flags |= kRecordDead;
+        slots_.erase(it);
+        ++removed;
+    }
+    header_->live = slots_.size();
+    return removed;
+}
+
+bool VectorIndex::contains(int64_t id) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return slots_.count(id) != 0;
+}
+
+bool VectorIndex::compact() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (header_ == nullptr) {
+        return false;
+    }
+    uint64_t kept = 0;
+    for (uint64_t slot = 0; slot < header_->count; ++slot) {
+        VectorRecord * rec = record(slot);
+        if ((rec->flags & kRecordDead) != 0) {
+            continue;
+        }
+        if (kept != slot) {
+            std::memmove(record(kept), rec, stride_);
+            slots_[rec->id] = kept;
+        }
+        ++kept;
+    }
+    header_->count = kept;
+    return true;
+}
+
+bool VectorIndex::flush() {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return map_ != nullptr && msync(map_, map_bytes_, MS_SYNC) == 0;
+}
+
+void VectorIndex::scan(const float * query, const int8_t * query_i8, float query_scale,
+                       uint64_t begin, uint64_t end, size_t k, VectorHit * heap, size_t & n_heap) const {
+    const Kernels & kernel = kernels();
+    for (uint64_t slot = begin; slot < end; ++slot) {
+        const VectorRecord * rec = record(slot);
+        if ((rec->flags & kRecordDead) != 0) {
+            continue;
+        }
+        const float score = type_ == VectorType::kI8
+            ? (float) kernel.i8(query_i8, reinterpret_cast<const int8_t *>(rec + 1), dim_) * rec->scale * query_scale
+            : kernel.f32(query, reinterpret_cast<const float *>(rec + 1), dim_);
+        offer(heap, n_heap, k, rec->id, score);
+    }
+}
+
+size_t VectorIndex::search(const float * query, size_t k, VectorHit * out, int n_threads) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    if (header_ == nullptr || query == nullptr || out == nullptr || k == 0) {
+        return 0;
+    }
+    std::vector<float> unit(query, query + dim_);
+    l2_normalize(unit.data(), dim_);
+    std::vector<int8_t> unit_i8;
+    float unit_scale = 0.0f;
+    if (type_ == VectorType::kI8) {
+        unit_i8.resize(dim_);
+        unit_scale = quantize(unit.data(), dim_, unit_i8.data());
+    }
+
+    const uint64_t count = header_->count;
+    const uint64_t wanted = n_threads > 0 ? (uint64_t) n_threads
+        : std::max(1u, std::thread::hardware_concurrency());
+    const size_t threads = (size_t) std::max<uint64_t>(1, std::min(wanted, count / kSlotsPerThread));
+    const uint64_t chunk = (count + threads - 1) / threads;
+
+    // One k-slot heap per thread, merged below.
+    std::vector<VectorHit> heaps(threads * k);
+    std::vector<size_t> filled(threads, 0);
+    auto run = [&](size_t t) {
+        const uint64_t begin = std::min(count, t * chunk);
+        const uint64_t end = std::min(count, begin + chunk);
+        scan(unit.data(), unit_i8.data(), unit_scale, begin, end, k, heaps.data() + t * k, filled[t]);
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (size_t t = 1; t < threads; ++t) {
+        workers.emplace_back(run, t);
+    }
+    run(0);
+    for (auto & worker : workers) {
+        worker.join();
+    }
+
+    size_t n = 0;
+    for (size_t t = 0; t < threads; ++t) {
+        for (size_t i = 0; i < filled[t]; ++i) {
+            heaps[n++] = heaps[t * k + i];
+        }
+    }
+    const size_t found = std::min(k, n);
+    std::partial_sort(heaps.begin(), heaps.begin() + (std::ptrdiff_t) found, heaps.begin() + (std::ptrdiff_t) n,
+                      [](const VectorHit & a, const VectorHit & b) {
+                          return a.score != b.score ? a.score > b.score : a.id < b.id;
+                      });
+    std::copy(heaps.begin(), heaps.begin() + (std::ptrdiff_t) found, out);
+    return found;
+}
+
+}  // namespace maathai
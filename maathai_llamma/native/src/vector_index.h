@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+namespace maathai {
+
+// Nearest-neighbour store for retrieval: unit vectors in a memory-mapped
+// file, scored by cosine similarity with an exhaustive SIMD scan. At the
+// sizes a phone holds (up to a few hundred thousand snippets) a flat scan
+// over int8 rows is both exact enough and faster than maintaining a graph.
+//
+// File layout (native endianness; indexes never leave the device):
+//   VectorIndexHeader                     (64 bytes)
+//   capacity x record, `stride` bytes each:
+//     VectorRecord                        (16 bytes)
+//     float[dim] or int8[dim]             (padded to a multiple of 16)
+//
+// Records are appended; remove() only marks them dead until compact().
+// `count` is bumped after a record is fully written, so a crash loses at
+// most the vector being added.
+constexpr uint32_t kVectorIndexMagic = 0x5849564Du; // "MVIX"
+constexpr uint32_t kVectorIndexVersion = 1;
+
+enum class VectorType : uint32_t {
+    kF32 = 0,
+    kI8 = 1, // symmetric per-vector scale; a quarter of the memory traffic
+};
+
+const char * vector_type_name(VectorType type);
+
+struct VectorIndexHeader {
+    uint32_t magic = kVectorIndexMagic;
+    uint32_t version = kVectorIndexVersion;
+    uint32_t dim = 0;
+    uint32_t type = 0;
+    uint64_t count = 0;    // records written, dead ones included
+    uint64_t capacity = 0; // records the file has room for
+    uint64_t live = 0;
+    uint32_t stride = 0;
+    uint32_t reserved = 0;
+    uint64_t reserved2[2] = {};
+};
+
+struct VectorRecord {
+    int64_t id;
+    float scale;    // int8 rows: value = q * scale
+    uint32_t flags; // kRecordDead
+};
+
+struct VectorHit {
+    int64_t id;
+    float score; // cosine similarity, higher is closer
+};
+
+// SIMD kernels, picked at compile time on ARM (NEON) and at run time on
+// x86 (AVX2 when the CPU has it, SSE2 otherwise).
+float dot_f32(const float * a, const float * b, size_t n);
+int32_t dot_i8(const int8_t * a, const int8_t * b, size_t n);
+const char * vector_simd_name();
+
+class VectorIndex {
+public:
+    VectorIndex() = default;
+    ~VectorIndex();
+
+    VectorIndex(const VectorIndex &) = delete;
+    VectorIndex & operator=(const VectorIndex &) = delete;
+
+    // Opens `path`, creating it when missing. An existing file must have
+    // been created with the same `dim` and `type`. Returns false on I/O
+    // errors, a foreign or corrupt file, or a mismatch.
+    bool open(const std::string & path, uint32_t dim, VectorType type);
+    void close();
+    bool is_open() const;
+
+    uint32_t dim() const { return dim_; }
+    VectorType type() const { return type_; }
+    size_t size() const;  // live vectors
+    size_t slots() const; // records in the file, dead ones included
+
+    // Stores `n` vectors of dim() floats under `ids`, normalized to unit
+    // length. An id that is already present is replaced.
+    bool add(const int64_t * ids, const float * vectors, size_t n);
+    bool add(int64_t id, const float * vector) { return add(&id, vector, 1); }
+    // Returns how many of `ids` were present.
+    size_t remove(const int64_t * ids, size_t n);
+    bool remove(int64_t id) { return remove(&id, 1) == 1; }
+    bool contains(int64_t id) const;
+    // Drops dead records so scans stop paying for them.
+    bool compact();
+    // Writes dirty pages back to the file.
+    bool flush();
+
+    // Writes the `k` best matches for `query` (dim() floats, need not be
+    // normalized) to `out`, best first, and returns how many were found.
+    // Collections of more than a few thousand vectors are split across up
+    // to `n_threads` threads (<= 0: one per core).
+    size_t search(const float * query, size_t k, VectorHit * out, int n_threads = 0) const;
+
+private:
+    bool map_locked(uint64_t capacity);
+    void unmap_locked();
+    bool reserve_locked(uint64_t capacity);
+    VectorRecord * record(uint64_t slot) const;
+    void scan(const float * query, const int8_t * query_i8, float query_scale,
+              uint64_t begin, uint64_t end, size_t k, VectorHit * heap, size_t & n_heap) const;
+
+    int fd_ = -1;
+    uint8_t * map_ = nullptr;
+    size_t map_bytes_ = 0;
+    VectorIndexHeader * header_ = nullptr;
+    uint32_t dim_ = 0;
+    VectorType type_ = VectorType::kF32;
+    uint32_t stride_ = 0;
+    std::unordered_map<int64_t, uint64_t> slots_; // live id -> slot
+    // Scans share it; add/remove/compact and remapping take it exclusively.
+    mutable std::shared_mutex mutex_;
+};
+
+}  // namespace maathai
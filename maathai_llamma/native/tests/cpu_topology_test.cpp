@@ -0,0 +1,147 @@
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cpu_topology.h"
+
+namespace {
+
+std::string g_dir;
+std::vector<std::string> g_created; // removed in reverse order
+
+void make_dir(const std::string & path) {
+    if (mkdir(path.c_str(), 0755) == 0) {
+        g_created.push_back(path);
+    }
+}
+
+void write_text(const std::string & path, const std::string & text) {
+    std::FILE * file = std::fopen(path.c_str(), "w");
+    assert(file != nullptr);
+    std::fputs(text.c_str(), file);
+    std::fclose(file);
+    g_created.push_back(path);
+}
+
+struct FakeCore {
+    long max_freq_khz; // 0: no cpufreq directory
+    int capacity;      // 0: no cpu_capacity file
+    const char * related;
+};
+
+// Lays out <root>/online and <root>/cpuN/{cpu_capacity,cpufreq/*} like sysfs.
+std::string make_tree(const char * name, const std::vector<FakeCore> & cores, bool with_online = true) {
+    const std::string root = g_dir + "/" + name;
+    make_dir(root);
+    if (with_online) {
+        write_text(root + "/online", "0-" + std::to_string(cores.size() - 1) + "\n");
+    }
+    for (size_t i = 0; i < cores.size(); ++i) {
+        const std::string cpu = root + "/cpu" + std::to_string(i);
+        make_dir(cpu);
+        if (cores[i].capacity > 0) {
+            write_text(cpu + "/cpu_capacity", std::to_string(cores[i].capacity) + "\n");
+        }
+        if (cores[i].max_freq_khz > 0) {
+            make_dir(cpu + "/cpufreq");
+            write_text(cpu + "/cpufreq/cpuinfo_max_freq", std::to_string(cores[i].max_freq_khz) + "\n");
+            write_text(cpu + "/cpufreq/related_cpus", std::string(cores[i].related) + "\n");
+        }
+    }
+    return root;
+}
+
+void test_parse_cpu_list() {
+    assert(maathai::parse_cpu_list("0-3,6\n") == std::vector<int>({0, 1, 2, 3, 6}));
+    assert(maathai::parse_cpu_list("7") == std::vector<int>({7}));
+    assert(maathai::parse_cpu_list("4-5,0-1") == std::vector<int>({0, 1, 4, 5}));
+    assert(maathai::parse_cpu_list("").empty());
+    assert(maathai::parse_cpu_list("3-1").empty());
+    assert(maathai::parse_cpu_list("0-x").empty());
+}
+
+// 4x little + 3x big + 1x prime, as on most 2022+ phone SoCs.
+void test_three_clusters_by_capacity() {
+    const std::string root = make_tree("tri", {
+        {1800000, 325, "0-3"}, {1800000, 325, "0-3"}, {1800000, 325, "0-3"}, {1800000, 325, "0-3"},
+        {2500000, 828, "4-6"}, {2500000, 828, "4-6"}, {2500000, 828, "4-6"},
+        {3200000, 1024, "7"},
+    });
+    const maathai::CpuTopology topology = maathai::read_cpu_topology(root);
+    assert(topology.cores.size() == 8);
+    assert(topology.heterogeneous());
+    assert(topology.clusters.size() == 3);
+    assert(topology.clusters[0] == std::vector<int>({7}));
+    assert(topology.clusters[1] == std::vector<int>({4, 5, 6}));
+    assert(topology.clusters[2] == std::vector<int>({0, 1, 2, 3}));
+    assert(topology.cores[7].cluster == 0 && topology.cores[0].cluster == 2);
+    assert(topology.performance_cores() == std::vector<int>({4, 5, 6, 7}));
+    assert(topology.fastest_cores(2) == std::vector<int>({7, 4}));
+    assert(topology.fastest_cores(20).size() == 8);
+}
+
+// Without cpu_capacity the ranking falls back to max frequency, and a DVFS
+// policy shared by cores of different speed is still split.
+void test_frequency_fallback_splits_shared_policy() {
+    const std::string root = make_tree("freq", {
+        {1400000, 0, "0-1"}, {1400000, 0, "0-1"},
+        {2200000, 0, "2-5"}, {2200000, 0, "2-5"}, {2000000, 0, "2-5"}, {2000000, 0, "2-5"},
+    }, false);
+    const maathai::CpuTopology topology = maathai::read_cpu_topology(root);
+    assert(topology.cores.size() == 6);
+    assert(topology.clusters.size() == 3);
+    assert(topology.clusters[0] == std::vector<int>({2, 3}));
+    assert(topology.clusters[1] == std::vector<int>({4, 5}));
+    assert(topology.performance_cores() == std::vector<int>({2, 3, 4, 5}));
+}
+
+void test_homogeneous_and_missing() {
+    const std::string root = make_tree("smp", {
+        {2000000, 1024, "0-3"}, {2000000, 1024, "0-3"}, {2000000, 1024, "0-3"}, {2000000, 1024, "0-3"},
+    });
+    const maathai::CpuTopology topology = maathai::read_cpu_topology(root);
+    assert(!topology.heterogeneous());
+    assert(topology.performance_cores() == std::vector<int>({0, 1, 2, 3}));
+
+    const maathai::CpuTopology missing = maathai::read_cpu_topology(g_dir + "/absent");
+    assert(missing.empty() && !missing.heterogeneous());
+    assert(missing.performance_cores().empty());
+}
+
+void test_pin_current_thread() {
+#if defined(__linux__)
+    const std::vector<int> original = maathai::current_thread_cpus();
+    assert(!original.empty());
+    assert(maathai::pin_current_thread({original.front()}));
+    assert(maathai::current_thread_cpus() == std::vector<int>({original.front()}));
+    assert(maathai::pin_current_thread(original));
+    assert(maathai::current_thread_cpus() == original);
+#endif
+    assert(!maathai::pin_current_thread({}));
+}
+
+}  // namespace
+
+int main() {
+    char tmpl[] = "/tmp/maathai_cpu_XXXXXX";
+    const char * dir = mkdtemp(tmpl);
+    assert(dir != nullptr);
+    g_dir = dir;
+
+    test_parse_cpu_list();
+    test_three_clusters_by_capacity();
+    test_frequency_fallback_splits_shared_policy();
+    test_homogeneous_and_missing();
+    test_pin_current_thread();
+
+    for (auto it = g_created.rbegin(); it != g_created.rend(); ++it) {
+        std::remove(it->c_str());
+    }
+    rmdir(dir);
+    std::puts("cpu_topology_test: ok");
+    return 0;
+}
@@ -0,0 +1,208 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "daemon_client.h"
+#include "daemon_wire.h"
+
+using maathai::DaemonClient;
+using maathai::DaemonFrame;
+using maathai::DaemonGenerate;
+using maathai::DaemonInfo;
+using maathai::DaemonMessage;
+using maathai::DaemonResult;
+using maathai::StreamFrame;
+
+namespace {
+
+void test_codecs() {
+    DaemonGenerate request;
+    request.messages = {{"system", "Be brief."}, {"user", "Habari? \xF0\x9F\x98\x80"}};
+    request.n_predict = 64;
+    request.logprobs = true;
+    request.priority = 2;
+    std::vector<uint8_t> body;
+    maathai::encode_daemon_generate(request, body);
+    DaemonGenerate back;
+    assert(maathai::decode_daemon_generate(body, back));
+    assert(back.messages.size() == 2 && back.messages[1].content == request.messages[1].content);
+    assert(back.n_predict == 64 && back.stream && back.logprobs && back.priority == 2);
+    body.pop_back();
+    assert(!maathai::decode_daemon_generate(body, back));
+    // a message count the body cannot hold is not trusted
+    std::vector<uint8_t> huge = {0, 0, 0, 0, 1, 1, 0xff, 0xff, 0xff, 0xff};
+    assert(!maathai::decode_daemon_generate(huge, back));
+
+    DaemonResult result;
+    result.ok = true;
+    result.cancelled = true;
+    result.generated_tokens = 12;
+    result.queue_ms = 1.5;
+    result.text = "jibu";
+    maathai::encode_daemon_result(result, body);
+    DaemonResult result_back;
+    assert(maathai::decode_daemon_result(body, result_back));
+    assert(result_back.ok && result_back.cancelled && result_back.generated_tokens == 12);
+    assert(result_back.queue_ms == 1.5 && result_back.text == "jibu");
+    body.push_back(0);
+    assert(!maathai::decode_daemon_result(body, result_back));
+
+    DaemonInfo info;
+    info.model = "/models/tiny.gguf";
+    info.sessions = 4;
+    info.requests = 1ull << 40;
+    maathai::encode_daemon_info(info, body);
+    DaemonInfo info_back;
+    assert(maathai::decode_daemon_info(body, info_back));
+    assert(info_back.model == info.model && info_back.sessions == 4 && info_back.requests == info.requests);
+}
+
+void test_framing() {
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    std::vector<uint8_t> body;
+    maathai::encode_daemon_string("busy", body);
+    assert(maathai::write_daemon_frame(fds[0], DaemonMessage::kError, 7, body));
+    assert(maathai::write_daemon_frame(fds[0], DaemonMessage::kCancel, 8, nullptr, 0));
+    DaemonFrame frame;
+    assert(maathai::read_daemon_frame(fds[1], frame));
+    assert(frame.type == DaemonMessage::kError && frame.request == 7 && frame.body == body);
+    assert(maathai::read_daemon_frame(fds[1], frame));
+    assert(frame.type == DaemonMessage::kCancel && frame.request == 8 && frame.body.empty());
+
+    // a length past the limit is refused before anything is allocated
+    const uint32_t length = maathai::kDaemonMaxFrameBytes + 1;
+    uint8_t header[maathai::kDaemonFrameHeaderBytes] = {};
+    std::memcpy(header, &length, 4);
+    assert(write(fds[0], header, sizeof(header)) == (ssize_t) sizeof(header));
+    assert(!maathai::read_daemon_frame(fds[1], frame));
+
+    close(fds[0]);
+    assert(!maathai::read_daemon_frame(fds[1], frame));
+    close(fds[1]);
+}
+
+void send_piece(int fd, uint32_t request, const std::string & text, int token) {
+    StreamFrame piece;
+    piece.text = text;
+    piece.tokens.resize(1);
+    piece.tokens[0].token = token;
+    std::vector<uint8_t> body(maathai::stream_frame_bytes(piece));
+    maathai::encode_stream_frame(piece, body.data(), body.size());
+    assert(maathai::write_daemon_frame(fd, DaemonMessage::kStream, request, body));
+}
+
+// Plays the daemon's side of one connection: streams two pieces per
+// generate, refuses an empty prompt, and for n_predict < 0 streams one piece
+// and waits for the client's cancel.
+void fake_daemon(int listen_fd) {
+    const int fd = accept(listen_fd, nullptr, nullptr);
+    assert(fd >= 0);
+    DaemonFrame frame;
+    std::vector<uint8_t> body;
+    while (maathai::read_daemon_frame(fd, frame)) {
+        if (frame.type == DaemonMessage::kInfo) {
+            DaemonInfo info;
+            info.model = "fake.gguf";
+            info.clients = 1;
+            maathai::encode_daemon_info(info, body);
+            maathai::write_daemon_frame(fd, DaemonMessage::kInfoReply, frame.request, body);
+            continue;
+        }
+        assert(frame.type == DaemonMessage::kGenerate);
+        DaemonGenerate request;
+        assert(maathai::decode_daemon_generate(frame.body, request));
+        if (request.messages.empty()) {
+            maathai::encode_daemon_string("no messages", body);
+            maathai::write_daemon_frame(fd, DaemonMessage::kError, frame.request, body);
+            continue;
+        }
+        DaemonResult result;
+        result.ok = true;
+        if (request.n_predict < 0) {
+            send_piece(fd, frame.request, "na", 1);
+            DaemonFrame cancel;
+            assert(maathai::read_daemon_frame(fd, cancel));
+            assert(cancel.type == DaemonMessage::kCancel && cancel.request == frame.request);
+            result.cancelled = true;
+            result.generated_tokens = 1;
+        } else {
+            // a stale frame from some earlier request is skipped
+            send_piece(fd, frame.request + 100, "??", 9);
+            send_piece(fd, frame.request, "Ja", 10);
+            send_piece(fd, frame.request, "mbo", 11);
+            result.generated_tokens = 2;
+        }
+        maathai::encode_daemon_result(result, body);
+        maathai::write_daemon_frame(fd, DaemonMessage::kDone, frame.request, body);
+    }
+    close(fd);
+}
+
+void test_client(const std::string & dir) {
+    const std::string path = dir + "/daemon.sock";
+    const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path.c_str());
+    assert(bind(listen_fd, (const sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(listen(listen_fd, 1) == 0);
+    std::thread server(fake_daemon, listen_fd);
+
+    DaemonClient client;
+    assert(!client.cancel());
+    assert(client.connect(path));
+
+    DaemonGenerate request;
+    request.messages = {{"user", "Sema jambo"}};
+    std::string streamed;
+    DaemonResult result;
+    assert(client.generate(request, result, [&](const StreamFrame & frame) { streamed += frame.text; }));
+    assert(streamed == "Jambo");
+    assert(result.ok && !result.cancelled && result.generated_tokens == 2);
+
+    DaemonInfo info;
+    assert(client.info(info));
+    assert(info.model == "fake.gguf" && info.clients == 1);
+
+    DaemonGenerate empty;
+    assert(!client.generate(empty, result));
+    assert(client.error() == "no messages");
+
+    // cancel from the frame callback, as a UI thread would mid-stream
+    request.n_predict = -1;
+    assert(client.generate(request, result, [&](const StreamFrame &) { assert(client.cancel()); }));
+    assert(result.cancelled && result.generated_tokens == 1);
+
+    client.close();
+    server.join();
+    close(listen_fd);
+    std::remove(path.c_str());
+
+    DaemonClient missing;
+    assert(!missing.connect(path));
+    assert(!missing.error().empty());
+}
+
+}  // namespace
+
+int main() {
+    char tmpl[] = "/tmp/maathai_daemon_XXXXXX";
+    const char * dir = mkdtemp(tmpl);
+    assert(dir != nullptr);
+
+    test_codecs();
+    test_framing();
+    test_client(dir);
+
+    rmdir(dir);
+    std::puts("daemon_wire_test: ok");
+    return 0;
+}
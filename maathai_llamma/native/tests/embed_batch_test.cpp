@@ -0,0 +1,71 @@
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "embed_batch.h"
+
+using maathai::EmbedBatch;
+using maathai::plan_embed_batches;
+
+namespace {
+
+void test_packs_short_texts_together() {
+    // 100 snippets of 12 tokens: 512 tokens hold 42 of them
+    const std::vector<int> lengths(100, 12);
+    const std::vector<EmbedBatch> batches = plan_embed_batches(lengths, 512, 64);
+    assert(batches.size() == 3);
+    assert(batches[0].first == 0 && batches[0].count == 42 && batches[0].n_tokens == 504);
+    assert(batches[1].first == 42 && batches[1].count == 42);
+    assert(batches[2].first == 84 && batches[2].count == 16);
+}
+
+void test_sequence_limit_closes_a_batch() {
+    const std::vector<int> lengths(10, 1);
+    const std::vector<EmbedBatch> batches = plan_embed_batches(lengths, 512, 4);
+    assert(batches.size() == 3);
+    assert(batches[0].count == 4 && batches[1].count == 4 && batches[2].count == 2);
+}
+
+void test_order_and_long_texts() {
+    // a text longer than the batch is clamped and gets a batch of its own
+    const std::vector<int> lengths = {10, 600, 5, 0, 7};
+    const std::vector<EmbedBatch> batches = plan_embed_batches(lengths, 512, 64);
+    assert(batches.size() == 3);
+    assert(batches[0].first == 0 && batches[0].count == 1);
+    assert(batches[1].first == 1 && batches[1].count == 1 && batches[1].n_tokens == 512);
+    assert(batches[2].first == 2 && batches[2].count == 3 && batches[2].n_tokens == 12);
+
+    size_t covered = 0;
+    for (const EmbedBatch & b : batches) {
+        assert(b.first == covered);
+        covered += b.count;
+    }
+    assert(covered == lengths.size());
+
+    assert(plan_embed_batches({}, 512, 64).empty());
+    assert(plan_embed_batches(lengths, 0, 64).empty());
+}
+
+void test_l2_normalize() {
+    std::vector<float> v = {3.0f, 4.0f};
+    maathai::l2_normalize(v.data(), v.size());
+    assert(std::fabs(v[0] - 0.6f) < 1e-6f && std::fabs(v[1] - 0.8f) < 1e-6f);
+
+    std::vector<float> zero(8, 0.0f);
+    maathai::l2_normalize(zero.data(), zero.size());
+    for (float x : zero) {
+        assert(x == 0.0f);
+    }
+}
+
+}  // namespace
+
+int main() {
+    test_packs_short_texts_together();
+    test_sequence_limit_closes_a_batch();
+    test_order_and_long_texts();
+    test_l2_normalize();
+    std::puts("embed_batch_test: ok");
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include <cassert>
+#include <cstdio>
+#include <limits>
+
+#include "lora_set.h"
+
+using maathai::LoraScale;
+using maathai::LoraSet;
+
+namespace {
+
+void test_normalize() {
+    LoraSet set = {{5, 0.5f}, {2, 1.0f}, {7, 0.0f}};
+    assert(maathai::normalize_lora_set(set));
+    // sorted by id, the zero-scale adapter gone
+    assert(set.size() == 2 && set[0] == (LoraScale{2, 1.0f}) && set[1] == (LoraScale{5, 0.5f}));
+
+    // the same weights compare equal whatever order they were given in
+    LoraSet other = {{5, 0.5f}, {2, 1.0f}};
+    assert(maathai::normalize_lora_set(other) && other == set);
+    other[1].scale = 0.25f;
+    assert(other != set);
+
+    LoraSet empty;
+    assert(maathai::normalize_lora_set(empty) && empty.empty());
+    LoraSet only_zero = {{1, 0.0f}};
+    assert(maathai::normalize_lora_set(only_zero) && only_zero.empty());
+
+    // negative scales subtract the adapter and are allowed
+    LoraSet negative = {{1, -1.0f}};
+    assert(maathai::normalize_lora_set(negative) && negative.size() == 1);
+}
+
+void test_rejects() {
+    const LoraSet bad[] = {
+        {{-1, 1.0f}},
+        {{1, 1.0f}, {1, 0.5f}},
+        {{1, 0.0f}, {1, 1.0f}}, // a duplicate behind a zero scale too
+        {{1, std::numeric_limits<float>::quiet_NaN()}},
+        {{1, std::numeric_limits<float>::infinity()}},
+    };
+    for (const LoraSet & entry : bad) {
+        LoraSet set = entry;
+        assert(!maathai::normalize_lora_set(set));
+        // left untouched
+        assert(set.size() == entry.size() && set[0].id == entry[0].id);
+    }
+}
+
+void test_format() {
+    assert(maathai::format_lora_set({}) == "none");
+    assert(maathai::format_lora_set({{3, 1.0f}, {5, 0.5f}}) == "3@1.00,5@0.50");
+}
+
+}  // namespace
+
+int main() {
+    test_normalize();
+    test_rejects();
+    test_format();
+    std::puts("lora_set_test: ok");
+    return 0;
+}
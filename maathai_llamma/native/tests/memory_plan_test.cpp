@@ -0,0 +1,213 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "memory_plan.h"
+
+using maathai::GgufModelInfo;
+using maathai::KvCacheType;
+
+namespace {
+
+std::string g_dir;
+
+// Minimal GGUF v3 writer for the header fields the estimator reads.
+class GgufWriter {
+public:
+    void str(const std::string & value) {
+        u64(value.size());
+        bytes_.insert(bytes_.end(), value.begin(), value.end());
+    }
+    void u32(uint32_t value) { raw(&value, sizeof(value)); }
+    void u64(uint64_t value) { raw(&value, sizeof(value)); }
+
+    void kv_u32(const std::string & key, uint32_t value) {
+        str(key);
+        u32(4);
+        u32(value);
+    }
+    void kv_str(const std::string & key, const std::string & value) {
+        str(key);
+        u32(8);
+        str(value);
+    }
+
+    void raw(const void * data, size_t len) {
+        const auto * p = static_cast<const unsigned char *>(data);
+        bytes_.insert(bytes_.end(), p, p + len);
+    }
+
+    size_t size() const { return bytes_.size(); }
+
+    void save(const std::string & path, size_t data_bytes) const {
+        std::FILE * file = std::fopen(path.c_str(), "wb");
+        assert(file != nullptr);
+        std::fwrite(bytes_.data(), 1, bytes_.size(), file);
+        // pad to the 32-byte alignment, then the "tensor data"
+        const size_t pad = (32 - bytes_.size() % 32) % 32;
+        const std::vector<unsigned char> zeros(pad + data_bytes, 0);
+        std::fwrite(zeros.data(), 1, zeros.size(), file);
+        std::fclose(file);
+    }
+
+private:
+    std::vector<unsigned char> bytes_;
+};
+
+// A small llama-shaped model: 4 layers, 8 heads of 64, GQA with 2 KV heads.
+std::string write_model(const char * name, size_t data_bytes) {
+    GgufWriter w;
+    w.u32(0x46554747u);
+    w.u32(3);
+    w.u64(2); // tensors
+    w.u64(9); // kv pairs
+    w.kv_str("general.architecture", "llama");
+    w.kv_str("general.name", "tiny");
+    w.kv_u32("llama.context_length", 8192);
+    w.kv_u32("llama.block_count", 4);
+    w.kv_u32("llama.embedding_length", 512);
+    w.kv_u32("llama.feed_forward_length", 1024);
+    w.kv_u32("llama.attention.head_count", 8);
+    // per-layer KV heads, as some architectures store them
+    w.str("llama.attention.head_count_kv");
+    w.u32(9);
+    w.u32(4);
+    w.u64(4);
+    for (uint32_t heads : {2u, 2u, 1u, 2u}) {
+        w.u32(heads);
+    }
+    w.str("tokenizer.ggml.tokens");
+    w.u32(9);
+    w.u32(8);
+    w.u64(3);
+    for (const char * token : {"<s>", "a", "b"}) {
+        w.str(token);
+    }
+    for (const char * tensor : {"token_embd.weight", "output.weight"}) {
+        w.str(tensor);
+        w.u32(2);
+        w.u64(512);
+        w.u64(3);
+        w.u32(0);
+        w.u64(0);
+    }
+    const std::string path = g_dir + "/" + name;
+    w.save(path, data_bytes);
+    return path;
+}
+
+void test_reads_header() {
+    const std::string path = write_model("tiny.gguf", 4096);
+    GgufModelInfo info;
+    assert(maathai::read_gguf_info(path, info));
+    assert(info.architecture == "llama");
+    assert(info.n_ctx_train == 8192);
+    assert(info.n_layer == 4 && info.n_embd == 512 && info.n_ff == 1024);
+    assert(info.n_head == 8 && info.n_head_kv == 2);
+    assert(info.n_embd_head_k == 64 && info.n_embd_head_v == 64);
+    assert(info.n_vocab == 3);
+    assert(info.n_params == 2 * 512 * 3);
+    assert(info.weights_bytes == 4096);
+    std::remove(path.c_str());
+}
+
+void test_rejects_other_files() {
+    GgufModelInfo info;
+    assert(!maathai::read_gguf_info(g_dir + "/absent.gguf", info));
+    const std::string path = g_dir + "/junk.gguf";
+    std::FILE * file = std::fopen(path.c_str(), "wb");
+    std::fputs("GGML not a gguf file at all", file);
+    std::fclose(file);
+    assert(!maathai::read_gguf_info(path, info));
+    std::remove(path.c_str());
+}
+
+GgufModelInfo make_info() {
+    GgufModelInfo info;
+    info.architecture = "llama";
+    info.weights_bytes = 700ull << 20;
+    info.n_ctx_train = 32768;
+    info.n_layer = 24;
+    info.n_embd = 2048;
+    info.n_ff = 5632;
+    info.n_head = 16;
+    info.n_head_kv = 4;
+    info.n_embd_head_k = info.n_embd_head_v = 128;
+    info.n_vocab = 32000;
+    return info;
+}
+
+void test_estimate_scales_with_context_and_kv_type() {
+    const GgufModelInfo info = make_info();
+    const auto f16 = maathai::estimate_memory(info, 4096, 64, 64, KvCacheType::kF16, KvCacheType::kF16, false);
+    // 24 layers x 4 heads x (128 + 128) x 2 bytes per cell
+    assert(f16.kv == 4096ull * 24 * 4 * 256 * 2);
+    assert(f16.weights == info.weights_bytes);
+    const auto f16_2x = maathai::estimate_memory(info, 8192, 64, 64, KvCacheType::kF16, KvCacheType::kF16, false);
+    assert(f16_2x.kv == 2 * f16.kv && f16_2x.compute > f16.compute);
+    const auto q8 = maathai::estimate_memory(info, 4096, 64, 64, KvCacheType::kQ8_0, KvCacheType::kQ8_0, false);
+    const auto q4 = maathai::estimate_memory(info, 4096, 64, 64, KvCacheType::kQ4_0, KvCacheType::kQ4_0, false);
+    assert(q4.kv < q8.kv && q8.kv < f16.kv);
+    assert(maathai::estimate_memory(info, 4096, 16, 16, KvCacheType::kF16, KvCacheType::kF16, false).compute < f16.compute);
+    // K and V are sized separately; flash attention drops the KQ scores
+    const auto mixed = maathai::estimate_memory(info, 4096, 64, 64, KvCacheType::kF16, KvCacheType::kQ8_0, false);
+    assert(mixed.kv < f16.kv && mixed.kv > q8.kv);
+    const auto fa = maathai::estimate_memory(info, 4096, 64, 64, KvCacheType::kF16, KvCacheType::kF16, true);
+    assert(fa.kv == f16.kv && fa.compute + 4ull * 64 * 4096 * 16 == f16.compute);
+}
+
+void test_plan_respects_budget() {
+    const GgufModelInfo info = make_info();
+    const uint64_t budget = 1200ull << 20;
+    const auto plan = maathai::plan_memory(info, budget, 0, 0, 0, KvCacheType::kF16, KvCacheType::kF16, false);
+    assert(plan.fits);
+    assert(plan.n_ctx > 0 && plan.n_ctx < info.n_ctx_train && plan.n_ctx % 256 == 0);
+    assert(plan.estimate.total() <= budget);
+    // one more step would not have fitted at any batch >= 16
+    assert(maathai::estimate_memory(info, plan.n_ctx + 256, 16, 16, KvCacheType::kF16, KvCacheType::kF16, false).total() > budget);
+
+    // a smaller cache type buys context
+    const auto q8 = maathai::plan_memory(info, budget, 0, 0, 0, KvCacheType::kQ8_0, KvCacheType::kQ8_0, false);
+    assert(q8.fits && q8.n_ctx > plan.n_ctx);
+
+    // plenty of memory: capped by the request, batch untouched
+    const auto roomy = maathai::plan_memory(info, 64ull << 30, 2048, 128, 0, KvCacheType::kF16, KvCacheType::kF16, false);
+    assert(roomy.fits && roomy.n_ctx == 2048 && roomy.n_batch == 128 && roomy.n_ubatch == 128);
+    const auto trained = maathai::plan_memory(info, 64ull << 30, 0, 0, 32, KvCacheType::kF16, KvCacheType::kF16, false);
+    assert(trained.n_ctx == info.n_ctx_train && trained.n_batch == maathai::kPlanDefaultBatch && trained.n_ubatch == 32);
+
+    // the weights alone exceed the budget
+    const auto none = maathai::plan_memory(info, 600ull << 20, 0, 0, 0, KvCacheType::kF16, KvCacheType::kF16, false);
+    assert(!none.fits && none.estimate.total() > (600ull << 20));
+}
+
+void test_kv_type_names() {
+    KvCacheType type = KvCacheType::kF16;
+    assert(maathai::parse_kv_cache_type("q8_0", type) && type == KvCacheType::kQ8_0);
+    assert(maathai::parse_kv_cache_type("q4_0", type) && type == KvCacheType::kQ4_0);
+    assert(!maathai::parse_kv_cache_type("q5_1", type) && type == KvCacheType::kQ4_0);
+    assert(std::string(maathai::kv_cache_type_name(KvCacheType::kF16)) == "f16");
+}
+
+}  // namespace
+
+int main() {
+    char tmpl[] = "/tmp/maathai_mem_XXXXXX";
+    const char * dir = mkdtemp(tmpl);
+    assert(dir != nullptr);
+    g_dir = dir;
+
+    test_reads_header();
+    test_rejects_other_files();
+    test_estimate_scales_with_context_and_kv_type();
+    test_plan_respects_budget();
+    test_kv_type_names();
+
+    rmdir(dir);
+    std::puts("memory_plan_test: ok");
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include <unistd.h>
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "metrics.h"
+
+using maathai::PhaseMetrics;
+using maathai::PhaseStat;
+using maathai::TraceRecorder;
+
+namespace {
+
+bool near(double actual, double expected, double rel) {
+    return std::fabs(actual - expected) <= rel * expected;
+}
+
+void test_phase_stat() {
+    PhaseStat stat;
+    assert(stat.percentile_us(0.5) == 0.0 && stat.mean_us() == 0.0);
+    for (int i = 1; i <= 1000; ++i) {
+        stat.add((double) i);
+    }
+    assert(stat.count == 1000);
+    assert(near(stat.mean_us(), 500.5, 1e-9));
+    assert(stat.max_us == 1000.0);
+    // bucket edges are within 1/4 octave of the true value
+    assert(near(stat.percentile_us(0.50), 500.0, 0.13));
+    assert(near(stat.percentile_us(0.95), 950.0, 0.13));
+    assert(stat.percentile_us(1.0) == 1000.0);
+    assert(stat.percentile_us(0.0) <= 1.25);
+
+    // sub-microsecond, negative and huge values all land somewhere
+    PhaseStat edges;
+    edges.add(0.25);
+    edges.add(-3.0);
+    edges.add(1e12);
+    assert(edges.count == 3 && edges.max_us == 1e12);
+    assert(edges.percentile_us(0.5) <= 1.0);
+    assert(edges.percentile_us(1.0) == 1e12);
+}
+
+void test_merge() {
+    PhaseMetrics a;
+    PhaseMetrics b;
+    a[maathai::kPhaseDecode].add(10.0);
+    b[maathai::kPhaseDecode].add(30.0);
+    b[maathai::kPhaseSample].add(2.0);
+    a.merge(b);
+    assert(a[maathai::kPhaseDecode].count == 2);
+    assert(a[maathai::kPhaseDecode].total_us == 40.0 && a[maathai::kPhaseDecode].max_us == 30.0);
+    assert(a[maathai::kPhaseSample].count == 1);
+    a.clear();
+    assert(a[maathai::kPhaseDecode].count == 0);
+    for (int phase = 0; phase < maathai::kMetricPhaseCount; ++phase) {
+        assert(std::string(maathai::metric_phase_name(phase)) != "unknown");
+    }
+}
+
+size_t count_of(const std::string & haystack, const std::string & needle) {
+    size_t n = 0;
+    for (size_t at = haystack.find(needle); at != std::string::npos; at = haystack.find(needle, at + 1)) {
+        ++n;
+    }
+    return n;
+}
+
+void test_trace() {
+    using Clock = TraceRecorder::Clock;
+    TraceRecorder trace;
+    const auto t0 = Clock::now();
+    trace.record("ignored", 0, t0, t0);
+    assert(trace.size() == 0);
+
+    trace.start(4);
+    trace.name_lane(0, "scheduler \"main\"");
+    const auto base = Clock::now();
+    for (int i = 0; i < 6; ++i) {
+        const auto begin = base + std::chrono::microseconds(100 * i);
+        trace.record(i % 2 == 0 ? "decode" : "sample", 1, begin, begin + std::chrono::microseconds(40), i);
+    }
+    assert(trace.size() == 4 && trace.dropped() == 2);
+    const std::string json = trace.to_json();
+    assert(json.rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 0) == 0);
+    assert(count_of(json, "\"ph\":\"X\"") == 4);
+    assert(count_of(json, "\"ph\":\"M\"") == 1);
+    assert(json.find("scheduler \\\"main\\\"") != std::string::npos);
+    // the two oldest were overwritten; the rest come out in order
+    assert(json.find("\"n\":1}") == std::string::npos);
+    assert(json.find("\"n\":2}") < json.find("\"n\":5}"));
+    assert(json.find("\"dur\":40") != std::string::npos);
+
+    trace.stop();
+    trace.record("late", 1, base, base);
+    assert(trace.size() == 4);
+
+    const std::string path = "/tmp/maathai_metrics_test_" + std::to_string(getpid()) + ".json";
+    assert(trace.write_json(path));
+    std::ifstream in(path);
+    std::stringstream read;
+    read << in.rdbuf();
+    assert(read.str() == json);
+    std::remove(path.c_str());
+    assert(!trace.write_json("/nonexistent-dir/trace.json"));
+}
+
+}  // namespace
+
+int main() {
+    test_phase_stat();
+    test_merge();
+    test_trace();
+    std::puts("metrics_test: ok");
+    return 0;
+}
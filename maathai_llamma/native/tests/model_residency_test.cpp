@@ -0,0 +1,119 @@
+#include <cassert>
+#include <cstdio>
+#include <vector>
+
+#include "model_residency.h"
+
+using maathai::ModelResidency;
+using maathai::ResidencyAction;
+using maathai::ResidencyActionKind;
+using maathai::ResidencyStats;
+
+namespace {
+
+constexpr uint64_t kMiB = 1ull << 20;
+
+void test_lookup_and_stats() {
+    ModelResidency residency(1000 * kMiB);
+    assert(residency.find("small.gguf|ctx=2048") == -1);
+    residency.add(1, "small.gguf|ctx=2048", 300 * kMiB, 100 * kMiB);
+    residency.add(2, "large.gguf|ctx=4096", 400 * kMiB, 150 * kMiB);
+    assert(residency.find("small.gguf|ctx=2048") == 1);
+    assert(residency.find("small.gguf|ctx=4096") == -1); // other settings, other engine
+
+    // the hit made 1 the most recent
+    const std::vector<maathai::ResidentModel> models = residency.models();
+    assert(models.size() == 2 && models[0].handle == 1 && models[1].handle == 2);
+
+    const ResidencyStats stats = residency.stats();
+    assert(stats.hits == 1 && stats.misses == 2);
+    assert(stats.resident_bytes == 950 * kMiB && stats.models == 2 && stats.contexts == 2);
+
+    // fits: nothing to do
+    std::vector<ResidencyAction> actions;
+    assert(residency.plan(50 * kMiB, {}, actions));
+    assert(actions.empty());
+
+    // no budget: never plans anything
+    ModelResidency unlimited;
+    unlimited.add(1, "a", 1ull << 40, 0);
+    assert(unlimited.plan(1ull << 40, {}, actions) && actions.empty());
+}
+
+void test_contexts_before_weights() {
+    ModelResidency residency(100 * kMiB);
+    residency.add(1, "a", 30 * kMiB, 10 * kMiB); // least recent
+    residency.add(2, "b", 30 * kMiB, 10 * kMiB);
+    residency.add(3, "c", 10 * kMiB, 5 * kMiB);  // active
+    assert(residency.resident_bytes() == 95 * kMiB);
+
+    // 12 MiB over: both idle contexts go, oldest first, weights stay
+    std::vector<ResidencyAction> actions;
+    assert(residency.plan(17 * kMiB, {3}, actions));
+    assert(actions.size() == 2);
+    assert(actions[0].kind == ResidencyActionKind::kFreeContext && actions[0].handle == 1);
+    assert(actions[1].kind == ResidencyActionKind::kFreeContext && actions[1].handle == 2);
+
+    // 5 MiB over: only the oldest context
+    assert(residency.plan(10 * kMiB, {3}, actions));
+    assert(actions.size() == 1 && actions[0].handle == 1 && actions[0].bytes == 10 * kMiB);
+
+    // using a model moves it to the back of the line
+    residency.touch(1);
+    assert(residency.plan(10 * kMiB, {3}, actions));
+    assert(actions.size() == 1 && actions[0].handle == 2);
+
+    residency.context_freed(2);
+    residency.context_freed(2); // counted once
+    assert(residency.resident_bytes() == 85 * kMiB);
+    assert(residency.stats().context_frees == 1 && residency.stats().contexts == 2);
+    residency.context_restored(2);
+    assert(residency.stats().context_restores == 1 && residency.resident_bytes() == 95 * kMiB);
+}
+
+void test_evicts_least_recent_weights() {
+    ModelResidency residency(100 * kMiB);
+    residency.add(1, "a", 30 * kMiB, 10 * kMiB);
+    residency.add(2, "b", 30 * kMiB, 10 * kMiB);
+    residency.add(3, "c", 10 * kMiB, 5 * kMiB);
+
+    // 35 MiB over: contexts give 20, so model 1 goes whole, and its 40 MiB
+    // alone cover it; model 2 keeps its context
+    std::vector<ResidencyAction> actions;
+    assert(residency.plan(40 * kMiB, {3}, actions));
+    assert(actions.size() == 1);
+    assert(actions[0].kind == ResidencyActionKind::kEvict && actions[0].handle == 1);
+    assert(actions[0].bytes == 40 * kMiB);
+
+    // 45 MiB over: the eviction is not enough, model 2's context still goes
+    assert(residency.plan(50 * kMiB, {3}, actions));
+    assert(actions.size() == 2);
+    assert(actions[0].kind == ResidencyActionKind::kFreeContext && actions[0].handle == 2);
+    assert(actions[1].kind == ResidencyActionKind::kEvict && actions[1].handle == 1);
+
+    // a pinned model is never touched, even when that means not fitting
+    assert(residency.set_pinned(1, true));
+    assert(!residency.set_pinned(9, true));
+    assert(!residency.plan(80 * kMiB, {3}, actions));
+    for (const ResidencyAction & action : actions) {
+        assert(action.handle == 2);
+    }
+    assert(actions.back().kind == ResidencyActionKind::kEvict);
+
+    residency.evicted(2);
+    residency.remove(3); // unloaded on request: not an eviction
+    const ResidencyStats stats = residency.stats();
+    assert(stats.evictions == 1 && stats.models == 1);
+    assert(residency.model(1) != nullptr && residency.model(1)->pinned);
+    assert(residency.model(2) == nullptr);
+}
+
+}  // namespace
+
+int main() {
+    test_lookup_and_stats();
+    test_contexts_before_weights();
+    test_evicts_least_recent_weights();
+    std::puts("model_residency_test: ok");
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "page_cache.h"
+
+using maathai::PrefaultResult;
+using maathai::ProgressGate;
+
+namespace {
+
+void test_progress_gate() {
+    ProgressGate gate(1000, 10);
+    assert(!gate.due(0));
+    assert(!gate.due(99));
+    assert(gate.due(100));
+    assert(!gate.due(150));
+    // a jump past several steps reports once
+    assert(gate.due(570));
+    assert(!gate.due(599));
+    assert(gate.due(600));
+    assert(gate.due(1000));
+    assert(!gate.due(1000));
+
+    ProgressGate empty(0);
+    assert(empty.due(0));
+    assert(!empty.due(0));
+
+    // more steps than bytes still moves forward
+    ProgressGate tiny(3, 100);
+    assert(tiny.due(1) && tiny.due(2) && tiny.due(3));
+}
+
+std::string write_file(size_t size) {
+    const std::string path = "/tmp/maathai_page_cache_test_" + std::to_string(getpid()) + ".bin";
+    std::FILE * file = std::fopen(path.c_str(), "wb");
+    assert(file != nullptr);
+    std::vector<unsigned char> data(size);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = (unsigned char) (i * 31u);
+    }
+    assert(std::fwrite(data.data(), 1, size, file) == size);
+    std::fclose(file);
+    return path;
+}
+
+void test_prefault() {
+    // a few read chunks plus a partial page
+    const size_t size = (9u << 20) + 123;
+    const std::string path = write_file(size);
+    assert(maathai::file_size_bytes(path) == size);
+
+    std::vector<uint64_t> seen;
+    PrefaultResult result;
+    const bool ok = maathai::prefault_file(path, [&](uint64_t done, uint64_t total) {
+        assert(total == size);
+        seen.push_back(done);
+        return true;
+    }, &result);
+    assert(ok && !result.cancelled && result.bytes == size && result.ms >= 0.0);
+    assert(!seen.empty() && seen.size() <= 101 && seen.back() == size);
+    for (size_t i = 1; i < seen.size(); ++i) {
+        assert(seen[i] > seen[i - 1]);
+    }
+    // just read, so every page is cached
+    assert(maathai::page_cache_residency(path) == 1.0);
+
+    size_t calls = 0;
+    assert(!maathai::prefault_file(path, [&](uint64_t, uint64_t) { return ++calls < 2; }, &result));
+    assert(result.cancelled && calls == 2 && result.bytes < size);
+
+    assert(maathai::prefault_file(path));
+    maathai::evict_file_pages(path); // best effort; tmpfs keeps the pages
+    const double residency = maathai::page_cache_residency(path);
+    assert(residency >= 0.0 && residency <= 1.0);
+    std::remove(path.c_str());
+}
+
+void test_missing() {
+    const std::string path = "/nonexistent-dir/model.gguf";
+    PrefaultResult result;
+    assert(!maathai::prefault_file(path, {}, &result));
+    assert(!result.cancelled && result.bytes == 0);
+    assert(maathai::page_cache_residency(path) < 0.0);
+    assert(!maathai::evict_file_pages(path));
+    assert(maathai::file_size_bytes(path) == 0);
+}
+
+}  // namespace
+
+int main() {
+    test_progress_gate();
+    test_prefault();
+    test_missing();
+    std::puts("page_cache_test: ok");
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+
+#include "preempt.h"
+
+using maathai::PreemptGate;
+using maathai::RequestPriority;
+
+namespace {
+
+void test_names() {
+    RequestPriority priority = RequestPriority::kNormal;
+    for (const auto level : {RequestPriority::kBackground, RequestPriority::kNormal, RequestPriority::kInteractive}) {
+        assert(maathai::parse_request_priority(maathai::request_priority_name(level), priority));
+        assert(priority == level);
+    }
+    assert(std::strcmp(maathai::request_priority_name(RequestPriority::kInteractive), "interactive") == 0);
+    assert(!maathai::parse_request_priority("urgent", priority));
+    assert(!maathai::parse_request_priority(nullptr, priority));
+    assert(priority == RequestPriority::kInteractive);
+}
+
+void test_outranked() {
+    PreemptGate gate;
+    // nothing decoding, nothing waiting
+    assert(!gate.outranked());
+    assert(!gate.waiting_above(RequestPriority::kBackground));
+
+    gate.begin_batch(RequestPriority::kBackground);
+    {
+        // an equal priority waits its turn
+        PreemptGate::Waiter same(gate, RequestPriority::kBackground);
+        assert(!gate.outranked());
+        {
+            PreemptGate::Waiter above(gate, RequestPriority::kNormal);
+            assert(gate.outranked());
+            assert(gate.waiting_above(RequestPriority::kBackground));
+            assert(!gate.waiting_above(RequestPriority::kNormal));
+        }
+        assert(!gate.outranked());
+    }
+
+    gate.begin_batch(RequestPriority::kNormal);
+    PreemptGate::Waiter interactive(gate, RequestPriority::kInteractive);
+    assert(gate.outranked());
+    // between batches there is nothing to abort
+    gate.end_batch();
+    assert(!gate.outranked());
+    assert(gate.waiting_above(RequestPriority::kNormal));
+
+    // released once queued, and only once
+    interactive.release();
+    interactive.release();
+    gate.begin_batch(RequestPriority::kBackground);
+    assert(!gate.outranked());
+    assert(!gate.waiting_above(RequestPriority::kBackground));
+}
+
+}  // namespace
+
+int main() {
+    test_names();
+    test_outranked();
+    std::puts("preempt_test: ok");
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "prefix_snapshot.h"
+
+using maathai::SnapshotCheck;
+using maathai::SnapshotHeader;
+
+namespace {
+
+std::string g_dir;
+
+std::string path_for(const SnapshotHeader & key) {
+    return g_dir + "/" + maathai::snapshot_file_name(key);
+}
+
+SnapshotHeader make_key(const std::vector<int32_t> & tokens) {
+    SnapshotHeader key;
+    key.model_fingerprint = 0x1234;
+    key.params_hash = 0x5678;
+    key.tokens_hash = maathai::hash_tokens(tokens.data(), tokens.size());
+    key.n_tokens = (uint32_t) tokens.size();
+    return key;
+}
+
+void test_round_trip() {
+    const std::vector<int32_t> tokens = {1, 15043, 29892, 920};
+    const std::vector<uint8_t> state = {9, 8, 7, 6, 5};
+    const SnapshotHeader key = make_key(tokens);
+    const std::string path = path_for(key);
+    assert(maathai::write_snapshot(path, key, tokens, state));
+
+    std::vector<uint8_t> loaded;
+    assert(maathai::read_snapshot(path, key, tokens, loaded) == SnapshotCheck::kOk);
+    assert(loaded == state);
+    std::remove(path.c_str());
+}
+
+void test_mismatches_are_reported() {
+    const std::vector<int32_t> tokens = {1, 2, 3};
+    const SnapshotHeader key = make_key(tokens);
+    const std::string path = path_for(key);
+    assert(maathai::write_snapshot(path, key, tokens, {1, 2, 3, 4}));
+
+    std::vector<uint8_t> loaded;
+    SnapshotHeader other = key;
+    other.model_fingerprint = 0x9999;
+    assert(maathai::read_snapshot(path, other, tokens, loaded) == SnapshotCheck::kModelMismatch);
+
+    other = key;
+    other.params_hash = 0x9999;
+    assert(maathai::read_snapshot(path, other, tokens, loaded) == SnapshotCheck::kParamsMismatch);
+
+    // same hash and length, different tokens
+    const std::vector<int32_t> different = {1, 2, 4};
+    assert(maathai::read_snapshot(path, key, different, loaded) == SnapshotCheck::kPrefixMismatch);
+
+    assert(maathai::read_snapshot(path + ".absent", key, tokens, loaded) == SnapshotCheck::kMissing);
+    std::remove(path.c_str());
+}
+
+void test_version_and_truncation_are_rejected() {
+    const std::vector<int32_t> tokens = {4, 5};
+    const SnapshotHeader key = make_key(tokens);
+    const std::string path = path_for(key);
+    assert(maathai::write_snapshot(path, key, tokens, std::vector<uint8_t>(64, 0xAB)));
+
+    // drop the tail of the state: the size no longer matches the header
+    assert(truncate(path.c_str(), (off_t) (sizeof(SnapshotHeader) + 2 * sizeof(int32_t) + 10)) == 0);
+    std::vector<uint8_t> loaded;
+    assert(maathai::read_snapshot(path, key, tokens, loaded) == SnapshotCheck::kCorrupt);
+
+    // bump the on-disk version
+    std::FILE * file = std::fopen(path.c_str(), "r+b");
+    assert(file != nullptr);
+    const uint32_t future = maathai::kSnapshotVersion + 1;
+    std::fseek(file, (long) sizeof(uint32_t), SEEK_SET);
+    std::fwrite(&future, sizeof(future), 1, file);
+    std::fclose(file);
+    assert(maathai::read_snapshot(path, key, tokens, loaded) == SnapshotCheck::kVersionMismatch);
+    std::remove(path.c_str());
+}
+
+void test_file_name_depends_on_every_key_field() {
+    const std::vector<int32_t> tokens = {7};
+    const SnapshotHeader key = make_key(tokens);
+    SnapshotHeader other = key;
+    other.params_hash += 1;
+    assert(maathai::snapshot_file_name(key) != maathai::snapshot_file_name(other));
+    other = key;
+    other.model_fingerprint += 1;
+    assert(maathai::snapshot_file_name(key) != maathai::snapshot_file_name(other));
+}
+
+void test_file_fingerprint() {
+    const std::string path = g_dir + "/model.bin";
+    std::FILE * file = std::fopen(path.c_str(), "wb");
+    assert(file != nullptr);
+    std::fputs("GGUF fake model", file);
+    std::fclose(file);
+    const uint64_t first = maathai::file_fingerprint(path);
+    assert(first != 0);
+    assert(maathai::file_fingerprint(path) == first);
+
+    file = std::fopen(path.c_str(), "ab");
+    std::fputc('!', file);
+    std::fclose(file);
+    assert(maathai::file_fingerprint(path) != first);
+    assert(maathai::file_fingerprint(g_dir + "/missing.bin") == 0);
+    std::remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    char tmpl[] = "/tmp/maathai_snapshot_XXXXXX";
+    const char * dir = mkdtemp(tmpl);
+    assert(dir != nullptr);
+    g_dir = dir;
+
+    test_round_trip();
+    test_mismatches_are_reported();
+    test_version_and_truncation_are_rejected();
+    test_file_name_depends_on_every_key_field();
+    test_file_fingerprint();
+
+    rmdir(dir);
+    std::puts("prefix_snapshot_test: ok");
+    return 0;
+}
@@ -0,0 +1,206 @@
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "sampler.h"
+
+namespace {
+
+maathai::SamplerConfig greedy_config() {
+    maathai::SamplerConfig config;
+    config.temperature = 0.0f;
+    return config;
+}
+
+// Logits with a clear ranking: token i scores n - i.
+std::vector<float> ranked_logits(int n) {
+    std::vector<float> logits((size_t) n);
+    for (int i = 0; i < n; ++i) {
+        logits[(size_t) i] = (float) (n - i);
+    }
+    return logits;
+}
+
+void test_greedy_and_top_k() {
+    std::vector<float> logits = ranked_logits(1000);
+    logits[517] = 5000.0f;
+    maathai::TokenSampler sampler;
+    sampler.reserve(1000);
+    sampler.set_config(greedy_config());
+    assert(sampler.sample(logits.data(), 1000) == 517);
+
+    maathai::SamplerConfig config;
+    config.top_k = 1;
+    config.temperature = 1.5f;
+    sampler.set_config(config);
+    for (int i = 0; i < 50; ++i) {
+        assert(sampler.sample(logits.data(), 1000) == 517);
+    }
+}
+
+// The penalties run before the token is drawn, so a repeated token loses
+// to the runner-up.
+void test_penalties_change_the_choice() {
+    std::vector<float> logits = {2.0f, 1.9f, 0.5f, -1.0f};
+    maathai::SamplerConfig config = greedy_config();
+    config.repeat_penalty = 1.5f;
+    config.repeat_last_n = 2;
+    maathai::TokenSampler sampler;
+    sampler.reserve(4);
+    sampler.set_config(config);
+    assert(sampler.sample(logits.data(), 4) == 0);
+    assert(sampler.sample(logits.data(), 4) == 1);
+    // both penalized now: 2.0 / 1.5 > 1.9 / 1.5
+    assert(sampler.sample(logits.data(), 4) == 0);
+
+    // swapping parameters in place keeps the window ...
+    config.presence_penalty = 10.0f;
+    sampler.set_config(config);
+    assert(sampler.sample(logits.data(), 4) == 2);
+    // ... and reset() forgets it
+    sampler.reset();
+    assert(sampler.sample(logits.data(), 4) == 0);
+
+    // frequency counts every occurrence in the window
+    maathai::SamplerConfig frequency = greedy_config();
+    frequency.frequency_penalty = 0.3f;
+    frequency.repeat_last_n = 8;
+    sampler.set_config(frequency);
+    assert(sampler.sample(logits.data(), 4) == 0); // 2.0
+    assert(sampler.sample(logits.data(), 4) == 1); // 1.7 < 1.9
+    assert(sampler.sample(logits.data(), 4) == 0); // 1.7 > 1.6
+}
+
+void test_truncation_filters() {
+    // one dominant token: top-p and min-p leave nothing else to draw
+    std::vector<float> logits = ranked_logits(200);
+    logits[42] = 1000.0f;
+    maathai::SamplerConfig config;
+    config.top_k = 0;
+    config.top_p = 0.9f;
+    config.temperature = 1.0f;
+    maathai::TokenSampler sampler(7);
+    sampler.reserve(200);
+    sampler.set_config(config);
+    for (int i = 0; i < 100; ++i) {
+        assert(sampler.sample(logits.data(), 200) == 42);
+    }
+
+    config.top_p = 1.0f;
+    config.min_p = 0.5f;
+    sampler.set_config(config);
+    for (int i = 0; i < 100; ++i) {
+        assert(sampler.sample(logits.data(), 200) == 42);
+    }
+
+    // min_keep wins over the filters
+    std::vector<float> flat = {1.0f, 0.0f, 0.0f, 0.0f};
+    config.min_p = 0.9f;
+    config.min_keep = 2;
+    sampler.set_config(config);
+    bool saw_other = false;
+    for (int i = 0; i < 2000 && !saw_other; ++i) {
+        saw_other = sampler.sample(flat.data(), 4) != 0;
+    }
+    assert(saw_other);
+
+    // top-n-sigma and typical keep the draw among the strongest tokens
+    maathai::SamplerConfig sigma;
+    sigma.top_k = 0;
+    sigma.top_p = -1.0f;
+    sigma.top_n_sigma = 1.0f;
+    sigma.typical_p = 0.9f;
+    sampler.set_config(sigma);
+    std::vector<float> spread = ranked_logits(100);
+    for (int i = 0; i < 200; ++i) {
+        assert(sampler.sample(spread.data(), 100) < 50);
+    }
+}
+
+void test_draw_follows_the_distribution() {
+    // p(0) = 0.75, p(1) = 0.25
+    std::vector<float> logits = {std::log(3.0f), 0.0f};
+    maathai::SamplerConfig config;
+    config.top_k = 0;
+    config.top_p = -1.0f;
+    config.temperature = 1.0f;
+    maathai::TokenSampler sampler(11);
+    sampler.reserve(2);
+    sampler.set_config(config);
+    int zeros = 0;
+    const int n = 20000;
+    for (int i = 0; i < n; ++i) {
+        zeros += sampler.sample(logits.data(), 2) == 0;
+    }
+    assert(std::fabs((double) zeros / n - 0.75) < 0.02);
+
+    // a lower temperature sharpens it
+    config.temperature = 0.25f;
+    sampler.set_config(config);
+    zeros = 0;
+    for (int i = 0; i < n; ++i) {
+        zeros += sampler.sample(logits.data(), 2) == 0;
+    }
+    assert((double) zeros / n > 0.95);
+}
+
+void test_mirostat() {
+    std::vector<float> logits = ranked_logits(5000);
+    for (const int type : {1, 2}) {
+        maathai::SamplerConfig config;
+        config.mirostat_type = type;
+        config.mirostat_tau = 3.0f;
+        config.temperature = 1.0f;
+        maathai::TokenSampler sampler(3);
+        sampler.reserve(5000);
+        sampler.set_config(config);
+        for (int i = 0; i < 200; ++i) {
+            const int32_t token = sampler.sample(logits.data(), 5000);
+            assert(token >= 0 && token < 5000);
+        }
+    }
+}
+
+void test_timings_and_bounds() {
+    const int n_vocab = 151936; // Qwen-sized vocabulary
+    std::vector<float> logits((size_t) n_vocab);
+    for (int i = 0; i < n_vocab; ++i) {
+        logits[(size_t) i] = (float) ((i * 7919) % 1000) / 100.0f;
+    }
+    maathai::SamplerConfig config;
+    config.repeat_penalty = 1.1f;
+    maathai::TokenSampler sampler;
+    sampler.reserve(n_vocab);
+    sampler.set_config(config);
+    for (int i = 0; i < 20; ++i) {
+        const int32_t token = sampler.sample(logits.data(), n_vocab);
+        assert(token >= 0 && token < n_vocab);
+    }
+    const maathai::SamplerTimings & timings = sampler.timings();
+    assert(timings.samples == 20);
+    for (int stage = 0; stage < maathai::kSamplerStageCount; ++stage) {
+        assert(timings.us[stage] >= 0.0);
+    }
+    assert(timings.us[maathai::kStageTopK] > 0.0);
+    sampler.reset_timings();
+    assert(sampler.timings().samples == 0);
+
+    // more logits than reserved
+    assert(sampler.sample(logits.data(), n_vocab + 1) == -1);
+    assert(std::string(maathai::sampler_stage_name(maathai::kStageDist)) == "dist");
+}
+
+}  // namespace
+
+int main() {
+    test_greedy_and_top_k();
+    test_penalties_change_the_choice();
+    test_truncation_filters();
+    test_draw_follows_the_distribution();
+    test_mirostat();
+    test_timings_and_bounds();
+    std::puts("sampler_test: ok");
+    return 0;
+}
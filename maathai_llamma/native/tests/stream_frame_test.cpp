@@ -0,0 +1,112 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "stream_frame.h"
+
+using maathai::PieceMeta;
+using maathai::StreamFrame;
+
+namespace {
+
+template <typename T>
+T read_at(const std::vector<uint8_t> & buf, size_t offset) {
+    T value;
+    std::memcpy(&value, buf.data() + offset, sizeof(T));
+    return value;
+}
+
+StreamFrame sample_frame(bool logprobs) {
+    StreamFrame frame;
+    frame.has_logprobs = logprobs;
+    frame.text = "Jambo \xF0\x9F\x98\x80";
+    PieceMeta a;
+    a.token = 42;
+    a.t_ms = 12.5f;
+    a.logprob = -0.25f;
+    PieceMeta b;
+    b.token = 7;
+    b.t_ms = 20.0f;
+    b.logprob = -1.5f;
+    frame.tokens = {a, b};
+    return frame;
+}
+
+void test_layout_without_logprobs() {
+    const StreamFrame frame = sample_frame(false);
+    std::vector<uint8_t> buf(256);
+    const size_t n = maathai::encode_stream_frame(frame, buf.data(), buf.size());
+    assert(n == maathai::kStreamFrameHeaderBytes + 2 * 8 + frame.text.size());
+    assert(read_at<uint16_t>(buf, 0) == maathai::kStreamFrameVersion);
+    assert(read_at<uint16_t>(buf, 2) == 0);
+    assert(read_at<uint32_t>(buf, 4) == 2);
+    assert(read_at<uint32_t>(buf, 8) == frame.text.size());
+    assert(read_at<int32_t>(buf, 12) == 42);
+    assert(read_at<int32_t>(buf, 16) == 7);
+    assert(read_at<float>(buf, 20) == 12.5f);
+    assert(read_at<float>(buf, 24) == 20.0f);
+    assert(std::memcmp(buf.data() + 28, frame.text.data(), frame.text.size()) == 0);
+}
+
+void test_layout_with_logprobs() {
+    const StreamFrame frame = sample_frame(true);
+    std::vector<uint8_t> buf(256);
+    const size_t n = maathai::encode_stream_frame(frame, buf.data(), buf.size());
+    assert(n == maathai::kStreamFrameHeaderBytes + 2 * 12 + frame.text.size());
+    assert(read_at<uint16_t>(buf, 2) == maathai::kStreamFrameLogprobs);
+    assert(read_at<float>(buf, 28) == -0.25f);
+    assert(read_at<float>(buf, 32) == -1.5f);
+    assert(std::memcmp(buf.data() + 36, frame.text.data(), frame.text.size()) == 0);
+}
+
+void test_too_small_buffer_is_rejected() {
+    const StreamFrame frame = sample_frame(true);
+    std::vector<uint8_t> buf(20);
+    assert(maathai::encode_stream_frame(frame, buf.data(), buf.size()) == 0);
+}
+
+void test_max_pieces_always_fit() {
+    const size_t capacity = 16 * 1024;
+    const size_t pieces = maathai::stream_frame_max_pieces(capacity);
+    assert(pieces > 0);
+
+    StreamFrame frame;
+    frame.has_logprobs = true;
+    frame.text.assign(pieces * maathai::TokenRing::kSlotBytes + 3, 'x');
+    frame.tokens.resize(pieces);
+    std::vector<uint8_t> buf(capacity);
+    assert(maathai::encode_stream_frame(frame, buf.data(), buf.size()) > 0);
+    assert(maathai::stream_frame_max_pieces(8) == 0);
+}
+
+void test_decode_round_trip() {
+    for (bool logprobs : {false, true}) {
+        const StreamFrame frame = sample_frame(logprobs);
+        std::vector<uint8_t> buf(maathai::stream_frame_bytes(frame));
+        assert(maathai::encode_stream_frame(frame, buf.data(), buf.size()) == buf.size());
+        StreamFrame back;
+        assert(maathai::decode_stream_frame(buf.data(), buf.size(), back));
+        assert(back.text == frame.text);
+        assert(back.has_logprobs == logprobs);
+        assert(back.tokens.size() == 2);
+        assert(back.tokens[1].token == 7 && back.tokens[1].t_ms == 20.0f);
+        assert(back.tokens[1].logprob == (logprobs ? -1.5f : 0.0f));
+        // a short or padded buffer does not parse
+        assert(!maathai::decode_stream_frame(buf.data(), buf.size() - 1, back));
+        buf.push_back(0);
+        assert(!maathai::decode_stream_frame(buf.data(), buf.size(), back));
+    }
+}
+
+}  // namespace
+
+int main() {
+    test_layout_without_logprobs();
+    test_layout_with_logprobs();
+    test_too_small_buffer_is_rejected();
+    test_max_pieces_always_fit();
+    test_decode_round_trip();
+    std::puts("stream_frame_test: ok");
+    return 0;
+}
@@ -0,0 +1,299 @@
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "thread_governor.h"
+
+using maathai::GovernorConfig;
+using maathai::GovernorDecision;
+using maathai::GovernorReason;
+using maathai::ThreadGovernor;
+
+namespace {
+
+std::string g_dir;
+std::vector<std::string> g_created; // removed in reverse order
+
+void make_dir(const std::string & path) {
+    if (mkdir(path.c_str(), 0755) == 0) {
+        g_created.push_back(path);
+    }
+}
+
+void write_text(const std::string & path, const std::string & text) {
+    std::FILE * file = std::fopen(path.c_str(), "w");
+    assert(file != nullptr);
+    std::fputs(text.c_str(), file);
+    std::fclose(file);
+    g_created.push_back(path);
+}
+
+void make_zone(const std::string & root, int index, const char * type, const char * temp) {
+    const std::string zone = root + "/thermal_zone" + std::to_string(index);
+    make_dir(zone);
+    write_text(zone + "/type", std::string(type) + "\n");
+    if (temp != nullptr) {
+        write_text(zone + "/temp", temp);
+    }
+}
+
+// Replays a temperature trace, one reading per window.
+class TraceThermal : public maathai::ThermalSource {
+public:
+    double celsius = 40.0;
+    int reads = 0;
+    bool read(double & out) override {
+        ++reads;
+        out = celsius;
+        return true;
+    }
+};
+
+// Decode throughput by thread count, peaking at 4 of 8 as on a phone whose
+// big cores saturate memory bandwidth. Throttled, every count is slower and
+// extra threads hurt more, so the peak moves to 3.
+struct Device {
+    bool throttled = false;
+    double tok_s(int threads) const {
+        static const double kCool[] = {0.0, 4.0, 7.0, 9.0, 10.0, 9.5, 9.0, 8.5, 8.0};
+        static const double kThrottled[] = {0.0, 4.0, 6.5, 7.0, 6.0, 5.0, 4.5, 4.0, 3.5};
+        return throttled ? kThrottled[threads] : kCool[threads];
+    }
+};
+
+GovernorConfig config_8() {
+    GovernorConfig config;
+    config.max_threads = 8;
+    config.max_threads_batch = 6;
+    config.window = 4;
+    return config;
+}
+
+// Runs `steps` single-token decode steps, counting steps per thread count.
+std::vector<int> run(ThreadGovernor & governor, const Device & device, int steps,
+                     std::vector<GovernorDecision> * decisions = nullptr) {
+    std::vector<int> at(9, 0);
+    for (int i = 0; i < steps; ++i) {
+        ++at[(size_t) governor.n_threads()];
+        GovernorDecision decision;
+        if (governor.observe(1, 1, 1e6 / device.tok_s(governor.n_threads()), decision)) {
+            assert(decision.n_threads == governor.n_threads());
+            assert(decision.from_threads != decision.n_threads);
+            if (decisions != nullptr) {
+                decisions->push_back(decision);
+            }
+        }
+    }
+    return at;
+}
+
+void test_sysfs_source() {
+    const std::string root = g_dir + "/thermal";
+    make_dir(root);
+    make_zone(root, 0, "battery", "30000\n");
+    make_zone(root, 1, "cpu-1-0-usr", "71500\n");
+    make_zone(root, 2, "cpuss-0", nullptr); // disabled: no reading
+    make_zone(root, 3, "CPU-big", "64\n");  // whole degrees
+    maathai::SysfsThermalSource source(root);
+    assert(source.zones().size() == 3);
+    double celsius = 0.0;
+    assert(source.read(celsius));
+    assert(celsius == 71.5);
+
+    // no cpu zone: every zone counts
+    const std::string other = g_dir + "/other";
+    make_dir(other);
+    make_zone(other, 0, "battery", "38000\n");
+    make_zone(other, 1, "skin", "41000\n");
+    maathai::SysfsThermalSource fallback(other);
+    assert(fallback.zones().size() == 2);
+    assert(fallback.read(celsius) && celsius == 41.0);
+
+    maathai::SysfsThermalSource missing(g_dir + "/nope");
+    assert(missing.zones().empty());
+    assert(!missing.read(celsius));
+}
+
+void test_finds_fastest_count() {
+    ThreadGovernor governor(config_8(), nullptr);
+    assert(governor.n_threads() == 8);
+    assert(governor.n_threads_batch() == 6);
+    std::vector<GovernorDecision> decisions;
+    const std::vector<int> at = run(governor, Device{}, 2000, &decisions);
+    // climbs down 8 -> 4, then only probes 3 and 5 now and then
+    assert(decisions.size() >= 5);
+    for (size_t i = 0; i < 4; ++i) {
+        assert(decisions[i].reason == GovernorReason::kProbe);
+        assert(decisions[i].n_threads == 7 - (int) i);
+    }
+    assert(at[4] > 1400);
+    assert(at[1] == 0 && at[2] == 0);
+    // the prefill count moves by the same steps
+    while (governor.n_threads() != 4) {
+        GovernorDecision decision;
+        governor.observe(1, 1, 1e6 / Device{}.tok_s(governor.n_threads()), decision);
+    }
+    assert(governor.n_threads_batch() == 2);
+}
+
+void test_thermal_steps_down() {
+    TraceThermal thermal;
+    ThreadGovernor governor(config_8(), &thermal);
+    GovernorConfig config = config_8();
+    Device device;
+    run(governor, device, 2000);
+    assert(thermal.reads == 2000 / config.window);
+    const int settled = governor.n_threads();
+    assert(settled == 4);
+
+    // overheating: one thread fewer every window, down to the minimum
+    thermal.celsius = 80.0;
+    std::vector<GovernorDecision> decisions;
+    run(governor, device, config.window * 3, &decisions);
+    assert(decisions.size() == 3);
+    for (const GovernorDecision & decision : decisions) {
+        assert(decision.reason == GovernorReason::kThermal);
+        assert(decision.temp_c == 80.0);
+    }
+    assert(governor.n_threads() == 1);
+    decisions.clear();
+    run(governor, device, config.window * 8, &decisions);
+    assert(decisions.empty());
+
+    // warm: no probing upwards, and nowhere further down to go
+    thermal.celsius = 70.0;
+    run(governor, device, 400, &decisions);
+    assert(decisions.empty());
+
+    // cool again: probes upwards and recovers
+    thermal.celsius = 45.0;
+    const std::vector<int> at = run(governor, device, 2000);
+    assert(at[4] > 1400);
+}
+
+void test_slowdown_probes_down() {
+    GovernorConfig config = config_8();
+    config.min_threads = 2;
+    ThreadGovernor governor(config, nullptr);
+    Device device;
+    run(governor, device, 2000);
+    assert(governor.n_threads() == 4);
+
+    // throttled without a thermal reading: the settled count got slower
+    device.throttled = true;
+    std::vector<GovernorDecision> decisions;
+    const std::vector<int> at = run(governor, device, 2000, &decisions);
+    assert(decisions.front().reason == GovernorReason::kSlowdown);
+    assert(decisions.front().from_threads == 4 && decisions.front().n_threads == 3);
+    assert(decisions.front().tok_s == 6.0);
+    // 2 is tried once and found slower; 3 is the new home
+    assert(decisions[1].reason == GovernorReason::kProbe && decisions[1].n_threads == 2);
+    assert(decisions[2].reason == GovernorReason::kRevert && decisions[2].n_threads == 3);
+    assert(at[3] > 1400);
+    assert(std::string(maathai::governor_reason_name(GovernorReason::kSlowdown)) == "slowdown");
+}
+
+// Sessions come and go at a constant thread count: a step takes about as
+// long with one session as with four, so tokens per second follow the
+// session count. None of that may read as throttling or as a probe paying
+// off.
+void test_batch_shape_changes() {
+    ThreadGovernor governor(config_8(), nullptr);
+    Device device;
+    run(governor, device, 2000);
+    assert(governor.n_threads() == 4);
+
+    static const int kSessions[] = {1, 4, 2, 3, 1, 2};
+    std::vector<GovernorDecision> decisions;
+    std::vector<int> at(9, 0);
+    for (int i = 0; i < 4000; ++i) {
+        // 10 steps per shape: two full windows and a partial one
+        const int sessions = kSessions[(i / 10) % 6];
+        ++at[(size_t) governor.n_threads()];
+        GovernorDecision decision;
+        if (governor.observe(sessions, sessions, 1e6 / device.tok_s(governor.n_threads()), decision)) {
+            decisions.push_back(decision);
+        }
+    }
+    for (const GovernorDecision & decision : decisions) {
+        assert(decision.reason != GovernorReason::kSlowdown);
+        assert(decision.n_threads >= 3 && decision.n_threads <= 5);
+    }
+    assert(at[4] > 2800);
+
+    // a session joining mid-probe: the probe is reverted, not judged
+    ThreadGovernor fresh(config_8(), nullptr);
+    GovernorDecision decision;
+    for (int i = 0; i < config_8().window; ++i) {
+        assert(!fresh.observe(1, 1, 1e6 / device.tok_s(8), decision) || i == config_8().window - 1);
+    }
+    assert(decision.reason == GovernorReason::kProbe && fresh.n_threads() == 7);
+    assert(fresh.observe(2, 2, 1e6 / device.tok_s(7), decision));
+    assert(decision.reason == GovernorReason::kRevert && decision.n_threads == 8);
+    // sessions change faster than a window: never enough to decide on
+    for (int i = 0; i < 400; ++i) {
+        const int sessions = 1 + (i / 3) % 4;
+        assert(!fresh.observe(sessions, sessions, 1e6 / device.tok_s(8), decision));
+    }
+    assert(fresh.n_threads() == 8);
+
+    // committed tokens vary with the drafts accepted; the window still
+    // completes and the count still settles
+    ThreadGovernor drafting(config_8(), nullptr);
+    for (int i = 0; i < 2000; ++i) {
+        const int committed = 1 + (i * 7) % 4;
+        drafting.observe(1, committed, committed * 1e6 / device.tok_s(drafting.n_threads()), decision);
+    }
+    assert(drafting.n_threads() >= 3 && drafting.n_threads() <= 5);
+}
+
+// A hot SoC steps down however the batch changes: windows that keep
+// restarting must not keep the thermal check from running.
+void test_thermal_ignores_batch_shape() {
+    TraceThermal thermal;
+    thermal.celsius = 90.0;
+    ThreadGovernor governor(config_8(), &thermal);
+    Device device;
+    std::vector<GovernorDecision> decisions;
+    static const int kSessions[] = {2, 4, 1, 3};
+    for (int i = 0; i < 2000; ++i) {
+        const int sessions = kSessions[i % 4];
+        GovernorDecision decision;
+        if (governor.observe(sessions, sessions, 1e6 / device.tok_s(governor.n_threads()), decision)) {
+            decisions.push_back(decision);
+        }
+    }
+    assert(decisions.size() == 7);
+    for (const GovernorDecision & decision : decisions) {
+        assert(decision.reason == GovernorReason::kThermal && decision.temp_c == 90.0);
+    }
+    assert(governor.n_threads() == 1);
+    assert(thermal.reads == 2000 / config_8().window);
+}
+
+}  // namespace
+
+int main() {
+    char tmpl[] = "/tmp/maathai_thermal_XXXXXX";
+    const char * dir = mkdtemp(tmpl);
+    assert(dir != nullptr);
+    g_dir = dir;
+
+    test_sysfs_source();
+    test_finds_fastest_count();
+    test_thermal_steps_down();
+    test_slowdown_probes_down();
+    test_batch_shape_changes();
+    test_thermal_ignores_batch_shape();
+
+    for (auto it = g_created.rbegin(); it != g_created.rend(); ++it) {
+        std::remove(it->c_str());
+    }
+    rmdir(dir);
+    std::puts("thread_governor_test: ok");
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "token_ring.h"
+
+using maathai::TokenRing;
+
+namespace {
+
+void test_closed_until_reset() {
+    TokenRing ring(4);
+    std::string out;
+    assert(ring.finished());
+    assert(!ring.push("a", 1));
+
+    ring.reset();
+    assert(!ring.finished());
+    assert(ring.push("a", 1));
+    ring.close();
+    assert(!ring.finished());
+    assert(ring.wait_and_drain(out, 0, 8) == 1);
+    assert(out == "a");
+    assert(ring.finished());
+}
+
+void test_drain_respects_max_count() {
+    TokenRing ring(8);
+    ring.reset();
+    for (const char * piece : {"he", "llo", " ", "wor", "ld"}) {
+        assert(ring.push(piece, std::char_traits<char>::length(piece)));
+    }
+    std::string out;
+    assert(ring.wait_and_drain(out, 0, 2) == 2);
+    assert(out == "hello");
+    assert(ring.wait_and_drain(out, 0, 16) == 3);
+    assert(out == "hello world");
+    assert(ring.wait_and_drain(out, 0, 16) == 0);
+}
+
+void test_long_piece_is_split() {
+    TokenRing ring(4);
+    ring.reset();
+    const std::string piece(TokenRing::kSlotBytes * 2 + 7, 'x');
+    assert(ring.push(piece.data(), piece.size()));
+    std::string out;
+    assert(ring.wait_and_drain(out, 0, 16) == 3);
+    assert(out == piece);
+}
+
+void test_meta_follows_first_slot_only() {
+    TokenRing ring(8);
+    ring.reset();
+    maathai::PieceMeta meta;
+    meta.token = 5;
+    meta.t_ms = 3.0f;
+    const std::string piece(TokenRing::kSlotBytes + 1, 'y');
+    assert(ring.push(piece.data(), piece.size(), meta));
+    meta.token = 6;
+    assert(ring.push("z", 1, meta));
+
+    std::string out;
+    std::vector<maathai::PieceMeta> metas;
+    assert(ring.wait_and_drain(out, 0, 16, &metas) == 3);
+    assert(out == piece + "z");
+    assert(metas.size() == 2);
+    assert(metas[0].token == 5 && metas[0].t_ms == 3.0f);
+    assert(metas[1].token == 6);
+}
+
+void test_try_push_is_all_or_nothing() {
+    TokenRing ring(4);
+    assert(!ring.try_push("a", 1));
+    ring.reset();
+    assert(ring.try_push("a", 1));
+    assert(ring.try_push("b", 1));
+    // three slots needed, two free: nothing may be written
+    const std::string piece(TokenRing::kSlotBytes * 2 + 1, 'x');
+    assert(!ring.try_push(piece.data(), piece.size()));
+    std::string out;
+    assert(ring.wait_and_drain(out, 0, 16) == 2);
+    assert(out == "ab");
+    assert(ring.try_push(piece.data(), piece.size()));
+    assert(ring.try_push("c", 1));
+    assert(!ring.try_push("d", 1));
+    out.clear();
+    assert(ring.wait_and_drain(out, 0, 16) == 4);
+    assert(out == piece + "c");
+}
+
+void test_wait_times_out_when_empty() {
+    TokenRing ring(4);
+    ring.reset();
+    std::string out;
+    const auto start = std::chrono::steady_clock::now();
+    assert(ring.wait_and_drain(out, 20, 4) == 0);
+    assert(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(15));
+    assert(out.empty());
+    assert(!ring.finished());
+}
+
+void test_close_wakes_blocked_producer() {
+    TokenRing ring(2);
+    ring.reset();
+    assert(ring.push("a", 1));
+    assert(ring.push("b", 1));
+    std::thread producer([&]() {
+        // ring is full and nobody drains: only close() lets this return
+        assert(!ring.push("c", 1));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ring.close();
+    producer.join();
+}
+
+// Small ring, many pieces: the producer has to block on a full ring and the
+// consumer on an empty one, and nothing may be lost or reordered.
+void test_producer_consumer_order() {
+    constexpr int kPieces = 20000;
+    TokenRing ring(16);
+    ring.reset();
+
+    std::thread producer([&]() {
+        char buf[16];
+        for (int i = 0; i < kPieces; ++i) {
+            const int n = std::snprintf(buf, sizeof(buf), "%d,", i);
+            assert(ring.push(buf, (size_t) n));
+        }
+        ring.close();
+    });
+
+    std::string out;
+    while (!ring.finished()) {
+        ring.wait_and_drain(out, 50, 7);
+    }
+    producer.join();
+
+    std::string expected;
+    for (int i = 0; i < kPieces; ++i) {
+        expected += std::to_string(i);
+        expected += ',';
+    }
+    assert(out == expected);
+}
+
+}  // namespace
+
+int main() {
+    test_closed_until_reset();
+    test_drain_respects_max_count();
+    test_long_piece_is_split();
+    test_meta_follows_first_slot_only();
+    test_try_push_is_all_or_nothing();
+    test_wait_times_out_when_empty();
+    test_close_wakes_blocked_producer();
+    test_producer_consumer_order();
+    std::puts("token_ring_test: ok");
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "tune_profile.h"
+
+using maathai::TuneKey;
+using maathai::TuneProfile;
+
+namespace {
+
+std::string g_dir;
+
+TuneKey make_key() {
+    TuneKey key;
+    key.model_fingerprint = 0xabcdef0123456789ULL;
+    key.device = 0x42;
+    key.n_ctx = 2048;
+    key.n_gpu_layers = 0;
+    return key;
+}
+
+void write_text(const std::string & path, const char * text) {
+    std::FILE * file = std::fopen(path.c_str(), "w");
+    assert(file != nullptr);
+    std::fputs(text, file);
+    std::fclose(file);
+}
+
+void test_round_trip() {
+    const TuneKey key = make_key();
+    TuneProfile profile;
+    profile.n_threads = 4;
+    profile.n_threads_batch = 6;
+    profile.n_batch = 128;
+    profile.prefill_tok_s = 81.5;
+    profile.decode_tok_s = 9.25;
+    const std::string path = g_dir + "/" + maathai::tune_profile_file_name(key);
+    assert(maathai::write_tune_profile(path, key, profile));
+
+    TuneProfile loaded;
+    assert(maathai::read_tune_profile(path, key, loaded));
+    assert(loaded.n_threads == 4 && loaded.n_threads_batch == 6 && loaded.n_batch == 128);
+    assert(loaded.prefill_tok_s == 81.5 && loaded.decode_tok_s == 9.25);
+    std::remove(path.c_str());
+}
+
+void test_other_key_or_version_is_rejected() {
+    const TuneKey key = make_key();
+    TuneProfile profile;
+    profile.n_threads = profile.n_threads_batch = profile.n_batch = 8;
+    const std::string path = g_dir + "/profile.txt";
+    assert(maathai::write_tune_profile(path, key, profile));
+
+    TuneProfile loaded;
+    TuneKey other = key;
+    other.device += 1;
+    assert(!maathai::read_tune_profile(path, other, loaded));
+    other = key;
+    other.n_ctx = 4096;
+    assert(!maathai::read_tune_profile(path, other, loaded));
+    assert(!maathai::read_tune_profile(path + ".absent", key, loaded));
+
+    write_text(path, "maathai-tune 999\nmodel abcdef0123456789\ndevice 42\nn_ctx 2048\n"
+                     "n_gpu_layers 0\nn_threads 2\nn_threads_batch 2\nn_batch 32\n");
+    assert(!maathai::read_tune_profile(path, key, loaded));
+    // a truncated profile must not yield zero threads
+    write_text(path, "maathai-tune 1\nmodel abcdef0123456789\ndevice 42\nn_ctx 2048\nn_gpu_layers 0\n");
+    assert(!maathai::read_tune_profile(path, key, loaded));
+    assert(loaded.n_threads == 0);
+    std::remove(path.c_str());
+}
+
+void test_file_name_depends_on_key() {
+    const TuneKey key = make_key();
+    TuneKey other = key;
+    other.n_gpu_layers = 99;
+    assert(maathai::tune_profile_file_name(key) != maathai::tune_profile_file_name(other));
+}
+
+void test_device_signature_ignores_frequencies() {
+    const std::string path = g_dir + "/cpuinfo";
+    write_text(path, "processor\t: 0\nBogoMIPS\t: 38.40\nCPU part\t: 0xd05\n"
+                     "processor\t: 1\nBogoMIPS\t: 38.40\nCPU part\t: 0xd41\n");
+    const uint64_t first = maathai::device_signature(path);
+    write_text(path, "processor\t: 0\nBogoMIPS\t: 52.00\nCPU part\t: 0xd05\n"
+                     "processor\t: 1\nBogoMIPS\t: 52.00\nCPU part\t: 0xd41\n");
+    assert(maathai::device_signature(path) == first);
+    write_text(path, "processor\t: 0\nCPU part\t: 0xd05\nprocessor\t: 1\nCPU part\t: 0xd05\n");
+    assert(maathai::device_signature(path) != first);
+    std::remove(path.c_str());
+}
+
+void test_remove_profiles_only_touches_profiles() {
+    TuneKey key = make_key();
+    TuneProfile profile;
+    profile.n_threads = profile.n_threads_batch = profile.n_batch = 4;
+    for (int i = 0; i < 3; ++i) {
+        key.n_ctx = 512 << i;
+        assert(maathai::write_tune_profile(g_dir + "/" + maathai::tune_profile_file_name(key), key, profile));
+    }
+    const std::string other = g_dir + "/prefix-0000000000000000.mstate";
+    write_text(other, "x");
+    assert(maathai::remove_tune_profiles(g_dir) == 3);
+    assert(maathai::remove_tune_profiles(g_dir) == 0);
+    assert(access(other.c_str(), F_OK) == 0);
+    std::remove(other.c_str());
+}
+
+void test_candidates() {
+    assert(maathai::tune_thread_candidates(1) == std::vector<int>({1}));
+    assert(maathai::tune_thread_candidates(4) == std::vector<int>({2, 4}));
+    assert(maathai::tune_thread_candidates(8) == std::vector<int>({2, 4, 6, 8}));
+    assert(maathai::tune_thread_candidates(12) == std::vector<int>({2, 4, 6, 8, 12}));
+    assert(maathai::tune_batch_candidates(128) == std::vector<int>({16, 32, 64, 128}));
+    assert(maathai::tune_batch_candidates(100) == std::vector<int>({16, 32, 64}));
+    assert(maathai::tune_batch_candidates(0) == std::vector<int>({16}));
+}
+
+}  // namespace
+
+int main() {
+    char tmpl[] = "/tmp/maathai_tune_XXXXXX";
+    const char * dir = mkdtemp(tmpl);
+    assert(dir != nullptr);
+    g_dir = dir;
+
+    test_round_trip();
+    test_other_key_or_version_is_rejected();
+    test_file_name_depends_on_key();
+    test_device_signature_ignores_frequencies();
+    test_remove_profiles_only_touches_profiles();
+    test_candidates();
+
+    rmdir(dir);
+    std::puts("tune_profile_test: ok");
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <cassert>
+#include <cstdio>
+#include <string>
+
+#include "utf8.h"
+
+using maathai::Utf8Assembler;
+
+namespace {
+
+// "é" (2 bytes), "€" (3 bytes) and an emoji (4 bytes)
+const std::string kEAcute = "\xC3\xA9";
+const std::string kEuro = "\xE2\x82\xAC";
+const std::string kEmoji = "\xF0\x9F\x98\x80";
+
+void test_ascii_passes_through() {
+    Utf8Assembler asm_;
+    std::string out;
+    asm_.append(out, "hello", 5);
+    assert(out == "hello");
+    assert(asm_.pending() == 0);
+}
+
+void test_split_sequences_are_held_back() {
+    for (const std::string & ch : {kEAcute, kEuro, kEmoji}) {
+        for (size_t cut = 1; cut < ch.size(); ++cut) {
+            Utf8Assembler asm_;
+            std::string out;
+            const std::string first = "a" + ch.substr(0, cut);
+            asm_.append(out, first.data(), first.size());
+            assert(out == "a");
+            assert(asm_.pending() == cut);
+            const std::string rest = ch.substr(cut) + "b";
+            asm_.append(out, rest.data(), rest.size());
+            assert(out == "a" + ch + "b");
+            assert(asm_.pending() == 0);
+        }
+    }
+}
+
+void test_byte_by_byte() {
+    const std::string text = "x" + kEmoji + kEuro + kEAcute + "y";
+    Utf8Assembler asm_;
+    std::string out;
+    for (char byte : text) {
+        asm_.append(out, &byte, 1);
+        // whatever was emitted so far always decodes cleanly
+        const std::u16string wide = maathai::utf8_to_utf16(out.data(), out.size());
+        assert(wide.find(u'\uFFFD') == std::u16string::npos);
+    }
+    assert(out == text);
+}
+
+void test_flush_emits_truncated_tail() {
+    Utf8Assembler asm_;
+    std::string out;
+    asm_.append(out, kEmoji.data(), 2);
+    assert(out.empty());
+    asm_.flush(out);
+    assert(out == kEmoji.substr(0, 2));
+    assert(asm_.pending() == 0);
+}
+
+void test_invalid_bytes_are_not_held() {
+    Utf8Assembler asm_;
+    std::string out;
+    const std::string junk = "a\xFF\x80";
+    asm_.append(out, junk.data(), junk.size());
+    assert(out == junk);
+}
+
+void test_utf16_round_trip() {
+    const std::string text = "Habari " + kEmoji + " " + kEuro + kEAcute;
+    const std::u16string wide = maathai::utf8_to_utf16(text.data(), text.size());
+    assert(wide.size() == 7 + 2 + 1 + 1 + 1);
+    assert(wide[7] == 0xD83D && wide[8] == 0xDE00);
+    assert(maathai::utf16_to_utf8(wide.data(), wide.size()) == text);
+}
+
+void test_invalid_input_becomes_replacement() {
+    const std::string bad = "a\xC3";
+    const std::u16string wide = maathai::utf8_to_utf16(bad.data(), bad.size());
+    assert(wide == u"a�");
+
+    const char16_t lone[] = {u'a', 0xD800, u'b'};
+    assert(maathai::utf16_to_utf8(lone, 3) == "a\xEF\xBF\xBD" "b");
+}
+
+}  // namespace
+
+int main() {
+    test_ascii_passes_through();
+    test_split_sequences_are_held_back();
+    test_byte_by_byte();
+    test_flush_emits_truncated_tail();
+    test_invalid_bytes_are_not_held();
+    test_utf16_round_trip();
+    test_invalid_input_becomes_replacement();
+    std::puts("utf8_test: ok");
+    return 0;
+}
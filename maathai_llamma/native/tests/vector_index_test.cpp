@@ -0,0 +1,169 @@
+#include <unistd.h>
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "vector_index.h"
+
+using maathai::VectorHit;
+using maathai::VectorIndex;
+using maathai::VectorType;
+
+namespace {
+
+std::string temp_path(const char * name) {
+    const std::string path = "/tmp/maathai_vector_index_test_" + std::to_string(getpid()) + "_" + name;
+    std::remove(path.c_str());
+    return path;
+}
+
+std::vector<float> random_vectors(size_t n, uint32_t dim, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> dist;
+    std::vector<float> out(n * dim);
+    for (float & x : out) {
+        x = dist(rng);
+    }
+    return out;
+}
+
+void test_kernels_match_scalar() {
+    // odd lengths exercise the tails after the vector loops
+    for (const size_t n : {1u, 7u, 16u, 33u, 384u, 1001u}) {
+        const std::vector<float> a = random_vectors(1, (uint32_t) n, 1);
+        const std::vector<float> b = random_vectors(1, (uint32_t) n, 2);
+        double want = 0.0;
+        std::vector<int8_t> qa(n);
+        std::vector<int8_t> qb(n);
+        int32_t want_i8 = 0;
+        for (size_t i = 0; i < n; ++i) {
+            want += (double) a[i] * b[i];
+            qa[i] = (int8_t) ((int) (i * 37) % 255 - 127);
+            qb[i] = (int8_t) ((int) (i * 91) % 255 - 127);
+            want_i8 += (int32_t) qa[i] * qb[i];
+        }
+        assert(std::fabs(maathai::dot_f32(a.data(), b.data(), n) - want) < 1e-3 * (1.0 + std::fabs(want)));
+        assert(maathai::dot_i8(qa.data(), qb.data(), n) == want_i8);
+    }
+    std::printf("vector_index_test: simd=%s\n", maathai::vector_simd_name());
+}
+
+void test_add_search_remove(VectorType type) {
+    const std::string path = temp_path(maathai::vector_type_name(type));
+    const uint32_t dim = 64;
+    const size_t n = 3000; // grows past the initial capacity
+    const std::vector<float> vectors = random_vectors(n, dim, 7);
+    std::vector<int64_t> ids(n);
+    for (size_t i = 0; i < n; ++i) {
+        ids[i] = (int64_t) i * 10;
+    }
+
+    VectorIndex index;
+    assert(index.open(path, dim, type));
+    assert(index.add(ids.data(), vectors.data(), n));
+    assert(index.size() == n);
+
+    // each stored vector finds itself first, scaled or not
+    VectorHit hits[5];
+    for (size_t i = 0; i < n; i += 97) {
+        std::vector<float> query(vectors.begin() + (std::ptrdiff_t) (i * dim),
+                                 vectors.begin() + (std::ptrdiff_t) ((i + 1) * dim));
+        for (float & x : query) {
+            x *= 3.0f;
+        }
+        assert(index.search(query.data(), 5, hits, 1) == 5);
+        assert(hits[0].id == ids[i]);
+        assert(std::fabs(hits[0].score - 1.0f) < (type == VectorType::kI8 ? 0.02f : 1e-4f));
+        for (int h = 1; h < 5; ++h) {
+            assert(hits[h].score <= hits[h - 1].score);
+        }
+    }
+
+    // removal hides a vector; re-adding an id replaces it
+    assert(index.remove(ids[0]));
+    assert(!index.remove(ids[0]));
+    assert(!index.contains(ids[0]));
+    assert(index.search(vectors.data(), 1, hits, 1) == 1 && hits[0].id != ids[0]);
+    assert(index.add(ids[1], vectors.data()));
+    assert(index.size() == n - 1);
+    assert(index.search(vectors.data(), 1, hits, 1) == 1 && hits[0].id == ids[1]);
+    assert(index.slots() == n + 1);
+    index.close();
+
+    // everything survives a reopen; compaction drops the dead records
+    assert(!index.open(path, dim + 1, type));
+    assert(index.open(path, dim, type));
+    assert(index.size() == n - 1 && index.slots() == n + 1);
+    assert(index.compact());
+    assert(index.slots() == n - 1);
+    assert(index.search(vectors.data(), 1, hits, 1) == 1 && hits[0].id == ids[1]);
+    assert(index.flush());
+    index.close();
+    assert(index.open(path, dim, type));
+    assert(index.size() == n - 1);
+    index.close();
+    std::remove(path.c_str());
+}
+
+void test_threads_agree() {
+    const std::string path = temp_path("threads");
+    const uint32_t dim = 32;
+    const size_t n = 40000;
+    const std::vector<float> vectors = random_vectors(n, dim, 3);
+    std::vector<int64_t> ids(n);
+    for (size_t i = 0; i < n; ++i) {
+        ids[i] = (int64_t) i;
+    }
+    VectorIndex index;
+    assert(index.open(path, dim, VectorType::kF32));
+    assert(index.add(ids.data(), vectors.data(), n));
+    const std::vector<float> query = random_vectors(1, dim, 99);
+    VectorHit one[10];
+    VectorHit many[10];
+    assert(index.search(query.data(), 10, one, 1) == 10);
+    assert(index.search(query.data(), 10, many, 4) == 10);
+    for (int i = 0; i < 10; ++i) {
+        assert(one[i].id == many[i].id);
+    }
+    // k larger than the collection
+    VectorIndex small;
+    const std::string small_path = temp_path("small");
+    assert(small.open(small_path, dim, VectorType::kF32));
+    assert(small.add(ids.data(), vectors.data(), 3));
+    std::vector<VectorHit> all(10);
+    assert(small.search(query.data(), 10, all.data()) == 3);
+    index.close();
+    small.close();
+    std::remove(path.c_str());
+    std::remove(small_path.c_str());
+}
+
+void test_rejects_foreign_files() {
+    const std::string path = temp_path("foreign");
+    std::FILE * file = std::fopen(path.c_str(), "wb");
+    std::fputs("definitely not an index, but long enough to hold a header ....", file);
+    std::fclose(file);
+    VectorIndex index;
+    assert(!index.open(path, 8, VectorType::kF32));
+    assert(!index.is_open());
+    VectorHit hit;
+    const float query[8] = {};
+    assert(index.search(query, 1, &hit) == 0);
+    std::remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    test_kernels_match_scalar();
+    test_add_search_remove(VectorType::kF32);
+    test_add_search_remove(VectorType::kI8);
+    test_threads_agree();
+    test_rejects_foreign_files();
+    std::puts("vector_index_test: ok");
+    return 0;
+}
@@ -1,6 +1,13 @@
+import 'dart:convert';
+import 'dart:typed_data';
+
 import 'package:flutter/services.dart';
 import 'package:flutter_test/flutter_test.dart';
+import 'package:maathai_llamma/embeddings.dart';
+import 'package:maathai_llamma/engine_stats.dart';
 import 'package:maathai_llamma/maathai_llamma_method_channel.dart';
+import 'package:maathai_llamma/token_frame.dart';
+import 'package:maathai_llamma/vector_index.dart';
 
 void main() {
   TestWidgetsFlutterBinding.ensureInitialized();
@@ -16,9 +23,167 @@ void main() {
           case 'initialize':
             return true;
           case 'loadModel':
+            final loadArgs = methodCall.arguments as Map;
+            if (loadArgs['modelPath'] == 'cancelled.gguf') {
+              throw PlatformException(code: 'load_cancelled');
+            }
+            if (loadArgs['cacheTypeV'] == 'f16') return true;
+            return {
+              'contextLength': loadArgs['contextLength'],
+              'cacheTypeK': loadArgs['cacheTypeK'],
+              'cacheTypeV': loadArgs['cacheTypeV'],
+              'flashAttention': true,
+              'load': {
+                'useMmap': loadArgs['useMmap'],
+                'useMlock': loadArgs['useMlock'],
+                'warmupMs': loadArgs['warmup'] == true ? 12.0 : 0.0,
+                'swapped': loadArgs['swap'],
+              },
+            };
+          case 'cancelLoad':
+            return true;
+          case 'setResidencyBudget':
+            return null;
+          case 'switchModel':
+            if ((methodCall.arguments as Map)['handle'] != 2) {
+              throw PlatformException(code: 'not_resident');
+            }
+            return {'contextLength': 2048, 'switchMs': 3.5};
+          case 'pinModel':
+            return (methodCall.arguments as Map)['handle'] == 2;
+          case 'unloadModel':
+            return (methodCall.arguments as Map)['handle'] == 2;
+          case 'residentModels':
+            return [
+              {'handle': 2, 'path': 'small.gguf', 'weightsBytes': 400, 'contextBytes': 100, 'hasContext': true},
+              {'handle': 1, 'path': 'large.gguf', 'weightsBytes': 900, 'hasContext': false, 'pinned': true},
+            ];
+          case 'residencyStats':
+            return {'budgetBytes': 2000, 'residentBytes': 1400, 'models': 2, 'hits': 1, 'currentHandle': 2};
+          case 'estimateMemory':
+            final memoryArgs = methodCall.arguments as Map;
+            return {
+              'kvBytes': (memoryArgs['contextLength'] as int) * 1024,
+              'fits': memoryArgs['cacheTypeK'] == 'q8_0' && memoryArgs['flashAttention'] == null,
+            };
+          case 'setContextShift':
+            final shiftArgs = methodCall.arguments as Map;
+            if (shiftArgs['session'] != 0) {
+              throw PlatformException(code: 'invalid_session');
+            }
+            return null;
+          case 'loadLora':
+            if ((methodCall.arguments as Map)['path'] == 'missing.gguf') {
+              throw PlatformException(code: 'invalid_path');
+            }
+            return 4;
+          case 'unloadLora':
+            return (methodCall.arguments as Map)['id'] == 4;
+          case 'setLoras':
+            final loraArgs = methodCall.arguments as Map;
+            if ((loraArgs['adapters'] as Map).keys.any((id) => id != 4)) {
+              throw PlatformException(code: 'invalid_adapter');
+            }
+            return null;
+          case 'setPriority':
+            if ((methodCall.arguments as Map)['priority'] == 'urgent') {
+              throw PlatformException(code: 'invalid_priority');
+            }
+            return null;
+          case 'embed':
+            final embedArgs = methodCall.arguments as Map;
+            final texts = embedArgs['texts'] as List;
+            // rows [i, 2i] as little-endian floats, one batch for all texts
+            final data = ByteData(texts.length * 2 * 4);
+            for (var i = 0; i < texts.length; i++) {
+              data.setFloat32(i * 8, i.toDouble(), Endian.little);
+              data.setFloat32(i * 8 + 4, 2.0 * i, Endian.little);
+            }
+            return {
+              'dimension': 2,
+              'count': texts.length,
+              'data': data.buffer.asUint8List(),
+              'pooling': embedArgs['pooling'] == 'model' ? 'cls' : embedArgs['pooling'],
+              'tokens': texts.length * 4,
+              'truncated': 0,
+              'batches': 1,
+              'elapsedMs': 5.0,
+              'textsPerSecond': texts.length * 200.0,
+            };
+          case 'vectorIndexOpen':
+            final indexArgs = methodCall.arguments as Map;
+            if ((indexArgs['dimension'] as int) <= 0) {
+              throw PlatformException(code: 'invalid_argument');
+            }
+            return 7;
+          case 'vectorIndexAdd':
+            final addArgs = methodCall.arguments as Map;
+            expect(addArgs['ids'], isA<Int64List>());
+            expect(addArgs['vectors'], isA<Float32List>());
+            return null;
+          case 'vectorIndexSearch':
+            final searchArgs = methodCall.arguments as Map;
+            final k = searchArgs['k'] as int;
+            return {
+              'ids': Int64List.fromList(List.generate(k, (i) => 100 + i)),
+              'scores': Float32List.fromList(List.generate(k, (i) => 1.0 - i / 10)),
+            };
+          case 'vectorIndexRemove':
+            return ((methodCall.arguments as Map)['ids'] as Int64List).length;
+          case 'vectorIndexInfo':
+            return {'size': 3, 'slots': 4, 'dimension': 2, 'quantized': true};
+          case 'vectorIndexCompact':
             return true;
+          case 'samplerTimings':
+            final timingArgs = methodCall.arguments as Map;
+            return {
+              'samples': 10 + (timingArgs['session'] as int),
+              'stagesUs': {'topK': 120.0, 'penalties': 4.0, 'filters': 9.0, 'temperature': 1.0, 'dist': 6.0},
+            };
+          case 'getStats':
+            final statsArgs = methodCall.arguments as Map;
+            return {
+              'requests': 4,
+              'threads': 4,
+              'kvUsed': 300,
+              'kvSession': 120 + (statsArgs['session'] as int),
+              'kvSize': 2048,
+              'llama': {'promptMs': 80.5, 'promptTokens': 200},
+              'last': {
+                'promptTokens': 120,
+                'generatedTokens': 16,
+                'totalMs': 512.0,
+                'cancelled': true,
+                'cancelMs': 12.5,
+                'phases': {
+                  'prefill': {'count': 2, 'totalUs': 80000.0, 'p95Us': 41000.0},
+                  'decode': {'count': 15, 'meanUs': 25000.0},
+                },
+              },
+              'total': {
+                'sample': {'count': 64, 'maxUs': 90.0},
+              },
+              'cancel': {'count': 1, 'maxUs': 12500.0},
+              'abortedDecodes': 1,
+            };
+          case 'stopTrace':
+            return (methodCall.arguments as Map)['path'] != null;
+          case 'invalidateTuning':
+            return (methodCall.arguments as Map)['tuneDir'] == null ? 3 : 0;
+          case 'openSession':
+            return 2;
+          case 'primePrefix':
+            final prefixArgs = methodCall.arguments as Map;
+            return {'status': 'restored', 'tokens': (prefixArgs['messages'] as List).length, 'elapsedMs': 3};
           case 'generate':
-            return 'native-response';
+            final args = methodCall.arguments as Map;
+            final messages = args['messages'] as List?;
+            final session = args['session'] as int;
+            final adapters = args['adapters'] as Map?;
+            if (args['priority'] != null) return 'native-response (${args['priority']})';
+            if (adapters != null) return 'native-response (adapters ${adapters.keys.join(',')})';
+            if (session != 0) return 'native-response (session $session)';
+            return messages == null ? 'native-response' : 'native-response (${messages.length} messages)';
           default:
             return null;
         }
@@ -36,13 +201,223 @@ void main() {
     expect(result, 'native-response');
   });
 
+  test('generate forwards conversation messages', () async {
+    final result = await platform.generate(
+      prompt: '',
+      messages: [
+        {'role': 'user', 'content': 'Hi'},
+        {'role': 'assistant', 'content': 'Hello!'},
+        {'role': 'user', 'content': 'How are you?'},
+      ],
+    );
+    expect(result, 'native-response (3 messages)');
+  });
+
+  test('generate forwards the session id', () async {
+    final session = await platform.openSession();
+    expect(session, 2);
+    final result = await platform.generate(prompt: 'Hi', session: session);
+    expect(result, 'native-response (session 2)');
+  });
+
+  test('primePrefix forwards the preamble and returns the snapshot status', () async {
+    final result = await platform.primePrefix(messages: [
+      {'role': 'system', 'content': 'You are a helpful assistant.'},
+    ]);
+    expect(result['status'], 'restored');
+    expect(result['tokens'], 1);
+  });
+
   test('loadModel delegates to native channel', () async {
     final ok = await platform.loadModel(modelPath: 'path/to/model');
     expect(ok, isTrue);
   });
 
+  test('loadModel surfaces the active settings', () async {
+    expect(await platform.loadModel(modelPath: 'm.gguf', contextLength: 1024, cacheTypeK: 'q8_0', cacheTypeV: 'q8_0'),
+        isTrue);
+    final settings = await platform.activeSettings();
+    expect(settings['contextLength'], 1024);
+    expect(settings['cacheTypeV'], 'q8_0');
+    expect(settings['flashAttention'], isTrue);
+
+    await platform.release();
+    expect(await platform.activeSettings(), isEmpty);
+  });
+
+  test('loadModel forwards the load options; a cancelled swap keeps the current model', () async {
+    expect(
+        await platform.loadModel(
+            modelPath: 'm.gguf', cacheTypeK: 'q8_0', cacheTypeV: 'q8_0', useMlock: true, warmup: true),
+        isTrue);
+    final load = (await platform.activeSettings())['load'] as Map;
+    expect(load['useMmap'], isTrue);
+    expect(load['useMlock'], isTrue);
+    expect(load['warmupMs'], 12.0);
+    expect(load['swapped'], isFalse);
+
+    expect(await platform.cancelLoad(), isTrue);
+    await expectLater(platform.loadModel(modelPath: 'cancelled.gguf', swap: true),
+        throwsA(isA<PlatformException>().having((e) => e.code, 'code', 'load_cancelled')));
+    expect((await platform.activeSettings())['cacheTypeK'], 'q8_0');
+  });
+
+  test('residency calls decode models and stats and track the current model', () async {
+    await platform.setResidencyBudget(2000);
+    final models = await platform.residentModels();
+    expect(models.map((m) => m.handle), [2, 1]);
+    expect(models.first.path, 'small.gguf');
+    expect(models.first.contextBytes, 100);
+    expect(models.last.hasContext, isFalse);
+    expect(models.last.pinned, isTrue);
+
+    final stats = await platform.residencyStats();
+    expect(stats.residentBytes, 1400);
+    expect(stats.hits, 1);
+    expect(stats.evictions, 0);
+    expect(stats.currentHandle, 2);
+
+    expect(await platform.pinModel(2), isTrue);
+    expect(await platform.pinModel(9, pinned: false), isFalse);
+
+    final settings = await platform.switchModel(2);
+    expect(settings['switchMs'], 3.5);
+    expect((await platform.activeSettings())['contextLength'], 2048);
+    await expectLater(platform.switchModel(9),
+        throwsA(isA<PlatformException>().having((e) => e.code, 'code', 'not_resident')));
+
+    // unloading the current model leaves nothing active
+    expect(await platform.unloadModel(2), isTrue);
+    expect(await platform.activeSettings(), isEmpty);
+  });
+
+  test('estimateMemory forwards the settings', () async {
+    final estimate = await platform.estimateMemory(modelPath: 'm.gguf', contextLength: 2048, cacheTypeK: 'q8_0');
+    expect(estimate['kvBytes'], 2048 * 1024);
+    expect(estimate['fits'], isTrue);
+  });
+
+  test('setContextShift forwards the session and rejects unknown ones', () async {
+    await platform.setContextShift(enabled: true, keepTokens: 32);
+    expect(platform.setContextShift(enabled: true, session: 3), throwsA(isA<PlatformException>()));
+  });
+
+  test('LoRA calls forward ids, scales and errors', () async {
+    expect(await platform.loadLora('legal.gguf'), 4);
+    expect(platform.loadLora('missing.gguf'), throwsA(isA<PlatformException>()));
+    await platform.setLoras(adapters: {4: 0.5}, session: 1);
+    expect(platform.setLoras(adapters: {7: 1.0}), throwsA(isA<PlatformException>()));
+    expect(
+      await platform.generate(prompt: 'Hi', adapters: {4: 1.0}),
+      'native-response (adapters 4)',
+    );
+    expect(await platform.unloadLora(4), isTrue);
+    expect(await platform.unloadLora(5), isFalse);
+  });
+
+  test('setPriority and the priority argument reach the platform', () async {
+    await platform.setPriority(priority: 'background', session: 1);
+    expect(platform.setPriority(priority: 'urgent'), throwsA(isA<PlatformException>()));
+    expect(await platform.generate(prompt: 'Hi', priority: 'interactive'), 'native-response (interactive)');
+  });
+
+  test('embed decodes the shared vector buffer and throughput', () async {
+    final Embeddings embeddings = await platform.embed(['x', 'y', 'z']);
+    expect(embeddings.dimension, 2);
+    expect(embeddings.length, 3);
+    expect(embeddings[2], [2.0, 4.0]);
+    expect(embeddings.dot(1, 2), 10.0);
+    expect(embeddings.pooling, 'cls');
+    expect(embeddings.batches, 1);
+    expect(embeddings.textsPerSecond, 600.0);
+  });
+
+  test('Embeddings.fromMap copes with unaligned bytes', () {
+    final bytes = Uint8List(1 + 8);
+    ByteData.sublistView(bytes)
+      ..setFloat32(1, 0.5, Endian.little)
+      ..setFloat32(5, -1.5, Endian.little);
+    final embeddings = Embeddings.fromMap({
+      'dimension': 2,
+      'count': 1,
+      'data': Uint8List.sublistView(bytes, 1),
+    });
+    expect(embeddings[0], [0.5, -1.5]);
+  });
+
+  test('vector index calls carry typed arrays and decode hits', () async {
+    final handle = await platform.openVectorIndex('/tmp/x.mvix', dimension: 2, quantized: true);
+    expect(handle, 7);
+    await platform.vectorIndexAdd(handle, Int64List.fromList([1, 2]), Float32List(4));
+    final VectorSearchResult result = await platform.vectorIndexSearch(handle, Float32List(2), k: 3);
+    expect(result.ids, [100, 101, 102]);
+    expect(result.scores[1], closeTo(0.9, 1e-6));
+    expect(await platform.vectorIndexRemove(handle, Int64List.fromList([1])), 1);
+    expect((await platform.vectorIndexInfo(handle))['slots'], 4);
+    expect(await platform.vectorIndexCompact(handle), isTrue);
+    expect(platform.openVectorIndex('/tmp/x.mvix', dimension: 0), throwsA(isA<PlatformException>()));
+  });
+
+  test('samplerTimings reports per-stage microseconds for the session', () async {
+    final timings = await platform.samplerTimings(session: 1);
+    expect(timings['samples'], 11);
+    expect((timings['stagesUs'] as Map)['topK'], 120.0);
+  });
+
+  test('getStats decodes phases, KV usage and llama counters', () async {
+    final stats = await platform.getStats(session: 2);
+    expect(stats.session, 2);
+    expect(stats.requests, 4);
+    expect(stats.kvSession, 122);
+    expect(stats.llama['promptTokens'], 200);
+    expect(stats.last.generatedTokens, 16);
+    expect(stats.last.phases['prefill']!.p95Us, 41000.0);
+    expect(stats.last.phases['decode']!.count, 15);
+    // phases the platform left out read as empty
+    expect(stats.last.phases.keys, EngineStats.phaseNames);
+    expect(stats.last.phases['handoff']!.count, 0);
+    expect(stats.total['sample']!.maxUs, 90.0);
+    expect(stats.last.cancelled, isTrue);
+    expect(stats.last.cancelMs, 12.5);
+    expect(stats.cancel.maxUs, 12500.0);
+    expect(stats.abortedDecodes, 1);
+    expect(stats.flush, isNull);
+  });
+
+  test('stopTrace forwards the output path', () async {
+    await platform.startTrace(maxEvents: 1000);
+    expect(await platform.stopTrace(path: '/tmp/trace.json'), isTrue);
+    expect(await platform.stopTrace(), isFalse);
+  });
+
+  test('invalidateTuning returns the number of removed profiles', () async {
+    expect(await platform.invalidateTuning(), 3);
+  });
+
   test('initialize delegates to native channel', () async {
     final ok = await platform.initialize();
     expect(ok, isTrue);
   });
+
+  test('TokenFrame decodes token ids, timings, logprobs and UTF-8 text', () {
+    final text = utf8.encode('Jambo 😀');
+    final data = ByteData(12 + 2 * 12 + text.length)
+      ..setUint16(0, 1, Endian.little)
+      ..setUint16(2, 1, Endian.little)
+      ..setUint32(4, 2, Endian.little)
+      ..setUint32(8, text.length, Endian.little)
+      ..setInt32(12, 42, Endian.little)
+      ..setInt32(16, 7, Endian.little)
+      ..setFloat32(20, 12.5, Endian.little)
+      ..setFloat32(24, 20.0, Endian.little)
+      ..setFloat32(28, -0.25, Endian.little)
+      ..setFloat32(32, -1.5, Endian.little);
+    final bytes = data.buffer.asUint8List()..setRange(36, 36 + text.length, text);
+
+    final frame = TokenFrame.decode(bytes);
+    expect(frame.tokens, [42, 7]);
+    expect(frame.timesMs, [12.5, 20.0]);
+    expect(frame.logprobs, [-0.25, -1.5]);
+    expect(frame.text, 'Jambo 😀');
+  });
 }
@@ -1,3 +1,5 @@
+import 'dart:typed_data';
+
 import 'package:flutter_test/flutter_test.dart';
 import 'package:maathai_llamma/maathai_llamma.dart';
 import 'package:maathai_llamma/maathai_llamma_platform_interface.dart';
@@ -18,9 +20,19 @@ class MockMaathaiLlammaPlatform
     int threads = 0,
     int? threadsBatch,
     int? batchSize,
+    int? ubatchSize,
     int gpuLayers = 0,
+    String? draftModelPath,
+    int? draftMax,
+    bool autoTune = false,
+    bool retune = false,
+    String? tuneDir,
     bool preferPerformanceCores = true,
     int? maxModelBytes,
+    int? memoryBudgetBytes,
+    String cacheTypeK = 'f16',
+    String cacheTypeV = 'f16',
+    bool? flashAttention,
     double temperature = 0.7,
     int topK = 40,
     double topP = 0.95,
@@ -35,20 +47,85 @@ class MockMaathaiLlammaPlatform
     double? presencePenalty,
     int? repeatLastN,
     int? minKeep,
-  }) async => modelPath.isNotEmpty;
+    bool useMmap = true,
+    bool useMlock = false,
+    bool warmup = false,
+    bool swap = false,
+    void Function(String stage, int done, int total)? onProgress,
+  }) async {
+    if (modelPath.isEmpty) return false;
+    if (warmup) {
+      onProgress?.call('weights', 100, 100);
+      onProgress?.call('prefault', 100, 100);
+      onProgress?.call('warmup', 2, 2);
+    }
+    return true;
+  }
+
+  @override
+  Future<bool> cancelLoad() async => false;
+
+  int _residencyBudget = 0;
+  final _pinned = <int>{};
+
+  @override
+  Future<void> setResidencyBudget(int budgetBytes) async => _residencyBudget = budgetBytes;
+
+  @override
+  Future<Map<String, Object?>> switchModel(int handle) async => {'contextLength': 2048, 'switchMs': 2.0};
+
+  @override
+  Future<bool> pinModel(int handle, {bool pinned = true}) async =>
+      pinned ? _pinned.add(handle) : _pinned.remove(handle);
+
+  @override
+  Future<bool> unloadModel(int handle) async => handle == 1;
+
+  @override
+  Future<List<ResidentModel>> residentModels() async => [
+        ResidentModel(handle: 1, path: 'model.gguf', weightsBytes: 500, contextBytes: 50, pinned: _pinned.contains(1)),
+      ];
+
+  @override
+  Future<ResidencyStats> residencyStats() async =>
+      ResidencyStats(budgetBytes: _residencyBudget, residentBytes: 550, models: 1, contexts: 1, currentHandle: 1);
+
+  @override
+  Future<Map<String, Object?>> activeSettings() async => {'cacheTypeK': 'q8_0', 'flashAttention': true};
+
+  int _nextSession = 1;
+
+  @override
+  Future<int> openSession() async => _nextSession++;
+
+  @override
+  Future<void> closeSession(int session) async {}
 
   @override
   Future<String> generate({
     required String prompt,
     int maxTokens = 512,
     String? cancelToken,
-  }) async => 'echo: $prompt (maxTokens=$maxTokens)';
+    List<Map<String, String>>? messages,
+    int session = 0,
+    Map<int, double>? adapters,
+    String? priority,
+  }) async => session == 0
+      ? 'echo: $prompt (maxTokens=$maxTokens)'
+      : 'echo[$session]: $prompt (maxTokens=$maxTokens)';
 
   @override
   Stream<String> generateStream({
     required String prompt,
     int maxTokens = 512,
     String? cancelToken,
+    List<Map<String, String>>? messages,
+    void Function(int done, int total)? onPrefillProgress,
+    bool logprobs = false,
+    void Function(TokenFrame frame)? onTokens,
+    int session = 0,
+    Map<int, double>? adapters,
+    String? priority,
   }) async* {
     yield 'stream: $prompt (maxTokens=$maxTokens)';
   }
@@ -72,7 +149,186 @@ class MockMaathaiLlammaPlatform
   }) async {}
 
   @override
-  Future<void> cancel() async {}
+  Future<void> cancel({int? session}) async {}
+
+  @override
+  Future<void> setConversationMode(bool enabled) async {}
+
+  bool adaptiveThreads = false;
+
+  @override
+  Future<void> setAdaptiveThreads(bool enabled) async => adaptiveThreads = enabled;
+
+  @override
+  Stream<ThreadChange> get threadEvents => Stream.fromIterable([
+        ThreadChange.fromMap({'threads': 6, 'threadsBatch': 4, 'fromThreads': 7, 'reason': 'thermal', 'tempC': 81.5}),
+      ]);
+
+  @override
+  Future<void> resetConversation({int session = 0}) async {}
+
+  final Map<int, bool> contextShift = {};
+
+  @override
+  Future<void> setContextShift({
+    required bool enabled,
+    int? keepTokens,
+    int? discardTokens,
+    int session = 0,
+  }) async {
+    contextShift[session] = enabled;
+  }
+
+  final Map<String, int> loras = {};
+  final Map<int, Map<int, double>> sessionLoras = {};
+  final Map<int, String> priorities = {};
+
+  @override
+  Future<int> loadLora(String path) async => loras.putIfAbsent(path, () => loras.length);
+
+  @override
+  Future<bool> unloadLora(int id) async {
+    final before = loras.length;
+    loras.removeWhere((_, value) => value == id);
+    return loras.length < before;
+  }
+
+  @override
+  Future<void> setLoras({required Map<int, double> adapters, int session = 0}) async {
+    sessionLoras[session] = adapters;
+  }
+
+  @override
+  Future<void> setPriority({required String priority, int session = 0}) async {
+    priorities[session] = priority;
+  }
+
+  @override
+  Future<Embeddings> embed(
+    List<String> texts, {
+    String pooling = 'model',
+    bool normalize = true,
+    int? batchSize,
+    int? maxSequences,
+  }) async {
+    // one-hot rows, so every text is orthogonal to the others
+    final vectors = Float32List(texts.length * texts.length);
+    for (var i = 0; i < texts.length; i++) {
+      vectors[i * texts.length + i] = 1;
+    }
+    return Embeddings(dimension: texts.length, vectors: vectors, pooling: pooling == 'model' ? 'mean' : pooling);
+  }
+
+  // handle -> id -> vector, scored by a plain dot product
+  final Map<int, Map<int, Float32List>> vectorIndexes = {};
+  final Map<int, int> vectorDimensions = {};
+
+  @override
+  Future<int> openVectorIndex(String path, {required int dimension, bool quantized = false}) async {
+    final handle = vectorIndexes.length + 1;
+    vectorIndexes[handle] = {};
+    vectorDimensions[handle] = dimension;
+    return handle;
+  }
+
+  @override
+  Future<void> closeVectorIndex(int handle) async {
+    vectorIndexes.remove(handle);
+  }
+
+  @override
+  Future<void> vectorIndexAdd(int handle, Int64List ids, Float32List vectors) async {
+    final dim = vectorDimensions[handle]!;
+    for (var i = 0; i < ids.length; i++) {
+      vectorIndexes[handle]![ids[i]] = Float32List.sublistView(vectors, i * dim, (i + 1) * dim);
+    }
+  }
+
+  @override
+  Future<int> vectorIndexRemove(int handle, Int64List ids) async =>
+      ids.where((id) => vectorIndexes[handle]!.remove(id) != null).length;
+
+  @override
+  Future<VectorSearchResult> vectorIndexSearch(int handle, Float32List query, {int k = 10, int? threads}) async {
+    final scored = vectorIndexes[handle]!.entries.map((e) {
+      var dot = 0.0;
+      for (var i = 0; i < query.length; i++) {
+        dot += query[i] * e.value[i];
+      }
+      return MapEntry(e.key, dot);
+    }).toList()
+      ..sort((a, b) => b.value.compareTo(a.value));
+    final top = scored.take(k).toList();
+    return VectorSearchResult(
+      ids: Int64List.fromList(top.map((e) => e.key).toList()),
+      scores: Float32List.fromList(top.map((e) => e.value).toList()),
+    );
+  }
+
+  @override
+  Future<Map<String, Object?>> vectorIndexInfo(int handle) async =>
+      {'size': vectorIndexes[handle]!.length, 'dimension': vectorDimensions[handle]};
+
+  @override
+  Future<bool> vectorIndexCompact(int handle) async => true;
+
+  @override
+  Future<Map<String, Object?>> samplerTimings({int session = 0}) async => {
+        'samples': 0,
+        'stagesUs': {'topK': 0.0, 'penalties': 0.0, 'filters': 0.0, 'temperature': 0.0, 'dist': 0.0},
+      };
+
+  String? tracePath;
+  bool tracing = false;
+
+  @override
+  Future<EngineStats> getStats({int session = 0}) async => EngineStats.fromMap({
+        'session': session,
+        'requests': 1,
+        'last': {
+          'generatedTokens': 8,
+          'phases': {
+            'decode': {'count': 8, 'meanUs': 30000.0},
+          },
+        },
+      });
+
+  @override
+  Stream<EngineStats> get statsEvents => Stream.fromFuture(getStats(session: 1));
+
+  @override
+  Future<void> startTrace({int maxEvents = 0}) async => tracing = true;
+
+  @override
+  Future<bool> stopTrace({String? path}) async {
+    tracing = false;
+    tracePath = path;
+    return true;
+  }
+
+  @override
+  Future<Map<String, Object?>> primePrefix({
+    required List<Map<String, String>> messages,
+    String? cacheDir,
+    int session = 0,
+  }) async =>
+      {'status': 'created', 'tokens': messages.length, 'elapsedMs': 0};
+
+  @override
+  Future<Map<String, Object?>> estimateMemory({
+    required String modelPath,
+    int contextLength = 4096,
+    int? batchSize,
+    int? ubatchSize,
+    String cacheTypeK = 'f16',
+    String cacheTypeV = 'f16',
+    bool? flashAttention,
+    int? memoryBudgetBytes,
+  }) async =>
+      {'totalBytes': 1000 + contextLength, 'fits': (memoryBudgetBytes ?? 0) >= 1000 + contextLength};
+
+  @override
+  Future<int> invalidateTuning({String? tuneDir}) async => 2;
 
   @override
   Future<void> release() async {}
@@ -100,6 +356,48 @@ void main() {
 
     expect(await plugin.loadModel(modelPath: 'model.gguf'), true);
     expect(await plugin.loadModel(modelPath: ''), false);
+    expect((await plugin.activeSettings())['cacheTypeK'], 'q8_0');
+
+    final stages = <String>[];
+    expect(
+        await plugin.loadModel(
+            modelPath: 'model.gguf', warmup: true, swap: true, onProgress: (stage, done, total) => stages.add(stage)),
+        true);
+    expect(stages, ['weights', 'prefault', 'warmup']);
+    expect(await plugin.cancelLoad(), false);
+  });
+
+  test('residency', () async {
+    final plugin = MaathaiLlamma();
+    final fakePlatform = MockMaathaiLlammaPlatform();
+    MaathaiLlammaPlatform.instance = fakePlatform;
+
+    await plugin.setResidencyBudget(1 << 30);
+    expect((await plugin.residencyStats()).budgetBytes, 1 << 30);
+    expect(await plugin.pinModel(1), true);
+    expect((await plugin.residentModels()).single.pinned, true);
+    expect(await plugin.pinModel(1, pinned: false), true);
+    expect((await plugin.switchModel(1))['switchMs'], 2.0);
+    expect(await plugin.unloadModel(3), false);
+  });
+
+  test('estimateMemory', () async {
+    final plugin = MaathaiLlamma();
+    final fakePlatform = MockMaathaiLlammaPlatform();
+    MaathaiLlammaPlatform.instance = fakePlatform;
+
+    final estimate = await plugin.estimateMemory(modelPath: 'model.gguf', contextLength: 24, memoryBudgetBytes: 2048);
+    expect(estimate['totalBytes'], 1024);
+    expect(estimate['fits'], true);
+  });
+
+  test('invalidateTuning', () async {
+    final plugin = MaathaiLlamma();
+    final fakePlatform = MockMaathaiLlammaPlatform();
+    MaathaiLlammaPlatform.instance = fakePlatform;
+
+    expect(await plugin.loadModel(modelPath: 'model.gguf', autoTune: true), true);
+    expect(await plugin.invalidateTuning(), 2);
   });
 
   test('generate', () async {
@@ -113,6 +411,121 @@ void main() {
     );
   });
 
+  test('sessions route generate requests', () async {
+    final plugin = MaathaiLlamma();
+    final fakePlatform = MockMaathaiLlammaPlatform();
+    MaathaiLlammaPlatform.instance = fakePlatform;
+
+    final session = await plugin.openSession();
+    expect(session, 1);
+    expect(
+      await plugin.generate(prompt: 'Hello', maxTokens: 8, session: session),
+      'echo[1]: Hello (maxTokens=8)',
+    );
+    await plugin.closeSession(session);
+  });
+
+  test('embed returns one row per text', () async {
+    final plugin = MaathaiLlamma();
+    MaathaiLlammaPlatform.instance = MockMaathaiLlammaPlatform();
+
+    final embeddings = await plugin.embed(['a', 'b', 'c']);
+    expect(embeddings.length, 3);
+    expect(embeddings.pooling, 'mean');
+    expect(embeddings[1], [0, 1, 0]);
+    expect(embeddings.dot(0, 0), 1);
+    expect(embeddings.dot(0, 2), 0);
+  });
+
+  test('vector index stores embeddings and finds the closest', () async {
+    final plugin = MaathaiLlamma();
+    final fakePlatform = MockMaathaiLlammaPlatform();
+    MaathaiLlammaPlatform.instance = fakePlatform;
+
+    final index = await plugin.openVectorIndex('/tmp/notes.mvix', dimension: 3);
+    await index.addEmbeddings([10, 20, 30], await plugin.embed(['a', 'b', 'c']));
+    final result = await index.search(Float32List.fromList([0, 0.9, 0.1]), k: 2);
+    expect(result.ids, [20, 30]);
+    expect(await index.remove([20, 99]), 1);
+    expect((await index.info())['size'], 2);
+    expect(() => index.search(Float32List(2)), throwsArgumentError);
+    await index.close();
+    expect(fakePlatform.vectorIndexes, isEmpty);
+  });
+
+  test('setAdaptiveThreads toggles the governor and threadEvents reports it', () async {
+    final plugin = MaathaiLlamma();
+    final fakePlatform = MockMaathaiLlammaPlatform();
+    MaathaiLlammaPlatform.instance = fakePlatform;
+
+    await plugin.setAdaptiveThreads(true);
+    expect(fakePlatform.adaptiveThreads, isTrue);
+    final change = await plugin.threadEvents.first;
+    expect(change.threads, 6);
+    expect(change.fromThreads, 7);
+    expect(change.reason, 'thermal');
+    expect(change.tempC, 81.5);
+    expect(change.tokS, 0);
+  });
+
+  test('getStats and statsEvents report per-phase timings', () async {
+    final plugin = MaathaiLlamma();
+    final fakePlatform = MockMaathaiLlammaPlatform();
+    MaathaiLlammaPlatform.instance = fakePlatform;
+
+    final stats = await plugin.getStats(session: 3);
+    expect(stats.session, 3);
+    expect(stats.last.phases['decode']!.meanUs, 30000.0);
+    expect(stats.last.phases['prefill']!.count, 0);
+    final pushed = await plugin.statsEvents.first;
+    expect(pushed.session, 1);
+
+    await plugin.startTrace();
+    expect(fakePlatform.tracing, isTrue);
+    expect(await plugin.stopTrace(path: '/tmp/t.json'), isTrue);
+    expect(fakePlatform.tracing, isFalse);
+    expect(fakePlatform.tracePath, '/tmp/t.json');
+  });
+
+  test('setContextShift is per session', () async {
+    final plugin = MaathaiLlamma();
+    final fakePlatform = MockMaathaiLlammaPlatform();
+    MaathaiLlammaPlatform.instance = fakePlatform;
+
+    await plugin.setContextShift(enabled: true, session: 2);
+    expect(fakePlatform.contextShift, {2: true});
+  });
+
+  test('LoRA adapters load once and apply per session', () async {
+    final plugin = MaathaiLlamma();
+    final fakePlatform = MockMaathaiLlammaPlatform();
+    MaathaiLlammaPlatform.instance = fakePlatform;
+
+    final legal = await plugin.loadLora('/models/legal.gguf');
+    final chat = await plugin.loadLora('/models/chat.gguf');
+    expect(await plugin.loadLora('/models/legal.gguf'), legal);
+    expect(chat, isNot(legal));
+
+    await plugin.setLoras(adapters: {legal: 1.0}, session: 1);
+    await plugin.setLoras(adapters: {}, session: 0);
+    expect(fakePlatform.sessionLoras, {
+      1: {legal: 1.0},
+      0: <int, double>{},
+    });
+    expect(await plugin.unloadLora(chat), isTrue);
+    expect(await plugin.unloadLora(chat), isFalse);
+  });
+
+  test('setPriority applies per session', () async {
+    final plugin = MaathaiLlamma();
+    final fakePlatform = MockMaathaiLlammaPlatform();
+    MaathaiLlammaPlatform.instance = fakePlatform;
+
+    await plugin.setPriority(priority: 'interactive', session: 1);
+    await plugin.setPriority(priority: 'background');
+    expect(fakePlatform.priorities, {1: 'interactive', 0: 'background'});
+  });
+
   test('generateStream', () async {
     final plugin = MaathaiLlamma();
     final fakePlatform = MockMaathaiLlammaPlatform();